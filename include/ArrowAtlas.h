@@ -0,0 +1,93 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of class ArrowAtlas
+ */
+// ======================================================================
+/*!
+ * \class ArrowAtlas
+ * \brief A cache of pre-rasterized wind arrows
+ *
+ * Rendering thousands of wind arrows means building, transforming,
+ * filling and stroking thousands of small paths, even though most
+ * arrows differ only by their position. The atlas rasterizes each
+ * distinct arrow shape once into coverage masks, which can then be
+ * blitted with any colour and blending rule.
+ *
+ * Each sprite consists of layers, one for each fill or stroke
+ * operation in the original rendering order. The caller is expected
+ * to identify the arrow shape uniquely with the key.
+ *
+ * Sprites larger than the given limit are not rasterized, instead
+ * the caller is expected to render such arrows as paths.
+ */
+// ======================================================================
+
+#ifndef ARROWATLAS_H
+#define ARROWATLAS_H
+
+#include <imagine/NFmiColorTools.h>
+#include <imagine/NFmiImage.h>
+#include <imagine/NFmiPath.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ArrowAtlas
+{
+ public:
+  //! A path to be filled (true) or stroked (false)
+  typedef std::pair<Imagine::NFmiPath, bool> Part;
+  typedef std::vector<Part> Parts;
+
+  class Sprite
+  {
+   public:
+    Sprite();
+
+    bool fits() const { return itsFits; }
+    std::size_t layers() const { return itsLayers.size(); }
+
+    void draw(Imagine::NFmiImage &theImage,
+              std::size_t theLayer,
+              int theX,
+              int theY,
+              Imagine::NFmiColorTools::Color theColor,
+              Imagine::NFmiColorTools::NFmiBlendRule theRule) const;
+
+   private:
+    friend class ArrowAtlas;
+
+    //! A horizontal run of pixels relative to the arrow origin
+    struct Run
+    {
+      int y;
+      int x1;
+      int x2;
+    };
+
+    typedef std::vector<Run> Runs;
+
+    bool itsFits;
+    std::vector<Runs> itsLayers;
+  };
+
+  ArrowAtlas();
+
+  bool empty() const;
+  void clear();
+
+  const Sprite *find(const std::string &theKey) const;
+  const Sprite &insert(const std::string &theKey, const Parts &theParts, int theMaxSize);
+
+ private:
+  typedef std::map<std::string, Sprite> Sprites;
+  Sprites itsSprites;
+
+};  // class ArrowAtlas
+
+#endif  // ARROWATLAS_H
+
+// ======================================================================
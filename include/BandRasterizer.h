@@ -0,0 +1,105 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of class BandRasterizer
+ */
+// ======================================================================
+/*!
+ * \class BandRasterizer
+ * \brief Fills several projected contour bands in a single sweep
+ *
+ * Filling each contour band separately with NFmiPath::Fill means
+ * building a separate edge table and making a separate pass over
+ * the image for each band. The BandRasterizer collects the edges
+ * of all bands first and then fills the image one scanline at a
+ * time, blending each band in the order the bands were added.
+ * The result is thus the same as filling the bands one by one.
+ *
+ * The even-odd rule is used, and pixels are sampled at integer
+ * coordinates just like in NFmiPath::Fill.
+ *
+ * Since each scanline is independent, large images can be filled
+ * in horizontal stripes by several threads with identical results.
+ *
+ * Only paths consisting of straight lines and only the most common
+ * blending rules are supported. The caller is expected to test
+ * the path and the rule first, and to flush the rasterizer before
+ * filling any unsupported path with NFmiPath::Fill.
+ *
+ * Typical use:
+ * \code
+ * BandRasterizer rasterizer(image.Width(), image.Height());
+ * for(...)
+ * {
+ *    if(BandRasterizer::supports(path, rule))
+ *      rasterizer.add(path, color, rule);
+ *    else
+ *    {
+ *      rasterizer.fill(image);
+ *      path.Fill(image, color, rule);
+ *    }
+ * }
+ * rasterizer.fill(image);
+ * \endcode
+ */
+// ======================================================================
+
+#ifndef BANDRASTERIZER_H
+#define BANDRASTERIZER_H
+
+#include <imagine/NFmiColorTools.h>
+#include <imagine/NFmiImage.h>
+#include <imagine/NFmiPath.h>
+
+#include <vector>
+
+class BandRasterizer
+{
+ public:
+  BandRasterizer(int theWidth, int theHeight);
+
+  static bool supports(const Imagine::NFmiPath &thePath,
+                       Imagine::NFmiColorTools::NFmiBlendRule theRule);
+
+  bool empty() const;
+  void clear();
+
+  void add(const Imagine::NFmiPath &thePath,
+           Imagine::NFmiColorTools::Color theColor,
+           Imagine::NFmiColorTools::NFmiBlendRule theRule);
+
+  void fill(Imagine::NFmiImage &theImage, unsigned int theThreads = 1);
+
+ private:
+  BandRasterizer();
+
+  //! A single non-horizontal edge of a band
+  struct Edge
+  {
+    int band;      // index of the band
+    int firstrow;  // first scanline crossed
+    int lastrow;   // last scanline crossed
+    double x;      // x-coordinate at the first scanline
+    double dxdy;   // slope
+  };
+
+  //! The fill style of a band
+  struct Band
+  {
+    Imagine::NFmiColorTools::Color color;
+    Imagine::NFmiColorTools::NFmiBlendRule rule;
+  };
+
+  void addEdge(int theBand, double theX1, double theY1, double theX2, double theY2);
+  void fillRows(Imagine::NFmiImage &theImage, int theFirstRow, int theLastRow, int theWidth) const;
+
+  int itsWidth;
+  int itsHeight;
+  std::vector<Band> itsBands;
+  std::vector<Edge> itsEdges;
+
+};  // class BandRasterizer
+
+#endif  // BANDRASTERIZER_H
+
+// ======================================================================
@@ -24,6 +24,11 @@ Imagine::NFmiColorTools::Color checkcolor(const std::string &theColor);
 Imagine::NFmiColorTools::NFmiBlendRule parserule(const std::string &theRule);
 Imagine::NFmiColorTools::NFmiBlendRule checkrule(const std::string &theRule);
 
+bool blendable(Imagine::NFmiColorTools::NFmiBlendRule theRule);
+Imagine::NFmiColorTools::Color blend(Imagine::NFmiColorTools::Color theColor,
+                                     Imagine::NFmiColorTools::Color theBackground,
+                                     Imagine::NFmiColorTools::NFmiBlendRule theRule);
+
 }  // namespace ColorTools
 
 #endif  // COLORTOOLS_H
@@ -21,6 +21,10 @@
  * A good principle is to change nothing but the projection, the
  * background and foreground images and the savepath.
  *
+ * The optional variant string can be used to store several
+ * derived versions of the same contour, for example the same
+ * contour projected onto different areas.
+ *
  * Typical use is shown below.
  * \code
  * ContourCache cache;
@@ -73,18 +77,21 @@ class ContourCache
   bool contains(float theLoLimit,
                 float theHiLimit,
                 const NFmiTime &theTime,
-                const LazyQueryData &theData) const;
+                const LazyQueryData &theData,
+                const std::string &theVariant = "") const;
 
   const Imagine::NFmiPath &find(float theLoLimit,
                                 float theHiLimit,
                                 const NFmiTime &theTime,
-                                const LazyQueryData &theData) const;
+                                const LazyQueryData &theData,
+                                const std::string &theVariant = "") const;
 
   void insert(const Imagine::NFmiPath &thePath,
               float theLoLimit,
               float theHiLimit,
               const NFmiTime &theTime,
-              const LazyQueryData &theData);
+              const LazyQueryData &theData,
+              const std::string &theVariant = "");
 
 };  // class ContourCache
 
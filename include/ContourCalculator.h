@@ -12,6 +12,10 @@
  * given data, and then to cache the result in case the same
  * contour is calculator again.
  *
+ * The same calculator may be used from several threads, for example
+ * when the same data is rendered onto several areas. The contours are
+ * then calculated one at a time, and each only once.
+ *
  */
 // ======================================================================
 
@@ -26,6 +30,7 @@ class NFmiDataMatrix;
 
 class ContourCalculatorPimple;
 class LazyQueryData;
+class NFmiGrid;
 class NFmiTime;
 
 namespace Imagine
@@ -50,6 +55,17 @@ class ContourCalculator
                             const NFmiTime &theTime,
                             ContourInterpolation theInterpolation);
 
+  Imagine::NFmiPath contour(const NFmiGrid &theGrid,
+                            bool theWorldData,
+                            float theLoLimit,
+                            float theHiLimit,
+                            ContourInterpolation theInterpolation);
+
+  Imagine::NFmiPath contour(const NFmiGrid &theGrid,
+                            bool theWorldData,
+                            float theValue,
+                            ContourInterpolation theInterpolation);
+
   void data(const NFmiDataMatrix<float> &theData);
   void clearCache();
   void cache(bool);
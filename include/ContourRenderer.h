@@ -0,0 +1,111 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of namespace ContourRenderer
+ */
+// ======================================================================
+/*!
+ * \namespace ContourRenderer
+ * \brief Rendering contours of data held in memory
+ *
+ * These functions make it possible to embed the contouring engine of
+ * qdcontour in other programs, without writing the data into files
+ * or running scripts. The contour fills and lines of each ContourSpec
+ * are drawn in the given order with the same path processing as
+ * qdcontour uses. The values are replaced and despeckled as the
+ * specification requires, and the fill mode, the rasterizer, the
+ * fill simplification and the unit conversions are given as options.
+ *
+ * Labels, symbols, fonts, patterns, overlays, smoothing and data
+ * limits are script level features. Specifications using them are
+ * rejected with an exception instead of being silently ignored.
+ *
+ * Typical use is shown below.
+ * \code
+ * ContourSpec spec("Temperature", "Linear", "None");
+ * spec.add(ContourRange(0, 10, ColorTools::checkcolor("red")));
+ * spec.add(ContourValue(0, 1, ColorTools::checkcolor("black")));
+ *
+ * std::list<ContourSpec> specs(1, spec);
+ * NFmiImage image = ContourRenderer::render(info, specs, area);
+ * std::vector<unsigned char> png = PngTools::encode(image, PngTools::Options());
+ * \endcode
+ */
+// ======================================================================
+
+#ifndef CONTOURRENDERER_H
+#define CONTOURRENDERER_H
+
+#include "ContourSpec.h"
+#include "UnitsConverter.h"
+
+#include <imagine/NFmiColorTools.h>
+#include <imagine/NFmiImage.h>
+#include <imagine/NFmiPath.h>
+
+#include <newbase/NFmiDataMatrix.h>
+
+#include <list>
+#include <string>
+
+class NFmiArea;
+class NFmiFastQueryInfo;
+class NFmiGrid;
+class PixelGridLookup;
+
+namespace ContourRenderer
+{
+//! Rendering settings, corresponding to the qdcontour commands
+struct Options
+{
+  Options();
+
+  std::string fillmode;      // contourfillmode: polygon or raster
+  std::string rasterizer;    // contourrasterizer: imagine or scanline
+  double simplifytolerance;  // contourfillsimplify tolerance in pixels
+  double simplifyarea;       // contourfillsimplify minimum area in pixels
+  unsigned int threads;      // threads used for filling and stroking
+  UnitsConverter units;      // conversions applied by render
+};
+
+void check(const ContourSpec &theSpec);
+
+Imagine::NFmiPath fillPath(const Imagine::NFmiPath &thePath,
+                           const NFmiArea &theArea,
+                           float theLoLimit,
+                           float theHiLimit,
+                           int theWidth,
+                           int theHeight,
+                           const Options &theOptions);
+
+Imagine::NFmiPath strokePath(const Imagine::NFmiPath &thePath,
+                             const NFmiArea &theArea,
+                             float theLineWidth,
+                             int theWidth,
+                             int theHeight);
+
+bool fillRaster(Imagine::NFmiImage &theImage,
+                const ContourSpec &theSpec,
+                const NFmiDataMatrix<float> &theValues,
+                PixelGridLookup &theLookup,
+                unsigned int theThreads);
+
+void draw(Imagine::NFmiImage &theImage,
+          const NFmiDataMatrix<float> &theValues,
+          const NFmiGrid &theGrid,
+          const ContourSpec &theSpec,
+          const NFmiArea &theArea,
+          const Options &theOptions = Options());
+
+Imagine::NFmiImage render(
+    NFmiFastQueryInfo &theInfo,
+    const std::list<ContourSpec> &theSpecs,
+    const NFmiArea &theArea,
+    Imagine::NFmiColorTools::Color theBackground = Imagine::NFmiColorTools::TransparentColor,
+    const Options &theOptions = Options());
+
+}  // namespace ContourRenderer
+
+#endif  // CONTOURRENDERER_H
+
+// ======================================================================
@@ -8,8 +8,11 @@
 #ifndef EXTREMALOCATOR_H
 #define EXTREMALOCATOR_H
 
+#include "SpatialHash.h"
+
 #include <list>
 #include <map>
+#include <vector>
 
 class ExtremaLocator
 {
@@ -40,31 +43,31 @@ class ExtremaLocator
   const ExtremaCoordinates &chooseCoordinates();
 
  private:
-  // Intentionally disabled:
+  //! A candidate coordinate
+  struct Candidate
+  {
+    Extremum type;
+    double x;
+    double y;
+  };
 
-  ExtremaLocator(const ExtremaLocator &theLocator);
-  ExtremaLocator &operator=(const ExtremaLocator &theLocator);
+  typedef std::vector<Candidate> Candidates;
+  typedef std::map<Extremum, SpatialHash> PreviousIndex;
 
   float itsMinDistanceToSame;
   float itsMinDistanceToDifferent;
 
   ExtremaCoordinates itsPreviousCoordinates;
   ExtremaCoordinates itsCurrentCoordinates;
+  Candidates itsCandidates;
+  PreviousIndex itsPreviousIndex;
 
   // Private methods:
 
-  Coordinates::const_iterator chooseOne(const Coordinates &theCandidates, Extremum theType);
-
-  Coordinates::const_iterator chooseClosestToPrevious(const Coordinates &theCandidates,
-                                                      const Coordinates &thePreviousChoices,
-                                                      Extremum theType);
-
-  Coordinates::const_iterator chooseClosestToBorder(const Coordinates &theCandidates,
-                                                    Extremum theType);
-
-  void removeCandidates(ExtremaCoordinates &theCandidates, const XY &thePoint, Extremum theType);
+  void mergeCandidates();
+  void indexPrevious();
 
-  void removeEmpties(ExtremaCoordinates &theCandidates);
+  std::vector<std::size_t> chooseOrder(const Candidates &theCandidates, Extremum theType) const;
 
 };  // class ExtremaLocator
 
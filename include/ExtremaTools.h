@@ -0,0 +1,35 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of namespace ExtremaTools
+ */
+// ======================================================================
+/*!
+ * \namespace ExtremaTools
+ * \brief Tools for detecting local extrema in gridded data
+ *
+ * The extrema are detected using separable running minimum and
+ * maximum filters (the van Herk / Gil-Werman algorithm), hence the
+ * cost per grid point does not depend on the size of the window.
+ */
+// ======================================================================
+
+#ifndef EXTREMATOOLS_H
+#define EXTREMATOOLS_H
+
+#include <newbase/NFmiDataMatrix.h>
+
+namespace ExtremaTools
+{
+// 1 for maxima, -1 for minima, 0 for none
+NFmiDataMatrix<int> extrema(const NFmiDataMatrix<float> &theValues,
+                            int theDX,
+                            int theDY,
+                            float theMinGradient,
+                            unsigned int theThreads = 1);
+
+}  // namespace ExtremaTools
+
+#endif  // EXTREMATOOLS_H
+
+// ======================================================================
@@ -8,14 +8,21 @@
 #ifndef GLOBALS_H
 #define GLOBALS_H
 
+#include "ArrowAtlas.h"
 #include "ArrowCache.h"
+#include "ContourCache.h"
 #include "ContourCalculator.h"
 #include "ContourSpec.h"
 #include "ExtremaLocator.h"
 
 #include "ImageCache.h"
+#include "ImageWriter.h"
 
 #include "LabelLocator.h"
+#include "Manifest.h"
+#include "MaskBitmap.h"
+#include "PixelGridLookup.h"
+#include "PngTools.h"
 #include "ShapeSpec.h"
 #include "UnitsConverter.h"
 
@@ -32,12 +39,17 @@
 
 #include <boost/shared_ptr.hpp>
 
+#include <ctime>
 #include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 class LazyQueryData;
+class NFmiGrid;
 class NFmiTime;
 
 // using Imagine::NFmiImage;
@@ -56,6 +68,14 @@ struct ArrowStyle
   }
 };
 
+//! One of the areas rendered simultaneously
+struct AreaSpec
+{
+  std::string projection;  // projection definition
+  std::string background;  // background image name
+  std::string savepath;    // path for the images
+};
+
 struct RoundArrowColor
 {
   float lolimit;
@@ -89,19 +109,24 @@ struct RoundArrowSize
   }
 };
 
-struct Globals
+// ----------------------------------------------------------------------
+/*!
+ * \brief The settings and locators of a single job
+ *
+ * The state is kept separate from the caches and the query streams so
+ * that a server can restore the initial state before each job. The
+ * contour calculator is shared by the copies of the state, so that
+ * its cache survives restoring the state.
+ */
+// ----------------------------------------------------------------------
+
+struct JobState
 {
-  ~Globals();
-  Globals();
+  JobState();
 
   void setImageModes(Imagine::NFmiImage &) const;
   boost::shared_ptr<NFmiArea> createArea() const;
-  const std::string getImageStampText(const NFmiTime &theTime) const;
-
-  void drawImageStampText(ImagineXr_or_NFmiImage &d, const std::string &text) const;
-  void drawCombine(ImagineXr_or_NFmiImage &d) const;
-
-  const ImagineXr_or_NFmiImage &getImage(const std::string &filename) const;
+  static boost::shared_ptr<NFmiArea> createArea(const std::string &theProjection);
 
   RoundArrowColor getRoundArrowFillColor(float speed) const;
   RoundArrowColor getRoundArrowStrokeColor(float speed) const;
@@ -110,14 +135,6 @@ struct Globals
   ArrowStyle getArrowFill(float speed) const;
   ArrowStyle getArrowStroke(float speed) const;
 
-  // Command line options
-
-  bool verbose;                          // -v option
-  bool force;                            // -f option
-  std::string cmdline_querydata;         // -q option
-  std::string cmdline_conf;              // -c option
-  std::list<std::string> cmdline_files;  // command line parameters
-
   // Status variables
 
   std::string datapath;  // default searchpath for data
@@ -138,11 +155,14 @@ struct Globals
   int pngquality;      // png quality, -1 = default
   int jpegquality;     // jpeg quality, -1 = default
   bool savealpha;      // save alpha channel?
+  int pngthreads;      // png compression threads, 0 = use imagine
 
   bool reducecolors;  // reduce colors before saving?
 
-  bool wantpalette;   // attempt to save as palette image?
-  bool forcepalette;  // force palette image?
+  bool wantpalette;                // attempt to save as palette image?
+  bool forcepalette;               // force palette image?
+  bool exactpalette;               // save as exact palette image if possible?
+  PngTools::Colors palettecolors;  // colours known to be in the images
 
   std::string contourinterpolation;  // contouring interpolation method
   int contourtriangles;              // keep triangles in result or simplify?
@@ -156,6 +176,8 @@ struct Globals
   std::string projection;  // projection definition
   std::string filter;      // filtering mode
 
+  std::vector<AreaSpec> areas;  // areas rendered simultaneously, if any
+
   std::string foregroundrule;  // foreground blending rule
   std::string background;      // background image name
   std::string foreground;      // foreground image name
@@ -173,13 +195,20 @@ struct Globals
 
   float contourlinewidth;  // width of contour lines
 
+  float contourfillsimplifytolerance;  // fill simplification tolerance in pixels
+  float contourfillsimplifyarea;       // minimum fill polygon area in pixels
+  std::string contourrasterizer;       // imagine or scanline
+  std::string contourfillmode;         // polygon or raster
+  unsigned int threads;                // number of rendering threads
+
   std::string directionparam;  // direction parameter for arrows
   std::string speedparam;      // speed parameter for arrows
 
   std::string speedxcomponent;  // X-component for speed
   std::string speedycomponent;  // Y-component for speed
 
-  float arrowscale;  // scale factor for arrows
+  float arrowscale;     // scale factor for arrows
+  int arrowspritesize;  // largest arrow sprite, 0 for no sprites
 
   std::string arrowfillcolor;
   std::string arrowstrokecolor;
@@ -201,19 +230,17 @@ struct Globals
 
   std::list<NFmiPoint> arrowpoints;  // Active wind arrows
 
-  std::string queryfilelist;                // querydata files in use
-  std::vector<std::string> queryfilenames;  // querydata files in use
-
-  boost::shared_ptr<LazyQueryData> queryinfo;  // active data, does not own pointer
-  int querydatalevel;                          // level value (-1 for first)
-  int timesteps;                               // how many images to draw?
-  int timestep;                                // timestep, 0 = all valid
-  int timeinterval;                            // inclusive time interval
-  int timestepskip;                            // initial time to skip in minutes
-  int timesteprounding;                        // rounding flag
-  int timestampflag;                           // put timestamp into image name?
-  std::string timestampzone;                   // timezone for the timestamp
-  std::string timestampimage;                  // image timestamping mode
+  std::string manifestfile;  // manifest filename, empty if none
+
+  int querydatalevel;                // level value (-1 for first)
+  int timesteps;                     // how many images to draw?
+  int timestep;                      // timestep, 0 = all valid
+  int timeinterval;                  // inclusive time interval
+  int timestepskip;                  // initial time to skip in minutes
+  int timesteprounding;              // rounding flag
+  int timestampflag;                 // put timestamp into image name?
+  std::string timestampzone;         // timezone for the timestamp
+  std::string timestampimage;        // image timestamping mode
   int timestampimagex;
   int timestampimagey;
   std::string timestampimageformat;  // hour or hourdate
@@ -236,28 +263,25 @@ struct Globals
   float lowpressurefactor;
   float lowpressuremaximum;
 
-  // Active storage
+  float pressureradius;       // extrema search radius in km, 0 for 7 grid cells
+  std::string pressureparam;  // parameter searched for extrema
+
+  boost::shared_ptr<ContourCalculator> calculator;  // data contourer
 
   ExtremaLocator pressurelocator;  // high/low pressure locator
   LabelLocator labellocator;       // label coordinate calculator
   LabelLocator symbollocator;      // symbol coordinate calculator
   LabelLocator imagelocator;       // contour symbol coordinate calculator
 
-  ContourCalculator calculator;                    // data contourer
-  ContourCalculator maskcalculator;                // mask contourer
-  boost::shared_ptr<LazyQueryData> maskqueryinfo;  // active mask data, does not own pointer
-  std::vector<boost::shared_ptr<LazyQueryData>> querystreams;
+  MaskBitmap maskbitmap;  // nontransparent pixels of the mask
+  bool contourcache;      // is contour caching on?
+  bool itsImageCacheOn;   // is image caching on?
 
   std::list<ShapeSpec> shapespecs;
   std::list<ContourSpec> specs;
 
   UnitsConverter unitsconverter;
 
-  ImageCache itsImageCache;
-  bool itsImageCacheOn;
-
-  ArrowCache itsArrowCache;
-
   std::string graticulecolor;
   double graticulelon1;
   double graticulelat1;
@@ -276,8 +300,96 @@ struct Globals
   unsigned long timestampformat;
 };
 
-// For global use
-static Globals globals;
+// ----------------------------------------------------------------------
+/*!
+ * \brief The caches shared by all jobs
+ *
+ * The cached data depends only on the inputs, not on the settings
+ * of the job using it. The caches are not synchronized, and may be
+ * used by only one RenderContext at a time, which holds the mutex
+ * of the caches for its lifetime. Areas rendered in parallel hence
+ * each have their own caches, which are kept in the caches of the
+ * job so that they survive until the next command. The image cache
+ * is thread-safe, and is shared by the caches of the areas.
+ */
+// ----------------------------------------------------------------------
+
+struct RenderCaches
+{
+  typedef std::map<std::pair<unsigned int, std::string>, boost::shared_ptr<RenderCaches> >
+      AreaCaches;
+
+  RenderCaches();
+  RenderCaches(const boost::shared_ptr<ImageCache> &theImageCache);
+
+  const ImagineXr_or_NFmiImage &getImage(const std::string &filename) const;
+
+  PixelGridLookup &getPixelGridLookup(const NFmiArea &theArea,
+                                      int theWidth,
+                                      int theHeight,
+                                      const NFmiGrid &theGrid);
+  PixelGridLookup &getPixelGridLookup(const NFmiArea &theArea, int theWidth, int theHeight);
+
+  ContourCache projectedcache;                              // projected and simplified fills
+  std::map<std::string, PixelGridLookup> pixelgridlookups;  // pixel/grid mappings
+  std::map<std::string, PngTools::Colors> imagecolors;      // palettes of background images
+
+  boost::shared_ptr<ImageCache> itsImageCache;  // shared with the area caches
+
+  ArrowCache itsArrowCache;
+  ArrowAtlas arrowatlas;  // pre-rasterized arrows
+
+  AreaCaches areacaches;  // caches of the areas by index and projection
+
+  std::mutex mutex;  // held by the context using the caches
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The job state and the caches plus the command line, the query
+ *        streams and the image output
+ */
+// ----------------------------------------------------------------------
+
+struct Globals : public JobState, public RenderCaches
+{
+  ~Globals();
+  Globals();
+
+  void restore(const JobState &theState);
+
+  // Command line options
+
+  bool verbose;                          // -v option
+  bool force;                            // -f option
+  std::string cmdline_querydata;         // -q option
+  std::string cmdline_conf;              // -c option
+  std::string cmdline_serve;             // -s option
+  bool cmdline_watch;                    // -w option
+  std::list<std::string> cmdline_files;  // command line parameters
+
+  // Query streams
+
+  std::string queryfilelist;                      // querydata files in use
+  std::vector<std::string> queryfilenames;        // querydata files in use
+  std::vector<std::time_t> querymtimes;           // modification times of the files
+  std::map<std::string, std::time_t> watchfiles;  // watched querydata and their read times
+  std::vector<boost::shared_ptr<LazyQueryData>> querystreams;
+
+  boost::shared_ptr<LazyQueryData> maskqueryinfo;  // active mask data, does not own pointer
+
+  // Image output
+
+  Manifest manifest;              // input fingerprints of the rendered images
+  std::size_t scriptfingerprint;  // hash of the script being processed
+
+  std::vector<boost::shared_ptr<Imagine::NFmiImage> > frameimages;  // reused frames per target
+  ImageWriter imagewriter;                                           // background image encoding
+};
+
+// The single instance, defined in Globals.cpp. Only the main program
+// refers to it, everything else is handed the instance explicitly.
+extern Globals globals;
 
 #endif  // GLOBALS_H
 
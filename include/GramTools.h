@@ -24,6 +24,8 @@ Imagine::NFmiPath metarrowlines(float theSpeed, const NFmiPoint &theLatLon);
 Imagine::NFmiPath metarrowflags(float theSpeed);
 Imagine::NFmiPath metarrowlines(float theSpeed);
 
+int knots(float theSpeed);
+
 }  // namespace GramTools
 
 #endif  // GRAMTOOLS_H
@@ -1,6 +1,13 @@
 // ======================================================================
 /*!
  * \brief Interface of class ImageCache
+ *
+ * The cache holds decoded images shared by reference. The images stay
+ * valid until the next call to trim() or clear(), which are called
+ * between rendered images. Trimming discards the least recently used
+ * images until the cache fits into the memory limit, excluding images
+ * still referenced elsewhere. The cache may be accessed from several
+ * threads.
  */
 // ======================================================================
 
@@ -14,18 +21,49 @@
 
 #include <imagine/NFmiImage.h>
 
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+#include <list>
 #include <map>
+#include <mutex>
 #include <string>
 
 class ImageCache
 {
  public:
+  typedef boost::shared_ptr<const ImagineXr_or_NFmiImage> ImagePtr;
+
+  ImageCache();
+
   const ImagineXr_or_NFmiImage &getImage(const std::string &theFile) const;
+  ImagePtr image(const std::string &theFile) const;
+
   void clear() const;
+  void trim() const;
+  void limit(std::size_t theBytes);
+  std::size_t bytes() const;
 
  private:
-  typedef std::map<std::string, ImagineXr_or_NFmiImage> storage_type;
+  ImageCache(const ImageCache &theCache);
+  ImageCache &operator=(const ImageCache &theCache);
+
+  typedef std::list<std::string> order_type;
+
+  struct Entry
+  {
+    ImagePtr image;
+    std::size_t bytes;
+    order_type::iterator position;
+  };
+
+  typedef std::map<std::string, Entry> storage_type;
+
+  mutable std::mutex itsMutex;
   mutable storage_type itsCache;
+  mutable order_type itsOrder;  // most recently used first
+  mutable std::size_t itsBytes;
+  std::size_t itsLimit;  // 0 for no limit
 };
 
 #endif  // IMAGECACHE_H
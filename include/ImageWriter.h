@@ -0,0 +1,87 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of class ImageWriter
+ */
+// ======================================================================
+/*!
+ * \class ImageWriter
+ * \brief Runs image encoding and writing jobs in background threads
+ *
+ * Encoding a large image may take as long as rendering it. The
+ * writer lets the renderer continue with the next image while the
+ * previous ones are being encoded. The number of queued jobs is
+ * limited to the number of threads, so that submitting blocks when
+ * the writers fall behind and the memory used by pending images
+ * stays bounded.
+ *
+ * With zero threads the jobs are run immediately in the calling
+ * thread. Errors thrown by the jobs are rethrown by wait().
+ *
+ * A Guard makes sure the jobs of a failed rendering are completed
+ * and their errors discarded, so that they do not surface in the
+ * next, unrelated rendering.
+ */
+// ======================================================================
+
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ImageWriter
+{
+ public:
+  typedef std::function<void()> Job;
+
+  ~ImageWriter();
+  ImageWriter();
+
+  void threads(unsigned int theThreads);
+  void submit(const Job &theJob);
+  void wait();
+  void discard();
+
+  //! Discards the jobs when the scope is left without calling wait()
+  class Guard
+  {
+   public:
+    ~Guard();
+    explicit Guard(ImageWriter &theWriter);
+    void wait();
+
+   private:
+    Guard(const Guard &theGuard);
+    Guard &operator=(const Guard &theGuard);
+
+    ImageWriter &itsWriter;
+    bool itsWaited;
+  };
+
+ private:
+  ImageWriter(const ImageWriter &theWriter);
+  ImageWriter &operator=(const ImageWriter &theWriter);
+
+  void work();
+  void stop();
+
+  std::mutex itsMutex;
+  std::condition_variable itsJobReady;
+  std::condition_variable itsJobDone;
+  std::deque<Job> itsJobs;
+  std::vector<std::thread> itsThreads;
+  std::size_t itsActiveJobs;
+  bool itsQuitting;
+  std::exception_ptr itsError;
+
+};  // class ImageWriter
+
+#endif  // IMAGEWRITER_H
+
+// ======================================================================
@@ -8,8 +8,11 @@
 #ifndef LABELLOCATOR_H
 #define LABELLOCATOR_H
 
+#include "SpatialHash.h"
+
 #include <list>
 #include <map>
+#include <vector>
 
 class LabelLocator
 {
@@ -38,11 +41,6 @@ class LabelLocator
   const ParamCoordinates &chooseLabels();
 
  private:
-  // Intentionally disabled:
-
-  LabelLocator(const LabelLocator &theLocator);
-  LabelLocator &operator=(const LabelLocator &theLocator);
-
   bool itHasBBox;
   int itsBBoxX1;
   int itsBBoxY1;
@@ -53,9 +51,24 @@ class LabelLocator
   float itsMinDistanceToDifferentValue;
   float itsMinDistanceToDifferentParameter;
 
+  //! A candidate label location
+  struct Candidate
+  {
+    int param;
+    float contour;
+    float dist;  // sorting distance
+    int x;
+    int y;
+  };
+
+  typedef std::vector<Candidate> Candidates;
+  typedef std::map<int, std::map<float, SpatialHash> > PreviousIndex;
+
   int itsActiveParameter;
   ParamCoordinates itsPreviousCoordinates;
   ParamCoordinates itsCurrentCoordinates;
+  Candidates itsCandidates;
+  PreviousIndex itsPreviousIndex;
 
   // Private methods:
 
@@ -63,12 +76,8 @@ class LabelLocator
 
   float distanceToBorder(float theX, float theY) const;
 
-  void removeCandidates(ParamCoordinates &theCandidates,
-                        const XY &thePoint,
-                        int theParam,
-                        float theContour);
-
-  void removeEmpties(ParamCoordinates &theCandidates);
+  void mergeCandidates();
+  void indexPrevious();
 
 };  // class LabelLocator
 
@@ -13,8 +13,8 @@
  *
  * To optimize the code we hence use a lazy matrix of coordinates,
  * which acts like a NFmiDataMatrix<NFmiPoint>, except that
- * the coordinates are only fetched from the global querydata
- * holder if necessary.
+ * the coordinates are only fetched from the given querydata
+ * if necessary. The querydata must outlive the object.
  *
  */
 // ======================================================================
@@ -24,7 +24,6 @@
 
 #include <newbase/NFmiDataMatrix.h>
 #include <newbase/NFmiPoint.h>
-#include "Globals.h"
 #include "LazyQueryData.h"
 
 class LazyCoordinates
@@ -34,7 +33,7 @@ class LazyCoordinates
   typedef NFmiDataMatrix<element_type> data_type;
   typedef data_type::size_type size_type;
 
-  LazyCoordinates(const NFmiArea &theArea);
+  LazyCoordinates(const NFmiArea &theArea, const LazyQueryData &theData);
   const element_type &operator()(size_type i, size_type j) const;
   const element_type &operator()(int i, int j, const element_type &theDefault) const;
   const data_type &operator*() const;
@@ -45,6 +44,7 @@ class LazyCoordinates
 
  private:
   const NFmiArea &itsArea;
+  const LazyQueryData &itsQueryData;
   mutable bool itsInitialized;
   mutable data_type itsData;
 
@@ -142,7 +142,7 @@ inline void LazyCoordinates::init() const
 {
   if (itsInitialized) return;
 
-  itsData = *globals.queryinfo->LocationsWorldXY(itsArea);
+  itsData = *itsQueryData.LocationsWorldXY(itsArea);
   itsInitialized = true;
 }
 
@@ -24,8 +24,13 @@
 #include <newbase/NFmiDataMatrix.h>
 #include <newbase/NFmiParameterName.h>
 #include <boost/shared_ptr.hpp>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <tuple>
+#include <utility>
 
 class NFmiArea;
 class NFmiFastQueryInfo;
@@ -51,6 +56,7 @@ class LazyQueryData
   // These do not require the data values
 
   void Read(const std::string &theDataFile);
+  boost::shared_ptr<LazyQueryData> Clone() const;
 
   void ResetTime();
   void ResetLevel();
@@ -60,6 +66,8 @@ class LazyQueryData
   bool NextLevel();
   bool NextTime();
   bool PreviousTime();
+  unsigned long TimeIndex() const;
+  bool TimeIndex(unsigned long theIndex);
   const NFmiLevel *Level() const;
 
   bool Param(FmiParameterName theParam);
@@ -99,10 +107,23 @@ class LazyQueryData
 
   bool IsWorldData() const;
 
+  // Parameters and levels to fingerprint, a negative level meaning all levels
+  typedef std::set<std::pair<FmiParameterName, int> > ParamLevels;
+
+  std::size_t Fingerprint(const NFmiTime &theTime1,
+                          const NFmiTime &theTime2,
+                          const ParamLevels &theParams) const;
+
  private:
   LazyQueryData(const LazyQueryData &theQD);
   LazyQueryData &operator=(const LazyQueryData &theQD);
 
+  std::size_t TimeFingerprint(NFmiFastQueryInfo &theInfo,
+                              FmiParameterName theParam,
+                              int theLevel) const;
+
+  typedef std::tuple<unsigned long, FmiParameterName, int> FingerprintKey;
+
   std::string itsInputName;
   std::string itsDataFile;
   boost::shared_ptr<NFmiFastQueryInfo> itsInfo;
@@ -112,6 +133,8 @@ class LazyQueryData
   mutable boost::shared_ptr<Coordinates> itsLocationsWorldXY;
   mutable boost::shared_ptr<Coordinates> itsLocationsXY;
   mutable std::string itsLocationsArea;
+  mutable std::map<FingerprintKey, std::size_t> itsFingerprints;
+  mutable std::mutex itsFingerprintMutex;  // guards itsFingerprints
 
 };  // class LazyQueryData
 
@@ -0,0 +1,67 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of class Manifest
+ */
+// ======================================================================
+/*!
+ * \class Manifest
+ * \brief Fingerprints of the inputs of the rendered images
+ *
+ * The manifest records for each image a fingerprint of everything
+ * used to render it: the data, the script and the image files. An
+ * image needs to be rendered again only if the fingerprint changes.
+ *
+ * The manifest may be saved into a file so that the information
+ * survives between runs. The file contains one line per image with
+ * the fingerprint in hexadecimal and the image filename. The file
+ * is replaced atomically so that an interrupted run never leaves
+ * a partial manifest behind.
+ *
+ * Typical use is shown below.
+ * \code
+ * Manifest manifest;
+ * manifest.load("images/.manifest");
+ *
+ * std::size_t old;
+ * if (!manifest.find(filename, old) || old != fingerprint)
+ * {
+ *    ... render and save the image ...
+ *    manifest.update(filename, fingerprint);
+ * }
+ * manifest.save();
+ * \endcode
+ */
+// ======================================================================
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+class Manifest
+{
+ public:
+  Manifest();
+
+  void load(const std::string &theFile);
+  void save();
+  void clear();
+
+  bool persistent() const { return !itsFile.empty(); }
+  const std::string &file() const { return itsFile; }
+  bool find(const std::string &theImage, std::size_t &theFingerprint) const;
+  void update(const std::string &theImage, std::size_t theFingerprint);
+
+ private:
+  std::string itsFile;
+  std::map<std::string, std::size_t> itsFingerprints;
+  bool itsModified;
+
+};  // class Manifest
+
+#endif  // MANIFEST_H
+
+// ======================================================================
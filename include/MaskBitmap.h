@@ -0,0 +1,131 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of class MaskBitmap
+ */
+// ======================================================================
+/*!
+ * \class MaskBitmap
+ * \brief A packed bitmap of the nontransparent pixels of a mask image
+ *
+ * Arrows, label markers and labels are not drawn at pixels where the
+ * mask image is not transparent. The test is done for every object,
+ * hence the mask is converted once into a bitmap with one bit per
+ * pixel. Points outside the image are clamped to the nearest edge
+ * pixel, and coordinates are rounded to the nearest pixel.
+ */
+// ======================================================================
+
+#ifndef MASKBITMAP_H
+#define MASKBITMAP_H
+
+#include <imagine/NFmiColorTools.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+class MaskBitmap
+{
+ public:
+  MaskBitmap();
+
+  bool empty() const { return itsBits.empty(); }
+  void clear();
+
+  template <typename T>
+  void build(const T &theImage);
+
+  bool masked(double theX, double theY) const;
+
+  template <typename T>
+  T unmasked(const T &thePoints) const;
+
+ private:
+  int itsWidth;
+  int itsHeight;
+  std::size_t itsWordsPerRow;
+  std::vector<unsigned long long> itsBits;
+
+};  // class MaskBitmap
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Build the bitmap from the given mask image
+ *
+ * \param theImage The mask image
+ */
+// ----------------------------------------------------------------------
+
+template <typename T>
+void MaskBitmap::build(const T &theImage)
+{
+  clear();
+
+  if (theImage.Width() <= 0 || theImage.Height() <= 0) return;
+
+  itsWidth = theImage.Width();
+  itsHeight = theImage.Height();
+  itsWordsPerRow = (static_cast<std::size_t>(itsWidth) + 63) / 64;
+  itsBits.assign(itsWordsPerRow * itsHeight, 0);
+
+  for (int j = 0; j < itsHeight; j++)
+  {
+    unsigned long long *row = &itsBits[j * itsWordsPerRow];
+    for (int i = 0; i < itsWidth; i++)
+    {
+      const int alpha = Imagine::NFmiColorTools::GetAlpha(theImage(i, j));
+      if (alpha != Imagine::NFmiColorTools::Transparent) row[i / 64] |= (1ULL << (i % 64));
+    }
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether the given pixel coordinates are masked
+ *
+ * \param theX The x-coordinate
+ * \param theY The y-coordinate
+ * \return True if the nearest mask pixel is not transparent
+ */
+// ----------------------------------------------------------------------
+
+inline bool MaskBitmap::masked(double theX, double theY) const
+{
+  if (itsBits.empty()) return false;
+
+  const int x = std::min(std::max(static_cast<int>(round(theX)), 0), itsWidth - 1);
+  const int y = std::min(std::max(static_cast<int>(round(theY)), 0), itsHeight - 1);
+
+  return ((itsBits[y * itsWordsPerRow + x / 64] >> (x % 64)) & 1ULL) != 0;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Select the unmasked points
+ *
+ * The points must have member xy with the pixel coordinates.
+ *
+ * \param thePoints The points to filter
+ * \return The points which are not masked, in the original order
+ */
+// ----------------------------------------------------------------------
+
+template <typename T>
+T MaskBitmap::unmasked(const T &thePoints) const
+{
+  if (itsBits.empty()) return thePoints;
+
+  T result;
+  result.reserve(thePoints.size());
+
+  for (typename T::const_iterator it = thePoints.begin(); it != thePoints.end(); ++it)
+    if (!masked(it->xy.X(), it->xy.Y())) result.push_back(*it);
+
+  return result;
+}
+
+#endif  // MASKBITMAP_H
+
+// ======================================================================
@@ -16,6 +16,8 @@ NFmiPoint Relocate(const NFmiPoint &thePoint, const NFmiArea &theArea);
 
 void Relocate(Imagine::NFmiPath &thePath, const NFmiArea &theArea);
 
+double PaperNorth(const NFmiArea &theArea, const NFmiPoint &theLatLon);
+
 }  // MeridianTools
 
 #endif  // MERIDIANTOOLS_H
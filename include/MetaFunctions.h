@@ -17,12 +17,14 @@
 #include "LazyQueryData.h"
 #include <newbase/NFmiDataMatrix.h>
 #include <string>
+#include <vector>
 
 namespace MetaFunctions
 {
 bool isMeta(const std::string &theFunction);
 int id(const std::string &theFunction);
 NFmiDataMatrix<float> values(const std::string &theFunction, LazyQueryData &theQI);
+std::vector<FmiParameterName> parameters(const std::string &theFunction);
 
 }  // namespace MetaFunctions
 
@@ -0,0 +1,29 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of namespace ParamTools
+ */
+// ======================================================================
+/*!
+ * \namespace ParamTools
+ * \brief Tools for handling parameter names
+ *
+ */
+// ======================================================================
+
+#ifndef PARAMTOOLS_H
+#define PARAMTOOLS_H
+
+#include <newbase/NFmiParameterName.h>
+
+#include <string>
+
+namespace ParamTools
+{
+FmiParameterName toparam(const std::string &theName);
+
+}  // namespace ParamTools
+
+#endif  // PARAMTOOLS_H
+
+// ======================================================================
@@ -0,0 +1,44 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of namespace PathTools
+ */
+// ======================================================================
+/*!
+ * \namespace PathTools
+ * \brief Geometric tools for projected paths
+ *
+ * The functions operate on paths which have already been projected
+ * to pixel coordinates, and are intended to reduce the amount of
+ * geometry passed on to the rasterizer.
+ */
+// ======================================================================
+
+#ifndef PATHTOOLS_H
+#define PATHTOOLS_H
+
+#include <imagine/NFmiPath.h>
+
+namespace PathTools
+{
+Imagine::NFmiPath clipPolygons(const Imagine::NFmiPath &thePath,
+                               double theX1,
+                               double theY1,
+                               double theX2,
+                               double theY2);
+
+Imagine::NFmiPath clipLines(const Imagine::NFmiPath &thePath,
+                            double theX1,
+                            double theY1,
+                            double theX2,
+                            double theY2);
+
+Imagine::NFmiPath simplifyPolygons(const Imagine::NFmiPath &thePath,
+                                   double theTolerance,
+                                   double theMinArea);
+
+}  // namespace PathTools
+
+#endif  // PATHTOOLS_H
+
+// ======================================================================
@@ -0,0 +1,217 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of class PixelGridLookup
+ */
+// ======================================================================
+/*!
+ * \class PixelGridLookup
+ * \brief Cached mappings between image pixels and data grid points
+ *
+ * Projecting coordinates between the image and the data grid is
+ * expensive, yet the result depends only on the image area, the
+ * image size and the data grid. The mappings are hence calculated
+ * on demand and cached until init() is called with a different
+ * area or grid, so that the same tables are reused for all
+ * timesteps and parameters.
+ *
+ * The available mappings are
+ *
+ *  - the nearest grid point for every pixel, -1 for pixels outside
+ *    the grid. Only pixels between the outermost grid points are
+ *    considered to be inside, which matches the extent of contours.
+ *  - the pixel coordinates of every grid point
+ *  - the direction of north on paper at every grid point, as needed
+ *    for rotating U/V winds
+ *  - the coordinates of a regular pixel grid, as used for pixelgrid
+ *    labels and wind arrows, along with their geographic and grid
+ *    coordinates and the direction of north.
+ *  - the same information for a list of geographic points and for
+ *    a regularly sampled subset of the data grid, as used for wind
+ *    arrows.
+ *
+ * The lookup can also be initialized without a grid, in which case
+ * only the pixel coordinates, the geographic coordinates and the
+ * direction of north are available.
+ *
+ * The area and grid given to init() must remain valid while the
+ * mappings are being used.
+ */
+// ======================================================================
+
+#ifndef PIXELGRIDLOOKUP_H
+#define PIXELGRIDLOOKUP_H
+
+#include <newbase/NFmiArea.h>
+#include <newbase/NFmiDataMatrix.h>
+#include <newbase/NFmiGlobals.h>
+#include <newbase/NFmiInterpolation.h>
+#include <newbase/NFmiPoint.h>
+
+#include <cmath>
+#include <list>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class NFmiGrid;
+
+class PixelGridLookup
+{
+ public:
+  //! Coordinates of a single pixel in all coordinate systems
+  struct PixelPoint
+  {
+    NFmiPoint xy;
+    NFmiPoint latlon;
+    NFmiPoint grid;
+    float north;
+  };
+
+  typedef std::vector<PixelPoint> PixelPoints;
+
+  PixelGridLookup();
+
+  static std::string key(const NFmiArea &theArea,
+                         int theWidth,
+                         int theHeight,
+                         const NFmiGrid &theGrid);
+  static std::string key(const NFmiArea &theArea, int theWidth, int theHeight);
+
+  void init(const NFmiArea &theArea, int theWidth, int theHeight, const NFmiGrid &theGrid);
+  void init(const NFmiArea &theArea, int theWidth, int theHeight);
+  void clear();
+
+  int width() const { return itsWidth; }
+  int height() const { return itsHeight; }
+  int gridWidth() const { return itsGridWidth; }
+  int gridHeight() const { return itsGridHeight; }
+
+  const std::vector<int> &nearestGridPoints(unsigned int theThreads = 1);
+
+  const std::vector<float> &gridNorth(const NFmiDataMatrix<NFmiPoint> &theLatLons,
+                                      unsigned int theThreads = 1);
+
+  const PixelPoints &pixelPoints(float theX0, float theY0, float theDX, float theDY);
+  const PixelPoints &latlonPoints(const std::list<NFmiPoint> &theLatLons);
+
+  template <typename T>
+  const PixelPoints &gridPoints(float theDX, float theDY, const T &theWorldXY);
+
+  template <typename T>
+  const std::vector<NFmiPoint> &gridPixels(const T &theWorldXY);
+
+ private:
+  void reset(const std::string &theKey, int theWidth, int theHeight);
+  PixelPoint makePoint(const NFmiPoint &theXY, const NFmiPoint &theLatLon) const;
+
+  std::string itsKey;
+  const NFmiArea *itsArea;
+  const NFmiGrid *itsGrid;
+
+  int itsWidth;
+  int itsHeight;
+  int itsGridWidth;
+  int itsGridHeight;
+
+  std::vector<int> itsNearestGridPoints;
+  std::vector<NFmiPoint> itsGridPixels;
+  std::vector<float> itsGridNorth;
+  std::map<std::string, PixelPoints> itsPixelPoints;
+
+};  // class PixelGridLookup
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The pixel coordinates of each grid point
+ *
+ * The coordinates are stored as i + j*gridWidth(). The world XY
+ * coordinates of the grid points in the image area are needed
+ * only when the mapping is first calculated, which allows passing
+ * lazily initialized coordinates.
+ *
+ * \param theWorldXY The world coordinates of the grid points
+ * \return The pixel coordinates
+ */
+// ----------------------------------------------------------------------
+
+template <typename T>
+const std::vector<NFmiPoint> &PixelGridLookup::gridPixels(const T &theWorldXY)
+{
+  if (itsGridPixels.empty() && itsArea != 0)
+  {
+    const int nx = static_cast<int>(theWorldXY.NX());
+    const int ny = static_cast<int>(theWorldXY.NY());
+
+    itsGridPixels.reserve(static_cast<std::size_t>(nx) * ny);
+    for (int j = 0; j < ny; j++)
+      for (int i = 0; i < nx; i++)
+      {
+        NFmiPoint latlon = itsArea->WorldXYToLatLon(theWorldXY(i, j));
+        // latlon = MeridianTools::Relocate(latlon,theArea);
+        itsGridPixels.push_back(itsArea->ToXY(latlon));
+      }
+  }
+  return itsGridPixels;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The coordinates of a regularly sampled subset of the grid
+ *
+ * The grid is sampled row by row with the given spacing, and the
+ * grid coordinates of the points may hence be fractional. The world
+ * XY coordinates of the sampled points are bilinearly interpolated
+ * from the coordinates of the surrounding grid points, which are
+ * needed only when the points are first calculated.
+ *
+ * \param theDX The x-spacing in grid units, must be positive
+ * \param theDY The y-spacing in grid units, must be positive
+ * \param theWorldXY The world coordinates of the grid points
+ * \return The coordinates
+ */
+// ----------------------------------------------------------------------
+
+template <typename T>
+const PixelGridLookup::PixelPoints &PixelGridLookup::gridPoints(float theDX,
+                                                                float theDY,
+                                                                const T &theWorldXY)
+{
+  std::ostringstream os;
+  os << "grid_" << theDX << '_' << theDY;
+
+  std::map<std::string, PixelPoints>::iterator it = itsPixelPoints.find(os.str());
+  if (it != itsPixelPoints.end()) return it->second;
+
+  PixelPoints &points = itsPixelPoints[os.str()];
+  if (itsArea == 0 || theDX <= 0 || theDY <= 0) return points;
+
+  const NFmiPoint bad(kFloatMissing, kFloatMissing);
+
+  for (float y = 0; y <= theWorldXY.NY() - 1; y += theDY)
+    for (float x = 0; x <= theWorldXY.NX() - 1; x += theDX)
+    {
+      const int i = static_cast<int>(floor(x));
+      const int j = static_cast<int>(floor(y));
+
+      NFmiPoint xy = NFmiInterpolation::BiLinear(x - i,
+                                                 y - j,
+                                                 theWorldXY.At(i, j + 1, bad),
+                                                 theWorldXY.At(i + 1, j + 1, bad),
+                                                 theWorldXY.At(i, j, bad),
+                                                 theWorldXY.At(i + 1, j, bad));
+
+      NFmiPoint latlon = itsArea->WorldXYToLatLon(xy);
+      // latlon = MeridianTools::Relocate(latlon,theArea);
+      PixelPoint point = makePoint(itsArea->ToXY(latlon), latlon);
+      point.grid = NFmiPoint(x, y);
+      points.push_back(point);
+    }
+
+  return points;
+}
+
+#endif  // PIXELGRIDLOOKUP_H
+
+// ======================================================================
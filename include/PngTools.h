@@ -0,0 +1,63 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of namespace PngTools
+ */
+// ======================================================================
+/*!
+ * \namespace PngTools
+ * \brief Parallel PNG encoding of truecolor images
+ *
+ * The image rows are split into chunks which are filtered and
+ * deflated independently in parallel. Each chunk is primed with
+ * the last 32 kB of the preceding data as a dictionary and ends
+ * with a sync flush, so that the concatenated chunks form a single
+ * valid zlib stream, in the same way as done by pigz. The loss in
+ * compression compared to a single stream is negligible.
+ *
+ * Truecolor images are written as RGB or RGBA. Palette images are
+ * written only if the image has at most 256 distinct colours, no
+ * quantization is done. Gamma and rendering intent chunks are left
+ * to imagine.
+ */
+// ======================================================================
+
+#ifndef PNGTOOLS_H
+#define PNGTOOLS_H
+
+#include <imagine/NFmiColorTools.h>
+#include <imagine/NFmiImage.h>
+
+#include <string>
+#include <vector>
+
+namespace PngTools
+{
+struct Options
+{
+  Options() : savealpha(true), level(-1), threads(1) {}
+  bool savealpha;        // write alpha channel?
+  int level;             // zlib compression level, -1 for default
+  unsigned int threads;  // number of compression threads
+};
+
+typedef std::vector<Imagine::NFmiColorTools::Color> Colors;
+
+void write(const Imagine::NFmiImage &theImage,
+           const std::string &theFilename,
+           const Options &theOptions);
+
+void writeIndexed(const Imagine::NFmiImage &theImage,
+                  const std::string &theFilename,
+                  const Options &theOptions,
+                  const Colors &theKnownColors);
+
+std::vector<unsigned char> encode(const Imagine::NFmiImage &theImage, const Options &theOptions);
+
+std::vector<unsigned char> rgba(const Imagine::NFmiImage &theImage);
+
+}  // namespace PngTools
+
+#endif  // PNGTOOLS_H
+
+// ======================================================================
@@ -0,0 +1,71 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of struct RenderContext
+ */
+// ======================================================================
+/*!
+ * \struct RenderContext
+ * \brief Everything needed to render the images of a job
+ *
+ * The drawing functions access the settings, the locators, the caches
+ * and the data only through the context they are given, never through
+ * the globals. The job state belongs to a single job, while the caches
+ * may be shared by several jobs. The active data is selected
+ * separately for each context.
+ *
+ * Typical use is shown below.
+ * \code
+ * RenderContext context(globals, globals, globals.querystreams, globals.verbose);
+ * draw_contours(globals, context);
+ * \endcode
+ */
+// ======================================================================
+
+#ifndef RENDERCONTEXT_H
+#define RENDERCONTEXT_H
+
+#include "Globals.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+class ContourCalculator;
+class LazyQueryData;
+class NFmiTime;
+
+struct RenderContext
+{
+  typedef std::vector<boost::shared_ptr<LazyQueryData> > QueryStreams;
+
+  RenderContext(JobState &theState,
+                RenderCaches &theCaches,
+                const QueryStreams &theQueryStreams,
+                bool theVerbose);
+
+  const std::string getImageStampText(const NFmiTime &theTime) const;
+  void drawImageStampText(ImagineXr_or_NFmiImage &d, const std::string &text) const;
+  void drawCombine(ImagineXr_or_NFmiImage &d) const;
+
+  JobState &state;                             // settings and locators of the job
+  RenderCaches &caches;                        // caches used exclusively by the context
+  const QueryStreams &querystreams;            // the available data
+  boost::shared_ptr<LazyQueryData> queryinfo;  // active data, does not own pointer
+  ContourCalculator *calculator;               // contourer of the active data
+  bool verbose;                                // print progress information?
+
+ private:
+  // Intentionally disabled:
+
+  RenderContext(const RenderContext &theContext);
+  RenderContext &operator=(const RenderContext &theContext);
+
+  std::unique_lock<std::mutex> itsCachesLock;
+};
+
+#endif  // RENDERCONTEXT_H
+
+// ======================================================================
@@ -0,0 +1,41 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of namespace ServerTools
+ */
+// ======================================================================
+/*!
+ * \namespace ServerTools
+ * \brief Running qdcontour jobs in a persistent process
+ *
+ * A job is a line of whitespace separated script names. The jobs are
+ * read either from a Unix domain socket, one job per connection, or
+ * from the standard input, one job per line. The jobs are run one
+ * at a time in the order received, and a status line is returned for
+ * each job: "OK" or "ERROR: <message>". The job "quit" stops the
+ * server. A socket client must send its job within ten seconds, or it
+ * is dropped. When serving the standard input, the standard output carries
+ * only the status lines; the progress output of the jobs goes to the
+ * standard error.
+ */
+// ======================================================================
+
+#ifndef SERVERTOOLS_H
+#define SERVERTOOLS_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ServerTools
+{
+//! Runs the given scripts, and returns an empty string or an error message
+typedef std::function<std::string(const std::vector<std::string> &theScripts)> JobFunction;
+
+void serve(const std::string &theSocket, const JobFunction &theJob);
+
+}  // namespace ServerTools
+
+#endif  // SERVERTOOLS_H
+
+// ======================================================================
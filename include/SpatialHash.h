@@ -0,0 +1,101 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of class SpatialHash
+ */
+// ======================================================================
+/*!
+ * \class SpatialHash
+ * \brief A uniform grid index for fast proximity queries on points
+ *
+ * The points are bucketed into square cells, which are stored
+ * contiguously. The index itself is immutable once built, callers
+ * are expected to mark removed points themselves and to skip them
+ * in the visitor.
+ *
+ * The cell size should be comparable to the typical query radius.
+ *
+ * Typical use:
+ * \code
+ * SpatialHash hash;
+ * hash.build(xcoords, ycoords, radius);
+ * hash.visit(x, y, radius, [&](std::size_t i) { ... });
+ * \endcode
+ */
+// ======================================================================
+
+#ifndef SPATIALHASH_H
+#define SPATIALHASH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+class SpatialHash
+{
+ public:
+  SpatialHash();
+
+  void build(const std::vector<double> &theX, const std::vector<double> &theY, double theCellSize);
+  void clear();
+
+  bool empty() const { return itsX.empty(); }
+  std::size_t size() const { return itsX.size(); }
+
+  template <typename F>
+  void visit(double theX, double theY, double theRadius, F theFunction) const;
+
+  double nearestDistance(double theX, double theY) const;
+
+ private:
+  int column(double theX) const;
+  int row(double theY) const;
+
+  double itsCellSize;
+  double itsMinX;
+  double itsMinY;
+  int itsColumns;
+  int itsRows;
+
+  std::vector<double> itsX;
+  std::vector<double> itsY;
+  std::vector<std::size_t> itsCellStart;  // size columns*rows+1
+  std::vector<std::size_t> itsItems;      // point indices ordered by cell
+
+};  // class SpatialHash
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Call the function for all points possibly within the radius
+ *
+ * The function is called with the index of the point in the original
+ * coordinate vectors. Points in cells overlapping the bounding square
+ * of the circle are visited, the caller must do the exact distance
+ * test. Within each cell the points are visited in index order.
+ */
+// ----------------------------------------------------------------------
+
+template <typename F>
+void SpatialHash::visit(double theX, double theY, double theRadius, F theFunction) const
+{
+  if (itsX.empty()) return;
+
+  const int i1 = column(theX - theRadius);
+  const int i2 = column(theX + theRadius);
+  const int j1 = row(theY - theRadius);
+  const int j2 = row(theY + theRadius);
+
+  for (int j = j1; j <= j2; j++)
+    for (int i = i1; i <= i2; i++)
+    {
+      const std::size_t cell =
+          static_cast<std::size_t>(i) + static_cast<std::size_t>(j) * itsColumns;
+      for (std::size_t k = itsCellStart[cell]; k < itsCellStart[cell + 1]; k++)
+        theFunction(itsItems[k]);
+    }
+}
+
+#endif  // SPATIALHASH_H
+
+// ======================================================================
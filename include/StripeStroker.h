@@ -0,0 +1,82 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of class StripeStroker
+ */
+// ======================================================================
+/*!
+ * \class StripeStroker
+ * \brief Strokes several projected paths in parallel horizontal stripes
+ *
+ * Stroking a long contour with NFmiPath::Stroke into a very large
+ * image is slow on a single core. The StripeStroker collects the
+ * strokes first, and then splits the image into horizontal stripes.
+ * Each thread strokes into a private buffer of the rows of its
+ * stripe only the strokes whose bounding box reaches the stripe,
+ * clipped to the stripe expanded by the line width, and copies the
+ * rows back. The buffers of separate stripes do not overlap, so no
+ * locking is needed, and each part of a path is rasterized only by
+ * the stripes it crosses.
+ *
+ * The paths are moved by a whole number of pixels, and are clipped
+ * only outside the stripe with the same margin qdcontour uses for
+ * the image edges, hence the pixels of each row are the same as
+ * when stroking the full image. The strokes are drawn in the order
+ * they were added.
+ *
+ * Typical use:
+ * \code
+ * StripeStroker stroker;
+ * for(...)
+ *   stroker.add(path, width, color, rule);
+ * stroker.stroke(image, threads);
+ * \endcode
+ */
+// ======================================================================
+
+#ifndef STRIPESTROKER_H
+#define STRIPESTROKER_H
+
+#include <imagine/NFmiColorTools.h>
+#include <imagine/NFmiImage.h>
+#include <imagine/NFmiPath.h>
+
+#include <vector>
+
+class StripeStroker
+{
+ public:
+  StripeStroker();
+
+  bool empty() const;
+  void clear();
+
+  void add(const Imagine::NFmiPath &thePath,
+           float theWidth,
+           Imagine::NFmiColorTools::Color theColor,
+           Imagine::NFmiColorTools::NFmiBlendRule theRule);
+
+  void stroke(Imagine::NFmiImage &theImage, unsigned int theThreads = 1);
+
+ private:
+  //! A single path and its style
+  struct Stroke
+  {
+    Imagine::NFmiPath path;
+    float width;
+    Imagine::NFmiColorTools::Color color;
+    Imagine::NFmiColorTools::NFmiBlendRule rule;
+    double margin;  // how far the stroke may extend from the path
+    double ymin;    // the rows the stroke may touch
+    double ymax;
+  };
+
+  void strokeRows(Imagine::NFmiImage &theImage, int theFirstRow, int theLastRow) const;
+
+  std::vector<Stroke> itsStrokes;
+
+};  // class StripeStroker
+
+#endif  // STRIPESTROKER_H
+
+// ======================================================================
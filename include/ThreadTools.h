@@ -0,0 +1,32 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of namespace ThreadTools
+ */
+// ======================================================================
+/*!
+ * \namespace ThreadTools
+ * \brief Tools for splitting rendering work between threads
+ *
+ */
+// ======================================================================
+
+#ifndef THREADTOOLS_H
+#define THREADTOOLS_H
+
+#include <cstddef>
+#include <functional>
+
+namespace ThreadTools
+{
+unsigned int concurrency(int theThreads);
+
+void parallel_for(std::size_t theCount,
+                  unsigned int theThreads,
+                  const std::function<void(std::size_t)> &theFunction);
+
+}  // namespace ThreadTools
+
+#endif  // THREADTOOLS_H
+
+// ======================================================================
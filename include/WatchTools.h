@@ -0,0 +1,65 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Interface of class WatchTools::Watcher
+ */
+// ======================================================================
+/*!
+ * \class WatchTools::Watcher
+ * \brief Waiting for querydata files to be updated
+ *
+ * The directories of the files are monitored with inotify, since new
+ * data is usually written into a temporary file which is then renamed
+ * over the old one. A file is considered changed once it has been
+ * closed after writing or moved into place. If a watched name is a
+ * directory, any new file in the directory counts as a change.
+ *
+ * Data often arrives in several parts at nearly the same time, hence
+ * after the first change the events are collected until none have
+ * arrived for the given settling time.
+ *
+ * The same watcher should be kept for the whole session, since the
+ * inotify instance then queues the changes made while the caller is
+ * busy processing the previous ones.
+ */
+// ======================================================================
+
+#ifndef WATCHTOOLS_H
+#define WATCHTOOLS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace WatchTools
+{
+class Watcher
+{
+ public:
+  ~Watcher();
+  Watcher();
+
+  void watch(const std::vector<std::string> &theFiles);
+  std::vector<std::string> wait(int theSettleTime);
+
+ private:
+  // Intentionally disabled:
+
+  Watcher(const Watcher &theWatcher);
+  Watcher &operator=(const Watcher &theWatcher);
+
+  int itsFd;
+
+  // The watched names in each directory. An empty name means
+  // the whole directory is watched.
+
+  std::map<int, std::map<std::string, std::string> > itsWatches;
+  std::vector<std::string> itsFiles;
+
+};  // class Watcher
+
+}  // namespace WatchTools
+
+#endif  // WATCHTOOLS_H
+
+// ======================================================================
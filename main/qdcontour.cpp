@@ -6,7 +6,10 @@
 // ======================================================================
 
 #include "Globals.h"
+#include "ArrowAtlas.h"
+#include "BandRasterizer.h"
 #include "ColorTools.h"
+#include "ContourRenderer.h"
 #include "ContourSpec.h"
 #include "ContourInterpolation.h"
 #include "GramTools.h"
@@ -14,9 +17,19 @@
 #include "LazyQueryData.h"
 #include "MeridianTools.h"
 #include "MetaFunctions.h"
+#include "ParamTools.h"
+#include "PathTools.h"
+#include "PixelGridLookup.h"
+#include "PngTools.h"
 #include "ProjectionFactory.h"
+#include "RenderContext.h"
+#include "ServerTools.h"
+#include "StripeStroker.h"
+#include "ThreadTools.h"
 #include "TimeTools.h"
+#include "WatchTools.h"
 #include "ExtremaLocator.h"
+#include "ExtremaTools.h"
 
 #include <imagine/NFmiColorTools.h>
 
@@ -39,6 +52,7 @@ typedef Imagine::NFmiImage ImagineXr_or_NFmiImage;
 #include <newbase/NFmiDataModifierClasses.h>
 #include <newbase/NFmiEnumConverter.h>  // FmiParameterName<-->string
 #include <newbase/NFmiFileSystem.h>     // FileExists()
+#include <newbase/NFmiGrid.h>
 #include <newbase/NFmiInterpolation.h>  // Interpolation functions
 #include <newbase/NFmiLatLonArea.h>     // Geographic projection
 #include <newbase/NFmiLevel.h>
@@ -49,13 +63,17 @@ typedef Imagine::NFmiImage ImagineXr_or_NFmiImage;
 #include <newbase/NFmiPreProcessor.h>
 
 #include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
 
 #include <fstream>
 #include <iomanip>
 #include <list>
+#include <map>
 #include <memory>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -63,27 +81,10 @@ typedef Imagine::NFmiImage ImagineXr_or_NFmiImage;
 using namespace std;
 using namespace boost;
 using namespace Imagine;
+using ParamTools::toparam;
 
 const float pi = 3.141592658979323f;
 
-// ----------------------------------------------------------------------
-// Convert parameter description to a enum
-// ----------------------------------------------------------------------
-
-FmiParameterName toparam(const string &name)
-{
-  static NFmiEnumConverter converter;
-
-  try
-  {
-    return FmiParameterName(boost::lexical_cast<int>(name));
-  }
-  catch (...)
-  {
-    return FmiParameterName(converter.ToEnum(name));
-  }
-}
-
 // ----------------------------------------------------------------------
 // Usage
 // ----------------------------------------------------------------------
@@ -98,9 +99,41 @@ void Usage(void)
        << "   -f\tForce overwriting old images" << endl
        << "   -q [querydata]\tSpecify querydata to be rendered" << endl
        << "   -c \"config line\"\tPrecede with config line (i.e. \"format pdf\")" << endl
+       << "   -s [socket]\tServe jobs from a Unix domain socket, or from stdin if \"-\"" << endl
+       << "   -w\tWatch the querydata files and render updated times again" << endl
+       << endl
+       << "In server mode each job is a line of conffiles, which are processed" << endl
+       << "as if given on the command line. The data and the caches are kept" << endl
+       << "between the jobs, and modified querydata is read again. A status" << endl
+       << "line \"OK\" or \"ERROR: <message>\" is returned for each job, and" << endl
+       << "the job \"quit\" stops the server." << endl
+       << endl
+       << "In watch mode the conffiles are processed again whenever the querydata" << endl
+       << "files they use are updated. Only the images whose data has changed" << endl
+       << "are rendered again, and the data and the caches are kept in between." << endl
        << endl;
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Get the bitmap of the given mask image
+ *
+ * The bitmap is built on first use after each "mask" command.
+ *
+ * \param theMask The mask filename
+ * \return The bitmap, which is empty if there is no mask
+ */
+// ----------------------------------------------------------------------
+
+const MaskBitmap &mask_bitmap(RenderContext &theContext, const std::string &theMask)
+{
+  JobState &state = theContext.state;
+
+  if (!theMask.empty() && state.maskbitmap.empty())
+    state.maskbitmap.build(theContext.caches.getImage(theMask));
+  return state.maskbitmap;
+}
+
 // ----------------------------------------------------------------------
 /*!
  * Test whether the given pixel coordinate is masked. This by definition
@@ -112,31 +145,14 @@ void Usage(void)
  *
  * \param thePoint The pixel coordinate
  * \param theMask The mask filename
- * \param theMaskImage The mask image
  * \return True, if the pixel is masked out
  */
 // ----------------------------------------------------------------------
 
-bool IsMasked(const NFmiPoint &thePoint, const std::string &theMask)
+bool IsMasked(RenderContext &theContext, const NFmiPoint &thePoint, const std::string &theMask)
 {
   if (theMask.empty()) return false;
-
-  int x = static_cast<int>(round(thePoint.X()));
-  int y = static_cast<int>(round(thePoint.Y()));
-
-  // Get the mask
-
-  const ImagineXr_or_NFmiImage &mask = globals.getImage(theMask);
-
-  // Clip outside pixels
-
-  x = min(max(x, 0), mask.Width() - 1);
-  y = min(max(y, 0), mask.Height() - 1);
-
-  const NFmiColorTools::Color c = mask(x, y);
-  const int alpha = NFmiColorTools::GetAlpha(c);
-
-  return (alpha != NFmiColorTools::Transparent);
+  return mask_bitmap(theContext, theMask).masked(thePoint.X(), thePoint.Y());
 }
 
 // ----------------------------------------------------------------------
@@ -145,9 +161,9 @@ bool IsMasked(const NFmiPoint &thePoint, const std::string &theMask)
  */
 // ----------------------------------------------------------------------
 
-void parse_command_line(int argc, const char *argv[])
+void parse_command_line(Globals &theGlobals, int argc, const char *argv[])
 {
-  NFmiCmdLine cmdline(argc, argv, "hvfq!c!");
+  NFmiCmdLine cmdline(argc, argv, "hvfq!c!s!w");
 
   // Check for parsing errors
 
@@ -163,26 +179,33 @@ void parse_command_line(int argc, const char *argv[])
 
   // Read -v option
 
-  if (cmdline.isOption('v')) globals.verbose = true;
+  if (cmdline.isOption('v')) theGlobals.verbose = true;
 
   // Read -f option
 
-  if (cmdline.isOption('f')) globals.force = true;
+  if (cmdline.isOption('f')) theGlobals.force = true;
 
-  if (cmdline.isOption('q')) globals.cmdline_querydata = cmdline.OptionValue('q');
+  if (cmdline.isOption('q')) theGlobals.cmdline_querydata = cmdline.OptionValue('q');
 
   // AKa 22-Aug-2008: Added for allowing "format pdf" enforcing (or any other
   //                  command) from the command line.
   //
-  if (cmdline.isOption('c')) globals.cmdline_conf = cmdline.OptionValue('c');
+  if (cmdline.isOption('c')) theGlobals.cmdline_conf = cmdline.OptionValue('c');
+
+  if (cmdline.isOption('s')) theGlobals.cmdline_serve = cmdline.OptionValue('s');
+
+  if (cmdline.isOption('w')) theGlobals.cmdline_watch = true;
+
+  if (theGlobals.cmdline_watch && !theGlobals.cmdline_serve.empty())
+    throw runtime_error("Options -s and -w cannot be used simultaneously");
 
   // Read command filenames
 
-  if (cmdline.NumberofParameters() == 0)
+  if (cmdline.NumberofParameters() == 0 && theGlobals.cmdline_serve.empty())
     throw runtime_error("Atleast one command line parameter is required");
 
   for (int i = 1; i <= cmdline.NumberofParameters(); i++)
-    globals.cmdline_files.push_back(cmdline.Parameter(i));
+    theGlobals.cmdline_files.push_back(cmdline.Parameter(i));
 }
 
 // ----------------------------------------------------------------------
@@ -227,14 +250,14 @@ const string read_script(const string &theName)
  */
 // ----------------------------------------------------------------------
 
-const string preprocess_script(const string &theScript)
+const string preprocess_script(const Globals &theGlobals, const string &theScript)
 {
   string ret;
 
-  if (!globals.cmdline_querydata.empty())
+  if (!theGlobals.cmdline_querydata.empty())
   {
     ret += "querydata ";
-    ret += globals.cmdline_querydata;
+    ret += theGlobals.cmdline_querydata;
     ret += '\n';
   }
   ret += theScript;
@@ -242,28 +265,6 @@ const string preprocess_script(const string &theScript)
   return ret;
 }
 
-// ----------------------------------------------------------------------
-/*!
- * \brief Flip fill inside out if contour limits are missing
- *
- * We assume the path has already been projected to pixel coordinates
- * so that we can use reasonable values for the external box around
- * the image.
- *
- */
-// ----------------------------------------------------------------------
-
-void invert_if_missing(NFmiPath &thePath, float lolimit, float hilimit)
-{
-  const float m = 10000;
-  if (lolimit != kFloatMissing || hilimit != kFloatMissing) return;
-  thePath.MoveTo(-m, -m);
-  thePath.LineTo(m, -m);
-  thePath.LineTo(m, m);
-  thePath.LineTo(-m, m);
-  thePath.LineTo(-m, -m);
-}
-
 // ----------------------------------------------------------------------
 /*!
  * \brief Check input stream validity
@@ -345,14 +346,14 @@ void report_extrema(const string &theParam, float theMin, float theMax)
 // ----------------------------------------------------------------------
 
 #ifdef IMAGINE_WITH_CAIRO
-static void write_image(const ImagineXr &xr)
+static void write_image(Globals &theGlobals, const ImagineXr &xr)
 {
   const string filename = xr.Filename();
   const string format = xr.Format();
 
-  if (globals.verbose) cout << "Writing '" << filename << "'" << endl;
+  if (theGlobals.verbose) cout << "Writing '" << filename << "'" << endl;
 
-  if ((format == "pdf") || (format == "png" && (!globals.reducecolors)))
+  if ((format == "pdf") || (format == "png" && (!theGlobals.reducecolors)))
   {
     // Cairo native writing (faster)
     //
@@ -380,25 +381,161 @@ static void write_image(const ImagineXr &xr)
       delete[] buf;
     }
 #endif
-    globals.setImageModes(img);
+    theGlobals.setImageModes(img);
 
-    if (globals.reducecolors) img.ReduceColors();
+    if (theGlobals.reducecolors) img.ReduceColors();
 
     img.Write(filename, format);
   }
 
-  if (!globals.itsImageCacheOn) globals.itsImageCache.clear();
+  if (!theGlobals.itsImageCacheOn)
+    theGlobals.itsImageCache->clear();
+  else
+    theGlobals.itsImageCache->trim();
 }
 #else
-static void write_image(NFmiImage &theImage, const string &theName, const string &theFormat)
+//! Image encoding settings captured for the writers
+struct ImageEncoding
+{
+  bool reducecolors;          // reduce colors before saving?
+  bool pngtools;              // write truecolor PNG with PngTools?
+  bool exactpalette;          // write a palette image with known colours?
+  PngTools::Options options;  // PngTools settings
+  PngTools::Colors colors;    // known palette colours
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The encoding settings for the given image format
+ *
+ * Palette quantization, gamma and rendering intent are handled by
+ * imagine only.
+ */
+// ----------------------------------------------------------------------
+
+static ImageEncoding image_encoding(const Globals &theGlobals, const string &theFormat)
+{
+  const bool plainpng = (theFormat == "png" && theGlobals.gamma <= 0 && theGlobals.intent.empty());
+
+  ImageEncoding encoding;
+  encoding.reducecolors = theGlobals.reducecolors;
+  encoding.pngtools = (plainpng && theGlobals.pngthreads > 0 && !theGlobals.wantpalette &&
+                       !theGlobals.forcepalette);
+  encoding.exactpalette = (plainpng && theGlobals.exactpalette);
+  encoding.options.savealpha = theGlobals.savealpha;
+  encoding.options.level = theGlobals.pngquality;
+  encoding.options.threads = max(1, theGlobals.pngthreads);
+  if (encoding.exactpalette) encoding.colors = theGlobals.palettecolors;
+  return encoding;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Encode and write the image
+ *
+ * A palette image starting with the known colours is written if so
+ * requested, otherwise the normal quantization and encoding is used.
+ */
+// ----------------------------------------------------------------------
+
+static void encode_image(NFmiImage &theImage,
+                         const string &theName,
+                         const string &theFormat,
+                         const ImageEncoding &theEncoding)
+{
+  if (theEncoding.exactpalette)
+  {
+    PngTools::writeIndexed(theImage, theName, theEncoding.options, theEncoding.colors);
+    return;
+  }
+
+  if (theEncoding.reducecolors) theImage.ReduceColors();
+
+  if (theEncoding.pngtools)
+    PngTools::write(theImage, theName, theEncoding.options);
+  else
+    theImage.Write(theName, theFormat);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Write image to file with desired format
+ */
+// ----------------------------------------------------------------------
+
+static void write_image(Globals &theGlobals,
+                        NFmiImage &theImage,
+                        const string &theName,
+                        const string &theFormat)
+{
+  if (theGlobals.verbose) cout << "Writing '" << theName << "'" << endl;
+
+  encode_image(theImage, theName, theFormat, image_encoding(theGlobals, theFormat));
+
+  if (!theGlobals.itsImageCacheOn)
+    theGlobals.itsImageCache->clear();
+  else
+    theGlobals.itsImageCache->trim();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Hand the image over to the background writers
+ *
+ * The caller must not modify the image afterwards. Errors are
+ * reported by the next wait() call of the image writer.
+ */
+// ----------------------------------------------------------------------
+
+static void queue_image(Globals &theGlobals,
+                        const boost::shared_ptr<NFmiImage> &theImage,
+                        const string &theName,
+                        const string &theFormat)
 {
-  if (globals.verbose) cout << "Writing '" << theName << "'" << endl;
+  if (theGlobals.verbose) cout << "Writing '" << theName << "'" << endl;
+
+  const ImageEncoding encoding = image_encoding(theGlobals, theFormat);
+  boost::shared_ptr<NFmiImage> image = theImage;
 
-  if (globals.reducecolors) theImage.ReduceColors();
+  theGlobals.imagewriter.submit([image, theName, theFormat, encoding]()
+                             { encode_image(*image, theName, theFormat, encoding); });
+
+  if (!theGlobals.itsImageCacheOn)
+    theGlobals.itsImageCache->clear();
+  else
+    theGlobals.itsImageCache->trim();
+}
+#endif
 
-  theImage.Write(theName, theFormat);
+#ifndef IMAGINE_WITH_CAIRO
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the image of the previous frame for reuse
+ *
+ * The image is reused only if it has the desired size and nobody
+ * else refers to it anymore, which saves allocating a new image for
+ * every frame. Each target has its own frame since the target sizes
+ * may differ.
+ *
+ * \param theFrame The previous frame of the target, reset on return
+ * \param theWidth The desired width
+ * \param theHeight The desired height
+ * \return The image, or an empty pointer if a new one is needed
+ */
+// ----------------------------------------------------------------------
 
-  if (!globals.itsImageCacheOn) globals.itsImageCache.clear();
+boost::shared_ptr<NFmiImage> frame_image(boost::shared_ptr<NFmiImage> &theFrame,
+                                         int theWidth,
+                                         int theHeight)
+{
+  boost::shared_ptr<NFmiImage> image;
+  if (theFrame.get() != 0 && theFrame.unique() && theFrame->Width() == theWidth &&
+      theFrame->Height() == theHeight)
+  {
+    image = theFrame;
+  }
+  theFrame.reset();
+  return image;
 }
 #endif
 
@@ -422,7 +559,7 @@ Imagine::NFmiFace make_face(const string &theSpec) { return NFmiFace(theSpec); }
  */
 // ----------------------------------------------------------------------
 
-void do_comment(istream &theInput)
+void do_comment(Globals &theGlobals, istream &theInput)
 {
 #ifdef PERKELEEN_296
   theInput.ignore(1000000, '\n');
@@ -437,15 +574,15 @@ void do_comment(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_cache(istream &theInput)
+void do_cache(Globals &theGlobals, istream &theInput)
 {
   int flag;
   theInput >> flag;
 
   check_errors(theInput, "cache");
 
-  globals.calculator.cache(flag != 0);
-  globals.maskcalculator.cache(flag != 0);
+  theGlobals.calculator->cache(flag != 0);
+  theGlobals.contourcache = (flag != 0);
 }
 
 // ----------------------------------------------------------------------
@@ -454,7 +591,7 @@ void do_cache(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_imagecache(istream &theInput)
+void do_imagecache(Globals &theGlobals, istream &theInput)
 {
   int flag;
   theInput >> flag;
@@ -462,48 +599,149 @@ void do_imagecache(istream &theInput)
   check_errors(theInput, "imagecache");
 
 #ifdef USE_IMAGECACHE
-  globals.itsImageCacheOn = (flag != 0);
+  theGlobals.itsImageCacheOn = (flag != 0);
 #endif
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle the "imagecachelimit" command
+ *
+ * The limit is given in megabytes, 0 disables the limit.
+ */
+// ----------------------------------------------------------------------
+
+void do_imagecachelimit(Globals &theGlobals, istream &theInput)
+{
+  int megabytes;
+  theInput >> megabytes;
+
+  check_errors(theInput, "imagecachelimit");
+
+  if (megabytes < 0) throw runtime_error("imagecachelimit must be nonnegative");
+
+  theGlobals.itsImageCache->limit(static_cast<size_t>(megabytes) * 1024 * 1024);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle the "manifest" command
+ *
+ * The fingerprints of the images are saved into the given file,
+ * or only kept in memory if the file is "none".
+ */
+// ----------------------------------------------------------------------
+
+void do_manifest(Globals &theGlobals, istream &theInput)
+{
+  string filename;
+  theInput >> filename;
+
+  check_errors(theInput, "manifest");
+
+  if (filename == "none")
+  {
+    theGlobals.manifestfile.clear();
+    theGlobals.manifest.clear();
+  }
+  else
+  {
+    theGlobals.manifestfile = filename;
+    theGlobals.manifest.load(filename);
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether the active querydata files have been modified
+ *
+ * This matters in server mode, where the same script may be run
+ * again after the data has been updated.
+ */
+// ----------------------------------------------------------------------
+
+bool querydata_modified(const Globals &theGlobals)
+{
+  for (size_t i = 0; i < theGlobals.queryfilenames.size(); i++)
+  {
+    if (NFmiFileSystem::FileModificationTime(theGlobals.queryfilenames[i]) !=
+        theGlobals.querymtimes[i])
+      return true;
+  }
+  return false;
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Handle the "querydata" command
+ *
+ * Files which are already in use and have not been modified since
+ * they were read are not read again.
  */
 // ----------------------------------------------------------------------
 
-void do_querydata(istream &theInput)
+void do_querydata(Globals &theGlobals, istream &theInput)
 {
   string newnames;
   theInput >> newnames;
 
   check_errors(theInput, "querydata");
 
-  if (globals.queryfilelist != newnames)
+  if (theGlobals.queryfilelist != newnames || querydata_modified(theGlobals))
   {
-    globals.queryfilelist = newnames;
-
-    // Delete possible old infos
-
-    globals.querystreams.clear();
-
     // Split the comma separated list into a real list
 
-    vector<string> qnames = NFmiStringTools::Split(globals.queryfilelist);
+    vector<string> qnames = NFmiStringTools::Split(newnames);
+
+    // Read the queryfiles. The old data is replaced only once all
+    // the files have been read, so that a failed read does not leave
+    // a truncated set of data which would never be reloaded
 
-    // Read the queryfiles
+    vector<boost::shared_ptr<LazyQueryData> > streams;
+    vector<string> filenames;
+    vector<time_t> mtimes;
+    vector<bool> reused(theGlobals.querystreams.size(), false);
 
     {
       vector<string>::const_iterator iter;
       for (iter = qnames.begin(); iter != qnames.end(); ++iter)
       {
-        boost::shared_ptr<LazyQueryData> tmp(new LazyQueryData());
-        string filename = NFmiFileSystem::FileComplete(*iter, globals.datapath);
-        globals.queryfilenames.push_back(filename);
-        tmp->Read(filename);
-        globals.querystreams.push_back(tmp);
+        string filename = NFmiFileSystem::FileComplete(*iter, theGlobals.datapath);
+        const time_t mtime = NFmiFileSystem::FileModificationTime(filename);
+
+        // Unmodified files already in use are not read again
+
+        boost::shared_ptr<LazyQueryData> tmp;
+        for (size_t i = 0; i < theGlobals.queryfilenames.size(); i++)
+        {
+          if (!reused[i] && theGlobals.queryfilenames[i] == filename &&
+              theGlobals.querymtimes[i] == mtime)
+          {
+            reused[i] = true;
+            tmp = theGlobals.querystreams[i];
+            break;
+          }
+        }
+
+        if (!tmp)
+        {
+          // A file which cannot be read is still watched, so that watch
+          // mode retries once the file is updated instead of immediately
+
+          theGlobals.watchfiles[filename] = mtime;
+          tmp.reset(new LazyQueryData());
+          tmp->Read(filename);
+        }
+        streams.push_back(tmp);
+        filenames.push_back(filename);
+        mtimes.push_back(mtime);
       }
     }
+
+    theGlobals.queryfilelist = newnames;
+    theGlobals.querystreams.swap(streams);
+    theGlobals.queryfilenames.swap(filenames);
+    theGlobals.querymtimes.swap(mtimes);
   }
 }
 
@@ -513,13 +751,13 @@ void do_querydata(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_level(istream &theInput)
+void do_level(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.querydatalevel;
+  theInput >> theGlobals.querydatalevel;
 
   check_errors(theInput, "level");
 
-  if (!globals.specs.empty()) globals.specs.back().level(globals.querydatalevel);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().level(theGlobals.querydatalevel);
 }
 
 // ----------------------------------------------------------------------
@@ -528,16 +766,16 @@ void do_level(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_filter(istream &theInput)
+void do_filter(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.filter;
+  theInput >> theGlobals.filter;
 
   check_errors(theInput, "filter");
 
-  if (globals.filter != "none" && globals.filter != "linear" && globals.filter != "min" &&
-      globals.filter != "max" && globals.filter != "mean" && globals.filter != "sum")
+  if (theGlobals.filter != "none" && theGlobals.filter != "linear" && theGlobals.filter != "min" &&
+      theGlobals.filter != "max" && theGlobals.filter != "mean" && theGlobals.filter != "sum")
   {
-    throw runtime_error("Filtering mode '" + globals.filter + "' is not recognized");
+    throw runtime_error("Filtering mode '" + theGlobals.filter + "' is not recognized");
   }
 }
 
@@ -547,17 +785,17 @@ void do_filter(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestepskip(istream &theInput)
+void do_timestepskip(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestepskip;
+  theInput >> theGlobals.timestepskip;
 
   check_errors(theInput, "timestepskip");
 
-  if (globals.timestepskip < 0) throw runtime_error("timestepskip cannot be negative");
+  if (theGlobals.timestepskip < 0) throw runtime_error("timestepskip cannot be negative");
 
   const int ludicruous = 30 * 24 * 60;  // 1 month
-  if (globals.timestepskip > ludicruous)
-    throw runtime_error("timestepskip " + NFmiStringTools::Convert(globals.timestepskip) +
+  if (theGlobals.timestepskip > ludicruous)
+    throw runtime_error("timestepskip " + NFmiStringTools::Convert(theGlobals.timestepskip) +
                         " is ridiculously large");
 }
 
@@ -567,18 +805,18 @@ void do_timestepskip(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestep(istream &theInput)
+void do_timestep(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestep;
-  globals.timeinterval = globals.timestep;
+  theInput >> theGlobals.timestep;
+  theGlobals.timeinterval = theGlobals.timestep;
 
   check_errors(theInput, "timestep");
 
-  if (globals.timestep < 0) throw runtime_error("timestep cannot be negative");
+  if (theGlobals.timestep < 0) throw runtime_error("timestep cannot be negative");
 
   const int ludicruous = 30 * 24 * 60;  // 1 month
-  if (globals.timestep > ludicruous)
-    throw runtime_error("timestep " + NFmiStringTools::Convert(globals.timestep) +
+  if (theGlobals.timestep > ludicruous)
+    throw runtime_error("timestep " + NFmiStringTools::Convert(theGlobals.timestep) +
                         " is ridiculously large");
 }
 
@@ -588,17 +826,17 @@ void do_timestep(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timeinterval(istream &theInput)
+void do_timeinterval(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timeinterval;
+  theInput >> theGlobals.timeinterval;
 
   check_errors(theInput, "timeinterval");
 
-  if (globals.timeinterval < 0) throw runtime_error("timeinterval cannot be negative");
+  if (theGlobals.timeinterval < 0) throw runtime_error("timeinterval cannot be negative");
 
   const int ludicruous = 30 * 24 * 60;  // 1 month
-  if (globals.timeinterval > ludicruous)
-    throw runtime_error("timestep " + NFmiStringTools::Convert(globals.timeinterval) +
+  if (theGlobals.timeinterval > ludicruous)
+    throw runtime_error("timestep " + NFmiStringTools::Convert(theGlobals.timeinterval) +
                         " is ridiculously large");
 }
 
@@ -608,17 +846,17 @@ void do_timeinterval(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timesteps(istream &theInput)
+void do_timesteps(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timesteps;
+  theInput >> theGlobals.timesteps;
 
   check_errors(theInput, "timesteps");
 
-  if (globals.timesteps < 0) throw runtime_error("timesteps cannot be negative");
+  if (theGlobals.timesteps < 0) throw runtime_error("timesteps cannot be negative");
 
   const int ludicruous = 30 * 24 * 60;  // 1 month
-  if (globals.timesteps > ludicruous)
-    throw runtime_error("timesteps " + NFmiStringTools::Convert(globals.timesteps) +
+  if (theGlobals.timesteps > ludicruous)
+    throw runtime_error("timesteps " + NFmiStringTools::Convert(theGlobals.timesteps) +
                         " is ridiculously large");
 }
 
@@ -628,9 +866,9 @@ void do_timesteps(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestamp(istream &theInput)
+void do_timestamp(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestampflag;
+  theInput >> theGlobals.timestampflag;
 
   check_errors(theInput, "timestamp");
 }
@@ -641,9 +879,9 @@ void do_timestamp(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestampformat(istream &theInput)
+void do_timestampformat(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestampformat;
+  theInput >> theGlobals.timestampformat;
   check_errors(theInput, "timestampformat");
 }
 
@@ -653,9 +891,9 @@ void do_timestampformat(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestampzone(istream &theInput)
+void do_timestampzone(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestampzone;
+  theInput >> theGlobals.timestampzone;
 
   check_errors(theInput, "timestampzone");
 }
@@ -666,9 +904,9 @@ void do_timestampzone(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timesteprounding(istream &theInput)
+void do_timesteprounding(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timesteprounding;
+  theInput >> theGlobals.timesteprounding;
 
   check_errors(theInput, "timesteprounding");
 }
@@ -679,16 +917,16 @@ void do_timesteprounding(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestampimage(istream &theInput)
+void do_timestampimage(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestampimage;
+  theInput >> theGlobals.timestampimage;
 
   check_errors(theInput, "timestampimage");
 
-  if (globals.timestampimage != "none" && globals.timestampimage != "obs" &&
-      globals.timestampimage != "for" && globals.timestampimage != "forobs")
+  if (theGlobals.timestampimage != "none" && theGlobals.timestampimage != "obs" &&
+      theGlobals.timestampimage != "for" && theGlobals.timestampimage != "forobs")
   {
-    throw runtime_error("Unrecognized timestampimage mode '" + globals.timestampimage + "'");
+    throw runtime_error("Unrecognized timestampimage mode '" + theGlobals.timestampimage + "'");
   }
 }
 
@@ -698,9 +936,9 @@ void do_timestampimage(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestampimagexy(istream &theInput)
+void do_timestampimagexy(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestampimagex >> globals.timestampimagey;
+  theInput >> theGlobals.timestampimagex >> theGlobals.timestampimagey;
 
   check_errors(theInput, "timestampimagexy");
 }
@@ -711,16 +949,18 @@ void do_timestampimagexy(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestampimageformat(istream &theInput)
+void do_timestampimageformat(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestampimageformat;
+  theInput >> theGlobals.timestampimageformat;
 
   check_errors(theInput, "timestampimageformat");
 
-  if (globals.timestampimageformat != "hour" && globals.timestampimageformat != "hourdate" &&
-      globals.timestampimageformat != "datehour" && globals.timestampimageformat != "hourdateyear")
+  if (theGlobals.timestampimageformat != "hour" && theGlobals.timestampimageformat != "hourdate" &&
+      theGlobals.timestampimageformat != "datehour" &&
+      theGlobals.timestampimageformat != "hourdateyear")
   {
-    throw runtime_error("Unrecognized timestampimageformat '" + globals.timestampimageformat + "'");
+    throw runtime_error("Unrecognized timestampimageformat '" + theGlobals.timestampimageformat +
+                        "'");
   }
 }
 
@@ -730,9 +970,9 @@ void do_timestampimageformat(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestampimagefont(istream &theInput)
+void do_timestampimagefont(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestampimagefont;
+  theInput >> theGlobals.timestampimagefont;
 
   check_errors(theInput, "timestampimagefont");
 }
@@ -743,14 +983,14 @@ void do_timestampimagefont(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestampimagecolor(istream &theInput)
+void do_timestampimagecolor(Globals &theGlobals, istream &theInput)
 {
   string scolor;
   theInput >> scolor;
 
   check_errors(theInput, "timestampimagecolor");
 
-  globals.timestampimagecolor = ColorTools::checkcolor(scolor);
+  theGlobals.timestampimagecolor = ColorTools::checkcolor(scolor);
 }
 
 // ----------------------------------------------------------------------
@@ -759,14 +999,14 @@ void do_timestampimagecolor(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestampimagebackground(istream &theInput)
+void do_timestampimagebackground(Globals &theGlobals, istream &theInput)
 {
   string scolor;
   theInput >> scolor;
 
   check_errors(theInput, "timestampimagebackground");
 
-  globals.timestampimagebackground = ColorTools::checkcolor(scolor);
+  theGlobals.timestampimagebackground = ColorTools::checkcolor(scolor);
 }
 
 // ----------------------------------------------------------------------
@@ -775,9 +1015,9 @@ void do_timestampimagebackground(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_timestampimagemargin(istream &theInput)
+void do_timestampimagemargin(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.timestampimagexmargin >> globals.timestampimageymargin;
+  theInput >> theGlobals.timestampimagexmargin >> theGlobals.timestampimageymargin;
 
   check_errors(theInput, "timestampimagemargin");
 }
@@ -788,26 +1028,89 @@ void do_timestampimagemargin(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_projection(istream &theInput)
+void do_projection(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.projection;
+  theInput >> theGlobals.projection;
 
   check_errors(theInput, "projection");
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "areas" command
+ *
+ * The areas are listed in braces, each one with a projection,
+ * a background image and a savepath:
+ * \code
+ * areas
+ * {
+ *     stereographic,20,90,60:6,51.3,49,70.2:600,-1 europe.png europe
+ *     stereographic,25,90,60:18,58,35,71:400,-1 none finland
+ * }
+ * \endcode
+ * After this "draw contours" renders each time onto all the areas
+ * in one pass instead of the projection, background and savepath
+ * settings. The values are prepared and contoured only once for
+ * each time, hence smoothing is always done in the metric of the
+ * first area listed, even if its image is already up to date. The
+ * areas are drawn in parallel if several threads have been enabled
+ * with the "threads" command, and the threads are then divided
+ * between the areas. An empty list reverts to the normal settings.
+ */
+// ----------------------------------------------------------------------
+
+void do_areas(Globals &theGlobals, istream &theInput)
+{
+  using NFmiFileSystem::FileComplete;
+
+  string token;
+  theInput >> token;
+
+  check_errors(theInput, "areas");
+
+  if (token != "{") throw runtime_error("The areas must be listed in braces");
+
+  vector<AreaSpec> areas;
+  for (;;)
+  {
+    AreaSpec spec;
+    theInput >> spec.projection;
+
+    check_errors(theInput, "areas");
+
+    if (spec.projection == "}") break;
+
+    theInput >> spec.background >> spec.savepath;
+
+    check_errors(theInput, "areas");
+
+    if (spec.background == "none")
+      spec.background = "";
+    else
+      spec.background = FileComplete(spec.background, theGlobals.mapspath);
+
+    if (!NFmiFileSystem::DirectoryExists(spec.savepath))
+      NFmiFileSystem::CreateDirectory(spec.savepath);
+
+    areas.push_back(spec);
+  }
+
+  theGlobals.areas.swap(areas);
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Handle "erase" command
  */
 // ----------------------------------------------------------------------
 
-void do_erase(istream &theInput)
+void do_erase(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.erase;
+  theInput >> theGlobals.erase;
 
   check_errors(theInput, "projection");
 
-  ColorTools::checkcolor(globals.erase);
+  ColorTools::checkcolor(theGlobals.erase);
 }
 
 // ----------------------------------------------------------------------
@@ -816,15 +1119,15 @@ void do_erase(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_fillrule(istream &theInput)
+void do_fillrule(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.fillrule;
+  theInput >> theGlobals.fillrule;
 
   check_errors(theInput, "fillrule");
 
-  ColorTools::checkrule(globals.fillrule);
+  ColorTools::checkrule(theGlobals.fillrule);
 
-  if (!globals.shapespecs.empty()) globals.shapespecs.back().fillrule(globals.fillrule);
+  if (!theGlobals.shapespecs.empty()) theGlobals.shapespecs.back().fillrule(theGlobals.fillrule);
 }
 
 // ----------------------------------------------------------------------
@@ -833,15 +1136,16 @@ void do_fillrule(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_strokerule(istream &theInput)
+void do_strokerule(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.strokerule;
+  theInput >> theGlobals.strokerule;
 
   check_errors(theInput, "strokerule");
 
-  ColorTools::checkrule(globals.strokerule);
+  ColorTools::checkrule(theGlobals.strokerule);
 
-  if (!globals.shapespecs.empty()) globals.shapespecs.back().strokerule(globals.strokerule);
+  if (!theGlobals.shapespecs.empty())
+    theGlobals.shapespecs.back().strokerule(theGlobals.strokerule);
 }
 
 // ----------------------------------------------------------------------
@@ -850,17 +1154,17 @@ void do_strokerule(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_directionparam(istream &theInput)
+void do_directionparam(Globals &theGlobals, istream &theInput)
 {
-  globals.speedxcomponent = "";
-  globals.speedycomponent = "";
+  theGlobals.speedxcomponent = "";
+  theGlobals.speedycomponent = "";
 
-  theInput >> globals.directionparam;
+  theInput >> theGlobals.directionparam;
 
   check_errors(theInput, "directionparam");
 
-  if (toparam(globals.directionparam) == kFmiBadParameter)
-    throw runtime_error("Unrecognized directionparam '" + globals.directionparam + "'");
+  if (toparam(theGlobals.directionparam) == kFmiBadParameter)
+    throw runtime_error("Unrecognized directionparam '" + theGlobals.directionparam + "'");
 }
 
 // ----------------------------------------------------------------------
@@ -869,17 +1173,17 @@ void do_directionparam(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_speedparam(istream &theInput)
+void do_speedparam(Globals &theGlobals, istream &theInput)
 {
-  globals.speedxcomponent = "";
-  globals.speedycomponent = "";
+  theGlobals.speedxcomponent = "";
+  theGlobals.speedycomponent = "";
 
-  theInput >> globals.speedparam;
+  theInput >> theGlobals.speedparam;
 
   check_errors(theInput, "speedparam");
 
-  if (toparam(globals.speedparam) == kFmiBadParameter)
-    throw runtime_error("Unrecognized speedparam '" + globals.speedparam + "'");
+  if (toparam(theGlobals.speedparam) == kFmiBadParameter)
+    throw runtime_error("Unrecognized speedparam '" + theGlobals.speedparam + "'");
 }
 
 // ----------------------------------------------------------------------
@@ -888,20 +1192,20 @@ void do_speedparam(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_speedcomponents(istream &theInput)
+void do_speedcomponents(Globals &theGlobals, istream &theInput)
 {
-  globals.speedparam = "";
-  globals.directionparam = "";
+  theGlobals.speedparam = "";
+  theGlobals.directionparam = "";
 
-  theInput >> globals.speedxcomponent >> globals.speedycomponent;
+  theInput >> theGlobals.speedxcomponent >> theGlobals.speedycomponent;
 
   check_errors(theInput, "speedcomponents");
 
-  if (toparam(globals.speedxcomponent) == kFmiBadParameter)
-    throw runtime_error("Unrecognized speedcomponent '" + globals.speedxcomponent + "'");
+  if (toparam(theGlobals.speedxcomponent) == kFmiBadParameter)
+    throw runtime_error("Unrecognized speedcomponent '" + theGlobals.speedxcomponent + "'");
 
-  if (toparam(globals.speedycomponent) == kFmiBadParameter)
-    throw runtime_error("Unrecognized speedcomponent '" + globals.speedycomponent + "'");
+  if (toparam(theGlobals.speedycomponent) == kFmiBadParameter)
+    throw runtime_error("Unrecognized speedcomponent '" + theGlobals.speedycomponent + "'");
 }
 
 // ----------------------------------------------------------------------
@@ -910,26 +1214,47 @@ void do_speedcomponents(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_arrowscale(istream &theInput)
+void do_arrowscale(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.arrowscale;
+  theInput >> theGlobals.arrowscale;
 
   check_errors(theInput, "arrowscale");
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "arrowsprites" command
+ *
+ * Arrows up to the given size in pixels are drawn from pre-rasterized
+ * sprites, larger ones as paths. Zero disables the sprites.
+ */
+// ----------------------------------------------------------------------
+
+void do_arrowsprites(Globals &theGlobals, istream &theInput)
+{
+  theInput >> theGlobals.arrowspritesize;
+
+  check_errors(theInput, "arrowsprites");
+
+  if (theGlobals.arrowspritesize < 0) throw runtime_error("arrowsprites size must be nonnegative");
+
+  theGlobals.arrowatlas.clear();
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Handle "windarrowscale" command
  */
 // ----------------------------------------------------------------------
 
-void do_windarrowscale(istream &theInput)
+void do_windarrowscale(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.windarrowscaleA >> globals.windarrowscaleB >> globals.windarrowscaleC;
+  theInput >> theGlobals.windarrowscaleA >> theGlobals.windarrowscaleB >>
+      theGlobals.windarrowscaleC;
 
   check_errors(theInput, "windarrowscale");
 
-  if (globals.windarrowscaleB < 0)
+  if (theGlobals.windarrowscaleB < 0)
     throw runtime_error("Second parameter of windarrowscale must be nonnegative");
 }
 
@@ -939,7 +1264,7 @@ void do_windarrowscale(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_arrowfill(istream &theInput)
+void do_arrowfill(Globals &theGlobals, istream &theInput)
 {
   string token1, token2;
 
@@ -951,9 +1276,9 @@ void do_arrowfill(istream &theInput)
     ColorTools::checkcolor(token1);
     ColorTools::checkrule(token2);
 
-    globals.arrowfillcolor = token1;
-    globals.arrowfillrule = token2;
-    globals.arrowfillstyles.clear();
+    theGlobals.arrowfillcolor = token1;
+    theGlobals.arrowfillrule = token2;
+    theGlobals.arrowfillstyles.clear();
   }
   catch (...)
   {
@@ -967,7 +1292,7 @@ void do_arrowfill(istream &theInput)
     style.color = ColorTools::parsecolor(scolor);
     style.rule = ColorTools::checkrule(srule);
 
-    globals.arrowfillstyles.push_back(style);
+    theGlobals.arrowfillstyles.push_back(style);
   }
 }
 
@@ -977,7 +1302,7 @@ void do_arrowfill(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_arrowstroke(istream &theInput)
+void do_arrowstroke(Globals &theGlobals, istream &theInput)
 {
   string token1, token2;
 
@@ -989,9 +1314,9 @@ void do_arrowstroke(istream &theInput)
     ColorTools::checkcolor(token1);
     ColorTools::checkrule(token2);
 
-    globals.arrowstrokecolor = token1;
-    globals.arrowstrokerule = token2;
-    globals.arrowstrokestyles.clear();
+    theGlobals.arrowstrokecolor = token1;
+    theGlobals.arrowstrokerule = token2;
+    theGlobals.arrowstrokestyles.clear();
   }
   catch (...)
   {
@@ -1005,7 +1330,7 @@ void do_arrowstroke(istream &theInput)
     style.color = ColorTools::parsecolor(scolor);
     style.rule = ColorTools::checkrule(srule);
 
-    globals.arrowstrokestyles.push_back(style);
+    theGlobals.arrowstrokestyles.push_back(style);
   }
 }
 
@@ -1015,16 +1340,16 @@ void do_arrowstroke(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_arrowpath(istream &theInput)
+void do_arrowpath(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.arrowfile;
+  theInput >> theGlobals.arrowfile;
 
   check_errors(theInput, "arrowpath");
 
-  if (globals.arrowfile != "meteorological" && globals.arrowfile != "roundarrow" &&
-      !NFmiFileSystem::FileExists(globals.arrowfile))
+  if (theGlobals.arrowfile != "meteorological" && theGlobals.arrowfile != "roundarrow" &&
+      !NFmiFileSystem::FileExists(theGlobals.arrowfile))
   {
-    throw runtime_error("The arrowpath file '" + globals.arrowfile + "' does not exist");
+    throw runtime_error("The arrowpath file '" + theGlobals.arrowfile + "' does not exist");
   }
 }
 
@@ -1036,13 +1361,13 @@ void do_arrowpath(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_graticule(istream &theInput)
+void do_graticule(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.graticulelon1 >> globals.graticulelon2 >> globals.graticuledx >>
-      globals.graticulelat1 >> globals.graticulelat2 >> globals.graticuledy >>
-      globals.graticulecolor;
+  theInput >> theGlobals.graticulelon1 >> theGlobals.graticulelon2 >> theGlobals.graticuledx >>
+      theGlobals.graticulelat1 >> theGlobals.graticulelat2 >> theGlobals.graticuledy >>
+      theGlobals.graticulecolor;
   check_errors(theInput, "graticule");
-  ColorTools::checkcolor(globals.graticulecolor);
+  ColorTools::checkcolor(theGlobals.graticulecolor);
 }
 
 // ----------------------------------------------------------------------
@@ -1051,7 +1376,7 @@ void do_graticule(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_roundarrowfill(istream &theInput)
+void do_roundarrowfill(Globals &theGlobals, istream &theInput)
 {
   string slo, shi, scircle, striangle;
   theInput >> slo >> shi >> scircle >> striangle;
@@ -1064,7 +1389,7 @@ void do_roundarrowfill(istream &theInput)
   color.circlecolor = ColorTools::checkcolor(scircle);
   color.trianglecolor = ColorTools::checkcolor(striangle);
 
-  globals.roundarrowfillcolors.push_back(color);
+  theGlobals.roundarrowfillcolors.push_back(color);
 }
 
 // ----------------------------------------------------------------------
@@ -1073,7 +1398,7 @@ void do_roundarrowfill(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_roundarrowstroke(istream &theInput)
+void do_roundarrowstroke(Globals &theGlobals, istream &theInput)
 {
   string slo, shi, scircle, striangle;
   theInput >> slo >> shi >> scircle >> striangle;
@@ -1086,7 +1411,7 @@ void do_roundarrowstroke(istream &theInput)
   color.circlecolor = ColorTools::checkcolor(scircle);
   color.trianglecolor = ColorTools::checkcolor(striangle);
 
-  globals.roundarrowstrokecolors.push_back(color);
+  theGlobals.roundarrowstrokecolors.push_back(color);
 }
 
 // ----------------------------------------------------------------------
@@ -1095,7 +1420,7 @@ void do_roundarrowstroke(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_roundarrowsize(istream &theInput)
+void do_roundarrowsize(Globals &theGlobals, istream &theInput)
 {
   RoundArrowSize sz;
 
@@ -1108,7 +1433,7 @@ void do_roundarrowsize(istream &theInput)
   sz.lolimit = (slo == "-" ? kFloatMissing : boost::lexical_cast<float>(slo));
   sz.hilimit = (shi == "-" ? kFloatMissing : boost::lexical_cast<float>(shi));
 
-  globals.roundarrowsizes.push_back(sz);
+  theGlobals.roundarrowsizes.push_back(sz);
 }
 
 // ----------------------------------------------------------------------
@@ -1117,14 +1442,14 @@ void do_roundarrowsize(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_windarrow(istream &theInput)
+void do_windarrow(Globals &theGlobals, istream &theInput)
 {
   double lon, lat;
   theInput >> lon >> lat;
 
   check_errors(theInput, "windarrow");
 
-  globals.arrowpoints.push_back(NFmiPoint(lon, lat));
+  theGlobals.arrowpoints.push_back(NFmiPoint(lon, lat));
 }
 
 // ----------------------------------------------------------------------
@@ -1133,13 +1458,13 @@ void do_windarrow(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_windarrows(istream &theInput)
+void do_windarrows(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.windarrowdx >> globals.windarrowdy;
+  theInput >> theGlobals.windarrowdx >> theGlobals.windarrowdy;
 
   check_errors(theInput, "windarrows");
 
-  if (globals.windarrowdx < 0 || globals.windarrowdy < 0)
+  if (theGlobals.windarrowdx < 0 || theGlobals.windarrowdy < 0)
     throw runtime_error("windarrows parameters must be nonnegative");
 }
 
@@ -1149,10 +1474,10 @@ void do_windarrows(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_windarrowsxy(istream &theInput)
+void do_windarrowsxy(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.windarrowsxyx0 >> globals.windarrowsxyy0 >> globals.windarrowsxydx >>
-      globals.windarrowsxydy;
+  theInput >> theGlobals.windarrowsxyx0 >> theGlobals.windarrowsxyy0 >> theGlobals.windarrowsxydx >>
+      theGlobals.windarrowsxydy;
 
   check_errors(theInput, "windarrowsxy");
 }
@@ -1163,18 +1488,18 @@ void do_windarrowsxy(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_background(istream &theInput)
+void do_background(Globals &theGlobals, istream &theInput)
 {
   using NFmiFileSystem::FileComplete;
 
-  theInput >> globals.background;
+  theInput >> theGlobals.background;
 
   check_errors(theInput, "background");
 
-  if (globals.background == "none")
-    globals.background = "";
+  if (theGlobals.background == "none")
+    theGlobals.background = "";
   else
-    globals.background = FileComplete(globals.background, globals.mapspath);
+    theGlobals.background = FileComplete(theGlobals.background, theGlobals.mapspath);
 }
 
 // ----------------------------------------------------------------------
@@ -1183,18 +1508,18 @@ void do_background(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_foreground(istream &theInput)
+void do_foreground(Globals &theGlobals, istream &theInput)
 {
   using NFmiFileSystem::FileComplete;
 
-  theInput >> globals.foreground;
+  theInput >> theGlobals.foreground;
 
   check_errors(theInput, "foreground");
 
-  if (globals.foreground == "none")
-    globals.foreground = "";
+  if (theGlobals.foreground == "none")
+    theGlobals.foreground = "";
   else
-    globals.foreground = FileComplete(globals.foreground, globals.mapspath);
+    theGlobals.foreground = FileComplete(theGlobals.foreground, theGlobals.mapspath);
 }
 
 // ----------------------------------------------------------------------
@@ -1203,18 +1528,20 @@ void do_foreground(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_mask(istream &theInput)
+void do_mask(Globals &theGlobals, istream &theInput)
 {
   using NFmiFileSystem::FileComplete;
 
-  theInput >> globals.mask;
+  theInput >> theGlobals.mask;
 
   check_errors(theInput, "mask");
 
-  if (globals.mask == "none")
-    globals.mask = "";
+  if (theGlobals.mask == "none")
+    theGlobals.mask = "";
   else
-    globals.mask = FileComplete(globals.mask, globals.mapspath);
+    theGlobals.mask = FileComplete(theGlobals.mask, theGlobals.mapspath);
+
+  theGlobals.maskbitmap.clear();
 }
 
 // ----------------------------------------------------------------------
@@ -1223,7 +1550,7 @@ void do_mask(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_overlay(istream &theInput)
+void do_overlay(Globals &theGlobals, istream &theInput)
 {
   string paramname, imgname;
 
@@ -1233,7 +1560,7 @@ void do_overlay(istream &theInput)
 
   check_errors(theInput, "overlay");
 
-  BOOST_FOREACH (ContourSpec &spec, globals.specs)
+  BOOST_FOREACH (ContourSpec &spec, theGlobals.specs)
   {
     if (spec.param() == paramname)
     {
@@ -1249,27 +1576,27 @@ void do_overlay(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_combine(istream &theInput)
+void do_combine(Globals &theGlobals, istream &theInput)
 {
   using NFmiFileSystem::FileComplete;
 
-  theInput >> globals.combine;
+  theInput >> theGlobals.combine;
 
   check_errors(theInput, "combine");
 
-  if (globals.combine == "none")
-    globals.combine = "";
+  if (theGlobals.combine == "none")
+    theGlobals.combine = "";
   else
   {
-    theInput >> globals.combinex >> globals.combiney >> globals.combinerule >>
-        globals.combinefactor;
+    theInput >> theGlobals.combinex >> theGlobals.combiney >> theGlobals.combinerule >>
+        theGlobals.combinefactor;
 
-    ColorTools::checkrule(globals.combinerule);
+    ColorTools::checkrule(theGlobals.combinerule);
 
-    if (globals.combinefactor < 0 || globals.combinefactor > 1)
+    if (theGlobals.combinefactor < 0 || theGlobals.combinefactor > 1)
       throw runtime_error("combine blending factor must be in range 0-1");
 
-    globals.combine = FileComplete(globals.combine, globals.mapspath);
+    theGlobals.combine = FileComplete(theGlobals.combine, theGlobals.mapspath);
   }
 }
 
@@ -1279,13 +1606,13 @@ void do_combine(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_foregroundrule(istream &theInput)
+void do_foregroundrule(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.foregroundrule;
+  theInput >> theGlobals.foregroundrule;
 
   check_errors(theInput, "foregroundrule");
 
-  ColorTools::checkrule(globals.foregroundrule);
+  ColorTools::checkrule(theGlobals.foregroundrule);
 }
 
 // ----------------------------------------------------------------------
@@ -1294,14 +1621,14 @@ void do_foregroundrule(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_savepath(istream &theInput)
+void do_savepath(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.savepath;
+  theInput >> theGlobals.savepath;
 
   check_errors(theInput, "savepath");
 
-  if (!NFmiFileSystem::DirectoryExists(globals.savepath))
-    NFmiFileSystem::CreateDirectory(globals.savepath);
+  if (!NFmiFileSystem::DirectoryExists(theGlobals.savepath))
+    NFmiFileSystem::CreateDirectory(theGlobals.savepath);
 }
 
 // ----------------------------------------------------------------------
@@ -1310,9 +1637,9 @@ void do_savepath(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_prefix(istream &theInput)
+void do_prefix(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.prefix;
+  theInput >> theGlobals.prefix;
 
   check_errors(theInput, "prefix");
 }
@@ -1323,9 +1650,9 @@ void do_prefix(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_suffix(istream &theInput)
+void do_suffix(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.suffix;
+  theInput >> theGlobals.suffix;
 
   check_errors(theInput, "suffix");
 }
@@ -1336,18 +1663,18 @@ void do_suffix(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_format(istream &theInput)
+void do_format(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.format;
+  theInput >> theGlobals.format;
 
   check_errors(theInput, "format");
 
-  if (globals.format != "png" && globals.format != "pdf" &&  // AKa 15-Aug-2008
-      globals.format != "jpg" &&
-      globals.format != "jpeg" && globals.format != "pnm" && globals.format != "pgm" &&
-      globals.format != "wbmp" && globals.format != "gif")
+  if (theGlobals.format != "png" && theGlobals.format != "pdf" &&  // AKa 15-Aug-2008
+      theGlobals.format != "jpg" &&
+      theGlobals.format != "jpeg" && theGlobals.format != "pnm" && theGlobals.format != "pgm" &&
+      theGlobals.format != "wbmp" && theGlobals.format != "gif")
   {
-    throw runtime_error("Image format +'" + globals.format + "' is not supported");
+    throw runtime_error("Image format +'" + theGlobals.format + "' is not supported");
   }
 }
 
@@ -1355,8 +1682,8 @@ void do_format(istream &theInput)
 * Handle "antialias" and other Cairo-specific commands
 */
 #if 0  // def IMAGINE_WITH_CAIRO
-  void do_antialias( istream &in ) {
-    in >> globals.antialias;
+  void do_antialias( Globals &theGlobals, istream &in ) {
+    in >> theGlobals.antialias;
     check_errors(in,"antialias");
   }
 #endif
@@ -1367,9 +1694,9 @@ void do_format(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_gamma(istream &theInput)
+void do_gamma(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.gamma;
+  theInput >> theGlobals.gamma;
 
   check_errors(theInput, "gamma");
 }
@@ -1380,9 +1707,9 @@ void do_gamma(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_intent(istream &theInput)
+void do_intent(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.intent;
+  theInput >> theGlobals.intent;
 
   check_errors(theInput, "intent");
 }
@@ -1393,22 +1720,61 @@ void do_intent(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_pngquality(istream &theInput)
+void do_pngquality(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.pngquality;
+  theInput >> theGlobals.pngquality;
 
   check_errors(theInput, "pngquality");
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "pngthreads" command
+ *
+ * A positive value enables the parallel PNG encoder with the given
+ * number of compression threads, zero restores the imagine encoder.
+ */
+// ----------------------------------------------------------------------
+
+void do_pngthreads(Globals &theGlobals, istream &theInput)
+{
+  theInput >> theGlobals.pngthreads;
+
+  check_errors(theInput, "pngthreads");
+
+  if (theGlobals.pngthreads < 0) throw runtime_error("pngthreads must be nonnegative");
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "exactpalette" command
+ *
+ * When set, PNG images are written with a palette starting with the
+ * colours of the contour specifications, instead of quantizing the
+ * colours. Images with more than 256 colours have the extra colours
+ * mapped to the nearest palette entry.
+ */
+// ----------------------------------------------------------------------
+
+void do_exactpalette(Globals &theGlobals, istream &theInput)
+{
+  int flag;
+  theInput >> flag;
+
+  check_errors(theInput, "exactpalette");
+
+  theGlobals.exactpalette = (flag != 0);
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Handle "jpegquality" command
  */
 // ----------------------------------------------------------------------
 
-void do_jpegquality(istream &theInput)
+void do_jpegquality(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.jpegquality;
+  theInput >> theGlobals.jpegquality;
 
   check_errors(theInput, "jpegquality");
 }
@@ -1419,9 +1785,9 @@ void do_jpegquality(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_savealpha(istream &theInput)
+void do_savealpha(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.savealpha;
+  theInput >> theGlobals.savealpha;
 
   check_errors(theInput, "savealpha");
 }
@@ -1432,9 +1798,9 @@ void do_savealpha(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_reducecolors(istream &theInput)
+void do_reducecolors(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.reducecolors;
+  theInput >> theGlobals.reducecolors;
 
   check_errors(theInput, "reducecolors");
 }
@@ -1445,9 +1811,9 @@ void do_reducecolors(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_wantpalette(istream &theInput)
+void do_wantpalette(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.wantpalette;
+  theInput >> theGlobals.wantpalette;
 
   check_errors(theInput, "wantpalette");
 }
@@ -1458,9 +1824,9 @@ void do_wantpalette(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_forcepalette(istream &theInput)
+void do_forcepalette(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.forcepalette;
+  theInput >> theGlobals.forcepalette;
 
   check_errors(theInput, "forcepalette");
 }
@@ -1471,9 +1837,9 @@ void do_forcepalette(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_alphalimit(istream &theInput)
+void do_alphalimit(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.alphalimit;
+  theInput >> theGlobals.alphalimit;
 
   check_errors(theInput, "alphalimit");
 }
@@ -1484,14 +1850,14 @@ void do_alphalimit(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_hilimit(istream &theInput)
+void do_hilimit(Globals &theGlobals, istream &theInput)
 {
   float limit;
   theInput >> limit;
 
   check_errors(theInput, "hilimit");
 
-  if (!globals.specs.empty()) globals.specs.back().exactHiLimit(limit);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().exactHiLimit(limit);
 }
 
 // ----------------------------------------------------------------------
@@ -1500,14 +1866,14 @@ void do_hilimit(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_datalolimit(istream &theInput)
+void do_datalolimit(Globals &theGlobals, istream &theInput)
 {
   float limit;
   theInput >> limit;
 
   check_errors(theInput, "datalolimit");
 
-  if (!globals.specs.empty()) globals.specs.back().dataLoLimit(limit);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().dataLoLimit(limit);
 }
 
 // ----------------------------------------------------------------------
@@ -1516,14 +1882,14 @@ void do_datalolimit(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_datahilimit(istream &theInput)
+void do_datahilimit(Globals &theGlobals, istream &theInput)
 {
   float limit;
   theInput >> limit;
 
   check_errors(theInput, "datahilimit");
 
-  if (!globals.specs.empty()) globals.specs.back().dataHiLimit(limit);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().dataHiLimit(limit);
 }
 
 // ----------------------------------------------------------------------
@@ -1532,14 +1898,14 @@ void do_datahilimit(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_datareplace(istream &theInput)
+void do_datareplace(Globals &theGlobals, istream &theInput)
 {
   float src, dst;
   theInput >> src >> dst;
 
   check_errors(theInput, "datareplace");
 
-  if (!globals.specs.empty()) globals.specs.back().replace(src, dst);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().replace(src, dst);
 }
 
 // ----------------------------------------------------------------------
@@ -1550,7 +1916,7 @@ void do_datareplace(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_despeckle(istream &theInput)
+void do_despeckle(Globals &theGlobals, istream &theInput)
 {
   string slo, shi;
   int radius, iterations;
@@ -1574,7 +1940,8 @@ void do_despeckle(istream &theInput)
   if (weight < 0 || weight > 100)
     throw runtime_error("despeckle weight must be in the range 0-100");
 
-  if (!globals.specs.empty()) globals.specs.back().despeckle(lo, hi, radius, weight, iterations);
+  if (!theGlobals.specs.empty())
+    theGlobals.specs.back().despeckle(lo, hi, radius, weight, iterations);
 }
 
 // ----------------------------------------------------------------------
@@ -1583,9 +1950,9 @@ void do_despeckle(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_expanddata(istream &theInput)
+void do_expanddata(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.expanddata;
+  theInput >> theGlobals.expanddata;
   check_errors(theInput, "expanddata");
 }
 
@@ -1595,7 +1962,7 @@ void do_expanddata(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourdepth(istream &theInput)
+void do_contourdepth(Globals &theGlobals, istream &theInput)
 {
   cerr << "Warning: contourdepth command is deprecated" << endl;
 }
@@ -1606,14 +1973,14 @@ void do_contourdepth(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourinterpolation(istream &theInput)
+void do_contourinterpolation(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.contourinterpolation;
+  theInput >> theGlobals.contourinterpolation;
 
   check_errors(theInput, "contourinterpolation");
 
-  if (!globals.specs.empty())
-    globals.specs.back().contourInterpolation(globals.contourinterpolation);
+  if (!theGlobals.specs.empty())
+    theGlobals.specs.back().contourInterpolation(theGlobals.contourinterpolation);
 }
 
 // ----------------------------------------------------------------------
@@ -1622,9 +1989,9 @@ void do_contourinterpolation(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourtriangles(istream &theInput)
+void do_contourtriangles(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.contourtriangles;
+  theInput >> theGlobals.contourtriangles;
 
   check_errors(theInput, "contourtriangles");
 }
@@ -1635,13 +2002,13 @@ void do_contourtriangles(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_smoother(istream &theInput)
+void do_smoother(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.smoother;
+  theInput >> theGlobals.smoother;
 
   check_errors(theInput, "smoother");
 
-  if (!globals.specs.empty()) globals.specs.back().smoother(globals.smoother);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().smoother(theGlobals.smoother);
 }
 
 // ----------------------------------------------------------------------
@@ -1650,13 +2017,13 @@ void do_smoother(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_smootherradius(istream &theInput)
+void do_smootherradius(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.smootherradius;
+  theInput >> theGlobals.smootherradius;
 
   check_errors(theInput, "smootherradius");
 
-  if (!globals.specs.empty()) globals.specs.back().smootherRadius(globals.smootherradius);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().smootherRadius(theGlobals.smootherradius);
 }
 
 // ----------------------------------------------------------------------
@@ -1665,13 +2032,13 @@ void do_smootherradius(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_smootherfactor(istream &theInput)
+void do_smootherfactor(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.smootherfactor;
+  theInput >> theGlobals.smootherfactor;
 
   check_errors(theInput, "smootherfactor");
 
-  if (!globals.specs.empty()) globals.specs.back().smootherFactor(globals.smootherfactor);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().smootherFactor(theGlobals.smootherfactor);
 }
 
 // ----------------------------------------------------------------------
@@ -1680,7 +2047,7 @@ void do_smootherfactor(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_param(istream &theInput)
+void do_param(Globals &theGlobals, istream &theInput)
 {
   string param;
 
@@ -1689,13 +2056,13 @@ void do_param(istream &theInput)
   check_errors(theInput, "param");
 
   ContourSpec spec(param,
-                   globals.contourinterpolation,
-                   globals.smoother,
-                   globals.querydatalevel,
-                   globals.smootherradius,
-                   globals.smootherfactor);
+                   theGlobals.contourinterpolation,
+                   theGlobals.smoother,
+                   theGlobals.querydatalevel,
+                   theGlobals.smootherradius,
+                   theGlobals.smootherfactor);
 
-  globals.specs.push_back(spec);
+  theGlobals.specs.push_back(spec);
 }
 
 // ----------------------------------------------------------------------
@@ -1704,7 +2071,7 @@ void do_param(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_shape(istream &theInput)
+void do_shape(Globals &theGlobals, istream &theInput)
 {
   string shapename, arg1;
 
@@ -1721,7 +2088,7 @@ void do_shape(istream &theInput)
     ColorTools::checkrule(markerrule);
     ShapeSpec spec(shapename);
     spec.marker(marker, markerrule, markeralpha);
-    globals.shapespecs.push_back(spec);
+    theGlobals.shapespecs.push_back(spec);
   }
   else
   {
@@ -1731,8 +2098,8 @@ void do_shape(istream &theInput)
     NFmiColorTools::Color fill = ColorTools::checkcolor(fillcolor);
     NFmiColorTools::Color stroke = ColorTools::checkcolor(strokecolor);
 
-    globals.shapespecs.push_back(
-        ShapeSpec(shapename, fill, stroke, globals.fillrule, globals.strokerule));
+    theGlobals.shapespecs.push_back(
+        ShapeSpec(shapename, fill, stroke, theGlobals.fillrule, theGlobals.strokerule));
   }
 
   check_errors(theInput, "shape");
@@ -1744,7 +2111,7 @@ void do_shape(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourfill(istream &theInput)
+void do_contourfill(Globals &theGlobals, istream &theInput)
 {
   string slo, shi, scolor;
   theInput >> slo >> shi >> scolor;
@@ -1763,8 +2130,8 @@ void do_contourfill(istream &theInput)
 
   NFmiColorTools::Color color = ColorTools::checkcolor(scolor);
 
-  if (!globals.specs.empty())
-    globals.specs.back().add(ContourRange(lo, hi, color, globals.fillrule));
+  if (!theGlobals.specs.empty())
+    theGlobals.specs.back().add(ContourRange(lo, hi, color, theGlobals.fillrule));
 }
 
 // ----------------------------------------------------------------------
@@ -1773,7 +2140,7 @@ void do_contourfill(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourpattern(istream &theInput)
+void do_contourpattern(Globals &theGlobals, istream &theInput)
 {
   string slo, shi, spattern, srule;
   float alpha;
@@ -1791,8 +2158,8 @@ void do_contourpattern(istream &theInput)
   else
     hi = NFmiStringTools::Convert<float>(shi);
 
-  if (!globals.specs.empty())
-    globals.specs.back().add(ContourPattern(lo, hi, spattern, srule, alpha));
+  if (!theGlobals.specs.empty())
+    theGlobals.specs.back().add(ContourPattern(lo, hi, spattern, srule, alpha));
 }
 
 // ----------------------------------------------------------------------
@@ -1801,7 +2168,7 @@ void do_contourpattern(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contoursymbol(istream &theInput)
+void do_contoursymbol(Globals &theGlobals, istream &theInput)
 {
   string slo, shi, spattern, srule;
   float alpha;
@@ -1819,8 +2186,8 @@ void do_contoursymbol(istream &theInput)
   else
     hi = NFmiStringTools::Convert<float>(shi);
 
-  if (!globals.specs.empty())
-    globals.specs.back().add(ContourSymbol(lo, hi, spattern, srule, alpha));
+  if (!theGlobals.specs.empty())
+    theGlobals.specs.back().add(ContourSymbol(lo, hi, spattern, srule, alpha));
 }
 
 // ----------------------------------------------------------------------
@@ -1829,7 +2196,7 @@ void do_contoursymbol(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourfont(istream &theInput)
+void do_contourfont(Globals &theGlobals, istream &theInput)
 {
   float value;
   int symbol;
@@ -1840,7 +2207,8 @@ void do_contourfont(istream &theInput)
 
   NFmiColorTools::Color color = ColorTools::checkcolor(scolor);
 
-  if (!globals.specs.empty()) globals.specs.back().add(ContourFont(value, color, symbol, font));
+  if (!theGlobals.specs.empty())
+    theGlobals.specs.back().add(ContourFont(value, color, symbol, font));
 }
 
 // ----------------------------------------------------------------------
@@ -1849,7 +2217,7 @@ void do_contourfont(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourline(istream &theInput)
+void do_contourline(Globals &theGlobals, istream &theInput)
 {
   string svalue, scolor;
   theInput >> svalue >> scolor;
@@ -1863,9 +2231,9 @@ void do_contourline(istream &theInput)
     value = NFmiStringTools::Convert<float>(svalue);
 
   NFmiColorTools::Color color = ColorTools::checkcolor(scolor);
-  if (!globals.specs.empty())
-    globals.specs.back().add(
-        ContourValue(value, globals.contourlinewidth, color, globals.strokerule));
+  if (!theGlobals.specs.empty())
+    theGlobals.specs.back().add(
+        ContourValue(value, theGlobals.contourlinewidth, color, theGlobals.strokerule));
 }
 
 // ----------------------------------------------------------------------
@@ -1874,58 +2242,161 @@ void do_contourline(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlinewidth(istream &theInput)
+void do_contourlinewidth(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.contourlinewidth;
+  theInput >> theGlobals.contourlinewidth;
 
   check_errors(theInput, "contourlinewidth");
 
-  if (globals.contourlinewidth <= 0) throw runtime_error("conturlinewidth must be nonnegative");
+  if (theGlobals.contourlinewidth <= 0) throw runtime_error("conturlinewidth must be nonnegative");
 }
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Handle "contourfills" command
+ * \brief Handle "contourfillsimplify" command
+ *
+ * The tolerance and the minimum area are given in pixels. Each ring
+ * of the projected fills is simplified separately with the
+ * Douglas-Peucker algorithm, which has two caveats:
+ *
+ *  - a simplified ring may intersect itself or a neighbouring ring
+ *    if the tolerance is large compared to the details of the data
+ *  - the minimum area is applied to each ring separately, hence a
+ *    small hole may be dropped while its outer ring is kept, filling
+ *    the hole
+ *
+ * Both effects are at most a few pixels in size when the tolerance
+ * and the area are kept at around a pixel, which is the intended use.
  */
 // ----------------------------------------------------------------------
 
-void do_contourfills(istream &theInput)
+void do_contourfillsimplify(Globals &theGlobals, istream &theInput)
 {
-  float lo, hi, step;
-  string scolor1, scolor2;
-  theInput >> lo >> hi >> step >> scolor1 >> scolor2;
+  theInput >> theGlobals.contourfillsimplifytolerance >> theGlobals.contourfillsimplifyarea;
 
-  check_errors(theInput, "contourfills");
+  check_errors(theInput, "contourfillsimplify");
 
-  int color1 = ColorTools::checkcolor(scolor1);
-  int color2 = ColorTools::checkcolor(scolor2);
+  if (theGlobals.contourfillsimplifytolerance < 0)
+    throw runtime_error("contourfillsimplify tolerance must be nonnegative");
+  if (theGlobals.contourfillsimplifyarea < 0)
+    throw runtime_error("contourfillsimplify area must be nonnegative");
+}
 
-  int steps = static_cast<int>((hi - lo) / step);
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "contourrasterizer" command
+ */
+// ----------------------------------------------------------------------
 
-  for (int i = 0; i < steps; i++)
-  {
-    float tmplo = lo + i * step;
-    float tmphi = lo + (i + 1) * step;
-    int color = color1;  // in case steps=1
-    if (steps != 1) color = NFmiColorTools::Interpolate(color1, color2, i / (steps - 1.0f));
-    if (!globals.specs.empty())
-      globals.specs.back().add(ContourRange(tmplo, tmphi, color, globals.fillrule));
-  }
+void do_contourrasterizer(Globals &theGlobals, istream &theInput)
+{
+  theInput >> theGlobals.contourrasterizer;
+
+  check_errors(theInput, "contourrasterizer");
+
+  if (theGlobals.contourrasterizer != "imagine" && theGlobals.contourrasterizer != "scanline")
+    throw runtime_error("Unknown contourrasterizer '" + theGlobals.contourrasterizer + "'");
 }
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Handle "contourlines" command
+ * \brief Handle "contourfillmode" command
  */
 // ----------------------------------------------------------------------
 
-void do_contourlines(istream &theInput)
+void do_contourfillmode(Globals &theGlobals, istream &theInput)
 {
-  float lo, hi, step;
-  string scolor1, scolor2;
-  theInput >> lo >> hi >> step >> scolor1 >> scolor2;
+  theInput >> theGlobals.contourfillmode;
 
-  check_errors(theInput, "contourlines");
+  check_errors(theInput, "contourfillmode");
+
+  if (theGlobals.contourfillmode != "polygon" && theGlobals.contourfillmode != "raster")
+    throw runtime_error("Unknown contourfillmode '" + theGlobals.contourfillmode + "'");
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "threads" command
+ *
+ * Zero means using all available hardware threads.
+ */
+// ----------------------------------------------------------------------
+
+void do_threads(Globals &theGlobals, istream &theInput)
+{
+  int threads;
+  theInput >> threads;
+
+  check_errors(theInput, "threads");
+
+  if (threads < 0) throw runtime_error("threads must be nonnegative");
+
+  theGlobals.threads = ThreadTools::concurrency(threads);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "writethreads" command
+ *
+ * Zero means writing the images synchronously.
+ */
+// ----------------------------------------------------------------------
+
+void do_writethreads(Globals &theGlobals, istream &theInput)
+{
+  int threads;
+  theInput >> threads;
+
+  check_errors(theInput, "writethreads");
+
+  if (threads < 0) throw runtime_error("writethreads must be nonnegative");
+
+  theGlobals.imagewriter.threads(threads);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "contourfills" command
+ */
+// ----------------------------------------------------------------------
+
+void do_contourfills(Globals &theGlobals, istream &theInput)
+{
+  float lo, hi, step;
+  string scolor1, scolor2;
+  theInput >> lo >> hi >> step >> scolor1 >> scolor2;
+
+  check_errors(theInput, "contourfills");
+
+  int color1 = ColorTools::checkcolor(scolor1);
+  int color2 = ColorTools::checkcolor(scolor2);
+
+  int steps = static_cast<int>((hi - lo) / step);
+
+  for (int i = 0; i < steps; i++)
+  {
+    float tmplo = lo + i * step;
+    float tmphi = lo + (i + 1) * step;
+    int color = color1;  // in case steps=1
+    if (steps != 1) color = NFmiColorTools::Interpolate(color1, color2, i / (steps - 1.0f));
+    if (!theGlobals.specs.empty())
+      theGlobals.specs.back().add(ContourRange(tmplo, tmphi, color, theGlobals.fillrule));
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "contourlines" command
+ */
+// ----------------------------------------------------------------------
+
+void do_contourlines(Globals &theGlobals, istream &theInput)
+{
+  float lo, hi, step;
+  string scolor1, scolor2;
+  theInput >> lo >> hi >> step >> scolor1 >> scolor2;
+
+  check_errors(theInput, "contourlines");
 
   int color1 = ColorTools::checkcolor(scolor1);
   int color2 = ColorTools::checkcolor(scolor2);
@@ -1938,9 +2409,9 @@ void do_contourlines(istream &theInput)
     int color = color1;  // in case steps=1
     if (steps != 0)
       color = NFmiColorTools::Interpolate(color1, color2, i / static_cast<float>(steps));
-    if (!globals.specs.empty())
-      globals.specs.back().add(
-          ContourValue(tmplo, globals.contourlinewidth, color, globals.strokerule));
+    if (!theGlobals.specs.empty())
+      theGlobals.specs.back().add(
+          ContourValue(tmplo, theGlobals.contourlinewidth, color, theGlobals.strokerule));
   }
 }
 
@@ -1950,16 +2421,16 @@ void do_contourlines(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabel(istream &theInput)
+void do_contourlabel(Globals &theGlobals, istream &theInput)
 {
   float value;
   theInput >> value;
 
   check_errors(theInput, "contourlabel");
 
-  if (globals.specs.empty()) throw runtime_error("Must define parameter before contourlabel");
+  if (theGlobals.specs.empty()) throw runtime_error("Must define parameter before contourlabel");
 
-  globals.specs.back().add(ContourLabel(value));
+  theGlobals.specs.back().add(ContourLabel(value));
 }
 
 // ----------------------------------------------------------------------
@@ -1968,21 +2439,21 @@ void do_contourlabel(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabels(istream &theInput)
+void do_contourlabels(Globals &theGlobals, istream &theInput)
 {
   float lo, hi, step;
   theInput >> lo >> hi >> step;
 
   check_errors(theInput, "contourlabels");
 
-  if (globals.specs.empty()) throw runtime_error("Must define parameter before contourlabels");
+  if (theGlobals.specs.empty()) throw runtime_error("Must define parameter before contourlabels");
 
   int steps = static_cast<int>((hi - lo) / step);
 
   for (int i = 0; i <= steps; i++)
   {
     float tmplo = lo + i * step;
-    globals.specs.back().add(ContourLabel(tmplo));
+    theGlobals.specs.back().add(ContourLabel(tmplo));
   }
 }
 
@@ -1992,14 +2463,15 @@ void do_contourlabels(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabeltext(istream &theInput)
+void do_contourlabeltext(Globals &theGlobals, istream &theInput)
 {
   string value, text;
   theInput >> value >> text;
   check_errors(theInput, "contourlabeltext");
-  if (globals.specs.empty()) throw runtime_error("Must define parameter before contourlabeltext");
+  if (theGlobals.specs.empty())
+    throw runtime_error("Must define parameter before contourlabeltext");
 
-  globals.specs.back().addContourLabelText(NFmiStringTools::Convert<float>(value), text);
+  theGlobals.specs.back().addContourLabelText(NFmiStringTools::Convert<float>(value), text);
 }
 
 // ----------------------------------------------------------------------
@@ -2008,7 +2480,7 @@ void do_contourlabeltext(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabelfont(istream &theInput)
+void do_contourlabelfont(Globals &theGlobals, istream &theInput)
 {
   string font;
 
@@ -2016,9 +2488,10 @@ void do_contourlabelfont(istream &theInput)
 
   check_errors(theInput, "contourlabelfont");
 
-  if (globals.specs.empty()) throw runtime_error("Must define parameter before contourlabelfont");
+  if (theGlobals.specs.empty())
+    throw runtime_error("Must define parameter before contourlabelfont");
 
-  globals.specs.back().contourLabelFont(font);
+  theGlobals.specs.back().contourLabelFont(font);
 }
 
 // ----------------------------------------------------------------------
@@ -2027,7 +2500,7 @@ void do_contourlabelfont(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabelcolor(istream &theInput)
+void do_contourlabelcolor(Globals &theGlobals, istream &theInput)
 {
   string scolor;
 
@@ -2035,11 +2508,12 @@ void do_contourlabelcolor(istream &theInput)
 
   check_errors(theInput, "contourlabelcolor");
 
-  if (globals.specs.empty()) throw runtime_error("Must define parameter before contourlabelcolor");
+  if (theGlobals.specs.empty())
+    throw runtime_error("Must define parameter before contourlabelcolor");
 
   NFmiColorTools::Color color = ColorTools::checkcolor(scolor);
 
-  globals.specs.back().contourLabelColor(color);
+  theGlobals.specs.back().contourLabelColor(color);
 }
 
 // ----------------------------------------------------------------------
@@ -2048,7 +2522,7 @@ void do_contourlabelcolor(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabelbackground(istream &theInput)
+void do_contourlabelbackground(Globals &theGlobals, istream &theInput)
 {
   string scolor;
 
@@ -2056,12 +2530,12 @@ void do_contourlabelbackground(istream &theInput)
 
   check_errors(theInput, "contourlabelbackground");
 
-  if (globals.specs.empty())
+  if (theGlobals.specs.empty())
     throw runtime_error("Must define parameter before contourlabelbackground");
 
   NFmiColorTools::Color color = ColorTools::checkcolor(scolor);
 
-  globals.specs.back().contourLabelBackgroundColor(color);
+  theGlobals.specs.back().contourLabelBackgroundColor(color);
 }
 
 // ----------------------------------------------------------------------
@@ -2070,7 +2544,7 @@ void do_contourlabelbackground(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabelmargin(istream &theInput)
+void do_contourlabelmargin(Globals &theGlobals, istream &theInput)
 {
   int dx, dy;
 
@@ -2078,10 +2552,11 @@ void do_contourlabelmargin(istream &theInput)
 
   check_errors(theInput, "contourlabelmargin");
 
-  if (globals.specs.empty()) throw runtime_error("Must define parameter before contourlabelmargin");
+  if (theGlobals.specs.empty())
+    throw runtime_error("Must define parameter before contourlabelmargin");
 
-  globals.specs.back().contourLabelBackgroundXMargin(dx);
-  globals.specs.back().contourLabelBackgroundYMargin(dy);
+  theGlobals.specs.back().contourLabelBackgroundXMargin(dx);
+  theGlobals.specs.back().contourLabelBackgroundYMargin(dy);
 }
 
 // ----------------------------------------------------------------------
@@ -2090,9 +2565,9 @@ void do_contourlabelmargin(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabelimagemargin(istream &theInput)
+void do_contourlabelimagemargin(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.contourlabelimagexmargin >> globals.contourlabelimageymargin;
+  theInput >> theGlobals.contourlabelimagexmargin >> theGlobals.contourlabelimageymargin;
 
   check_errors(theInput, "contourlabelimagemargin");
 }
@@ -2103,14 +2578,14 @@ void do_contourlabelimagemargin(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabelmindistsamevalue(istream &theInput)
+void do_contourlabelmindistsamevalue(Globals &theGlobals, istream &theInput)
 {
   float dist;
   theInput >> dist;
 
   check_errors(theInput, "contourlabelmindistsamevalue");
 
-  globals.labellocator.minDistanceToSameValue(dist);
+  theGlobals.labellocator.minDistanceToSameValue(dist);
 }
 
 // ----------------------------------------------------------------------
@@ -2119,14 +2594,14 @@ void do_contourlabelmindistsamevalue(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabelmindistdifferentvalue(istream &theInput)
+void do_contourlabelmindistdifferentvalue(Globals &theGlobals, istream &theInput)
 {
   float dist;
   theInput >> dist;
 
   check_errors(theInput, "contourlabelmindistdifferentvalue");
 
-  globals.labellocator.minDistanceToDifferentValue(dist);
+  theGlobals.labellocator.minDistanceToDifferentValue(dist);
 }
 
 // ----------------------------------------------------------------------
@@ -2135,7 +2610,7 @@ void do_contourlabelmindistdifferentvalue(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourlabelmindistdifferentparam(istream &theInput)
+void do_contourlabelmindistdifferentparam(Globals &theGlobals, istream &theInput)
 {
   float dist;
 
@@ -2143,7 +2618,7 @@ void do_contourlabelmindistdifferentparam(istream &theInput)
 
   check_errors(theInput, "contourlabelmindistdifferentparam");
 
-  globals.labellocator.minDistanceToDifferentParameter(dist);
+  theGlobals.labellocator.minDistanceToDifferentParameter(dist);
 }
 
 // ----------------------------------------------------------------------
@@ -2152,14 +2627,14 @@ void do_contourlabelmindistdifferentparam(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourfontmindistsamevalue(istream &theInput)
+void do_contourfontmindistsamevalue(Globals &theGlobals, istream &theInput)
 {
   float dist;
   theInput >> dist;
 
   check_errors(theInput, "contourfontmindistsamevalue");
 
-  globals.symbollocator.minDistanceToSameValue(dist);
+  theGlobals.symbollocator.minDistanceToSameValue(dist);
 }
 
 // ----------------------------------------------------------------------
@@ -2168,14 +2643,14 @@ void do_contourfontmindistsamevalue(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourfontmindistdifferentvalue(istream &theInput)
+void do_contourfontmindistdifferentvalue(Globals &theGlobals, istream &theInput)
 {
   float dist;
   theInput >> dist;
 
   check_errors(theInput, "contourfontmindistdifferentvalue");
 
-  globals.symbollocator.minDistanceToDifferentValue(dist);
+  theGlobals.symbollocator.minDistanceToDifferentValue(dist);
 }
 
 // ----------------------------------------------------------------------
@@ -2184,7 +2659,7 @@ void do_contourfontmindistdifferentvalue(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contourfontmindistdifferentparam(istream &theInput)
+void do_contourfontmindistdifferentparam(Globals &theGlobals, istream &theInput)
 {
   float dist;
 
@@ -2192,7 +2667,7 @@ void do_contourfontmindistdifferentparam(istream &theInput)
 
   check_errors(theInput, "contourfontmindistdifferentparam");
 
-  globals.symbollocator.minDistanceToDifferentParameter(dist);
+  theGlobals.symbollocator.minDistanceToDifferentParameter(dist);
 }
 
 // ----------------------------------------------------------------------
@@ -2201,7 +2676,7 @@ void do_contourfontmindistdifferentparam(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_contoursymbolmindist(istream &theInput)
+void do_contoursymbolmindist(Globals &theGlobals, istream &theInput)
 {
   float dist;
 
@@ -2209,9 +2684,9 @@ void do_contoursymbolmindist(istream &theInput)
 
   check_errors(theInput, "contoursymbolmindist");
 
-  globals.imagelocator.minDistanceToDifferentParameter(dist);
-  globals.imagelocator.minDistanceToDifferentValue(dist);
-  globals.imagelocator.minDistanceToSameValue(dist);
+  theGlobals.imagelocator.minDistanceToDifferentParameter(dist);
+  theGlobals.imagelocator.minDistanceToDifferentValue(dist);
+  theGlobals.imagelocator.minDistanceToSameValue(dist);
 }
 
 // ----------------------------------------------------------------------
@@ -2220,9 +2695,10 @@ void do_contoursymbolmindist(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_highpressure(istream &theInput)
+void do_highpressure(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.highpressureimage >> globals.highpressurerule >> globals.highpressurefactor;
+  theInput >> theGlobals.highpressureimage >> theGlobals.highpressurerule >>
+      theGlobals.highpressurefactor;
 
   check_errors(theInput, "highpressure");
 }
@@ -2233,9 +2709,10 @@ void do_highpressure(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_lowpressure(istream &theInput)
+void do_lowpressure(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.lowpressureimage >> globals.lowpressurerule >> globals.lowpressurefactor;
+  theInput >> theGlobals.lowpressureimage >> theGlobals.lowpressurerule >>
+      theGlobals.lowpressurefactor;
 
   check_errors(theInput, "lowpressure");
 }
@@ -2246,9 +2723,9 @@ void do_lowpressure(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_highpressureminimum(istream &theInput)
+void do_highpressureminimum(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.highpressureminimum;
+  theInput >> theGlobals.highpressureminimum;
 
   check_errors(theInput, "highpressureminimum");
 }
@@ -2259,9 +2736,9 @@ void do_highpressureminimum(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_lowpressuremaximum(istream &theInput)
+void do_lowpressuremaximum(Globals &theGlobals, istream &theInput)
 {
-  theInput >> globals.lowpressuremaximum;
+  theInput >> theGlobals.lowpressuremaximum;
 
   check_errors(theInput, "lowpressuremaximum");
 }
@@ -2272,13 +2749,13 @@ void do_lowpressuremaximum(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_pressuremindistsame(istream &theInput)
+void do_pressuremindistsame(Globals &theGlobals, istream &theInput)
 {
   float dist;
   theInput >> dist;
   check_errors(theInput, "mindistsame");
 
-  globals.pressurelocator.minDistanceToSame(dist);
+  theGlobals.pressurelocator.minDistanceToSame(dist);
 }
 
 // ----------------------------------------------------------------------
@@ -2287,13 +2764,49 @@ void do_pressuremindistsame(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_pressuremindistdifferent(istream &theInput)
+void do_pressuremindistdifferent(Globals &theGlobals, istream &theInput)
 {
   float dist;
   theInput >> dist;
   check_errors(theInput, "mindistdifferent");
 
-  globals.pressurelocator.minDistanceToDifferent(dist);
+  theGlobals.pressurelocator.minDistanceToDifferent(dist);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "pressureradius" command
+ *
+ * Zero means a fixed 7 grid cell radius.
+ */
+// ----------------------------------------------------------------------
+
+void do_pressureradius(Globals &theGlobals, istream &theInput)
+{
+  theInput >> theGlobals.pressureradius;
+
+  check_errors(theInput, "pressureradius");
+
+  if (theGlobals.pressureradius < 0) throw runtime_error("pressureradius must be nonnegative");
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "pressureparam" command
+ *
+ * The high and low markers are placed at the extrema of the given
+ * parameter, which is Pressure by default.
+ */
+// ----------------------------------------------------------------------
+
+void do_pressureparam(Globals &theGlobals, istream &theInput)
+{
+  theInput >> theGlobals.pressureparam;
+
+  check_errors(theInput, "pressureparam");
+
+  if (toparam(theGlobals.pressureparam) == kFmiBadParameter)
+    throw runtime_error("Unrecognized pressureparam '" + theGlobals.pressureparam + "'");
 }
 
 // ----------------------------------------------------------------------
@@ -2302,7 +2815,7 @@ void do_pressuremindistdifferent(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelmarker(istream &theInput)
+void do_labelmarker(Globals &theGlobals, istream &theInput)
 {
   string filename, rule;
   float alpha;
@@ -2311,11 +2824,11 @@ void do_labelmarker(istream &theInput)
 
   check_errors(theInput, "labelmarker");
 
-  if (!globals.specs.empty())
+  if (!theGlobals.specs.empty())
   {
-    globals.specs.back().labelMarker(filename);
-    globals.specs.back().labelMarkerRule(rule);
-    globals.specs.back().labelMarkerAlphaFactor(alpha);
+    theGlobals.specs.back().labelMarker(filename);
+    theGlobals.specs.back().labelMarkerRule(rule);
+    theGlobals.specs.back().labelMarkerAlphaFactor(alpha);
   }
 }
 
@@ -2325,14 +2838,14 @@ void do_labelmarker(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelfont(istream &theInput)
+void do_labelfont(Globals &theGlobals, istream &theInput)
 {
   string font;
   theInput >> font;
 
   check_errors(theInput, "labelfont");
 
-  if (!globals.specs.empty()) globals.specs.back().labelFont(font);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().labelFont(font);
 }
 
 // ----------------------------------------------------------------------
@@ -2341,14 +2854,14 @@ void do_labelfont(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelcolor(istream &theInput)
+void do_labelcolor(Globals &theGlobals, istream &theInput)
 {
   string color;
   theInput >> color;
 
   check_errors(theInput, "labelcolor");
 
-  if (!globals.specs.empty()) globals.specs.back().labelColor(ColorTools::checkcolor(color));
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().labelColor(ColorTools::checkcolor(color));
 }
 
 // ----------------------------------------------------------------------
@@ -2357,7 +2870,7 @@ void do_labelcolor(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelrule(istream &theInput)
+void do_labelrule(Globals &theGlobals, istream &theInput)
 {
   string rule;
   theInput >> rule;
@@ -2366,7 +2879,7 @@ void do_labelrule(istream &theInput)
 
   ColorTools::checkrule(rule);
 
-  if (!globals.specs.empty()) globals.specs.back().labelRule(rule);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().labelRule(rule);
 }
 
 // ----------------------------------------------------------------------
@@ -2375,14 +2888,14 @@ void do_labelrule(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelalign(istream &theInput)
+void do_labelalign(Globals &theGlobals, istream &theInput)
 {
   string align;
   theInput >> align;
 
   check_errors(theInput, "labelalign");
 
-  if (!globals.specs.empty()) globals.specs.back().labelAlignment(align);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().labelAlignment(align);
 }
 
 // ----------------------------------------------------------------------
@@ -2391,7 +2904,7 @@ void do_labelalign(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelformat(istream &theInput)
+void do_labelformat(Globals &theGlobals, istream &theInput)
 {
   string format;
   theInput >> format;
@@ -2399,7 +2912,7 @@ void do_labelformat(istream &theInput)
   check_errors(theInput, "labelformat");
 
   if (format == "-") format = "";
-  if (!globals.specs.empty()) globals.specs.back().labelFormat(format);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().labelFormat(format);
 }
 
 // ----------------------------------------------------------------------
@@ -2408,7 +2921,7 @@ void do_labelformat(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelmissing(istream &theInput)
+void do_labelmissing(Globals &theGlobals, istream &theInput)
 {
   string label;
   theInput >> label;
@@ -2417,7 +2930,7 @@ void do_labelmissing(istream &theInput)
 
   if (label == "none") label = "";
 
-  if (!globals.specs.empty()) globals.specs.back().labelMissing(label);
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().labelMissing(label);
 }
 
 // ----------------------------------------------------------------------
@@ -2426,17 +2939,17 @@ void do_labelmissing(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labeloffset(istream &theInput)
+void do_labeloffset(Globals &theGlobals, istream &theInput)
 {
   float dx, dy;
   theInput >> dx >> dy;
 
   check_errors(theInput, "labeloffset");
 
-  if (!globals.specs.empty())
+  if (!theGlobals.specs.empty())
   {
-    globals.specs.back().labelOffsetX(dx);
-    globals.specs.back().labelOffsetY(dy);
+    theGlobals.specs.back().labelOffsetX(dx);
+    theGlobals.specs.back().labelOffsetY(dy);
   }
 }
 
@@ -2446,7 +2959,7 @@ void do_labeloffset(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelcaption(istream &theInput)
+void do_labelcaption(Globals &theGlobals, istream &theInput)
 {
   string name, align;
   float dx, dy;
@@ -2454,12 +2967,12 @@ void do_labelcaption(istream &theInput)
 
   check_errors(theInput, "labelcaption");
 
-  if (!globals.specs.empty())
+  if (!theGlobals.specs.empty())
   {
-    globals.specs.back().labelCaption(name);
-    globals.specs.back().labelCaptionDX(dx);
-    globals.specs.back().labelCaptionDY(dy);
-    globals.specs.back().labelCaptionAlignment(align);
+    theGlobals.specs.back().labelCaption(name);
+    theGlobals.specs.back().labelCaptionDX(dx);
+    theGlobals.specs.back().labelCaptionDY(dy);
+    theGlobals.specs.back().labelCaptionAlignment(align);
   }
 }
 
@@ -2469,14 +2982,14 @@ void do_labelcaption(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_label(istream &theInput)
+void do_label(Globals &theGlobals, istream &theInput)
 {
   float lon, lat;
   theInput >> lon >> lat;
 
   check_errors(theInput, "label");
 
-  if (!globals.specs.empty()) globals.specs.back().add(NFmiPoint(lon, lat));
+  if (!theGlobals.specs.empty()) theGlobals.specs.back().add(NFmiPoint(lon, lat));
 }
 
 // ----------------------------------------------------------------------
@@ -2485,7 +2998,7 @@ void do_label(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelxy(istream &theInput)
+void do_labelxy(Globals &theGlobals, istream &theInput)
 {
   float lon, lat;
   int dx, dy;
@@ -2493,7 +3006,8 @@ void do_labelxy(istream &theInput)
 
   check_errors(theInput, "labelxy");
 
-  if (!globals.specs.empty()) globals.specs.back().add(NFmiPoint(lon, lat), NFmiPoint(dx, dy));
+  if (!theGlobals.specs.empty())
+    theGlobals.specs.back().add(NFmiPoint(lon, lat), NFmiPoint(dx, dy));
 }
 
 // ----------------------------------------------------------------------
@@ -2502,7 +3016,7 @@ void do_labelxy(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labels(istream &theInput)
+void do_labels(Globals &theGlobals, istream &theInput)
 {
   float dx, dy;
   theInput >> dx >> dy;
@@ -2511,10 +3025,10 @@ void do_labels(istream &theInput)
 
   if (dx < 0 || dy < 0) throw runtime_error("labels arguments must be nonnegative");
 
-  if (!globals.specs.empty())
+  if (!theGlobals.specs.empty())
   {
-    globals.specs.back().labelDX(dx);
-    globals.specs.back().labelDY(dy);
+    theGlobals.specs.back().labelDX(dx);
+    theGlobals.specs.back().labelDY(dy);
   }
 }
 
@@ -2524,7 +3038,7 @@ void do_labels(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelsxy(istream &theInput)
+void do_labelsxy(Globals &theGlobals, istream &theInput)
 {
   float x0, y0, dx, dy;
   theInput >> x0 >> y0 >> dx >> dy;
@@ -2533,12 +3047,12 @@ void do_labelsxy(istream &theInput)
 
   if (dx < 0 || dy < 0) throw runtime_error("labelsxy arguments must be nonnegative");
 
-  if (!globals.specs.empty())
+  if (!theGlobals.specs.empty())
   {
-    globals.specs.back().labelXyX0(x0);
-    globals.specs.back().labelXyY0(y0);
-    globals.specs.back().labelXyDX(dx);
-    globals.specs.back().labelXyDY(dy);
+    theGlobals.specs.back().labelXyX0(x0);
+    theGlobals.specs.back().labelXyY0(y0);
+    theGlobals.specs.back().labelXyDX(dx);
+    theGlobals.specs.back().labelXyDY(dy);
   }
 }
 
@@ -2548,7 +3062,7 @@ void do_labelsxy(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_labelfile(istream &theInput)
+void do_labelfile(Globals &theGlobals, istream &theInput)
 {
   string datafilename;
   theInput >> datafilename;
@@ -2570,7 +3084,7 @@ void do_labelfile(istream &theInput)
     {
       float lon, lat;
       datafile >> lon >> lat;
-      if (!globals.specs.empty()) globals.specs.back().add(NFmiPoint(lon, lat));
+      if (!theGlobals.specs.empty()) theGlobals.specs.back().add(NFmiPoint(lon, lat));
     }
     else
       throw runtime_error("Unknown datacommand " + datacommand);
@@ -2584,7 +3098,7 @@ void do_labelfile(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_units(istream &theInput)
+void do_units(Globals &theGlobals, istream &theInput)
 {
   string paramname, conversion;
 
@@ -2594,7 +3108,7 @@ void do_units(istream &theInput)
 
   FmiParameterName param = toparam(paramname);
   if (param == kFmiBadParameter) throw runtime_error("Unknown parametername '" + paramname + "'");
-  globals.unitsconverter.setConversion(param, conversion);
+  theGlobals.unitsconverter.setConversion(param, conversion);
 }
 
 // ----------------------------------------------------------------------
@@ -2603,7 +3117,7 @@ void do_units(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_clear(istream &theInput)
+void do_clear(Globals &theGlobals, istream &theInput)
 {
   string command;
 
@@ -2613,55 +3127,57 @@ void do_clear(istream &theInput)
 
   if (command == "contours")
   {
-    globals.specs.clear();
-    globals.labellocator.clear();
-    globals.symbollocator.clear();
-    globals.imagelocator.clear();
-    globals.highpressureimage.clear();
-    globals.lowpressureimage.clear();
+    theGlobals.specs.clear();
+    theGlobals.labellocator.clear();
+    theGlobals.symbollocator.clear();
+    theGlobals.imagelocator.clear();
+    theGlobals.highpressureimage.clear();
+    theGlobals.lowpressureimage.clear();
   }
   else if (command == "shapes")
-    globals.shapespecs.clear();
+    theGlobals.shapespecs.clear();
   else if (command == "cache")
   {
-    globals.calculator.clearCache();
-    globals.maskcalculator.clearCache();
+    theGlobals.calculator->clearCache();
+    theGlobals.projectedcache.clear();
+    theGlobals.areacaches.clear();
   }
   else if (command == "imagecache")
   {
 #ifdef USE_IMAGECACHE
-    globals.itsImageCache.clear();
+    theGlobals.itsImageCache->clear();
 #endif
   }
   else if (command == "arrows")
   {
-    globals.arrowpoints.clear();
-    globals.windarrowdx = 0;
-    globals.windarrowdy = 0;
-    globals.windarrowsxydx = -1;
-    globals.windarrowsxydy = -1;
+    theGlobals.arrowpoints.clear();
+    theGlobals.windarrowdx = 0;
+    theGlobals.windarrowdy = 0;
+    theGlobals.windarrowsxydx = -1;
+    theGlobals.windarrowsxydy = -1;
   }
   else if (command == "roundarrow")
   {
-    globals.roundarrowfillcolors.clear();
-    globals.roundarrowstrokecolors.clear();
-    globals.roundarrowsizes.clear();
+    theGlobals.roundarrowfillcolors.clear();
+    theGlobals.roundarrowstrokecolors.clear();
+    theGlobals.roundarrowsizes.clear();
   }
   else if (command == "labels")
   {
     list<ContourSpec>::iterator it;
-    for (it = globals.specs.begin(); it != globals.specs.end(); ++it)
+    for (it = theGlobals.specs.begin(); it != theGlobals.specs.end(); ++it)
       it->clearLabels();
   }
   else if (command == "pressure")
   {
-    globals.highpressureimage.clear();
-    globals.lowpressureimage.clear();
+    theGlobals.highpressureimage.clear();
+    theGlobals.lowpressureimage.clear();
+    theGlobals.pressurelocator.clear();
   }
   else if (command == "units")
-    globals.unitsconverter.clear();
+    theGlobals.unitsconverter.clear();
   else if (command == "graticule")
-    globals.graticulecolor = "";
+    theGlobals.graticulecolor = "";
   else
     throw runtime_error("Unknown clear target: " + command);
 }
@@ -2672,7 +3188,7 @@ void do_clear(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_draw_shapes(istream &theInput)
+void do_draw_shapes(Globals &theGlobals, istream &theInput)
 {
   // The output filename
 
@@ -2681,27 +3197,27 @@ void do_draw_shapes(istream &theInput)
 
   check_errors(theInput, "draw shapes");
 
-  boost::shared_ptr<NFmiArea> area = globals.createArea();
+  boost::shared_ptr<NFmiArea> area = theGlobals.createArea();
 
-  if (globals.verbose) report_area(*area);
+  if (theGlobals.verbose) report_area(*area);
 
   int imgwidth = static_cast<int>(area->Width() + 0.5);
   int imgheight = static_cast<int>(area->Height() + 0.5);
 
 // Initialize the background
 #ifdef IMAGINE_WITH_CAIRO
-  ImagineXr image(imgwidth, imgheight, filename + "." + globals.format, globals.format);
+  ImagineXr image(imgwidth, imgheight, filename + "." + theGlobals.format, theGlobals.format);
 #else
   NFmiImage image(imgwidth, imgheight);
-  globals.setImageModes(image);
+  theGlobals.setImageModes(image);
 #endif
-  image.Erase(ColorTools::checkcolor(globals.erase));
+  image.Erase(ColorTools::checkcolor(theGlobals.erase));
 
   // Draw all the shapes
 
   list<ShapeSpec>::const_iterator iter;
-  list<ShapeSpec>::const_iterator begin = globals.shapespecs.begin();
-  list<ShapeSpec>::const_iterator end = globals.shapespecs.end();
+  list<ShapeSpec>::const_iterator begin = theGlobals.shapespecs.begin();
+  list<ShapeSpec>::const_iterator end = theGlobals.shapespecs.end();
 
   for (iter = begin; iter != end; ++iter)
   {
@@ -2720,15 +3236,15 @@ void do_draw_shapes(istream &theInput)
     {
       NFmiColorTools::NFmiBlendRule markerrule = ColorTools::checkrule(iter->markerrule());
 
-      const ImagineXr_or_NFmiImage &marker = globals.getImage(iter->marker());
+      const ImagineXr_or_NFmiImage &marker = theGlobals.getImage(iter->marker());
       geo.Mark(image, marker, markerrule, kFmiAlignCenter, iter->markeralpha());
     }
   }
 
 #ifdef IMAGINE_WITH_CAIRO
-  write_image(image);
+  write_image(theGlobals, image);
 #else
-  write_image(image, filename + '.' + globals.format, globals.format);
+  write_image(theGlobals, image, filename + '.' + theGlobals.format, theGlobals.format);
 #endif
 }
 
@@ -2738,7 +3254,7 @@ void do_draw_shapes(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void do_draw_imagemap(istream &theInput)
+void do_draw_imagemap(Globals &theGlobals, istream &theInput)
 {
   // The relevant field name and filenames
 
@@ -2747,7 +3263,7 @@ void do_draw_imagemap(istream &theInput)
 
   check_errors(theInput, "draw imagemap");
 
-  boost::shared_ptr<NFmiArea> area = globals.createArea();
+  boost::shared_ptr<NFmiArea> area = theGlobals.createArea();
 
   // Generate map from all shapes in the list
 
@@ -2755,11 +3271,11 @@ void do_draw_imagemap(istream &theInput)
   ofstream out(outfile.c_str());
   if (!out) throw runtime_error("Failed to open " + outfile + " for writing");
 
-  if (globals.verbose) cout << "Writing " << outfile << endl;
+  if (theGlobals.verbose) cout << "Writing " << outfile << endl;
 
   list<ShapeSpec>::const_iterator iter;
-  list<ShapeSpec>::const_iterator begin = globals.shapespecs.begin();
-  list<ShapeSpec>::const_iterator end = globals.shapespecs.end();
+  list<ShapeSpec>::const_iterator begin = theGlobals.shapespecs.begin();
+  list<ShapeSpec>::const_iterator end = theGlobals.shapespecs.end();
 
   for (iter = begin; iter != end; ++iter)
   {
@@ -2776,24 +3292,26 @@ void do_draw_imagemap(istream &theInput)
  */
 // ----------------------------------------------------------------------
 
-void draw_graticule(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
+void draw_graticule(RenderContext &theContext, ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
 {
-  if (globals.graticulecolor.empty()) return;
+  JobState &state = theContext.state;
+
+  if (state.graticulecolor.empty()) return;
 
   NFmiPath path;
 
-  for (double lon = globals.graticulelon1; lon <= globals.graticulelon2; lon += globals.graticuledx)
+  for (double lon = state.graticulelon1; lon <= state.graticulelon2; lon += state.graticuledx)
   {
-    path.MoveTo(lon, globals.graticulelat1);
-    for (double lat = globals.graticulelat1 + globals.graticuledy; lat <= globals.graticulelat2;
+    path.MoveTo(lon, state.graticulelat1);
+    for (double lat = state.graticulelat1 + state.graticuledy; lat <= state.graticulelat2;
          lat += 1.0)
       path.LineTo(lon, lat);
   }
 
-  for (double lat = globals.graticulelat1; lat <= globals.graticulelat2; lat += globals.graticuledy)
+  for (double lat = state.graticulelat1; lat <= state.graticulelat2; lat += state.graticuledy)
   {
-    path.MoveTo(globals.graticulelon1, lat);
-    for (double lon = globals.graticulelon1 + globals.graticuledx; lon <= globals.graticulelon2;
+    path.MoveTo(state.graticulelon1, lat);
+    for (double lon = state.graticulelon1 + state.graticuledx; lon <= state.graticulelon2;
          lon += 1.0)
       path.LineTo(lon, lat);
   }
@@ -2801,7 +3319,7 @@ void draw_graticule(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
   // MeridianTools::Relocate(path,theArea);
   path.Project(&theArea);
 
-  NFmiColorTools::Color color = ColorTools::checkcolor(globals.graticulecolor);
+  NFmiColorTools::Color color = ColorTools::checkcolor(state.graticulecolor);
   path.Stroke(img, color, NFmiColorTools::kFmiColorCopy);
 }
 
@@ -2830,13 +3348,13 @@ int paramid(const string &theParam)
  */
 // ----------------------------------------------------------------------
 
-unsigned int choose_queryinfo(const string &theName, int theLevel)
+unsigned int choose_queryinfo(RenderContext &theContext, const string &theName, int theLevel)
 {
-  if (globals.querystreams.size() == 0) throw runtime_error("No querydata has been specified");
+  if (theContext.querystreams.size() == 0) throw runtime_error("No querydata has been specified");
 
   if (MetaFunctions::isMeta(theName))
   {
-    globals.queryinfo = globals.querystreams[0];
+    theContext.queryinfo = theContext.querystreams[0];
     return 0;
   }
   else
@@ -2845,13 +3363,13 @@ unsigned int choose_queryinfo(const string &theName, int theLevel)
 
     FmiParameterName param = toparam(theName);
 
-    for (unsigned int qi = 0; qi < globals.querystreams.size(); qi++)
+    for (unsigned int qi = 0; qi < theContext.querystreams.size(); qi++)
     {
-      globals.queryinfo = globals.querystreams[qi];
-      globals.queryinfo->Param(param);
-      if (globals.queryinfo->IsParamUsable())
+      theContext.queryinfo = theContext.querystreams[qi];
+      theContext.queryinfo->Param(param);
+      if (theContext.queryinfo->IsParamUsable())
       {
-        if (set_level(*globals.queryinfo, theLevel)) return qi;
+        if (set_level(*theContext.queryinfo, theLevel)) return qi;
       }
     }
     if (theLevel < 0)
@@ -2906,33 +3424,36 @@ void expand_data(NFmiDataMatrix<float> &theValues)
  */
 // ----------------------------------------------------------------------
 
-void filter_values(NFmiDataMatrix<float> &theValues,
+void filter_values(RenderContext &theContext,
+                   NFmiDataMatrix<float> &theValues,
                    const NFmiTime &theTime,
                    const ContourSpec &theSpec)
 {
-  if (globals.filter == "none")
+  JobState &state = theContext.state;
+
+  if (state.filter == "none")
   {
     // The time is known to be exact
   }
-  else if (globals.filter == "linear")
+  else if (state.filter == "linear")
   {
-    NFmiTime tnow = globals.queryinfo->ValidTime();
+    NFmiTime tnow = theContext.queryinfo->ValidTime();
     bool isexact = theTime.IsEqual(tnow);
 
     if (!isexact)
     {
       NFmiDataMatrix<float> tmpvals;
-      NFmiTime t2 = globals.queryinfo->ValidTime();
-      globals.queryinfo->PreviousTime();
-      NFmiTime t1 = globals.queryinfo->ValidTime();
+      NFmiTime t2 = theContext.queryinfo->ValidTime();
+      theContext.queryinfo->PreviousTime();
+      NFmiTime t1 = theContext.queryinfo->ValidTime();
       if (!MetaFunctions::isMeta(theSpec.param()))
       {
-        globals.queryinfo->Values(tmpvals);
-        globals.unitsconverter.convert(FmiParameterName(globals.queryinfo->GetParamIdent()),
+        theContext.queryinfo->Values(tmpvals);
+        state.unitsconverter.convert(FmiParameterName(theContext.queryinfo->GetParamIdent()),
                                        tmpvals);
       }
       else
-        tmpvals = MetaFunctions::values(theSpec.param(), *globals.queryinfo);
+        tmpvals = MetaFunctions::values(theSpec.param(), *theContext.queryinfo);
       if (theSpec.replace())
         tmpvals.Replace(theSpec.replaceSourceValue(), theSpec.replaceTargetValue());
 
@@ -2949,7 +3470,7 @@ void filter_values(NFmiDataMatrix<float> &theValues,
   else
   {
     NFmiTime tprev = theTime;
-    tprev.ChangeByMinutes(-globals.timeinterval);
+    tprev.ChangeByMinutes(-state.timeinterval);
 
     if (MetaFunctions::isMeta(theSpec.param()))
       throw runtime_error("Unable to filter metafunctions - use newbase parameters only");
@@ -2959,19 +3480,20 @@ void filter_values(NFmiDataMatrix<float> &theValues,
     int steps = 1;
     for (;;)
     {
-      globals.queryinfo->Values(tmpvals, tnow);
-      globals.unitsconverter.convert(FmiParameterName(globals.queryinfo->GetParamIdent()), tmpvals);
+      theContext.queryinfo->Values(tmpvals, tnow);
+      state.unitsconverter.convert(FmiParameterName(theContext.queryinfo->GetParamIdent()),
+                                   tmpvals);
 
       if (theSpec.replace())
         tmpvals.Replace(theSpec.replaceSourceValue(), theSpec.replaceTargetValue());
 
-      if (globals.filter == "min")
+      if (state.filter == "min")
         theValues.Min(tmpvals);
-      else if (globals.filter == "max")
+      else if (state.filter == "max")
         theValues.Max(tmpvals);
-      else if (globals.filter == "mean")
+      else if (state.filter == "mean")
         theValues += tmpvals;
-      else if (globals.filter == "sum")
+      else if (state.filter == "sum")
         theValues += tmpvals;
 
       ++steps;
@@ -2980,7 +3502,7 @@ void filter_values(NFmiDataMatrix<float> &theValues,
       if (tnow.IsLessThan(tprev)) break;
     }
 
-    if (globals.filter == "mean") theValues /= static_cast<float>(steps);
+    if (state.filter == "mean") theValues /= static_cast<float>(steps);
   }
 
   // Noise reduction
@@ -2994,7 +3516,8 @@ void filter_values(NFmiDataMatrix<float> &theValues,
  */
 // ----------------------------------------------------------------------
 
-void add_label_grid_values(ContourSpec &theSpec,
+void add_label_grid_values(RenderContext &theContext,
+                           ContourSpec &theSpec,
                            const NFmiArea &theArea,
                            const LazyCoordinates &thePoints)
 {
@@ -3039,10 +3562,15 @@ void add_label_grid_values(ContourSpec &theSpec,
 // ----------------------------------------------------------------------
 /*!
  * \brief Save pixelgrid values for later labelling
+ *
+ * Gridded values are interpolated from the prepared values. Point
+ * data has no grid to interpolate in, and the values are then
+ * interpolated by the querydata itself.
  */
 // ----------------------------------------------------------------------
 
-void add_label_pixelgrid_values(ContourSpec &theSpec,
+void add_label_pixelgrid_values(RenderContext &theContext,
+                                ContourSpec &theSpec,
                                 const NFmiArea &theArea,
                                 const ImagineXr_or_NFmiImage &img,
                                 const NFmiDataMatrix<float> &theValues)
@@ -3056,24 +3584,48 @@ void add_label_pixelgrid_values(ContourSpec &theSpec,
 
   if (dx > 0 && dy > 0)
   {
-    for (float y = y0; y <= img.Height(); y += dy)
-      for (float x = x0; x <= img.Width(); x += dx)
+    // The projected coordinates are the same for all timesteps
+
+    const NFmiGrid *grid = theContext.queryinfo->Grid();
+    PixelGridLookup &lookup =
+        (grid != 0 ? theContext.caches.getPixelGridLookup(
+                         theArea, img.Width(), img.Height(), *grid)
+                   : theContext.caches.getPixelGridLookup(theArea, img.Width(), img.Height()));
+    const PixelGridLookup::PixelPoints &points = lookup.pixelPoints(x0, y0, dx, dy);
+
+    if (grid == 0)
+    {
+      JobState &state = theContext.state;
+      const FmiParameterName param = FmiParameterName(theContext.queryinfo->GetParamIdent());
+
+      for (PixelGridLookup::PixelPoints::const_iterator it = points.begin(); it != points.end();
+           ++it)
       {
-        NFmiPoint latlon = theArea.ToLatLon(NFmiPoint(x, y));
-        NFmiPoint ij = globals.queryinfo->LatLonToGrid(latlon);
-
-        int i = static_cast<int>(ij.X());  // rounds down
-        int j = static_cast<int>(ij.Y());
-        float value = static_cast<float>(
-            NFmiInterpolation::BiLinear(ij.X() - floor(ij.X()),
-                                        ij.Y() - floor(ij.Y()),
-                                        theValues.At(i, j + 1, kFloatMissing),
-                                        theValues.At(i + 1, j + 1, kFloatMissing),
-                                        theValues.At(i, j, kFloatMissing),
-
-                                        theValues.At(i + 1, j, kFloatMissing)));
-        theSpec.addPixelLabel(NFmiPoint(x, y), value);
+        float value = theContext.queryinfo->InterpolatedValue(it->latlon);
+        value = state.unitsconverter.convert(param, value);
+        if (theSpec.replace() && value == theSpec.replaceSourceValue())
+          value = theSpec.replaceTargetValue();
+        theSpec.addPixelLabel(it->xy, value);
       }
+      return;
+    }
+
+    for (PixelGridLookup::PixelPoints::const_iterator it = points.begin(); it != points.end(); ++it)
+    {
+      const NFmiPoint &ij = it->grid;
+
+      int i = static_cast<int>(ij.X());  // rounds down
+      int j = static_cast<int>(ij.Y());
+      float value = static_cast<float>(
+          NFmiInterpolation::BiLinear(ij.X() - floor(ij.X()),
+                                      ij.Y() - floor(ij.Y()),
+                                      theValues.At(i, j + 1, kFloatMissing),
+                                      theValues.At(i + 1, j + 1, kFloatMissing),
+                                      theValues.At(i, j, kFloatMissing),
+
+                                      theValues.At(i + 1, j, kFloatMissing)));
+      theSpec.addPixelLabel(it->xy, value);
+    }
   }
 }
 
@@ -3083,7 +3635,8 @@ void add_label_pixelgrid_values(ContourSpec &theSpec,
  */
 // ----------------------------------------------------------------------
 
-void add_label_point_values(ContourSpec &theSpec,
+void add_label_point_values(RenderContext &theContext,
+                            ContourSpec &theSpec,
                             const NFmiArea &theArea,
                             const NFmiDataMatrix<float> &theValues)
 {
@@ -3095,7 +3648,7 @@ void add_label_point_values(ContourSpec &theSpec,
     for (it = theSpec.labelPoints().begin(); it != theSpec.labelPoints().end(); ++it)
     {
       NFmiPoint latlon = it->first;
-      NFmiPoint ij = globals.queryinfo->LatLonToGrid(latlon);
+      NFmiPoint ij = theContext.queryinfo->LatLonToGrid(latlon);
 
       int i = static_cast<int>(ij.X());  // rounds down
       int j = static_cast<int>(ij.Y());
@@ -3118,10 +3671,13 @@ void add_label_point_values(ContourSpec &theSpec,
  */
 // ----------------------------------------------------------------------
 
-void draw_label_markers(ImagineXr_or_NFmiImage &img,
+void draw_label_markers(RenderContext &theContext,
+                        ImagineXr_or_NFmiImage &img,
                         const ContourSpec &theSpec,
                         const NFmiArea &theArea)
 {
+  JobState &state = theContext.state;
+
   if (theSpec.labelMarker().empty()) return;
 
   // Establish that something is to be done
@@ -3130,7 +3686,7 @@ void draw_label_markers(ImagineXr_or_NFmiImage &img,
 
   // Establish the marker specs
 
-  const ImagineXr_or_NFmiImage &marker = globals.getImage(theSpec.labelMarker());
+  const ImagineXr_or_NFmiImage &marker = theContext.caches.getImage(theSpec.labelMarker());
 
   NFmiColorTools::NFmiBlendRule markerrule = ColorTools::checkrule(theSpec.labelMarkerRule());
 
@@ -3158,7 +3714,7 @@ void draw_label_markers(ImagineXr_or_NFmiImage &img,
 
       // Skip rendering if the start point is masked
 
-      if (IsMasked(xy, globals.mask)) continue;
+      if (IsMasked(theContext, xy, state.mask)) continue;
 
       img.Composite(marker,
                     markerrule,
@@ -3181,7 +3737,7 @@ void draw_label_markers(ImagineXr_or_NFmiImage &img,
 
       // Skip rendering if the start point is masked
 
-      if (IsMasked(NFmiPoint(x, y), globals.mask)) continue;
+      if (IsMasked(theContext, NFmiPoint(x, y), state.mask)) continue;
 
       float value = iter->second;
 
@@ -3204,10 +3760,13 @@ void draw_label_markers(ImagineXr_or_NFmiImage &img,
  */
 // ----------------------------------------------------------------------
 
-void draw_label_texts(ImagineXr_or_NFmiImage &img,
+void draw_label_texts(RenderContext &theContext,
+                      ImagineXr_or_NFmiImage &img,
                       const ContourSpec &theSpec,
                       const NFmiArea &theArea)
 {
+  JobState &state = theContext.state;
+
   // Establish that something is to be done
 
   if (theSpec.labelPoints().empty() && theSpec.pixelLabels().empty()) return;
@@ -3263,7 +3822,7 @@ void draw_label_texts(ImagineXr_or_NFmiImage &img,
 
       // Skip rendering if the start point is masked
 
-      if (IsMasked(NFmiPoint(x, y), globals.mask)) continue;
+      if (IsMasked(theContext, NFmiPoint(x, y), state.mask)) continue;
 
       // Convert value to string
       string strvalue = theSpec.labelMissing();
@@ -3348,7 +3907,7 @@ void draw_label_texts(ImagineXr_or_NFmiImage &img,
 
       // Skip rendering if the start point is masked
 
-      if (IsMasked(NFmiPoint(x, y), globals.mask)) continue;
+      if (IsMasked(theContext, NFmiPoint(x, y), state.mask)) continue;
 
       // Convert value to string
       string strvalue = theSpec.labelMissing();
@@ -3414,29 +3973,6 @@ void draw_label_texts(ImagineXr_or_NFmiImage &img,
   }
 }
 
-// ----------------------------------------------------------------------
-/*!
- * \brief Calculate direction of north on paper coordinates
- */
-// ----------------------------------------------------------------------
-
-double paper_north(const NFmiArea &theArea, const NFmiPoint &theLatLon)
-{
-  // Safety against polar regions just in case
-
-  if (theLatLon.Y() <= -89.9 || theLatLon.Y() >= 89.9) return 0;
-
-  const NFmiPoint origo = theArea.ToXY(theLatLon);
-
-  const float pi = 3.141592658979323f;
-  const double latstep = 0.01;  // degrees to north
-
-  const double lat = theLatLon.Y() + latstep;
-  const NFmiPoint north = theArea.ToXY(NFmiPoint(theLatLon.X(), lat));
-  const float alpha = static_cast<float>(atan2(origo.X() - north.X(), origo.Y() - north.Y()));
-  return alpha * 180 / pi;
-}
-
 // ----------------------------------------------------------------------
 /*!
  * \brief Return the circle for a round arrow
@@ -3496,11 +4032,17 @@ NFmiPath roundarrow_triangle(const NFmiPoint &xy, float angle, const RoundArrowS
  */
 // ----------------------------------------------------------------------
 
-void draw_roundarrow(NFmiImage &img, const NFmiPoint &xy, float speed, float angle)
+void draw_roundarrow(RenderContext &theContext,
+                     NFmiImage &img,
+                     const NFmiPoint &xy,
+                     float speed,
+                     float angle)
 {
-  RoundArrowColor fillcolor = globals.getRoundArrowFillColor(speed);
-  RoundArrowColor strokecolor = globals.getRoundArrowStrokeColor(speed);
-  RoundArrowSize sz = globals.getRoundArrowSize(speed);
+  JobState &state = theContext.state;
+
+  RoundArrowColor fillcolor = state.getRoundArrowFillColor(speed);
+  RoundArrowColor strokecolor = state.getRoundArrowStrokeColor(speed);
+  RoundArrowSize sz = state.getRoundArrowSize(speed);
 
   NFmiPath circle = roundarrow_circle(xy, sz);
   NFmiPath triangle = roundarrow_triangle(xy, angle, sz);
@@ -3512,13 +4054,51 @@ void draw_roundarrow(NFmiImage &img, const NFmiPoint &xy, float speed, float ang
   circle.Stroke(img, strokecolor.circlecolor);
 }
 
+//! The wind values of the current frame as stored in the data
+struct WindFields
+{
+  NFmiDataMatrix<float> speed;      // speed or the U component
+  NFmiDataMatrix<float> direction;  // direction or the V component
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Fetch the wind values of the current frame
+ *
+ * The values are fetched only for gridded data, and only once per
+ * frame for all the arrow types.
+ */
+// ----------------------------------------------------------------------
+
+void get_wind_fields(RenderContext &theContext, WindFields &theFields)
+{
+  JobState &state = theContext.state;
+
+  if (theContext.queryinfo->Grid() == 0) return;
+
+  const bool polar = !state.directionparam.empty();
+  const string &param1 = (polar ? state.speedparam : state.speedxcomponent);
+  const string &param2 = (polar ? state.directionparam : state.speedycomponent);
+
+  if (theContext.queryinfo->Param(toparam(param1))) theContext.queryinfo->Values(theFields.speed);
+  if (theContext.queryinfo->Param(toparam(param2)))
+    theContext.queryinfo->Values(theFields.direction);
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Establish speed and direction in a grid
+ *
+ * The direction of north needed for U/V winds is cached for gridded
+ * data, since it depends only on the area and the grid.
  */
 // ----------------------------------------------------------------------
 
-void get_speed_direction(const NFmiArea &area,
+template <typename T>
+void get_speed_direction(RenderContext &theContext,
+                         const T &img,
+                         const NFmiArea &area,
+                         const WindFields &theFields,
                          float speed_src,
                          float speed_dst,
                          float direction_src,
@@ -3526,32 +4106,40 @@ void get_speed_direction(const NFmiArea &area,
                          NFmiDataMatrix<float> &speed,
                          NFmiDataMatrix<float> &direction)
 {
-  if (!globals.directionparam.empty())
+  JobState &state = theContext.state;
+
+  if (!state.directionparam.empty())
   {
-    if (globals.queryinfo->Param(toparam(globals.speedparam)))
+    if (theFields.speed.NX() != 0 && theFields.speed.NY() != 0)
     {
-      globals.queryinfo->Values(speed);
+      speed = theFields.speed;
       speed.Replace(speed_src, speed_dst);
-      globals.unitsconverter.convert(FmiParameterName(globals.queryinfo->GetParamIdent()), speed);
+      state.unitsconverter.convert(toparam(state.speedparam), speed);
     }
 
-    if (globals.queryinfo->Param(toparam(globals.directionparam)))
+    if (theFields.direction.NX() != 0 && theFields.direction.NY() != 0)
     {
-      globals.queryinfo->Values(direction);
+      direction = theFields.direction;
       direction.Replace(direction_src, direction_dst);
-      globals.unitsconverter.convert(FmiParameterName(globals.queryinfo->GetParamIdent()),
-                                     direction);
+      state.unitsconverter.convert(toparam(state.directionparam), direction);
     }
   }
   else
   {
-    NFmiDataMatrix<float> dx;
-    NFmiDataMatrix<float> dy;
+    const NFmiDataMatrix<float> &dx = theFields.speed;
+    const NFmiDataMatrix<float> &dy = theFields.direction;
 
-    if (globals.queryinfo->Param(toparam(globals.speedxcomponent))) globals.queryinfo->Values(dx);
-    if (globals.queryinfo->Param(toparam(globals.speedycomponent))) globals.queryinfo->Values(dy);
+    boost::shared_ptr<NFmiDataMatrix<NFmiPoint>> latlon = theContext.queryinfo->Locations();
 
-    boost::shared_ptr<NFmiDataMatrix<NFmiPoint>> latlon = globals.queryinfo->Locations();
+    const vector<float> *northfield = 0;
+    const NFmiGrid *grid = theContext.queryinfo->Grid();
+    if (grid != 0)
+    {
+      PixelGridLookup &lookup =
+          theContext.caches.getPixelGridLookup(area, img.Width(), img.Height(), *grid);
+      northfield = &lookup.gridNorth(*latlon, state.threads);
+      if (northfield->size() != dx.NX() * dx.NY()) northfield = 0;
+    }
 
     if (dx.NX() != 0 && dx.NY() != 0 && dy.NX() != 0 && dy.NY() != 0)
     {
@@ -3565,7 +4153,8 @@ void get_speed_direction(const NFmiArea &area,
             speed[i][j] = sqrt(dx[i][j] * dx[i][j] + dy[i][j] * dy[i][j]);
             if (dx[i][j] != 0 || dy[i][j] != 0)
             {
-              double north = paper_north(area, (*latlon)[i][j]);
+              double north = (northfield != 0 ? (*northfield)[i + j * dx.NX()]
+                                              : MeridianTools::PaperNorth(area, (*latlon)[i][j]));
               direction[i][j] = fmod(180 + north + FmiDeg(atan2(dx[i][j], dy[i][j])), 360.0);
             }
           }
@@ -3577,11 +4166,13 @@ void get_speed_direction(const NFmiArea &area,
 // ----------------------------------------------------------------------
 /*!
  * \brief Establish speed & direction at the given point
+ *
+ * The direction of north of the point is used for rotating U/V winds.
  */
 // ----------------------------------------------------------------------
 
-void get_speed_direction(const NFmiArea &area,
-                         const NFmiPoint &latlon,
+void get_speed_direction(RenderContext &theContext,
+                         const PixelGridLookup::PixelPoint &thePoint,
                          float speed_src,
                          float speed_dst,
                          float direction_src,
@@ -3589,27 +4180,29 @@ void get_speed_direction(const NFmiArea &area,
                          float &speed,
                          float &direction)
 {
+  JobState &state = theContext.state;
+
   speed = direction = kFloatMissing;
 
-  if (!globals.directionparam.empty())
+  if (!state.directionparam.empty())
   {
-    if (globals.queryinfo->Param(toparam(globals.directionparam)))
+    if (theContext.queryinfo->Param(toparam(state.directionparam)))
     {
-      direction = globals.queryinfo->InterpolatedValue(latlon);
+      direction = theContext.queryinfo->InterpolatedValue(thePoint.latlon);
       if (direction == direction_src) direction = direction_dst;
 
-      direction = globals.unitsconverter.convert(
-          FmiParameterName(globals.queryinfo->GetParamIdent()), direction);
+      direction = state.unitsconverter.convert(
+          FmiParameterName(theContext.queryinfo->GetParamIdent()), direction);
     }
 
-    if (globals.queryinfo->Param(toparam(globals.speedparam)))
+    if (theContext.queryinfo->Param(toparam(state.speedparam)))
     {
-      speed = globals.queryinfo->InterpolatedValue(latlon);
+      speed = theContext.queryinfo->InterpolatedValue(thePoint.latlon);
       if (speed == speed_src) speed = speed_dst;
-      speed = globals.unitsconverter.convert(FmiParameterName(globals.queryinfo->GetParamIdent()),
+      speed = state.unitsconverter.convert(FmiParameterName(theContext.queryinfo->GetParamIdent()),
                                              speed);
     }
-    globals.queryinfo->Param(toparam(globals.directionparam));
+    theContext.queryinfo->Param(toparam(state.directionparam));
   }
 
   else
@@ -3617,17 +4210,17 @@ void get_speed_direction(const NFmiArea &area,
     float dx = kFloatMissing;
     float dy = kFloatMissing;
 
-    if (globals.queryinfo->Param(toparam(globals.speedxcomponent)))
-      dx = globals.queryinfo->InterpolatedValue(latlon);
-    if (globals.queryinfo->Param(toparam(globals.speedycomponent)))
-      dy = globals.queryinfo->InterpolatedValue(latlon);
+    if (theContext.queryinfo->Param(toparam(state.speedxcomponent)))
+      dx = theContext.queryinfo->InterpolatedValue(thePoint.latlon);
+    if (theContext.queryinfo->Param(toparam(state.speedycomponent)))
+      dy = theContext.queryinfo->InterpolatedValue(thePoint.latlon);
 
     if (dx != kFloatMissing && dy != kFloatMissing)
     {
       speed = sqrt(dx * dx + dy * dy);
       if (dx != 0 || dy != 0)
       {
-        double north = paper_north(area, latlon);
+        double north = thePoint.north;
         direction = fmod(180 + north + FmiDeg(atan2f(dx, dy)), 360.0);
       }
     }
@@ -3636,357 +4229,648 @@ void get_speed_direction(const NFmiArea &area,
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Draw the listed wind arrow points
+ * \brief Interpolate a parameter at several points
+ *
+ * The values are interpolated from the given matrix of the current
+ * time when all four surrounding grid points have a value. Points on
+ * or outside the grid edges, such as points across the dateline in
+ * world data, and points next to missing values are interpolated by
+ * InterpolatedValue as before, so that the results do not change.
+ *
+ * \param theParam The parameter name
+ * \param theValues The values of the parameter at the current time
+ * \param thePoints The points, with grid coordinates
+ * \param theModular True if the values are directions
+ * \param theResult The interpolated values
+ * \return False if the parameter is not available
  */
 // ----------------------------------------------------------------------
 
-void draw_wind_arrows_points(ImagineXr_or_NFmiImage &img,
-                             const NFmiArea &theArea,
-                             const NFmiPath &theArrow,
-                             float direction_src,
-                             float direction_dst,
-                             float speed_src,
-                             float speed_dst)
+bool interpolate_points(RenderContext &theContext,
+                        const string &theParam,
+                        const NFmiDataMatrix<float> &theValues,
+                        const PixelGridLookup::PixelPoints &thePoints,
+                        bool theModular,
+                        vector<float> &theResult)
 {
-  // Handle all given coordinates
+  theResult.assign(thePoints.size(), kFloatMissing);
 
-  list<NFmiPoint>::const_iterator iter;
+  if (!theContext.queryinfo->Param(toparam(theParam))) return false;
 
-  for (iter = globals.arrowpoints.begin(); iter != globals.arrowpoints.end(); ++iter)
+  const int nx = static_cast<int>(theValues.NX());
+  const int ny = static_cast<int>(theValues.NY());
+
+  for (unsigned int k = 0; k < thePoints.size(); k++)
   {
-    // The start point
-    // NFmiPoint latlon = MeridianTools::Relocate(*iter,theArea);
-    NFmiPoint latlon = *iter;
-    NFmiPoint xy0 = theArea.ToXY(latlon);
+    const double x = thePoints[k].grid.X();
+    const double y = thePoints[k].grid.Y();
 
-    // Skip rendering if the start point is masked
+    if (x >= 0 && y >= 0 && x < nx - 1 && y < ny - 1)
+    {
+      const int i = static_cast<int>(floor(x));
+      const int j = static_cast<int>(floor(y));
+
+      const float tl = theValues[i][j + 1];
+      const float tr = theValues[i + 1][j + 1];
+      const float bl = theValues[i][j];
+      const float br = theValues[i + 1][j];
+
+      if (tl != kFloatMissing && tr != kFloatMissing && bl != kFloatMissing &&
+          br != kFloatMissing)
+      {
+        if (theModular)
+          theResult[k] = NFmiInterpolation::ModBiLinear(x - i, y - j, tl, tr, bl, br, 360);
+        else
+          theResult[k] = NFmiInterpolation::BiLinear(x - i, y - j, tl, tr, bl, br);
+        continue;
+      }
+    }
 
-    if (IsMasked(xy0, globals.mask)) continue;
+    theResult[k] = theContext.queryinfo->InterpolatedValue(thePoints[k].latlon);
+  }
+  return true;
+}
 
-    float dir, speed;
+// ----------------------------------------------------------------------
+/*!
+ * \brief Establish speed & direction at several points
+ *
+ * For gridded data the values are interpolated from the wind values
+ * of the current frame, and the parameter is changed only once per
+ * parameter instead of once per point. As in the single point case
+ * the replacements and unit conversions are applied after the
+ * interpolation. Otherwise each point is handled separately.
+ *
+ * \param thePoints The points, the grid coordinates must be set for gridded data
+ * \param theFields The wind values of the current frame
+ * \param speed The speeds at the points
+ * \param direction The directions at the points
+ */
+// ----------------------------------------------------------------------
 
-    get_speed_direction(
-        theArea, *iter, speed_src, speed_dst, direction_src, direction_dst, speed, dir);
+void get_speed_direction(RenderContext &theContext,
+                         const PixelGridLookup::PixelPoints &thePoints,
+                         const WindFields &theFields,
+                         float speed_src,
+                         float speed_dst,
+                         float direction_src,
+                         float direction_dst,
+                         vector<float> &speed,
+                         vector<float> &direction)
+{
+  JobState &state = theContext.state;
 
-    // Ignore missing values
-    if (dir == kFloatMissing || speed == kFloatMissing) continue;
+  speed.assign(thePoints.size(), kFloatMissing);
+  direction.assign(thePoints.size(), kFloatMissing);
 
-    // Direction calculations
+  if (thePoints.empty()) return;
 
-    const float north = paper_north(theArea, latlon);
+  if (theContext.queryinfo->Grid() == 0)
+  {
+    for (unsigned int k = 0; k < thePoints.size(); k++)
+      get_speed_direction(theContext,
+                          thePoints[k],
+                          speed_src,
+                          speed_dst,
+                          direction_src,
+                          direction_dst,
+                          speed[k],
+                          direction[k]);
+    return;
+  }
 
-    // Render the arrow
+  if (!state.directionparam.empty())
+  {
+    const FmiParameterName dirparam = toparam(state.directionparam);
+    const FmiParameterName speedparam = toparam(state.speedparam);
 
-    if (globals.arrowfile == "roundarrow")
+    if (interpolate_points(
+            theContext, state.directionparam, theFields.direction, thePoints, true, direction))
     {
-      draw_roundarrow(img, xy0, speed, -dir + north + 180);
+      for (unsigned int k = 0; k < thePoints.size(); k++)
+      {
+        if (direction[k] == direction_src) direction[k] = direction_dst;
+        direction[k] = state.unitsconverter.convert(dirparam, direction[k]);
+      }
     }
-    else
+
+    if (interpolate_points(theContext, state.speedparam, theFields.speed, thePoints, false, speed))
     {
-      if (globals.arrowfile == "meteorological")
+      for (unsigned int k = 0; k < thePoints.size(); k++)
       {
-        NFmiPath strokes;
-        NFmiPath flags;
+        if (speed[k] == speed_src) speed[k] = speed_dst;
+        speed[k] = state.unitsconverter.convert(speedparam, speed[k]);
+      }
+    }
 
-        strokes.Add(GramTools::metarrowlines(speed, latlon));
-        flags.Add(GramTools::metarrowflags(speed, latlon));
+    theContext.queryinfo->Param(dirparam);
+  }
+  else
+  {
+    vector<float> dx;
+    vector<float> dy;
+    interpolate_points(theContext, state.speedxcomponent, theFields.speed, thePoints, false, dx);
+    interpolate_points(
+        theContext, state.speedycomponent, theFields.direction, thePoints, false, dy);
 
-        if (speed > 0 && speed != kFloatMissing)
+    for (unsigned int k = 0; k < thePoints.size(); k++)
+    {
+      if (dx[k] != kFloatMissing && dy[k] != kFloatMissing)
+      {
+        speed[k] = sqrt(dx[k] * dx[k] + dy[k] * dy[k]);
+        if (dx[k] != 0 || dy[k] != 0)
         {
-          strokes.Scale(globals.windarrowscaleA * log10(globals.windarrowscaleB * speed + 1) +
-                        globals.windarrowscaleC);
-          flags.Scale(globals.windarrowscaleA * log10(globals.windarrowscaleB * speed + 1) +
-                      globals.windarrowscaleC);
+          double north = thePoints[k].north;
+          direction[k] = fmod(180 + north + FmiDeg(atan2f(dx[k], dy[k])), 360.0);
         }
-
-        strokes.Scale(globals.arrowscale);
-        strokes.Rotate(-dir + north + 180);
-        strokes.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
-
-        flags.Scale(globals.arrowscale);
-        flags.Rotate(-dir + north + 180);
-        flags.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
-
-        ArrowStyle style = globals.getArrowStroke(speed);
-        strokes.Stroke(img, style.color, style.rule);
-        flags.Fill(img, style.color, style.rule);
-      }
-      else
-      {
-        NFmiPath arrowpath;
-        arrowpath.Add(theArrow);
-
-        if (speed > 0 && speed != kFloatMissing)
-          arrowpath.Scale(globals.windarrowscaleA * log10(globals.windarrowscaleB * speed + 1) +
-                          globals.windarrowscaleC);
-        arrowpath.Scale(globals.arrowscale);
-        arrowpath.Rotate(-dir + north + 180);
-        arrowpath.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
-
-        // And render it
-
-        ArrowStyle fillstyle = globals.getArrowFill(speed);
-        arrowpath.Fill(img, fillstyle.color, fillstyle.rule);
-
-        ArrowStyle strokestyle = globals.getArrowStroke(speed);
-        arrowpath.Stroke(img, strokestyle.color, strokestyle.rule);
       }
     }
   }
 }
 
+#ifndef IMAGINE_WITH_CAIRO
+
 // ----------------------------------------------------------------------
 /*!
- * \brief Draw the data gridded wind arrow points
+ * \brief Draw a wind arrow from the sprite atlas
+ *
+ * Each distinct arrow shape is rasterized only once. The shape is
+ * identified by the arrow type, the scale, the direction rounded to
+ * the nearest degree, the hemisphere and the number of barbs for
+ * meteorological arrows, or the size for round arrows. The colours
+ * are applied when blitting. The arrow origin is rounded to the
+ * nearest pixel.
+ *
+ * \return False if the arrow must be rendered as paths instead
  */
 // ----------------------------------------------------------------------
 
-void draw_wind_arrows_grid(ImagineXr_or_NFmiImage &img,
-                           const NFmiArea &theArea,
-                           const NFmiPath &theArrow,
-                           float direction_src,
-                           float direction_dst,
-                           float speed_src,
-                           float speed_dst)
+bool draw_wind_arrow_sprite(RenderContext &theContext,
+                            NFmiImage &img,
+                            const NFmiPath &theArrow,
+                            const NFmiPoint &xy0,
+                            const NFmiPoint &latlon,
+                            float speed,
+                            double angle)
 {
-  // Draw the full grid if so desired
+  JobState &state = theContext.state;
 
-  if (globals.windarrowdx <= 0 || globals.windarrowdy <= 0) return;
+  const bool roundarrow = (state.arrowfile == "roundarrow");
+  const bool meteorological = (state.arrowfile == "meteorological");
 
-  NFmiDataMatrix<float> speedvalues, dirvalues;
+  // The styles in rendering order
 
-  get_speed_direction(
-      theArea, speed_src, speed_dst, direction_src, direction_dst, speedvalues, dirvalues);
+  vector<NFmiColorTools::Color> colors;
+  vector<NFmiColorTools::NFmiBlendRule> rules;
 
-  if (dirvalues.NX() == 0 || dirvalues.NY() == 0)
+  if (roundarrow)
   {
-    return;
+    RoundArrowColor fillcolor = state.getRoundArrowFillColor(speed);
+    RoundArrowColor strokecolor = state.getRoundArrowStrokeColor(speed);
+    colors.push_back(fillcolor.trianglecolor);
+    colors.push_back(strokecolor.trianglecolor);
+    colors.push_back(fillcolor.circlecolor);
+    colors.push_back(strokecolor.circlecolor);
+    rules.resize(4, NFmiColorTools::kFmiColorCopy);
+  }
+  else if (meteorological)
+  {
+    ArrowStyle style = state.getArrowStroke(speed);
+    colors.resize(2, style.color);
+    rules.resize(2, style.rule);
+  }
+  else
+  {
+    ArrowStyle fillstyle = state.getArrowFill(speed);
+    ArrowStyle strokestyle = state.getArrowStroke(speed);
+    colors.push_back(fillstyle.color);
+    colors.push_back(strokestyle.color);
+    rules.push_back(fillstyle.rule);
+    rules.push_back(strokestyle.rule);
   }
 
-  bool speedok = (speedvalues.NX() != 0 && speedvalues.NY() != 0);
+  for (unsigned int i = 0; i < rules.size(); i++)
+    if (!ColorTools::blendable(rules[i])) return false;
 
-  boost::shared_ptr<NFmiDataMatrix<NFmiPoint>> worldpts =
-      globals.queryinfo->LocationsWorldXY(theArea);
-  for (float y = 0; y <= worldpts->NY() - 1; y += globals.windarrowdy)
-    for (float x = 0; x <= worldpts->NX() - 1; x += globals.windarrowdx)
-    {
-      // The start point
+  // The shape of the arrow
 
-      const int i = static_cast<int>(floor(x));
-      const int j = static_cast<int>(floor(y));
+  int direction = static_cast<int>(round(fmod(angle, 360.0)));
+  if (direction < 0) direction += 360;
 
-      NFmiPoint bad(kFloatMissing, kFloatMissing);
-      NFmiPoint xy = NFmiInterpolation::BiLinear(x - i,
-                                                 y - j,
-                                                 worldpts->At(i, j + 1, bad),
-                                                 worldpts->At(i + 1, j + 1, bad),
-                                                 worldpts->At(i, j, bad),
-                                                 worldpts->At(i + 1, j, bad));
+  double scale = state.arrowscale;
+  if (!roundarrow && speed > 0 && speed != kFloatMissing)
+    scale *= state.windarrowscaleA * log10(state.windarrowscaleB * speed + 1) +
+             state.windarrowscaleC;
+  scale = round(scale * 100) / 100;
 
-      NFmiPoint latlon = theArea.WorldXYToLatLon(xy);
-      // latlon = MeridianTools::Relocate(latlon,theArea);
-      NFmiPoint xy0 = theArea.ToXY(latlon);
+  ostringstream key;
+  key << state.arrowfile << ' ' << direction;
 
-      // Skip rendering if the start point is masked
-      if (IsMasked(xy0, globals.mask)) continue;
+  RoundArrowSize sz;
+  if (roundarrow)
+  {
+    sz = state.getRoundArrowSize(speed);
+    key << ' ' << sz.circleradius << ' ' << sz.triangleradius << ' ' << sz.trianglewidth << ' '
+        << sz.triangleangle;
+  }
+  else
+  {
+    key << ' ' << scale;
+    if (meteorological)
+      key << ' ' << (speed == kFloatMissing ? -1 : GramTools::knots(speed)) << ' '
+          << (latlon.Y() < 0);
+  }
 
-      // Skip rendering if the start point is way outside the image
+  const ArrowAtlas::Sprite *sprite = theContext.caches.arrowatlas.find(key.str());
 
-      const int safetymargin = 50;
-      if (xy0.X() < -safetymargin || xy0.Y() < -safetymargin ||
-          xy0.X() > img.Width() + safetymargin || xy0.Y() > img.Height() + safetymargin)
-        continue;
+  if (sprite == 0)
+  {
+    ArrowAtlas::Parts parts;
+    const NFmiPoint origin(0, 0);
 
-      // Render the arrow
+    if (roundarrow)
+    {
+      NFmiPath triangle = roundarrow_triangle(origin, direction, sz);
+      NFmiPath circle = roundarrow_circle(origin, sz);
+      parts.push_back(ArrowAtlas::Part(triangle, true));
+      parts.push_back(ArrowAtlas::Part(triangle, false));
+      parts.push_back(ArrowAtlas::Part(circle, true));
+      parts.push_back(ArrowAtlas::Part(circle, false));
+    }
+    else if (meteorological)
+    {
+      NFmiPath strokes = GramTools::metarrowlines(speed, latlon);
+      NFmiPath flags = GramTools::metarrowflags(speed, latlon);
+      strokes.Scale(scale);
+      strokes.Rotate(direction);
+      flags.Scale(scale);
+      flags.Rotate(direction);
+      parts.push_back(ArrowAtlas::Part(strokes, false));
+      parts.push_back(ArrowAtlas::Part(flags, true));
+    }
+    else
+    {
+      NFmiPath arrowpath;
+      arrowpath.Add(theArrow);
+      arrowpath.Scale(scale);
+      arrowpath.Rotate(direction);
+      parts.push_back(ArrowAtlas::Part(arrowpath, true));
+      parts.push_back(ArrowAtlas::Part(arrowpath, false));
+    }
 
-      double dir = NFmiInterpolation::ModBiLinear(x - i,
-                                                  y - j,
-                                                  dirvalues.At(i, j + 1, kFloatMissing),
-                                                  dirvalues.At(i + 1, j + 1, kFloatMissing),
-                                                  dirvalues.At(i, j, kFloatMissing),
-                                                  dirvalues.At(i + 1, j, kFloatMissing),
-                                                  360);
+    sprite = &theContext.caches.arrowatlas.insert(key.str(), parts, state.arrowspritesize);
+  }
 
-      if (dir == kFloatMissing)  // ignore missing
-        continue;
+  if (!sprite->fits()) return false;
 
-      double speed = NFmiInterpolation::BiLinear(x - i,
-                                                 y - j,
-                                                 speedvalues.At(i, j + 1, kFloatMissing),
-                                                 speedvalues.At(i + 1, j + 1, kFloatMissing),
-                                                 speedvalues.At(i, j, kFloatMissing),
-                                                 speedvalues.At(i + 1, j, kFloatMissing));
+  const int x = static_cast<int>(round(xy0.X()));
+  const int y = static_cast<int>(round(xy0.Y()));
 
-      if (speedok && speed == kFloatMissing)  // ignore missing
-        continue;
+  for (unsigned int i = 0; i < sprite->layers(); i++)
+    sprite->draw(img, i, x, y, colors[i], rules[i]);
 
-      // Direction calculations
+  return true;
+}
 
-      const float north = paper_north(theArea, latlon);
+#endif
 
-      // Render the arrow
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw a single wind arrow
+ *
+ * \param img The image to draw into
+ * \param theArrow The custom arrow path
+ * \param xy0 The image coordinates of the arrow
+ * \param latlon The geographic coordinates of the arrow
+ * \param speed The wind speed
+ * \param angle The rotation of the arrow in degrees
+ */
+// ----------------------------------------------------------------------
 
-      if (globals.arrowfile == "roundarrow")
-      {
-        draw_roundarrow(img, xy0, speed, -dir + north + 180);
-      }
-      else
-      {
-        if (globals.arrowfile == "meteorological")
-        {
-          NFmiPath strokes;
-          NFmiPath flags;
+void draw_wind_arrow(RenderContext &theContext,
+                     ImagineXr_or_NFmiImage &img,
+                     const NFmiPath &theArrow,
+                     const NFmiPoint &xy0,
+                     const NFmiPoint &latlon,
+                     float speed,
+                     double angle)
+{
+  JobState &state = theContext.state;
 
-          strokes.Add(GramTools::metarrowlines(speed, latlon));
-          flags.Add(GramTools::metarrowflags(speed, latlon));
+#ifndef IMAGINE_WITH_CAIRO
+  if (state.arrowspritesize > 0 &&
+      draw_wind_arrow_sprite(theContext, img, theArrow, xy0, latlon, speed, angle))
+    return;
+#endif
 
-          if (speed > 0 && speed != kFloatMissing)
-          {
-            strokes.Scale(globals.windarrowscaleA * log10(globals.windarrowscaleB * speed + 1) +
-                          globals.windarrowscaleC);
-            flags.Scale(globals.windarrowscaleA * log10(globals.windarrowscaleB * speed + 1) +
-                        globals.windarrowscaleC);
-          }
+  if (state.arrowfile == "roundarrow")
+  {
+    draw_roundarrow(theContext, img, xy0, speed, angle);
+  }
+  else if (state.arrowfile == "meteorological")
+  {
+    NFmiPath strokes;
+    NFmiPath flags;
 
-          strokes.Scale(globals.arrowscale);
-          strokes.Rotate(-dir + north + 180);
-          strokes.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
+    strokes.Add(GramTools::metarrowlines(speed, latlon));
+    flags.Add(GramTools::metarrowflags(speed, latlon));
 
-          flags.Scale(globals.arrowscale);
-          flags.Rotate(-dir + north + 180);
-          flags.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
+    if (speed > 0 && speed != kFloatMissing)
+    {
+      strokes.Scale(state.windarrowscaleA * log10(state.windarrowscaleB * speed + 1) +
+                    state.windarrowscaleC);
+      flags.Scale(state.windarrowscaleA * log10(state.windarrowscaleB * speed + 1) +
+                  state.windarrowscaleC);
+    }
 
-          ArrowStyle style = globals.getArrowStroke(speed);
-          strokes.Stroke(img, style.color, style.rule);
-          flags.Fill(img, style.color, style.rule);
-        }
-        else
-        {
-          NFmiPath arrowpath;
-          arrowpath.Add(theArrow);
+    strokes.Scale(state.arrowscale);
+    strokes.Rotate(angle);
+    strokes.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
 
-          if (speed > 0 && speed != kFloatMissing)
-            arrowpath.Scale(globals.windarrowscaleA * log10(globals.windarrowscaleB * speed + 1) +
-                            globals.windarrowscaleC);
-          arrowpath.Scale(globals.arrowscale);
-          arrowpath.Rotate(-dir + north + 180);
-          arrowpath.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
+    flags.Scale(state.arrowscale);
+    flags.Rotate(angle);
+    flags.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
 
-          // And render it
+    ArrowStyle style = state.getArrowStroke(speed);
+    strokes.Stroke(img, style.color, style.rule);
+    flags.Fill(img, style.color, style.rule);
+  }
+  else
+  {
+    NFmiPath arrowpath;
+    arrowpath.Add(theArrow);
 
-          ArrowStyle fillstyle = globals.getArrowFill(speed);
-          arrowpath.Fill(img, fillstyle.color, fillstyle.rule);
+    if (speed > 0 && speed != kFloatMissing)
+      arrowpath.Scale(state.windarrowscaleA * log10(state.windarrowscaleB * speed + 1) +
+                      state.windarrowscaleC);
+    arrowpath.Scale(state.arrowscale);
+    arrowpath.Rotate(angle);
+    arrowpath.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
 
-          ArrowStyle strokestyle = globals.getArrowStroke(speed);
-          arrowpath.Stroke(img, strokestyle.color, strokestyle.rule);
-        }
-      }
-    }
+    // And render it
+
+    ArrowStyle fillstyle = state.getArrowFill(speed);
+    arrowpath.Fill(img, fillstyle.color, fillstyle.rule);
+
+    ArrowStyle strokestyle = state.getArrowStroke(speed);
+    arrowpath.Stroke(img, strokestyle.color, strokestyle.rule);
+  }
 }
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Draw the wind arrows in image coordinates
+ * \brief Draw wind arrows at the given points
  */
 // ----------------------------------------------------------------------
 
-void draw_wind_arrows_pixelgrid(ImagineXr_or_NFmiImage &img,
-                                const NFmiArea &theArea,
-                                const NFmiPath &theArrow,
-                                float direction_src,
-                                float direction_dst,
-                                float speed_src,
-                                float speed_dst)
+void draw_wind_arrows_at(RenderContext &theContext,
+                         ImagineXr_or_NFmiImage &img,
+                         const NFmiArea &theArea,
+                         const NFmiPath &theArrow,
+                         const PixelGridLookup::PixelPoints &thePoints,
+                         const WindFields &theFields,
+                         float direction_src,
+                         float direction_dst,
+                         float speed_src,
+                         float speed_dst)
+{
+  // Calculate the speed & direction values
+
+  vector<float> speeds;
+  vector<float> directions;
+
+  get_speed_direction(theContext,
+                      thePoints,
+                      theFields,
+                      speed_src,
+                      speed_dst,
+                      direction_src,
+                      direction_dst,
+                      speeds,
+                      directions);
+
+  for (unsigned int k = 0; k < thePoints.size(); k++)
+  {
+    const NFmiPoint &xy0 = thePoints[k].xy;
+    const NFmiPoint &latlon = thePoints[k].latlon;
+
+    const float dir = directions[k];
+    const float speed = speeds[k];
+
+    // Ignore missing values
+
+    if (dir == kFloatMissing || speed == kFloatMissing) continue;
+
+    // Direction calculations
+
+    const float north = thePoints[k].north;
+
+    // Render the arrow
+
+    draw_wind_arrow(theContext, img, theArrow, xy0, latlon, speed, -dir + north + 180);
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw the listed wind arrow points
+ */
+// ----------------------------------------------------------------------
+
+void draw_wind_arrows_points(RenderContext &theContext,
+                             ImagineXr_or_NFmiImage &img,
+                             const NFmiArea &theArea,
+                             const NFmiPath &theArrow,
+                             const WindFields &theFields,
+                             float direction_src,
+                             float direction_dst,
+                             float speed_src,
+                             float speed_dst)
+{
+  JobState &state = theContext.state;
+
+  // The projected coordinates are cached
+
+  const NFmiGrid *grid = theContext.queryinfo->Grid();
+  PixelGridLookup &lookup =
+      (grid != 0 ? theContext.caches.getPixelGridLookup(
+                       theArea, img.Width(), img.Height(), *grid)
+                 : theContext.caches.getPixelGridLookup(theArea, img.Width(), img.Height()));
+  const PixelGridLookup::PixelPoints &allpoints = lookup.latlonPoints(state.arrowpoints);
+
+  // Collect the points which are not masked
+
+  PixelGridLookup::PixelPoints points;
+  for (unsigned int k = 0; k < allpoints.size(); k++)
+    if (!IsMasked(theContext, allpoints[k].xy, state.mask)) points.push_back(allpoints[k]);
+
+  draw_wind_arrows_at(theContext,
+                      img,
+                      theArea,
+                      theArrow,
+                      points,
+                      theFields,
+                      direction_src,
+                      direction_dst,
+                      speed_src,
+                      speed_dst);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw the data gridded wind arrow points
+ */
+// ----------------------------------------------------------------------
+
+void draw_wind_arrows_grid(RenderContext &theContext,
+                           ImagineXr_or_NFmiImage &img,
+                           const NFmiArea &theArea,
+                           const NFmiPath &theArrow,
+                           const WindFields &theFields,
+                           float direction_src,
+                           float direction_dst,
+                           float speed_src,
+                           float speed_dst)
 {
+  JobState &state = theContext.state;
+
   // Draw the full grid if so desired
 
-  if (globals.windarrowsxydx <= 0 || globals.windarrowsxydy <= 0) return;
+  if (state.windarrowdx <= 0 || state.windarrowdy <= 0) return;
 
-  for (float y = globals.windarrowsxyy0; y <= img.Height(); y += globals.windarrowsxydy)
-    for (float x = globals.windarrowsxyx0; x <= img.Width(); x += globals.windarrowsxydx)
-    {
-      NFmiPoint xy0(x, y);
+  NFmiDataMatrix<float> speedvalues, dirvalues;
+
+  get_speed_direction(theContext,
+                      img,
+                      theArea,
+                      theFields,
+                      speed_src,
+                      speed_dst,
+                      direction_src,
+                      direction_dst,
+                      speedvalues,
+                      dirvalues);
 
-      // Skip the point if it is masked
-      if (IsMasked(xy0, globals.mask)) continue;
+  if (dirvalues.NX() == 0 || dirvalues.NY() == 0)
+  {
+    return;
+  }
 
-      // Calculate the latlon value
+  bool speedok = (speedvalues.NX() != 0 && speedvalues.NY() != 0);
 
-      NFmiPoint latlon = theArea.ToLatLon(xy0);
+  const NFmiGrid *grid = theContext.queryinfo->Grid();
+  if (grid == 0) return;
 
-      // Calculate the speed & direction values
+  // The sampled points are cached
 
-      float dir, speed;
+  PixelGridLookup &lookup =
+      theContext.caches.getPixelGridLookup(theArea, img.Width(), img.Height(), *grid);
+  const PixelGridLookup::PixelPoints &points = lookup.gridPoints(
+      state.windarrowdx, state.windarrowdy, *theContext.queryinfo->LocationsWorldXY(theArea));
 
-      get_speed_direction(
-          theArea, latlon, speed_src, speed_dst, direction_src, direction_dst, speed, dir);
+  for (unsigned int k = 0; k < points.size(); k++)
+  {
+    // The start point
 
-      // Ignore missing values
+    const NFmiPoint &xy0 = points[k].xy;
+    const NFmiPoint &latlon = points[k].latlon;
 
-      if (dir == kFloatMissing || speed == kFloatMissing) continue;
+    // Skip rendering if the start point is masked
+    if (IsMasked(theContext, xy0, state.mask)) continue;
 
-      // Direction calculations
+    // Skip rendering if the start point is way outside the image
 
-      const float north = paper_north(theArea, latlon);
+    const int safetymargin = 50;
+    if (xy0.X() < -safetymargin || xy0.Y() < -safetymargin ||
+        xy0.X() > img.Width() + safetymargin || xy0.Y() > img.Height() + safetymargin)
+      continue;
 
-      // Render the arrow
+    // Render the arrow
 
-      if (globals.arrowfile == "roundarrow")
-      {
-        draw_roundarrow(img, xy0, speed, -dir + north + 180);
-      }
-      else
-      {
-        if (globals.arrowfile == "meteorological")
-        {
-          NFmiPath strokes;
-          NFmiPath flags;
+    const double x = points[k].grid.X();
+    const double y = points[k].grid.Y();
+    const int i = static_cast<int>(floor(x));
+    const int j = static_cast<int>(floor(y));
 
-          strokes.Add(GramTools::metarrowlines(speed, latlon));
-          flags.Add(GramTools::metarrowflags(speed, latlon));
+    double dir = NFmiInterpolation::ModBiLinear(x - i,
+                                                y - j,
+                                                dirvalues.At(i, j + 1, kFloatMissing),
+                                                dirvalues.At(i + 1, j + 1, kFloatMissing),
+                                                dirvalues.At(i, j, kFloatMissing),
+                                                dirvalues.At(i + 1, j, kFloatMissing),
+                                                360);
 
-          if (speed > 0 && speed != kFloatMissing)
-          {
-            strokes.Scale(globals.windarrowscaleA * log10(globals.windarrowscaleB * speed + 1) +
-                          globals.windarrowscaleC);
-            flags.Scale(globals.windarrowscaleA * log10(globals.windarrowscaleB * speed + 1) +
-                        globals.windarrowscaleC);
-          }
+    if (dir == kFloatMissing)  // ignore missing
+      continue;
 
-          strokes.Scale(globals.arrowscale);
-          strokes.Rotate(-dir + north + 180);
-          strokes.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
+    float speed = static_cast<float>(
+        NFmiInterpolation::BiLinear(x - i,
+                                    y - j,
+                                    speedvalues.At(i, j + 1, kFloatMissing),
+                                    speedvalues.At(i + 1, j + 1, kFloatMissing),
+                                    speedvalues.At(i, j, kFloatMissing),
+                                    speedvalues.At(i + 1, j, kFloatMissing)));
 
-          flags.Scale(globals.arrowscale);
-          flags.Rotate(-dir + north + 180);
-          flags.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
+    if (speedok && speed == kFloatMissing)  // ignore missing
+      continue;
 
-          ArrowStyle style = globals.getArrowStroke(speed);
-          strokes.Stroke(img, style.color, style.rule);
-          flags.Fill(img, style.color, style.rule);
-        }
-        else
-        {
-          NFmiPath arrowpath;
-          arrowpath.Add(theArrow);
+    // Direction calculations
 
-          if (speed > 0 && speed != kFloatMissing)
-            arrowpath.Scale(globals.windarrowscaleA * log10(globals.windarrowscaleB * speed + 1) +
-                            globals.windarrowscaleC);
-          arrowpath.Scale(globals.arrowscale);
-          arrowpath.Rotate(-dir + north + 180);
-          arrowpath.Translate(static_cast<float>(xy0.X()), static_cast<float>(xy0.Y()));
+    const float north = points[k].north;
 
-          // And render it
+    // Render the arrow
 
-          ArrowStyle fillstyle = globals.getArrowFill(speed);
-          arrowpath.Fill(img, fillstyle.color, fillstyle.rule);
+    draw_wind_arrow(theContext, img, theArrow, xy0, latlon, speed, -dir + north + 180);
+  }
+}
 
-          ArrowStyle strokestyle = globals.getArrowStroke(speed);
-          arrowpath.Stroke(img, strokestyle.color, strokestyle.rule);
-        }
-      }
-    }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw the wind arrows in image coordinates
+ */
+// ----------------------------------------------------------------------
+
+void draw_wind_arrows_pixelgrid(RenderContext &theContext,
+                                ImagineXr_or_NFmiImage &img,
+                                const NFmiArea &theArea,
+                                const NFmiPath &theArrow,
+                                const WindFields &theFields,
+                                float direction_src,
+                                float direction_dst,
+                                float speed_src,
+                                float speed_dst)
+{
+  JobState &state = theContext.state;
+
+  // Draw the full grid if so desired
+
+  if (state.windarrowsxydx <= 0 || state.windarrowsxydy <= 0) return;
+
+  // The projected coordinates are cached
+
+  const NFmiGrid *grid = theContext.queryinfo->Grid();
+  PixelGridLookup &lookup =
+      (grid != 0 ? theContext.caches.getPixelGridLookup(
+                       theArea, img.Width(), img.Height(), *grid)
+                 : theContext.caches.getPixelGridLookup(theArea, img.Width(), img.Height()));
+  const PixelGridLookup::PixelPoints &points = lookup.pixelPoints(
+      state.windarrowsxyx0, state.windarrowsxyy0, state.windarrowsxydx, state.windarrowsxydy);
+
+  // Skip the masked points
+
+  const PixelGridLookup::PixelPoints unmasked =
+      mask_bitmap(theContext, state.mask).unmasked(points);
+
+  draw_wind_arrows_at(theContext,
+                      img,
+                      theArea,
+                      theArrow,
+                      unmasked,
+                      theFields,
+                      direction_src,
+                      direction_dst,
+                      speed_src,
+                      speed_dst);
 }
 
 // ----------------------------------------------------------------------
@@ -3995,23 +4879,27 @@ void draw_wind_arrows_pixelgrid(ImagineXr_or_NFmiImage &img,
  */
 // ----------------------------------------------------------------------
 
-void draw_wind_arrows(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
+void draw_wind_arrows(RenderContext &theContext,
+                      ImagineXr_or_NFmiImage &img,
+                      const NFmiArea &theArea)
 {
-  if ((!globals.arrowpoints.empty() || (globals.windarrowdx > 0 && globals.windarrowdy > 0) ||
-       (globals.windarrowsxydx > 0 && globals.windarrowsxydy > 0)) &&
-      (globals.arrowfile != ""))
+  JobState &state = theContext.state;
+
+  if ((!state.arrowpoints.empty() || (state.windarrowdx > 0 && state.windarrowdy > 0) ||
+       (state.windarrowsxydx > 0 && state.windarrowsxydy > 0)) &&
+      (state.arrowfile != ""))
   {
     FmiParameterName param;
     std::string name;
-    if (!globals.directionparam.empty())
+    if (!state.directionparam.empty())
     {
-      param = toparam(globals.directionparam);
-      name = globals.directionparam;
+      param = toparam(state.directionparam);
+      name = state.directionparam;
     }
     else
     {
-      param = toparam(globals.speedxcomponent);
-      name = globals.speedxcomponent;
+      param = toparam(state.speedxcomponent);
+      name = state.speedxcomponent;
     }
 
     if (param == kFmiBadParameter) throw runtime_error("Unknown parameter " + name);
@@ -4019,11 +4907,11 @@ void draw_wind_arrows(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
     // Find the proper queryinfo to be used
 
     bool ok = false;
-    for (unsigned int qi = 0; qi < globals.querystreams.size(); qi++)
+    for (unsigned int qi = 0; qi < theContext.querystreams.size(); qi++)
     {
-      globals.queryinfo = globals.querystreams[qi];
-      globals.queryinfo->Param(param);
-      ok = globals.queryinfo->IsParamUsable();
+      theContext.queryinfo = theContext.querystreams[qi];
+      theContext.queryinfo->Param(param);
+      ok = theContext.queryinfo->IsParamUsable();
       if (ok) break;
     }
 
@@ -4032,17 +4920,17 @@ void draw_wind_arrows(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
     // Read the arrow definition
 
     NFmiPath arrowpath;
-    if (globals.arrowfile != "meteorological" && globals.arrowfile != "roundarrow")
+    if (state.arrowfile != "meteorological" && state.arrowfile != "roundarrow")
     {
-      const string &arr = globals.itsArrowCache.find(globals.arrowfile);
+      const string &arr = theContext.caches.itsArrowCache.find(state.arrowfile);
       arrowpath.Add(arr);
     }
 
     // Establish data replacement values
 
     list<ContourSpec>::iterator piter;
-    list<ContourSpec>::iterator pbegin = globals.specs.begin();
-    list<ContourSpec>::iterator pend = globals.specs.end();
+    list<ContourSpec>::iterator pbegin = state.specs.begin();
+    list<ContourSpec>::iterator pend = state.specs.end();
 
     float direction_src = kFloatMissing;
     float direction_dst = kFloatMissing;
@@ -4051,39 +4939,173 @@ void draw_wind_arrows(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
 
     for (piter = pbegin; piter != pend; ++piter)
     {
-      if (piter->param() == globals.directionparam && piter->replace())
+      if (piter->param() == state.directionparam && piter->replace())
       {
         direction_src = piter->replaceSourceValue();
         direction_dst = piter->replaceTargetValue();
       }
-      else if (piter->param() == globals.speedparam && piter->replace())
+      else if (piter->param() == state.speedparam && piter->replace())
       {
         speed_src = piter->replaceSourceValue();
         speed_dst = piter->replaceTargetValue();
       }
     }
 
-    draw_wind_arrows_points(
-        img, theArea, arrowpath, direction_src, direction_dst, speed_src, speed_dst);
-    draw_wind_arrows_grid(
-        img, theArea, arrowpath, direction_src, direction_dst, speed_src, speed_dst);
-    draw_wind_arrows_pixelgrid(
-        img, theArea, arrowpath, direction_src, direction_dst, speed_src, speed_dst);
+    // Fetch the wind values once for all the arrows
+
+    WindFields fields;
+    get_wind_fields(theContext, fields);
+
+    draw_wind_arrows_points(theContext,
+                            img,
+                            theArea,
+                            arrowpath,
+                            fields,
+                            direction_src,
+                            direction_dst,
+                            speed_src,
+                            speed_dst);
+    draw_wind_arrows_grid(theContext,
+                          img,
+                          theArea,
+                          arrowpath,
+                          fields,
+                          direction_src,
+                          direction_dst,
+                          speed_src,
+                          speed_dst);
+    draw_wind_arrows_pixelgrid(theContext,
+                               img,
+                               theArea,
+                               arrowpath,
+                               fields,
+                               direction_src,
+                               direction_dst,
+                               speed_src,
+                               speed_dst);
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Calculate a projected fill path ready for rendering
+ *
+ * The contour is projected, clipped to the image and simplified.
+ * When caching is on the final path is cached too, since projecting
+ * and simplifying large paths is expensive compared to filling them.
+ * The projection, the image size and the simplification settings
+ * are part of the cache key.
+ */
+// ----------------------------------------------------------------------
+
+template <typename T>
+NFmiPath contour_fill_path(RenderContext &theContext,
+                           const T &img,
+                           const NFmiArea &theArea,
+                           float theLoLimit,
+                           float theHiLimit,
+                           const NFmiTime &theTime,
+                           ContourInterpolation theInterpolation)
+{
+  JobState &state = theContext.state;
+
+  string variant;
+  if (state.contourcache)
+  {
+    ostringstream os;
+    os << theArea << '_' << img.Width() << 'x' << img.Height() << '_'
+       << state.contourfillsimplifytolerance << '_' << state.contourfillsimplifyarea;
+    variant = os.str();
+
+    if (theContext.caches.projectedcache.contains(
+            theLoLimit, theHiLimit, theTime, *theContext.queryinfo, variant))
+    {
+      if (theContext.verbose)
+        cout << "Using cached projected " << theLoLimit << " - " << theHiLimit << endl;
+      return theContext.caches.projectedcache.find(
+          theLoLimit, theHiLimit, theTime, *theContext.queryinfo, variant);
+    }
   }
+
+  NFmiPath path = theContext.calculator->contour(
+      *theContext.queryinfo, theLoLimit, theHiLimit, theTime, theInterpolation);
+
+  if (theContext.verbose && theContext.calculator->wasCached())
+    cout << "Using cached " << theLoLimit << " - " << theHiLimit << endl;
+
+  ContourRenderer::Options options;
+  options.simplifytolerance = state.contourfillsimplifytolerance;
+  options.simplifyarea = state.contourfillsimplifyarea;
+  path = ContourRenderer::fillPath(
+      path, theArea, theLoLimit, theHiLimit, img.Width(), img.Height(), options);
+
+  if (state.contourcache)
+    theContext.caches.projectedcache.insert(
+        path, theLoLimit, theHiLimit, theTime, *theContext.queryinfo, variant);
+
+  return path;
+}
+
+#ifndef IMAGINE_WITH_CAIRO
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw contour fills directly from the grid
+ *
+ * Used when contourfillmode is raster and the interpolation follows
+ * the grid cell edges. The pixel to grid mapping is cached per area.
+ * Returns false if the caller should contour normally.
+ */
+// ----------------------------------------------------------------------
+
+bool draw_contour_raster(RenderContext &theContext,
+                         NFmiImage &img,
+                         const NFmiArea &theArea,
+                         const ContourSpec &theSpec,
+                         const NFmiDataMatrix<float> &theValues,
+                         ContourInterpolation theInterpolation)
+{
+  JobState &state = theContext.state;
+
+  if (state.contourfillmode != "raster") return false;
+  if (theInterpolation != Nearest && theInterpolation != Discrete) return false;
+
+  const list<ContourRange> &fills = theSpec.contourFills();
+  if (fills.empty()) return false;
+
+  const NFmiGrid *grid = theContext.queryinfo->Grid();
+  if (grid == 0) return false;
+
+  PixelGridLookup &lookup =
+      theContext.caches.getPixelGridLookup(theArea, img.Width(), img.Height(), *grid);
+  if (!ContourRenderer::fillRaster(img, theSpec, theValues, lookup, state.threads)) return false;
+
+  if (theContext.verbose) cout << "Filled " << fills.size() << " contours as a raster" << endl;
+  return true;
 }
 
+#endif
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Draw contour fills
  */
 // ----------------------------------------------------------------------
 
-void draw_contour_fills(ImagineXr_or_NFmiImage &img,
+void draw_contour_fills(RenderContext &theContext,
+                        ImagineXr_or_NFmiImage &img,
                         const NFmiArea &theArea,
                         const ContourSpec &theSpec,
                         const NFmiTime &theTime,
-                        ContourInterpolation theInterpolation)
+                        ContourInterpolation theInterpolation,
+                        const NFmiDataMatrix<float> &theValues)
 {
+  JobState &state = theContext.state;
+
+#ifndef IMAGINE_WITH_CAIRO
+  if (draw_contour_raster(theContext, img, theArea, theSpec, theValues, theInterpolation)) return;
+#endif
+
   list<ContourRange>::const_iterator it;
   list<ContourRange>::const_iterator begin;
   list<ContourRange>::const_iterator end;
@@ -4091,29 +5113,45 @@ void draw_contour_fills(ImagineXr_or_NFmiImage &img,
   begin = theSpec.contourFills().begin();
   end = theSpec.contourFills().end();
 
+#ifndef IMAGINE_WITH_CAIRO
+  // Collect consecutive fills to be rendered in a single pass
+
+  const bool scanline = (state.contourrasterizer == "scanline");
+  BandRasterizer rasterizer(img.Width(), img.Height());
+#endif
+
   for (it = begin; it != end; ++it)
   {
     // Contour the actual data
 
-    if (globals.verbose) cout << "Calculating " << it->lolimit() << " - " << it->hilimit() << endl;
+    if (theContext.verbose)
+      cout << "Calculating " << it->lolimit() << " - " << it->hilimit() << endl;
 
-    NFmiPath path = globals.calculator.contour(
-        *globals.queryinfo, it->lolimit(), it->hilimit(), theTime, theInterpolation);
+    NFmiPath path = contour_fill_path(
+        theContext, img, theArea, it->lolimit(), it->hilimit(), theTime, theInterpolation);
 
-    if (globals.verbose && globals.calculator.wasCached())
-      cout << "Using cached " << it->lolimit() << " - " << it->hilimit() << endl;
-
-    // Avoid unnecessary work if the path is empty
-    if (path.Empty() && it->lolimit() != kFloatMissing && it->hilimit() != kFloatMissing) continue;
-
-    // MeridianTools::Relocate(path,theArea);
-    path.Project(&theArea);
-    invert_if_missing(path, it->lolimit(), it->hilimit());
+    if (path.Empty()) continue;
 
     NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(it->rule());
 
+#ifndef IMAGINE_WITH_CAIRO
+    if (scanline)
+    {
+      if (BandRasterizer::supports(path, rule))
+      {
+        rasterizer.add(path, it->color(), rule);
+        continue;
+      }
+      rasterizer.fill(img, state.threads);
+    }
+#endif
+
     path.Fill(img, it->color(), rule);
   }
+
+#ifndef IMAGINE_WITH_CAIRO
+  rasterizer.fill(img, state.threads);
+#endif
 }
 
 // ----------------------------------------------------------------------
@@ -4122,7 +5160,8 @@ void draw_contour_fills(ImagineXr_or_NFmiImage &img,
  */
 // ----------------------------------------------------------------------
 
-void draw_contour_patterns(ImagineXr_or_NFmiImage &img,
+void draw_contour_patterns(RenderContext &theContext,
+                           ImagineXr_or_NFmiImage &img,
                            const NFmiArea &theArea,
                            const ContourSpec &theSpec,
                            const NFmiTime &theTime,
@@ -4137,18 +5176,13 @@ void draw_contour_patterns(ImagineXr_or_NFmiImage &img,
 
   for (it = begin; it != end; ++it)
   {
-    NFmiPath path = globals.calculator.contour(
-        *globals.queryinfo, it->lolimit(), it->hilimit(), theTime, theInterpolation);
+    NFmiPath path = contour_fill_path(
+        theContext, img, theArea, it->lolimit(), it->hilimit(), theTime, theInterpolation);
 
-    if (globals.verbose && globals.calculator.wasCached())
-      cout << "Using cached " << it->lolimit() << " - " << it->hilimit() << endl;
+    if (path.Empty()) continue;
 
     NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(it->rule());
-    const ImagineXr_or_NFmiImage &pattern = globals.getImage(it->pattern());
-
-    // MeridianTools::Relocate(path,theArea);
-    path.Project(&theArea);
-    invert_if_missing(path, it->lolimit(), it->hilimit());
+    const ImagineXr_or_NFmiImage &pattern = theContext.caches.getImage(it->pattern());
 
     path.Fill(img, pattern, rule, it->factor());
   }
@@ -4160,7 +5194,8 @@ void draw_contour_patterns(ImagineXr_or_NFmiImage &img,
  */
 // ----------------------------------------------------------------------
 
-void draw_contour_strokes(ImagineXr_or_NFmiImage &img,
+void draw_contour_strokes(RenderContext &theContext,
+                          ImagineXr_or_NFmiImage &img,
                           const NFmiArea &theArea,
                           const ContourSpec &theSpec,
                           const NFmiTime &theTime,
@@ -4173,24 +5208,35 @@ void draw_contour_strokes(ImagineXr_or_NFmiImage &img,
   begin = theSpec.contourValues().begin();
   end = theSpec.contourValues().end();
 
+#ifndef IMAGINE_WITH_CAIRO
+  // Collect the strokes to be rendered in parallel stripes
+  StripeStroker stroker;
+#endif
+
   for (it = begin; it != end; ++it)
   {
-    NFmiPath path =
-        globals.calculator.contour(*globals.queryinfo, it->value(), theTime, theInterpolation);
+    NFmiPath path = theContext.calculator->contour(
+        *theContext.queryinfo, it->value(), theTime, theInterpolation);
 
-    if (globals.verbose && globals.calculator.wasCached())
+    if (theContext.verbose && theContext.calculator->wasCached())
       cout << "Using cached " << it->value() << endl;
 
     NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(it->rule());
-    // MeridianTools::Relocate(path,theArea);
-    path.Project(&theArea);
-    path.SimplifyLines(10);
     float width = it->linewidth();
+    path = ContourRenderer::strokePath(path, theArea, width, img.Width(), img.Height());
+#ifndef IMAGINE_WITH_CAIRO
+    stroker.add(path, width, it->color(), rule);
+#else
     if (width == 1)
       path.Stroke(img, it->color(), rule);
     else
       path.Stroke(img, width, it->color(), rule);
+#endif
   }
+
+#ifndef IMAGINE_WITH_CAIRO
+  stroker.stroke(img, theContext.state.threads);
+#endif
 }
 
 // ----------------------------------------------------------------------
@@ -4199,16 +5245,19 @@ void draw_contour_strokes(ImagineXr_or_NFmiImage &img,
  */
 // ----------------------------------------------------------------------
 
-void save_contour_labels(ImagineXr_or_NFmiImage &img,
+void save_contour_labels(RenderContext &theContext,
+                         ImagineXr_or_NFmiImage &img,
                          const NFmiArea &theArea,
                          const ContourSpec &theSpec,
                          const NFmiTime &theTime,
                          ContourInterpolation theInterpolation)
 {
+  JobState &state = theContext.state;
+
   // The ID under which the coordinates will be stored
 
   int id = paramid(theSpec.param());
-  globals.labellocator.parameter(id);
+  state.labellocator.parameter(id);
 
   // Start saving candindate coordinates
 
@@ -4221,8 +5270,8 @@ void save_contour_labels(ImagineXr_or_NFmiImage &img,
 
   for (it = begin; it != end; ++it)
   {
-    NFmiPath path =
-        globals.calculator.contour(*globals.queryinfo, it->value(), theTime, theInterpolation);
+    NFmiPath path = theContext.calculator->contour(
+        *theContext.queryinfo, it->value(), theTime, theInterpolation);
 
     // MeridianTools::Relocate(path,theArea);
     path.Project(&theArea);
@@ -4232,7 +5281,7 @@ void save_contour_labels(ImagineXr_or_NFmiImage &img,
     {
       if (pit->op == kFmiLineTo)
       {
-        globals.labellocator.add(
+        state.labellocator.add(
             it->value(), static_cast<int>(round(pit->x)), static_cast<int>(round(pit->y)));
       }
     }
@@ -4245,17 +5294,19 @@ void save_contour_labels(ImagineXr_or_NFmiImage &img,
  */
 // ----------------------------------------------------------------------
 
-void draw_contour_labels(ImagineXr_or_NFmiImage &img)
+void draw_contour_labels(RenderContext &theContext, ImagineXr_or_NFmiImage &img)
 {
-  const LabelLocator::ParamCoordinates &coords = globals.labellocator.chooseLabels();
+  JobState &state = theContext.state;
+
+  const LabelLocator::ParamCoordinates &coords = state.labellocator.chooseLabels();
 
   if (coords.empty()) return;
 
   // Iterate through all parameters
 
   list<ContourSpec>::iterator piter;
-  list<ContourSpec>::iterator pbegin = globals.specs.begin();
-  list<ContourSpec>::iterator pend = globals.specs.end();
+  list<ContourSpec>::iterator pbegin = state.specs.begin();
+  list<ContourSpec>::iterator pend = state.specs.end();
 
   for (piter = pbegin; piter != pend; ++piter)
   {
@@ -4312,22 +5363,72 @@ void draw_contour_labels(ImagineXr_or_NFmiImage &img)
   }
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Get the cached pixel coordinates of the grid points
+ *
+ * Returns an empty vector if the lookup cannot be used, in which
+ * case the caller should project the coordinates directly.
+ */
+// ----------------------------------------------------------------------
+
+const vector<NFmiPoint> &grid_pixels(RenderContext &theContext,
+                                     const ImagineXr_or_NFmiImage &img,
+                                     const NFmiArea &theArea,
+                                     const LazyCoordinates &thePoints,
+                                     const NFmiDataMatrix<float> &theValues)
+{
+  static const vector<NFmiPoint> none;
+
+  const NFmiGrid *grid = theContext.queryinfo->Grid();
+  if (grid == 0) return none;
+
+  PixelGridLookup &lookup =
+      theContext.caches.getPixelGridLookup(theArea, img.Width(), img.Height(), *grid);
+  const vector<NFmiPoint> &pixels = lookup.gridPixels(thePoints);
+
+  if (pixels.size() != theValues.NX() * theValues.NY()) return none;
+  return pixels;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Get the pixel coordinates of a grid point
+ */
+// ----------------------------------------------------------------------
+
+NFmiPoint grid_pixel(const vector<NFmiPoint> &thePixels,
+                     const NFmiArea &theArea,
+                     const LazyCoordinates &thePoints,
+                     unsigned int i,
+                     unsigned int j)
+{
+  if (!thePixels.empty()) return thePixels[i + j * thePoints.NX()];
+
+  NFmiPoint latlon = theArea.WorldXYToLatLon(thePoints(i, j));
+  // latlon = MeridianTools::Relocate(latlon,theArea);
+  return theArea.ToXY(latlon);
+}
+
 // ----------------------------------------------------------------------
 /*!
  *\brief Save contour symbols
  */
 // ----------------------------------------------------------------------
 
-void save_contour_symbols(ImagineXr_or_NFmiImage &img,
+void save_contour_symbols(RenderContext &theContext,
+                          ImagineXr_or_NFmiImage &img,
                           const NFmiArea &theArea,
                           const ContourSpec &theSpec,
                           const LazyCoordinates &thePoints,
                           const NFmiDataMatrix<float> &theValues)
 {
+  JobState &state = theContext.state;
+
   // The ID under which the coordinates will be stored
 
   int id = paramid(theSpec.param());
-  globals.imagelocator.parameter(id);
+  state.imagelocator.parameter(id);
 
   list<ContourSymbol>::const_iterator it;
   list<ContourSymbol>::const_iterator begin;
@@ -4336,6 +5437,10 @@ void save_contour_symbols(ImagineXr_or_NFmiImage &img,
   begin = theSpec.contourSymbols().begin();
   end = theSpec.contourSymbols().end();
 
+  // Projected grid coordinates are fetched only if needed
+
+  const vector<NFmiPoint> *pixels = 0;
+
   for (it = begin; it != end; ++it)
   {
     const float lo = it->lolimit();
@@ -4359,11 +5464,10 @@ void save_contour_symbols(ImagineXr_or_NFmiImage &img,
 
         if (inside)
         {
-          NFmiPoint latlon = theArea.WorldXYToLatLon(thePoints(i, j));
-          // latlon = MeridianTools::Relocate(latlon,theArea);
-          NFmiPoint xy = theArea.ToXY(latlon);
+          if (pixels == 0) pixels = &grid_pixels(theContext, img, theArea, thePoints, theValues);
+          NFmiPoint xy = grid_pixel(*pixels, theArea, thePoints, i, j);
 
-          globals.imagelocator.add(
+          state.imagelocator.add(
               z, static_cast<int>(round(xy.X())), static_cast<int>(round(xy.Y())));
         }
       }
@@ -4376,17 +5480,19 @@ void save_contour_symbols(ImagineXr_or_NFmiImage &img,
  */
 // ----------------------------------------------------------------------
 
-void draw_contour_symbols(ImagineXr_or_NFmiImage &img)
+void draw_contour_symbols(RenderContext &theContext, ImagineXr_or_NFmiImage &img)
 {
-  const LabelLocator::ParamCoordinates &paramcoords = globals.imagelocator.chooseLabels();
+  JobState &state = theContext.state;
+
+  const LabelLocator::ParamCoordinates &paramcoords = state.imagelocator.chooseLabels();
 
   if (paramcoords.empty()) return;
 
   // Iterate through all parameters
 
   list<ContourSpec>::iterator piter;
-  list<ContourSpec>::iterator pbegin = globals.specs.begin();
-  list<ContourSpec>::iterator pend = globals.specs.end();
+  list<ContourSpec>::iterator pbegin = state.specs.begin();
+  list<ContourSpec>::iterator pend = state.specs.end();
 
   for (piter = pbegin; piter != pend; ++piter)
   {
@@ -4434,7 +5540,7 @@ void draw_contour_symbols(ImagineXr_or_NFmiImage &img)
       // Render the symbols
 
       NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(fit->rule());
-      const ImagineXr_or_NFmiImage &symbol = globals.getImage(fit->pattern());
+      const ImagineXr_or_NFmiImage &symbol = theContext.caches.getImage(fit->pattern());
       const float factor = fit->factor();
 
       for (LabelLocator::Coordinates::const_iterator it = cit->second.begin();
@@ -4453,17 +5559,19 @@ void draw_contour_symbols(ImagineXr_or_NFmiImage &img)
  */
 // ----------------------------------------------------------------------
 
-void draw_contour_fonts(ImagineXr_or_NFmiImage &img)
+void draw_contour_fonts(RenderContext &theContext, ImagineXr_or_NFmiImage &img)
 {
-  const LabelLocator::ParamCoordinates &paramcoords = globals.symbollocator.chooseLabels();
+  JobState &state = theContext.state;
+
+  const LabelLocator::ParamCoordinates &paramcoords = state.symbollocator.chooseLabels();
 
   if (paramcoords.empty()) return;
 
   // Iterate through all parameters
 
   list<ContourSpec>::iterator piter;
-  list<ContourSpec>::iterator pbegin = globals.specs.begin();
-  list<ContourSpec>::iterator pend = globals.specs.end();
+  list<ContourSpec>::iterator pbegin = state.specs.begin();
+  list<ContourSpec>::iterator pend = state.specs.end();
 
   for (piter = pbegin; piter != pend; ++piter)
   {
@@ -4535,16 +5643,19 @@ void draw_contour_fonts(ImagineXr_or_NFmiImage &img)
  */
 // ----------------------------------------------------------------------
 
-void save_contour_fonts(ImagineXr_or_NFmiImage &img,
+void save_contour_fonts(RenderContext &theContext,
+                        ImagineXr_or_NFmiImage &img,
                         const NFmiArea &theArea,
                         const ContourSpec &theSpec,
                         const LazyCoordinates &thePoints,
                         const NFmiDataMatrix<float> &theValues)
 {
+  JobState &state = theContext.state;
+
   // The ID under which the coordinates will be stored
 
   int id = paramid(theSpec.param());
-  globals.symbollocator.parameter(id);
+  state.symbollocator.parameter(id);
 
   // For speed we prefer to iterate only once through the data, and
   // instead use a fast way to test if a given value is to be contoured
@@ -4565,16 +5676,17 @@ void save_contour_fonts(ImagineXr_or_NFmiImage &img,
 
   // Now iterate through the data once, saving candidate points
 
+  const vector<NFmiPoint> *pixels = 0;
+
   for (unsigned int j = 0; j < theValues.NY(); j++)
     for (unsigned int i = 0; i < theValues.NX(); i++)
     {
       if (okvalues.find(theValues[i][j]) != okvalues.end())
       {
-        NFmiPoint latlon = theArea.WorldXYToLatLon(thePoints(i, j));
-        // latlon = MeridianTools::Relocate(latlon,theArea);
-        NFmiPoint xy = theArea.ToXY(latlon);
+        if (pixels == 0) pixels = &grid_pixels(theContext, img, theArea, thePoints, theValues);
+        NFmiPoint xy = grid_pixel(*pixels, theArea, thePoints, i, j);
 
-        globals.symbollocator.add(
+        state.symbollocator.add(
             theValues[i][j], static_cast<int>(round(xy.X())), static_cast<int>(round(xy.Y())));
       }
     }
@@ -4586,11 +5698,13 @@ void save_contour_fonts(ImagineXr_or_NFmiImage &img,
  */
 // ----------------------------------------------------------------------
 
-void draw_overlay(ImagineXr_or_NFmiImage &img, const ContourSpec &theSpec)
+void draw_overlay(RenderContext &theContext,
+                  ImagineXr_or_NFmiImage &img,
+                  const ContourSpec &theSpec)
 {
   if (theSpec.overlay().empty()) return;
 
-  img.Composite(globals.getImage(theSpec.overlay()),
+  img.Composite(theContext.caches.getImage(theSpec.overlay()),
                 NFmiColorTools::kFmiColorOver,
                 kFmiAlignNorthWest,
                 0,
@@ -4600,76 +5714,20 @@ void draw_overlay(ImagineXr_or_NFmiImage &img, const ContourSpec &theSpec)
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Establish the type of extremum at the given point
+ * \brief Extremum search radius in grid cells
  *
- * \param theValues The matrix of values
- * \param i The i-coordinate of the value
- * \param j The j-coordinate of the value
- * \param DX The search region in X-direction
- * \param DY The search region in Y-direction
- * \param mingradient Minimum required difference in area
- * \return -2/2 for absolute minima/maxima, -1/1 for minima/maxima, 0 for none
+ * \param theRadius The radius in kilometres, or 0 for the default
+ * \param theCells The number of grid cells
+ * \param theSize The size of the grid in metres
  */
 // ----------------------------------------------------------------------
 
-int extrematype(
-    const NFmiDataMatrix<float> &theValues, int i, int j, int DX, int DY, float mingradient)
+int extrema_radius(float theRadius, unsigned long theCells, double theSize)
 {
-  int smaller = 0;
-  int bigger = 0;
-
-  // minimum/maximum on the frame
-  float minimum = theValues[i - DX][j - DY];
-  float maximum = theValues[i - DX][j - DY];
-
-  for (int dy = -DY; dy <= DY; dy++)
-    for (int dx = -DX; dx <= DX; dx++)
-    {
-      // quick exit for missing values
-      if (theValues[i + dx][j + dy] == kFloatMissing) return 0;
-
-      if (dx != 0 && dy != 0)
-      {
-        if (theValues[i + dx][j + dy] < theValues[i][j])
-          ++smaller;
-        else if (theValues[i + dx][j + dy] > theValues[i][j])
-          ++bigger;
-      }
-
-      // quick exit for non-extrema
-      if (smaller > 0 && bigger > 0) return 0;
-
-      // update extrema values
-
-      if (dx == -DX || dx == DX || dy == -DY || dy == DY)
-      {
-        minimum = min(minimum, theValues[i + dx][j + dy]);
-        maximum = max(maximum, theValues[i + dx][j + dy]);
-      }
-    }
-
-  // minimum change from center to rim
+  if (theRadius <= 0 || theCells < 2 || theSize <= 0) return 7;
 
-  float change = min(abs(theValues[i][j] - minimum), abs(theValues[i][j] - maximum));
-
-#if 0
-  if(change >= mingradient)
-	cout << "Change = " << change << " at " << i << ' ' << j << endl;
-#endif
-
-  if (change < mingradient)
-    return 0;
-
-  else if (smaller == (DX * 2 + 1) * (DY * 2 + 1) - 1)
-    return 2;
-  else if (bigger == (DX * 2 + 1) * (DY * 2 + 1) - 1)
-    return -2;
-  else if (smaller > 0)
-    return 1;
-  else if (bigger > 0)
-    return -1;
-  else
-    return 0;  // should never happen due to quick exit in the loop
+  const double resolution = theSize / (theCells - 1);
+  return max(1, static_cast<int>(ceil(theRadius * 1000 / resolution)));
 }
 
 // ----------------------------------------------------------------------
@@ -4678,12 +5736,16 @@ int extrematype(
  */
 // ----------------------------------------------------------------------
 
-void draw_pressure_markers(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
+void draw_pressure_markers(RenderContext &theContext,
+                           ImagineXr_or_NFmiImage &img,
+                           const NFmiArea &theArea)
 {
+  JobState &state = theContext.state;
+
   // Establish which markers are to be drawn
 
-  bool dohigh = !globals.highpressureimage.empty();
-  bool dolow = !globals.lowpressureimage.empty();
+  bool dohigh = !state.highpressureimage.empty();
+  bool dolow = !state.lowpressureimage.empty();
 
   // Exit if none
 
@@ -4691,28 +5753,36 @@ void draw_pressure_markers(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
 
   // Get the data to be analyzed
 
-  choose_queryinfo("Pressure", 0);
+  choose_queryinfo(theContext, state.pressureparam, 0);
 
   boost::shared_ptr<NFmiDataMatrix<NFmiPoint>> worldpts =
-      globals.queryinfo->LocationsWorldXY(theArea);
+      theContext.queryinfo->LocationsWorldXY(theArea);
 
   NFmiDataMatrix<float> vals;
-  globals.queryinfo->Values(vals);
-  globals.unitsconverter.convert(FmiParameterName(globals.queryinfo->GetParamIdent()), vals);
+  theContext.queryinfo->Values(vals);
+  state.unitsconverter.convert(FmiParameterName(theContext.queryinfo->GetParamIdent()), vals);
 
   // Insert candidate coordinates into the system
 
-  // const double dx = theArea.WorldXYWidth()/theArea.Grid()->XNumber();
-  // const double dy = theArea.WorldXYHeight()/theArea.Grid()->YNumber();
+  int DX = 7;
+  int DY = 7;
+
+  const NFmiGrid *grid = theContext.queryinfo->Grid();
+  if (grid != 0 && grid->Area() != 0)
+  {
+    DX = extrema_radius(state.pressureradius, grid->XNumber(), grid->Area()->WorldXYWidth());
+    DY = extrema_radius(state.pressureradius, grid->YNumber(), grid->Area()->WorldXYHeight());
+  }
 
-  const int DX = 7;  // ceil(500*1000/dx/2);	// 500km radius required
-  const int DY = 7;  // ceil(500*1000/dx/2);
   const float required_gradient = 1.0;
 
-  for (unsigned int j = DY; j < vals.NY() - DY; j++)
-    for (unsigned int i = DX; i < vals.NX() - DX; i++)
+  const NFmiDataMatrix<int> types =
+      ExtremaTools::extrema(vals, DX, DY, required_gradient, state.threads);
+
+  for (unsigned int j = 0; j < vals.NY(); j++)
+    for (unsigned int i = 0; i < vals.NX(); i++)
     {
-      int extrem = extrematype(vals, i, j, DX, DY, required_gradient);
+      int extrem = types[i][j];
       if (extrem != 0)
       {
         // the point in kilometer units
@@ -4720,21 +5790,21 @@ void draw_pressure_markers(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
 
         if (extrem < 0)
         {
-          if (dolow) globals.pressurelocator.add(ExtremaLocator::Minimum, point.X(), point.Y());
+          if (dolow) state.pressurelocator.add(ExtremaLocator::Minimum, point.X(), point.Y());
         }
         else
         {
-          if (dohigh) globals.pressurelocator.add(ExtremaLocator::Maximum, point.X(), point.Y());
+          if (dohigh) state.pressurelocator.add(ExtremaLocator::Maximum, point.X(), point.Y());
         }
       }
     }
 
   // Now choose the marker positions and draw them
 
-  const ExtremaLocator::ExtremaCoordinates &extrema = globals.pressurelocator.chooseCoordinates();
+  const ExtremaLocator::ExtremaCoordinates &extrema = state.pressurelocator.chooseCoordinates();
 
-  NFmiColorTools::NFmiBlendRule lowrule = ColorTools::checkrule(globals.lowpressurerule);
-  NFmiColorTools::NFmiBlendRule highrule = ColorTools::checkrule(globals.highpressurerule);
+  NFmiColorTools::NFmiBlendRule lowrule = ColorTools::checkrule(state.lowpressurerule);
+  NFmiColorTools::NFmiBlendRule highrule = ColorTools::checkrule(state.highpressurerule);
 
   for (ExtremaLocator::ExtremaCoordinates::const_iterator eit = extrema.begin();
        eit != extrema.end();
@@ -4752,20 +5822,20 @@ void draw_pressure_markers(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
       switch (eit->first)
       {
         case ExtremaLocator::Minimum:
-          img.Composite(globals.lowpressureimage,
+          img.Composite(state.lowpressureimage,
                         lowrule,
                         kFmiAlignCenter,
                         static_cast<int>(round(xy.X())),
                         static_cast<int>(round(xy.Y())),
-                        globals.lowpressurefactor);
+                        state.lowpressurefactor);
           break;
         case ExtremaLocator::Maximum:
-          img.Composite(globals.highpressureimage,
+          img.Composite(state.highpressureimage,
                         highrule,
                         kFmiAlignCenter,
                         static_cast<int>(round(xy.X())),
                         static_cast<int>(round(xy.Y())),
-                        globals.highpressurefactor);
+                        state.highpressurefactor);
           break;
       }
     }
@@ -4778,23 +5848,700 @@ void draw_pressure_markers(ImagineXr_or_NFmiImage &img, const NFmiArea &theArea)
  */
 // ----------------------------------------------------------------------
 
-void draw_foreground(ImagineXr_or_NFmiImage &img)
+void draw_foreground(RenderContext &theContext, ImagineXr_or_NFmiImage &img)
 {
-  if (globals.foreground.empty()) return;
+  JobState &state = theContext.state;
+
+  if (state.foreground.empty()) return;
 
-  NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(globals.foregroundrule);
+  NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(state.foregroundrule);
 
-  img.Composite(globals.getImage(globals.foreground), rule, kFmiAlignNorthWest, 0, 0, 1);
+  img.Composite(theContext.caches.getImage(state.foreground), rule, kFmiAlignNorthWest, 0, 0, 1);
 }
 
+#ifndef IMAGINE_WITH_CAIRO
 // ----------------------------------------------------------------------
 /*!
- * \brief Handle "draw contours" command
+ * \brief Collect the colours expected to appear in the images
+ *
+ * The erase colour, the colours of the contour specifications and
+ * the colours of the background image are included. The background
+ * is skipped if it has too many colours to fit into a palette. The
+ * background is scanned only once per run.
+ *
+ * \param theBackground The background image name, or an empty string
+ */
+// ----------------------------------------------------------------------
+
+PngTools::Colors palette_colors(RenderContext &theContext, const string &theBackground)
+{
+  JobState &state = theContext.state;
+
+  PngTools::Colors colors;
+  set<NFmiColorTools::Color> seen;
+
+  list<NFmiColorTools::Color> candidates;
+  candidates.push_back(ColorTools::checkcolor(state.erase));
+
+  for (list<ContourSpec>::const_iterator it = state.specs.begin(); it != state.specs.end();
+       ++it)
+  {
+    for (list<ContourRange>::const_iterator rit = it->contourFills().begin();
+         rit != it->contourFills().end();
+         ++rit)
+      candidates.push_back(rit->color());
+
+    for (list<ContourValue>::const_iterator vit = it->contourValues().begin();
+         vit != it->contourValues().end();
+         ++vit)
+      candidates.push_back(vit->color());
+
+    candidates.push_back(it->labelColor());
+  }
+
+  if (!theBackground.empty())
+  {
+    map<string, PngTools::Colors> &imagecolors = theContext.caches.imagecolors;
+    map<string, PngTools::Colors>::iterator pos = imagecolors.find(theBackground);
+    if (pos == imagecolors.end())
+    {
+      const NFmiImage &background = theContext.caches.getImage(theBackground);
+      set<NFmiColorTools::Color> bgcolors;
+      for (int j = 0; j < background.Height() && bgcolors.size() <= 256; j++)
+        for (int i = 0; i < background.Width() && bgcolors.size() <= 256; i++)
+          bgcolors.insert(background(i, j));
+
+      pos = imagecolors.insert(make_pair(theBackground, PngTools::Colors())).first;
+      if (bgcolors.size() <= 256) pos->second.assign(bgcolors.begin(), bgcolors.end());
+    }
+    candidates.insert(candidates.end(), pos->second.begin(), pos->second.end());
+  }
+
+  for (list<NFmiColorTools::Color>::const_iterator it = candidates.begin();
+       it != candidates.end();
+       ++it)
+  {
+    if (*it != NFmiColorTools::NoColor && seen.insert(*it).second) colors.push_back(*it);
+  }
+
+  return colors;
+}
+#endif
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Add the identity of an image file into a fingerprint
+ *
+ * The name, size and modification time are used instead of the
+ * contents, since the images are not read unless needed.
  */
 // ----------------------------------------------------------------------
 
-void do_draw_contours(istream &theInput)
+void hash_image_file(std::size_t &theHash, const string &theFile)
 {
+  if (theFile.empty()) return;
+
+  boost::hash_combine(theHash, theFile);
+  if (!NFmiFileSystem::FileExists(theFile)) return;
+
+  boost::hash_combine(theHash, static_cast<long>(NFmiFileSystem::FileSize(theFile)));
+  boost::hash_combine(theHash,
+                      static_cast<long>(NFmiFileSystem::FileModificationTime(theFile)));
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Fingerprint of the inputs common to all images
+ *
+ * The script defines all the settings, the rest are the image
+ * files composited into the images.
+ *
+ * \param theGlobals The globals holding the script fingerprint
+ * \param theContext The context of the job
+ * \param theBackground The background image name, or an empty string
+ */
+// ----------------------------------------------------------------------
+
+std::size_t input_fingerprint(const Globals &theGlobals,
+                              RenderContext &theContext,
+                              const string &theBackground)
+{
+  JobState &state = theContext.state;
+
+  std::size_t hash = theGlobals.scriptfingerprint;
+
+  hash_image_file(hash, theBackground);
+  hash_image_file(hash, state.foreground);
+  hash_image_file(hash, state.mask);
+  hash_image_file(hash, state.combine);
+
+  for (list<ContourSpec>::const_iterator it = state.specs.begin(); it != state.specs.end();
+       ++it)
+  {
+    hash_image_file(hash, it->overlay());
+    hash_image_file(hash, it->labelMarker());
+
+    for (list<ContourPattern>::const_iterator pit = it->contourPatterns().begin();
+         pit != it->contourPatterns().end();
+         ++pit)
+      hash_image_file(hash, pit->pattern());
+
+    for (list<ContourSymbol>::const_iterator sit = it->contourSymbols().begin();
+         sit != it->contourSymbols().end();
+         ++sit)
+      hash_image_file(hash, sit->pattern());
+  }
+
+  return hash;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The parameters and levels whose values affect the images
+ *
+ * These are the contoured parameters, the parameters the meta
+ * functions are calculated from, the wind arrow parameters and the
+ * parameter used for the pressure markers. The arrows use whatever
+ * level happens to be active, hence all their levels are included.
+ *
+ * \return The parameters and levels
+ */
+// ----------------------------------------------------------------------
+
+LazyQueryData::ParamLevels fingerprint_params(RenderContext &theContext)
+{
+  JobState &state = theContext.state;
+
+  LazyQueryData::ParamLevels params;
+
+  for (list<ContourSpec>::const_iterator it = state.specs.begin(); it != state.specs.end();
+       ++it)
+  {
+    if (!MetaFunctions::isMeta(it->param()))
+      params.insert(make_pair(toparam(it->param()), it->level()));
+    else
+    {
+      const vector<FmiParameterName> metaparams = MetaFunctions::parameters(it->param());
+      for (unsigned int i = 0; i < metaparams.size(); i++)
+        params.insert(make_pair(metaparams[i], -1));
+    }
+  }
+
+  const string arrowparams[] = {
+      state.speedparam, state.directionparam, state.speedxcomponent, state.speedycomponent};
+
+  for (unsigned int i = 0; i < sizeof(arrowparams) / sizeof(*arrowparams); i++)
+    if (!arrowparams[i].empty()) params.insert(make_pair(toparam(arrowparams[i]), -1));
+
+  if (!state.highpressureimage.empty() || !state.lowpressureimage.empty())
+    params.insert(make_pair(toparam(state.pressureparam), 0));
+
+  return params;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Fingerprint of the inputs of an image
+ *
+ * Times which are not available in the data are interpolated,
+ * and the filters use the data from the preceding interval.
+ *
+ * \param theInputs The fingerprint of the common inputs
+ * \param theParams The parameters and levels to include
+ * \param theTime The valid time of the image
+ * \return The combined fingerprint
+ */
+// ----------------------------------------------------------------------
+
+std::size_t frame_fingerprint(RenderContext &theContext,
+                              std::size_t theInputs,
+                              const LazyQueryData::ParamLevels &theParams,
+                              const NFmiTime &theTime)
+{
+  JobState &state = theContext.state;
+
+  NFmiTime starttime = theTime;
+  if (state.filter != "none") starttime.ChangeByMinutes(-state.timeinterval);
+
+  std::size_t hash = theInputs;
+  for (unsigned int qi = 0; qi < theContext.querystreams.size(); qi++)
+    boost::hash_combine(
+        hash, theContext.querystreams[qi]->Fingerprint(starttime, theTime, theParams));
+  return hash;
+}
+
+//! An image rendered for each time
+struct DrawTarget
+{
+  std::string background;            // background image name
+  std::string savepath;              // path for the images
+  std::string projection;            // the projection description
+  boost::shared_ptr<NFmiArea> area;  // the projection
+  std::size_t inputfingerprint;      // fingerprint of the common inputs
+#ifndef IMAGINE_WITH_CAIRO
+  PngTools::Colors palettecolors;  // colours known to be in the images
+#endif
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Establish the images to be rendered for each time
+ *
+ * Normally there is only one image defined by the projection,
+ * background and savepath settings. If areas have been defined,
+ * there is one image per area instead.
+ *
+ * \param theGlobals The globals holding the script fingerprint
+ * \param theContext The context of the job
+ * \param theFingerprinting True if input fingerprints are needed
+ * \return The targets
+ */
+// ----------------------------------------------------------------------
+
+vector<DrawTarget> draw_targets(const Globals &theGlobals,
+                                RenderContext &theContext,
+                                bool theFingerprinting)
+{
+  JobState &state = theContext.state;
+
+  vector<AreaSpec> specs = state.areas;
+  if (specs.empty())
+  {
+    AreaSpec spec;
+    spec.projection = state.projection;
+    spec.background = state.background;
+    spec.savepath = state.savepath;
+    specs.push_back(spec);
+  }
+
+  vector<DrawTarget> targets;
+  for (vector<AreaSpec>::const_iterator it = specs.begin(); it != specs.end(); ++it)
+  {
+    DrawTarget target;
+    target.background = it->background;
+    target.savepath = it->savepath;
+    target.projection = it->projection;
+    target.area = JobState::createArea(it->projection);
+    target.inputfingerprint =
+        (theFingerprinting ? input_fingerprint(theGlobals, theContext, it->background) : 0);
+#ifndef IMAGINE_WITH_CAIRO
+    if (state.exactpalette) target.palettecolors = palette_colors(theContext, it->background);
+#endif
+
+    // This message intentionally ignores theContext.verbose
+
+    if (!target.background.empty())
+      cout << "Contouring for background " << target.background << endl;
+
+    if (theContext.verbose) report_area(*target.area);
+
+    targets.push_back(target);
+  }
+
+  return targets;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The rendering state of one area when several areas are drawn
+ *
+ * Each area has its own copy of the job state, and hence its own
+ * label locators, its own caches and its own iterators to the data
+ * so that the areas can be rendered in parallel. The caches are
+ * owned by the caches of the job so that they persist over commands.
+ */
+// ----------------------------------------------------------------------
+
+struct AreaRenderer
+{
+  AreaRenderer(const RenderContext &theContext, RenderCaches &theCaches, unsigned int theThreads)
+      : state(theContext.state),
+        caches(theCaches),
+        querystreams(),
+        context(state, caches, querystreams, theContext.verbose)
+  {
+    state.threads = theThreads;
+    for (unsigned int qi = 0; qi < theContext.querystreams.size(); qi++)
+      querystreams.push_back(theContext.querystreams[qi]->Clone());
+  }
+
+  //! Move the data iterators to the time of the given context
+  RenderContext &synchronize(const RenderContext &theContext)
+  {
+    for (unsigned int qi = 0; qi < querystreams.size(); qi++)
+      querystreams[qi]->TimeIndex(theContext.querystreams[qi]->TimeIndex());
+    return context;
+  }
+
+  JobState state;                           // settings and locators of the area
+  RenderCaches &caches;                     // images, lookups and arrows of the area
+  RenderContext::QueryStreams querystreams;  // own iterators to the data
+  RenderContext context;                    // the context using the above
+
+ private:
+  // Intentionally disabled:
+
+  AreaRenderer(const AreaRenderer &theRenderer);
+  AreaRenderer &operator=(const AreaRenderer &theRenderer);
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Prepare the values of all parameters for the given time
+ *
+ * The values are smoothed in world coordinates of the given area
+ * so that the smoothing radius can be given in meters.
+ *
+ * \param theContext The context whose data is used
+ * \param theArea The area used for smoothing
+ * \param theTime The time to prepare
+ * \param theFields The values of each parameter
+ */
+// ----------------------------------------------------------------------
+
+void prepare_fields(RenderContext &theContext,
+                    const NFmiArea &theArea,
+                    const NFmiTime &theTime,
+                    vector<NFmiDataMatrix<float> > &theFields)
+{
+  JobState &state = theContext.state;
+
+  list<ContourSpec>::const_iterator piter;
+  list<ContourSpec>::const_iterator pbegin = state.specs.begin();
+  list<ContourSpec>::const_iterator pend = state.specs.end();
+
+  unsigned int pi;
+  for (piter = pbegin, pi = 0; piter != pend; ++piter, ++pi)
+  {
+    // Establish the parameter
+
+    string name = piter->param();
+    int level = piter->level();
+
+    choose_queryinfo(theContext, name, level);
+
+    // Get the values
+
+    NFmiDataMatrix<float> &vals = theFields[pi];
+
+    if (!MetaFunctions::isMeta(name))
+    {
+      theContext.queryinfo->Values(vals);
+      state.unitsconverter.convert(FmiParameterName(theContext.queryinfo->GetParamIdent()), vals);
+    }
+    else
+      vals = MetaFunctions::values(piter->param(), *theContext.queryinfo);
+
+    // Replace values if so requested
+
+    if (piter->replace()) vals.Replace(piter->replaceSourceValue(), piter->replaceTargetValue());
+
+    // Filter the values if so requested
+
+    filter_values(theContext, vals, theTime, *piter);
+
+    // Expand the data if so requested
+
+    if (state.expanddata) expand_data(vals);
+
+    // Call smoother only if necessary to avoid LazyCoordinates dereferencing
+
+    if (piter->smoother() != "None")
+    {
+      LazyCoordinates worldpts(theArea, *theContext.queryinfo);
+      NFmiSmoother smoother(piter->smoother(), piter->smootherFactor(), piter->smootherRadius());
+      vals = smoother.Smoothen(*worldpts, vals);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Create the image of a target with the background drawn
+ *
+ * \param theContext The context of the target
+ * \param theTarget The target
+ * \param theFilename The name of the image to be written
+ * \param theFrame The previous frame of the target for reuse
+ * \return The image
+ */
+// ----------------------------------------------------------------------
+
+boost::shared_ptr<ImagineXr_or_NFmiImage> area_image(
+    RenderContext &theContext,
+    const DrawTarget &theTarget,
+    const string &theFilename,
+    boost::shared_ptr<Imagine::NFmiImage> &theFrame)
+{
+  JobState &state = theContext.state;
+
+  int imgwidth = static_cast<int>(theTarget.area->Width() + 0.5);
+  int imgheight = static_cast<int>(theTarget.area->Height() + 0.5);
+
+  NFmiColorTools::Color erasecolor = ColorTools::checkcolor(state.erase);
+
+#ifdef IMAGINE_WITH_CAIRO
+  boost::shared_ptr<ImagineXr> xr(new ImagineXr(imgwidth, imgheight, theFilename, state.format));
+
+  if (theTarget.background.empty())
+  {
+    xr->Erase(erasecolor);
+  }
+  else
+  {
+    const ImagineXr &xr2 = theContext.caches.getImage(theTarget.background);
+
+    if ((xr2.Width() != xr->Width()) || (xr2.Height() != xr->Height()))
+      throw runtime_error("Background image size does not match area size");
+
+    xr->Composite(xr2);
+  }
+  return xr;
+#else
+  boost::shared_ptr<Imagine::NFmiImage> image = frame_image(theFrame, imgwidth, imgheight);
+  if (theTarget.background.empty())
+  {
+    if (image.get() == 0)
+      image.reset(new Imagine::NFmiImage(imgwidth, imgheight, erasecolor));
+    else
+      image->Erase(erasecolor);
+  }
+  else
+  {
+    const Imagine::NFmiImage &background = theContext.caches.getImage(theTarget.background);
+    if (imgwidth != background.Width() || imgheight != background.Height())
+    {
+      throw runtime_error("Background image size does not match area size");
+    }
+    if (image.get() == 0)
+      image.reset(new Imagine::NFmiImage(background));
+    else
+      *image = background;
+  }
+  if (image.get() == 0) throw runtime_error("Failed to allocate a new image for rendering");
+
+  theFrame = image;
+
+  state.setImageModes(*image);
+  return image;
+#endif
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw the contours, the map layers and the arrows of an area
+ *
+ * This stage may be run for several areas in parallel. The text
+ * layers are drawn separately by draw_area_labels.
+ *
+ * \param theContext The context of the area
+ * \param img The image to draw into
+ * \param theArea The area
+ * \param theTime The time to draw
+ * \param theFields The prepared values of each parameter
+ * \param theCalculators The contourers of each parameter, or none
+ *                       if the values are to be contoured here
+ * \param theLabelsDone True if the grid labels have already been added
+ */
+// ----------------------------------------------------------------------
+
+void draw_area_contours(RenderContext &theContext,
+                        ImagineXr_or_NFmiImage &img,
+                        const NFmiArea &theArea,
+                        const NFmiTime &theTime,
+                        const vector<NFmiDataMatrix<float> > &theFields,
+                        const vector<boost::shared_ptr<ContourCalculator> > &theCalculators,
+                        bool theLabelsDone)
+{
+  JobState &state = theContext.state;
+
+  // Initialize label locator bounding box
+
+  state.labellocator.boundingBox(state.contourlabelimagexmargin,
+                                 state.contourlabelimageymargin,
+                                 img.Width() - state.contourlabelimagexmargin,
+                                 img.Height() - state.contourlabelimageymargin);
+
+  // Initialize symbol locator bounding box with reasonably safety
+  // for large symbols
+
+  state.symbollocator.boundingBox(-30, -30, img.Width() + 30, img.Height() + 30);
+  state.imagelocator.boundingBox(-30, -30, img.Width() + 30, img.Height() + 30);
+
+  // Loop over all parameters
+  // The loop collects all contour label information, but
+  // does not render it yet
+
+  list<ContourSpec>::iterator piter;
+  list<ContourSpec>::iterator pbegin = state.specs.begin();
+  list<ContourSpec>::iterator pend = state.specs.end();
+
+  unsigned int pi;
+  for (piter = pbegin, pi = 0; piter != pend; ++piter, ++pi)
+  {
+    // Establish the parameter
+
+    string name = piter->param();
+    int level = piter->level();
+
+    unsigned int qi = choose_queryinfo(theContext, name, level);
+
+    if (theContext.verbose) report_queryinfo(name, qi);
+
+    // Establish the contour method
+
+    string interpname = piter->contourInterpolation();
+    ContourInterpolation interp = ContourInterpolationValue(interpname);
+    if (interp == Missing)
+      throw runtime_error("Unknown contour interpolation method " + interpname);
+
+    // Setup the contourer with the values, unless they are
+    // shared with the other areas
+
+    const NFmiDataMatrix<float> &vals = theFields[pi];
+
+    if (theCalculators.empty())
+      theContext.calculator->data(vals);
+    else
+      theContext.calculator = theCalculators[pi].get();
+
+    LazyCoordinates worldpts(theArea, *theContext.queryinfo);
+
+    // Save the data values at desired points for later
+    // use, this lets us avoid using InterpolatedValue()
+    // which does not use smoothened values.
+
+    // First, however, if this is the first image, we add
+    // the grid points to the set of points, if so requested
+
+    if (!theLabelsDone) add_label_grid_values(theContext, *piter, theArea, worldpts);
+
+    // For pixelgrids we must repeat the process for all new
+    // background images, since the pixel spacing changes
+    // every time. Note! We assume the following calling order!
+
+    add_label_point_values(theContext, *piter, theArea, vals);
+    add_label_pixelgrid_values(theContext, *piter, theArea, img, vals);
+
+    // Fill the contours
+
+    draw_contour_fills(theContext, img, theArea, *piter, theTime, interp, vals);
+
+    // Pattern fill the contours
+
+    draw_contour_patterns(theContext, img, theArea, *piter, theTime, interp);
+
+    // Stroke the contours
+
+    draw_contour_strokes(theContext, img, theArea, *piter, theTime, interp);
+
+    // Save contour symbol coordinates
+
+    save_contour_symbols(theContext, img, theArea, *piter, worldpts, vals);
+
+    // Save symbol fill coordinates
+
+    save_contour_fonts(theContext, img, theArea, *piter, worldpts, vals);
+
+    // Save contour label coordinates
+
+    save_contour_labels(theContext, img, theArea, *piter, theTime, interp);
+
+    // Draw optional overlay
+
+    draw_overlay(theContext, img, *piter);
+  }
+
+  // Draw graticule
+
+  draw_graticule(theContext, img, theArea);
+
+  // Bang the foreground
+
+  draw_foreground(theContext, img);
+
+  // Draw wind arrows if so requested
+
+  draw_wind_arrows(theContext, img, theArea);
+
+  // Draw contour symbols
+
+  draw_contour_symbols(theContext, img);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw the text layers of an area
+ *
+ * Fonts are not safe to use from several threads, hence this
+ * stage is always run for one area at a time.
+ *
+ * \param theContext The context of the area
+ * \param img The image to draw into
+ * \param theArea The area
+ * \param theTime The time to draw
+ */
+// ----------------------------------------------------------------------
+
+void draw_area_labels(RenderContext &theContext,
+                      ImagineXr_or_NFmiImage &img,
+                      const NFmiArea &theArea,
+                      const NFmiTime &theTime)
+{
+  JobState &state = theContext.state;
+
+  // Draw contour fonts
+
+  draw_contour_fonts(theContext, img);
+
+  // Label the contours
+
+  draw_contour_labels(theContext, img);
+
+  // Draw labels
+
+  for (list<ContourSpec>::iterator piter = state.specs.begin(); piter != state.specs.end();
+       ++piter)
+  {
+    draw_label_markers(theContext, img, *piter, theArea);
+    draw_label_texts(theContext, img, *piter, theArea);
+  }
+
+  // Draw high/low pressure markers
+
+  draw_pressure_markers(theContext, img, theArea);
+
+  // Bang the combine image (legend, logo, whatever)
+
+  theContext.drawCombine(img);
+
+  // Finally, draw a time stamp on the image if so
+  // requested
+
+  const string stamp = theContext.getImageStampText(theTime);
+  theContext.drawImageStampText(img, stamp);
+
+  // Advance in time
+
+  state.labellocator.nextTime();
+  state.pressurelocator.nextTime();
+  state.symbollocator.nextTime();
+  state.imagelocator.nextTime();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw the contour images of all times
+ *
+ * \param theGlobals The globals holding the image output
+ * \param theContext The context of the job
+ */
+// ----------------------------------------------------------------------
+
+void draw_contours(Globals &theGlobals, RenderContext &theContext)
+{
+  JobState &state = theContext.state;
+
   // 1. Make sure query data has been read
   // 2. Make sure image has been initialized
   // 3. Loop over all times
@@ -4809,21 +6556,66 @@ void do_draw_contours(istream &theInput)
   //   12. Draw arrows if requested
   //   13. Save the image
 
-  globals.labellocator.clear();
-  globals.pressurelocator.clear();
-  globals.symbollocator.clear();
-  globals.imagelocator.clear();
+  state.labellocator.clear();
+  state.pressurelocator.clear();
+  state.symbollocator.clear();
+  state.imagelocator.clear();
+
+  if (theContext.querystreams.empty()) throw runtime_error("No query data has been read!");
+
+  // If rendering fails the queued images are still completed, and
+  // their errors are discarded instead of failing the next job
+
+  ImageWriter::Guard writerguard(theGlobals.imagewriter);
+
+  // Image fingerprints are needed in watch mode and for manifests.
+  // They are recorded only once all the images have been saved.
+
+  const bool fingerprinting = (theGlobals.cmdline_watch || theGlobals.manifest.persistent());
+  const LazyQueryData::ParamLevels fingerprintparams = fingerprint_params(theContext);
+  vector<pair<string, std::size_t> > fingerprints;
 
-  if (globals.querystreams.empty()) throw runtime_error("No query data has been read!");
+  // The images to render for each time. With several areas each
+  // area is rendered by its own context, and the areas are drawn
+  // in parallel if threads are available. The values of each
+  // parameter are prepared only once per time, and the contours
+  // are shared by the areas through a calculator per parameter.
 
-  boost::shared_ptr<NFmiArea> area = globals.createArea();
+  const vector<DrawTarget> targets = draw_targets(theGlobals, theContext, fingerprinting);
+  const bool fanout = (targets.size() > 1);
 
-  // This message intentionally ignores globals.verbose
+  const unsigned int areathreads =
+      (fanout ? min<unsigned int>(state.threads, targets.size()) : 1);
 
-  if (!globals.background.empty())
-    cout << "Contouring for background " << globals.background << endl;
+  vector<NFmiDataMatrix<float> > fields(state.specs.size());
+  vector<boost::shared_ptr<ContourCalculator> > calculators;
+  vector<boost::shared_ptr<AreaRenderer> > renderers;
+  vector<bool> labelsdone(targets.size(), false);
+
+  if (fanout)
+  {
+    const unsigned int threads = max(1u, state.threads / areathreads);
+    for (unsigned int pi = 0; pi < state.specs.size(); pi++)
+      calculators.push_back(boost::make_shared<ContourCalculator>());
+
+    // Keep the caches of the areas in use for the next commands
+
+    RenderCaches::AreaCaches areacaches;
+    for (unsigned int ai = 0; ai < targets.size(); ai++)
+    {
+      const RenderCaches::AreaCaches::key_type key(ai, targets[ai].projection);
+      RenderCaches::AreaCaches::const_iterator it = theContext.caches.areacaches.find(key);
+      if (it != theContext.caches.areacaches.end())
+        areacaches[key] = it->second;
+      else
+        areacaches[key] = boost::make_shared<RenderCaches>(theContext.caches.itsImageCache);
+      renderers.push_back(boost::shared_ptr<AreaRenderer>(
+          new AreaRenderer(theContext, *areacaches[key], threads)));
+    }
+    theContext.caches.areacaches.swap(areacaches);
+  }
 
-  if (globals.verbose) report_area(*area);
+  theGlobals.frameimages.resize(targets.size());
 
   // Establish querydata timelimits and initialize
   // the XY-coordinates simultaneously.
@@ -4835,21 +6627,20 @@ void do_draw_contours(istream &theInput)
 
   NFmiTime time1, time2;
 
-  NFmiDataMatrix<float> vals;
   NFmiDataMatrix<float> maskvalues;
 
   unsigned int qi;
-  for (qi = 0; qi < globals.querystreams.size(); qi++)
+  for (qi = 0; qi < theContext.querystreams.size(); qi++)
   {
     // Establish time limits
 
-    globals.queryinfo = globals.querystreams[qi];
+    theContext.queryinfo = theContext.querystreams[qi];
 
-    globals.queryinfo->LastTime();
-    NFmiTime t2 = globals.queryinfo->ValidTime();
+    theContext.queryinfo->LastTime();
+    NFmiTime t2 = theContext.queryinfo->ValidTime();
 
-    globals.queryinfo->FirstTime();
-    NFmiTime t1 = globals.queryinfo->ValidTime();
+    theContext.queryinfo->FirstTime();
+    NFmiTime t1 = theContext.queryinfo->ValidTime();
 
     if (qi == 0)
     {
@@ -4863,7 +6654,7 @@ void do_draw_contours(istream &theInput)
     }
   }
 
-  if (globals.verbose)
+  if (theContext.verbose)
   {
     cout << "Data start time " << time1 << endl << "Data end time " << time2 << endl;
   }
@@ -4871,23 +6662,22 @@ void do_draw_contours(istream &theInput)
   // Skip to first time
 
   NFmiMetTime tmptime(time1,
-                      globals.timesteprounding ? (globals.timestep > 0 ? globals.timestep : 1) : 1);
+                      state.timesteprounding ? (state.timestep > 0 ? state.timestep : 1) : 1);
 
-  tmptime.ChangeByMinutes(globals.timestepskip);
-  if (globals.timesteprounding) tmptime.PreviousMetTime();
+  tmptime.ChangeByMinutes(state.timestepskip);
+  if (state.timesteprounding) tmptime.PreviousMetTime();
   NFmiTime t = tmptime;
 
   // Loop over all times
 
   int imagesdone = 0;
-  bool labeldxdydone = false;
   for (;;)
   {
-    if (imagesdone >= globals.timesteps) break;
+    if (imagesdone >= state.timesteps) break;
 
     // Skip to next time to be drawn
 
-    t.ChangeByMinutes(globals.timestep > 0 ? globals.timestep : 1);
+    t.ChangeByMinutes(state.timestep > 0 ? state.timestep : 1);
 
     // If the time is after time2, we're done
 
@@ -4899,20 +6689,20 @@ void do_draw_contours(istream &theInput)
     // time.
 
     bool ok = true;
-    for (qi = 0; ok && qi < globals.querystreams.size(); qi++)
+    for (qi = 0; ok && qi < theContext.querystreams.size(); qi++)
     {
-      globals.queryinfo = globals.querystreams[qi];
-      globals.queryinfo->ResetTime();
-      while (globals.queryinfo->NextTime())
+      theContext.queryinfo = theContext.querystreams[qi];
+      theContext.queryinfo->ResetTime();
+      while (theContext.queryinfo->NextTime())
       {
-        NFmiTime loc = globals.queryinfo->ValidTime();
+        NFmiTime loc = theContext.queryinfo->ValidTime();
         if (!loc.IsLessThan(t)) break;
       }
-      NFmiTime tnow = globals.queryinfo->ValidTime();
+      NFmiTime tnow = theContext.queryinfo->ValidTime();
 
       // we wanted
 
-      if (globals.timestep == 0) t = tnow;
+      if (state.timestep == 0) t = tnow;
 
       // If time is before time1, ignore it
 
@@ -4930,20 +6720,20 @@ void do_draw_contours(istream &theInput)
       // Use NFmiTime, not NFmiMetTime to avoid rounding up!
 
       NFmiTime tprev = t;
-      tprev.ChangeByMinutes(-globals.timeinterval);
+      tprev.ChangeByMinutes(-state.timeinterval);
 
       bool hasprevious = !tprev.IsLessThan(time1);
 
       // Skip this image if we are unable to render it
 
-      if (globals.filter == "none")
+      if (state.filter == "none")
       {
         // Cannot draw time with filter none
         // if time is not exact.
 
         ok = isexact;
       }
-      else if (globals.filter == "linear")
+      else if (state.filter == "linear")
       {
         // OK if is exact, otherwise previous step required
 
@@ -4966,275 +6756,154 @@ void do_draw_contours(istream &theInput)
 
     imagesdone++;
 
-    // Create the filename
-
-    // The timestamp as a string
-
-    NFmiString datatimestr = t.ToStr(globals.timestampformat);
-
-    if (globals.verbose) cout << "Time is " << datatimestr.CharPtr() << endl;
+    // Establish the areas to be rendered for the time
 
-    string filename = globals.savepath + "/" + globals.prefix + datatimestr.CharPtr();
+    vector<unsigned int> todo;
+    vector<string> filenames(targets.size());
 
-    if (globals.timestampflag)
+    for (unsigned int ai = 0; ai < targets.size(); ai++)
     {
-      for (qi = 0; qi < globals.queryfilenames.size(); qi++)
-      {
-        time_t secs = NFmiFileSystem::FileModificationTime(globals.queryfilenames[qi]);
-        NFmiTime tstamp = TimeTools::ToUTC(secs);
-        filename += "_" + tstamp.ToStr(globals.timestampformat);
-      }
-    }
-
-    filename += globals.suffix + "." + globals.format;
+      const DrawTarget &target = targets[ai];
 
-    // In force-mode we always write, but otherwise
-    // we first check if the output image already
-    // exists. If so, we assume it is up to date
-    // and skip to the next time stamp.
+      // Create the filename
 
-    if (!globals.force && !NFmiFileSystem::FileEmpty(filename))
-    {
-      if (globals.verbose) cout << "Not overwriting " << filename << endl;
-      continue;
-    }
-
-    // Initialize the background
+      // The timestamp as a string
 
-    int imgwidth = static_cast<int>(area->Width() + 0.5);
-    int imgheight = static_cast<int>(area->Height() + 0.5);
+      NFmiString datatimestr = t.ToStr(state.timestampformat);
 
-    NFmiColorTools::Color erasecolor = ColorTools::checkcolor(globals.erase);
+      if (theContext.verbose) cout << "Time is " << datatimestr.CharPtr() << endl;
 
-#ifdef IMAGINE_WITH_CAIRO
-    ImagineXr *xr = new ImagineXr(imgwidth, imgheight, filename, globals.format);
+      string filename = target.savepath + "/" + state.prefix + datatimestr.CharPtr();
 
-    if (globals.background.empty())
-    {
-      xr->Erase(erasecolor);
-    }
-    else
-    {
-      const ImagineXr &xr2 = globals.getImage(globals.background);
-
-      if ((xr2.Width() != xr->Width()) || (xr2.Height() != xr->Height()))
-        throw runtime_error("Background image size does not match area size");
-
-      xr->Composite(xr2);
-    }
-#else
-    boost::shared_ptr<Imagine::NFmiImage> image;
-    if (globals.background.empty())
-    {
-      image.reset(new Imagine::NFmiImage(imgwidth, imgheight, erasecolor));
-    }
-    else
-    {
-      image.reset(new Imagine::NFmiImage(globals.getImage(globals.background)));
-      if (imgwidth != image->Width() || imgheight != image->Height())
+      if (state.timestampflag)
       {
-        throw runtime_error("Background image size does not match area size");
+        for (qi = 0; qi < theGlobals.queryfilenames.size(); qi++)
+        {
+          time_t secs = NFmiFileSystem::FileModificationTime(theGlobals.queryfilenames[qi]);
+          NFmiTime tstamp = TimeTools::ToUTC(secs);
+          filename += "_" + tstamp.ToStr(state.timestampformat);
+        }
       }
-    }
-    if (image.get() == 0) throw runtime_error("Failed to allocate a new image for rendering");
-
-    globals.setImageModes(*image);
-#define xr image /* HACK */
-#endif
-
-    // Initialize label locator bounding box
 
-    globals.labellocator.boundingBox(globals.contourlabelimagexmargin,
-                                     globals.contourlabelimageymargin,
-                                     xr->Width() - globals.contourlabelimagexmargin,
-                                     xr->Height() - globals.contourlabelimageymargin);
+      filename += state.suffix + "." + state.format;
 
-    // Initialize symbol locator bounding box with reasonably safety
-    // for large symbols
+      // In force-mode we always write, but otherwise
+      // we first check if the output image already
+      // exists. If so, we assume it is up to date
+      // and skip to the next time stamp, unless the
+      // recorded fingerprint of its inputs differs.
+      // A persistent manifest must also know the image.
 
-    globals.symbollocator.boundingBox(-30, -30, xr->Width() + 30, xr->Height() + 30);
-    globals.imagelocator.boundingBox(-30, -30, xr->Width() + 30, xr->Height() + 30);
+      bool uptodate = !NFmiFileSystem::FileEmpty(filename);
 
-    // Loop over all parameters
-    // The loop collects all contour label information, but
-    // does not render it yet
-
-    list<ContourSpec>::iterator piter;
-    list<ContourSpec>::iterator pbegin = globals.specs.begin();
-    list<ContourSpec>::iterator pend = globals.specs.end();
-
-    for (piter = pbegin; piter != pend; ++piter)
-    {
-      // Establish the parameter
-
-      string name = piter->param();
-      int level = piter->level();
-
-      qi = choose_queryinfo(name, level);
-
-      if (globals.verbose) report_queryinfo(name, qi);
-
-      // Establish the contour method
-
-      string interpname = piter->contourInterpolation();
-      ContourInterpolation interp = ContourInterpolationValue(interpname);
-      if (interp == Missing)
-        throw runtime_error("Unknown contour interpolation method " + interpname);
-
-      // Get the values.
-
-      if (!MetaFunctions::isMeta(name))
+      if (fingerprinting)
       {
-        globals.queryinfo->Values(vals);
-        globals.unitsconverter.convert(FmiParameterName(globals.queryinfo->GetParamIdent()), vals);
+        const std::size_t fingerprint =
+            frame_fingerprint(theContext, target.inputfingerprint, fingerprintparams, t);
+        std::size_t oldfingerprint;
+        if (theGlobals.manifest.find(filename, oldfingerprint))
+          uptodate &= (oldfingerprint == fingerprint);
+        else if (theGlobals.manifest.persistent())
+          uptodate = false;
+        fingerprints.push_back(make_pair(filename, fingerprint));
       }
-      else
-        vals = MetaFunctions::values(piter->param(), *globals.queryinfo);
-
-      // Replace values if so requested
-
-      if (piter->replace()) vals.Replace(piter->replaceSourceValue(), piter->replaceTargetValue());
 
-      // Filter the values if so requested
-
-      filter_values(vals, t, *piter);
-
-      // Expand the data if so requested
-
-      if (globals.expanddata) expand_data(vals);
-
-      // Call smoother only if necessary to avoid LazyCoordinates dereferencing
-
-      LazyCoordinates worldpts(*area);
-
-      if (piter->smoother() != "None")
+      if (!theGlobals.force && uptodate)
       {
-        NFmiSmoother smoother(piter->smoother(), piter->smootherFactor(), piter->smootherRadius());
-
-        vals = smoother.Smoothen(*worldpts, vals);
+        if (theContext.verbose) cout << "Not overwriting " << filename << endl;
+        continue;
       }
 
-      // Setup the contourer with the values
-
-      globals.calculator.data(vals);
-
-      // Save the data values at desired points for later
-      // use, this lets us avoid using InterpolatedValue()
-      // which does not use smoothened values.
-
-      // First, however, if this is the first image, we add
-      // the grid points to the set of points, if so requested
-
-      if (!labeldxdydone) add_label_grid_values(*piter, *area, worldpts);
-
-      // For pixelgrids we must repeat the process for all new
-      // background images, since the pixel spacing changes
-      // every time. Note! We assume the following calling order!
-
-      add_label_point_values(*piter, *area, vals);
-      add_label_pixelgrid_values(*piter, *area, *xr, vals);
-
-      // Fill the contours
-
-      draw_contour_fills(*xr, *area, *piter, t, interp);
-
-      // Pattern fill the contours
-
-      draw_contour_patterns(*xr, *area, *piter, t, interp);
-
-      // Stroke the contours
-
-      draw_contour_strokes(*xr, *area, *piter, t, interp);
-
-      // Save contour symbol coordinates
-
-      save_contour_symbols(*xr, *area, *piter, worldpts, vals);
-
-      // Save symbol fill coordinates
-
-      save_contour_fonts(*xr, *area, *piter, worldpts, vals);
-
-      // Save contour label coordinates
-
-      save_contour_labels(*xr, *area, *piter, t, interp);
-
-      // Draw optional overlay
-
-      draw_overlay(*xr, *piter);
+      filenames[ai] = filename;
+      todo.push_back(ai);
     }
 
-    // Draw graticule
+    if (todo.empty()) continue;
 
-    draw_graticule(*xr, *area);
+    // Prepare the values of each parameter. The first area is used
+    // for smoothing so that the values do not depend on which areas
+    // happen to be up to date.
 
-    // Bang the foreground
+    prepare_fields(theContext, *targets[0].area, t, fields);
 
-    draw_foreground(*xr);
+    for (unsigned int pi = 0; pi < calculators.size(); pi++)
+      calculators[pi]->data(fields[pi]);
 
-    // Draw wind arrows if so requested
+    // Draw the contours of the areas, in parallel if possible
 
-    draw_wind_arrows(*xr, *area);
+    vector<boost::shared_ptr<ImagineXr_or_NFmiImage> > images(targets.size());
 
-    // Draw contour symbols
+    ThreadTools::parallel_for(todo.size(),
+                              areathreads,
+                              [&](std::size_t i)
+                              {
+                                const unsigned int ai = todo[i];
+                                RenderContext &context =
+                                    (fanout ? renderers[ai]->synchronize(theContext) : theContext);
 
-    draw_contour_symbols(*xr);
+                                images[ai] = area_image(context,
+                                                        targets[ai],
+                                                        filenames[ai],
+                                                        theGlobals.frameimages[ai]);
 
-    // Draw contour fonts
+                                draw_area_contours(context,
+                                                   *images[ai],
+                                                   *targets[ai].area,
+                                                   t,
+                                                   fields,
+                                                   calculators,
+                                                   labelsdone[ai]);
+                              });
 
-    draw_contour_fonts(*xr);
+    // Draw the texts and save the images one area at a time
 
-    // Label the contours
-
-    draw_contour_labels(*xr);
-
-    // Draw labels
-
-    for (piter = pbegin; piter != pend; ++piter)
+    for (unsigned int i = 0; i < todo.size(); i++)
     {
-      draw_label_markers(*xr, *piter, *area);
-      draw_label_texts(*xr, *piter, *area);
-    }
-
-    // Draw high/low pressure markers
-
-    draw_pressure_markers(*xr, *area);
-
-    // Bang the combine image (legend, logo, whatever)
+      const unsigned int ai = todo[i];
+      RenderContext &context = (fanout ? renderers[ai]->context : theContext);
 
-    globals.drawCombine(*xr);
+      draw_area_labels(context, *images[ai], *targets[ai].area, t);
 
-    // Finally, draw a time stamp on the image if so
-    // requested
+      // dx and dy labels have now been extracted into a list,
+      // disable adding them again and again and again..
 
-    const string stamp = globals.getImageStampText(t);
-    globals.drawImageStampText(*xr, stamp);
-
-    // dx and dy labels have now been extracted into a list,
-    // disable adding them again and again and again..
-
-    labeldxdydone = true;
+      labelsdone[ai] = true;
 
 // Save
 
 #ifdef IMAGINE_WITH_CAIRO
-    assert(xr->Filename() != "");
-    write_image(*xr);
-    delete xr;
+      assert(images[ai]->Filename() != "");
+      write_image(theGlobals, *images[ai]);
 #else
-    write_image(*image, filename, globals.format);
+      state.palettecolors = targets[ai].palettecolors;
+      queue_image(theGlobals, images[ai], filenames[ai], state.format);
 #endif
+    }
+  }
 
-    // Advance in time
+  writerguard.wait();
 
-    globals.labellocator.nextTime();
-    globals.pressurelocator.nextTime();
-    globals.symbollocator.nextTime();
-    globals.imagelocator.nextTime();
-  }
+  for (vector<pair<string, std::size_t> >::const_iterator it = fingerprints.begin();
+       it != fingerprints.end();
+       ++it)
+    theGlobals.manifest.update(it->first, it->second);
+  theGlobals.manifest.save();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Handle "draw contours" command
+ */
+// ----------------------------------------------------------------------
+
+void do_draw_contours(Globals &theGlobals, istream &theInput)
+{
+  RenderContext context(theGlobals, theGlobals, theGlobals.querystreams, theGlobals.verbose);
+  draw_contours(theGlobals, context);
 }
 
 /****/
-static void process_cmd(const string &text)
+static void process_cmd(Globals &theGlobals, const string &text)
 {
   istringstream in(text);
   string cmd;
@@ -5243,263 +6912,289 @@ static void process_cmd(const string &text)
     // Handle comments
 
     if (cmd == "#")
-      do_comment(in);
+      do_comment(theGlobals, in);
     else if (cmd[0] == '#')
-      do_comment(in);
+      do_comment(theGlobals, in);
     else if (cmd == "//")
-      do_comment(in);
+      do_comment(theGlobals, in);
     else if (cmd == "cache")
-      do_cache(in);
+      do_cache(theGlobals, in);
     else if (cmd == "imagecache")
-      do_imagecache(in);
+      do_imagecache(theGlobals, in);
+    else if (cmd == "imagecachelimit")
+      do_imagecachelimit(theGlobals, in);
+    else if (cmd == "manifest")
+      do_manifest(theGlobals, in);
     else if (cmd == "querydata")
-      do_querydata(in);
+      do_querydata(theGlobals, in);
     else if (cmd == "filter")
-      do_filter(in);
+      do_filter(theGlobals, in);
     else if (cmd == "timestepskip")
-      do_timestepskip(in);
+      do_timestepskip(theGlobals, in);
     else if (cmd == "timestep")
-      do_timestep(in);
+      do_timestep(theGlobals, in);
     else if (cmd == "timeinterval")
-      do_timeinterval(in);
+      do_timeinterval(theGlobals, in);
     else if (cmd == "timesteps")
-      do_timesteps(in);
+      do_timesteps(theGlobals, in);
     else if (cmd == "timestamp")
-      do_timestamp(in);
+      do_timestamp(theGlobals, in);
     else if (cmd == "timestampzone")
-      do_timestampzone(in);
+      do_timestampzone(theGlobals, in);
     else if (cmd == "timesteprounding")
-      do_timesteprounding(in);
+      do_timesteprounding(theGlobals, in);
     else if (cmd == "timestampimage")
-      do_timestampimage(in);
+      do_timestampimage(theGlobals, in);
     else if (cmd == "timestampimagexy")
-      do_timestampimagexy(in);
+      do_timestampimagexy(theGlobals, in);
     else if (cmd == "timestampimageformat")
-      do_timestampimageformat(in);
+      do_timestampimageformat(theGlobals, in);
     else if (cmd == "timestampimagefont")
-      do_timestampimagefont(in);
+      do_timestampimagefont(theGlobals, in);
     else if (cmd == "timestampimagecolor")
-      do_timestampimagecolor(in);
+      do_timestampimagecolor(theGlobals, in);
     else if (cmd == "timestampimagebackground")
-      do_timestampimagebackground(in);
+      do_timestampimagebackground(theGlobals, in);
     else if (cmd == "timestampimagemargin")
-      do_timestampimagemargin(in);
+      do_timestampimagemargin(theGlobals, in);
     else if (cmd == "timestampformat")
-      do_timestampformat(in);
+      do_timestampformat(theGlobals, in);
     else if (cmd == "projection")
-      do_projection(in);
+      do_projection(theGlobals, in);
+    else if (cmd == "areas")
+      do_areas(theGlobals, in);
     else if (cmd == "erase")
-      do_erase(in);
+      do_erase(theGlobals, in);
     else if (cmd == "fillrule")
-      do_fillrule(in);
+      do_fillrule(theGlobals, in);
     else if (cmd == "strokerule")
-      do_strokerule(in);
+      do_strokerule(theGlobals, in);
     else if (cmd == "directionparam")
-      do_directionparam(in);
+      do_directionparam(theGlobals, in);
     else if (cmd == "speedparam")
-      do_speedparam(in);
+      do_speedparam(theGlobals, in);
     else if (cmd == "speedcomponents")
-      do_speedcomponents(in);
+      do_speedcomponents(theGlobals, in);
     else if (cmd == "arrowscale")
-      do_arrowscale(in);
+      do_arrowscale(theGlobals, in);
+    else if (cmd == "arrowsprites")
+      do_arrowsprites(theGlobals, in);
     else if (cmd == "windarrowscale")
-      do_windarrowscale(in);
+      do_windarrowscale(theGlobals, in);
     else if (cmd == "arrowfill")
-      do_arrowfill(in);
+      do_arrowfill(theGlobals, in);
     else if (cmd == "arrowstroke")
-      do_arrowstroke(in);
+      do_arrowstroke(theGlobals, in);
     else if (cmd == "arrowpath")
-      do_arrowpath(in);
+      do_arrowpath(theGlobals, in);
     else if (cmd == "roundarrowfill")
-      do_roundarrowfill(in);
+      do_roundarrowfill(theGlobals, in);
     else if (cmd == "roundarrowstroke")
-      do_roundarrowstroke(in);
+      do_roundarrowstroke(theGlobals, in);
     else if (cmd == "roundarrowsize")
-      do_roundarrowsize(in);
+      do_roundarrowsize(theGlobals, in);
     else if (cmd == "windarrow")
-      do_windarrow(in);
+      do_windarrow(theGlobals, in);
     else if (cmd == "windarrows")
-      do_windarrows(in);
+      do_windarrows(theGlobals, in);
     else if (cmd == "windarrowsxy")
-      do_windarrowsxy(in);
+      do_windarrowsxy(theGlobals, in);
     else if (cmd == "background")
-      do_background(in);
+      do_background(theGlobals, in);
     else if (cmd == "foreground")
-      do_foreground(in);
+      do_foreground(theGlobals, in);
     else if (cmd == "mask")
-      do_mask(in);
+      do_mask(theGlobals, in);
     else if (cmd == "overlay")
-      do_overlay(in);
+      do_overlay(theGlobals, in);
     else if (cmd == "combine")
-      do_combine(in);
+      do_combine(theGlobals, in);
     else if (cmd == "foregroundrule")
-      do_foregroundrule(in);
+      do_foregroundrule(theGlobals, in);
     else if (cmd == "savepath")
-      do_savepath(in);
+      do_savepath(theGlobals, in);
     else if (cmd == "prefix")
-      do_prefix(in);
+      do_prefix(theGlobals, in);
     else if (cmd == "suffix")
-      do_suffix(in);
+      do_suffix(theGlobals, in);
     else if (cmd == "format")
-      do_format(in);
+      do_format(theGlobals, in);
     else if (cmd == "graticule")
-      do_graticule(in);
+      do_graticule(theGlobals, in);
 #if 0  // def IMAGINE_WITH_CAIRO
     // AKa 22-Aug-2008: Extension conf for Cairo
     //
-      else if(cmd == "antialias")				do_antialias(in);
+      else if(cmd == "antialias")				do_antialias(theGlobals, in);
 #endif
     else if (cmd == "gamma")
-      do_gamma(in);
+      do_gamma(theGlobals, in);
     else if (cmd == "intent")
-      do_intent(in);
+      do_intent(theGlobals, in);
     else if (cmd == "pngquality")
-      do_pngquality(in);
+      do_pngquality(theGlobals, in);
+    else if (cmd == "pngthreads")
+      do_pngthreads(theGlobals, in);
+    else if (cmd == "exactpalette")
+      do_exactpalette(theGlobals, in);
     else if (cmd == "jpegquality")
-      do_jpegquality(in);
+      do_jpegquality(theGlobals, in);
     else if (cmd == "savealpha")
-      do_savealpha(in);
+      do_savealpha(theGlobals, in);
     else if (cmd == "reducecolors")
-      do_reducecolors(in);
+      do_reducecolors(theGlobals, in);
     else if (cmd == "wantpalette")
-      do_wantpalette(in);
+      do_wantpalette(theGlobals, in);
     else if (cmd == "forcepalette")
-      do_forcepalette(in);
+      do_forcepalette(theGlobals, in);
     else if (cmd == "alphalimit")
-      do_alphalimit(in);
+      do_alphalimit(theGlobals, in);
     else if (cmd == "hilimit")
-      do_hilimit(in);
+      do_hilimit(theGlobals, in);
     else if (cmd == "datalolimit")
-      do_datalolimit(in);
+      do_datalolimit(theGlobals, in);
     else if (cmd == "datahilimit")
-      do_datahilimit(in);
+      do_datahilimit(theGlobals, in);
     else if (cmd == "datareplace")
-      do_datareplace(in);
+      do_datareplace(theGlobals, in);
     else if (cmd == "despeckle")
-      do_despeckle(in);
+      do_despeckle(theGlobals, in);
     else if (cmd == "expanddata")
-      do_expanddata(in);
+      do_expanddata(theGlobals, in);
     else if (cmd == "contourdepth")
-      do_contourdepth(in);
+      do_contourdepth(theGlobals, in);
     else if (cmd == "contourinterpolation")
-      do_contourinterpolation(in);
+      do_contourinterpolation(theGlobals, in);
     else if (cmd == "contourtriangles")
-      do_contourtriangles(in);
+      do_contourtriangles(theGlobals, in);
     else if (cmd == "smoother")
-      do_smoother(in);
+      do_smoother(theGlobals, in);
     else if (cmd == "smootherradius")
-      do_smootherradius(in);
+      do_smootherradius(theGlobals, in);
     else if (cmd == "smootherfactor")
-      do_smootherfactor(in);
+      do_smootherfactor(theGlobals, in);
     else if (cmd == "level")
-      do_level(in);
+      do_level(theGlobals, in);
     else if (cmd == "param")
-      do_param(in);
+      do_param(theGlobals, in);
     else if (cmd == "shape")
-      do_shape(in);
+      do_shape(theGlobals, in);
     else if (cmd == "contourfill")
-      do_contourfill(in);
+      do_contourfill(theGlobals, in);
     else if (cmd == "contourpattern")
-      do_contourpattern(in);
+      do_contourpattern(theGlobals, in);
     else if (cmd == "contoursymbol")
-      do_contoursymbol(in);
+      do_contoursymbol(theGlobals, in);
     else if (cmd == "contoursymbolmindist")
-      do_contoursymbolmindist(in);
+      do_contoursymbolmindist(theGlobals, in);
     else if (cmd == "contourfont")
-      do_contourfont(in);
+      do_contourfont(theGlobals, in);
     else if (cmd == "contourlinewidth")
-      do_contourlinewidth(in);
+      do_contourlinewidth(theGlobals, in);
+    else if (cmd == "contourfillsimplify")
+      do_contourfillsimplify(theGlobals, in);
+    else if (cmd == "contourrasterizer")
+      do_contourrasterizer(theGlobals, in);
+    else if (cmd == "contourfillmode")
+      do_contourfillmode(theGlobals, in);
+    else if (cmd == "threads")
+      do_threads(theGlobals, in);
+    else if (cmd == "writethreads")
+      do_writethreads(theGlobals, in);
     else if (cmd == "contourline")
-      do_contourline(in);
+      do_contourline(theGlobals, in);
     else if (cmd == "contourfills")
-      do_contourfills(in);
+      do_contourfills(theGlobals, in);
     else if (cmd == "contourlines")
-      do_contourlines(in);
+      do_contourlines(theGlobals, in);
 
     else if (cmd == "contourlabel")
-      do_contourlabel(in);
+      do_contourlabel(theGlobals, in);
     else if (cmd == "contourlabels")
-      do_contourlabels(in);
+      do_contourlabels(theGlobals, in);
     else if (cmd == "contourlabeltext")
-      do_contourlabeltext(in);
+      do_contourlabeltext(theGlobals, in);
     else if (cmd == "contourlabelfont")
-      do_contourlabelfont(in);
+      do_contourlabelfont(theGlobals, in);
     else if (cmd == "contourlabelcolor")
-      do_contourlabelcolor(in);
+      do_contourlabelcolor(theGlobals, in);
     else if (cmd == "contourlabelbackground")
-      do_contourlabelbackground(in);
+      do_contourlabelbackground(theGlobals, in);
     else if (cmd == "contourlabelmargin")
-      do_contourlabelmargin(in);
+      do_contourlabelmargin(theGlobals, in);
     else if (cmd == "contourlabelimagemargin")
-      do_contourlabelimagemargin(in);
+      do_contourlabelimagemargin(theGlobals, in);
     else if (cmd == "contourlabelmindistsamevalue")
-      do_contourlabelmindistsamevalue(in);
+      do_contourlabelmindistsamevalue(theGlobals, in);
     else if (cmd == "contourlabelmindistdifferentvalue")
-      do_contourlabelmindistdifferentvalue(in);
+      do_contourlabelmindistdifferentvalue(theGlobals, in);
     else if (cmd == "contourlabelmindistdifferentparam")
-      do_contourlabelmindistdifferentparam(in);
+      do_contourlabelmindistdifferentparam(theGlobals, in);
     else if (cmd == "contourfontmindistsamevalue")
-      do_contourfontmindistsamevalue(in);
+      do_contourfontmindistsamevalue(theGlobals, in);
     else if (cmd == "contourfontmindistdifferentvalue")
-      do_contourfontmindistdifferentvalue(in);
+      do_contourfontmindistdifferentvalue(theGlobals, in);
     else if (cmd == "contourfontmindistdifferentparam")
-      do_contourfontmindistdifferentparam(in);
+      do_contourfontmindistdifferentparam(theGlobals, in);
 
     else if (cmd == "highpressure")
-      do_highpressure(in);
+      do_highpressure(theGlobals, in);
     else if (cmd == "lowpressure")
-      do_lowpressure(in);
+      do_lowpressure(theGlobals, in);
     else if (cmd == "lowpressuremaximum")
-      do_lowpressuremaximum(in);
+      do_lowpressuremaximum(theGlobals, in);
     else if (cmd == "highpressureminimum")
-      do_highpressureminimum(in);
+      do_highpressureminimum(theGlobals, in);
     else if (cmd == "pressuremindistsame")
-      do_pressuremindistsame(in);
+      do_pressuremindistsame(theGlobals, in);
     else if (cmd == "pressuremindistdifferent")
-      do_pressuremindistdifferent(in);
+      do_pressuremindistdifferent(theGlobals, in);
+    else if (cmd == "pressureradius")
+      do_pressureradius(theGlobals, in);
+    else if (cmd == "pressureparam")
+      do_pressureparam(theGlobals, in);
     else if (cmd == "labelmarker")
-      do_labelmarker(in);
+      do_labelmarker(theGlobals, in);
     else if (cmd == "labelfont")
-      do_labelfont(in);
+      do_labelfont(theGlobals, in);
     else if (cmd == "labelcolor")
-      do_labelcolor(in);
+      do_labelcolor(theGlobals, in);
     else if (cmd == "labelrule")
-      do_labelrule(in);
+      do_labelrule(theGlobals, in);
     else if (cmd == "labelalign")
-      do_labelalign(in);
+      do_labelalign(theGlobals, in);
     else if (cmd == "labelformat")
-      do_labelformat(in);
+      do_labelformat(theGlobals, in);
     else if (cmd == "labelmissing")
-      do_labelmissing(in);
+      do_labelmissing(theGlobals, in);
     else if (cmd == "labeloffset")
-      do_labeloffset(in);
+      do_labeloffset(theGlobals, in);
     else if (cmd == "labelcaption")
-      do_labelcaption(in);
+      do_labelcaption(theGlobals, in);
     else if (cmd == "label")
-      do_label(in);
+      do_label(theGlobals, in);
     else if (cmd == "labelxy")
-      do_labelxy(in);
+      do_labelxy(theGlobals, in);
     else if (cmd == "labels")
-      do_labels(in);
+      do_labels(theGlobals, in);
     else if (cmd == "labelsxy")
-      do_labelsxy(in);
+      do_labelsxy(theGlobals, in);
     else if (cmd == "labelfile")
-      do_labelfile(in);
+      do_labelfile(theGlobals, in);
     else if (cmd == "units")
-      do_units(in);
+      do_units(theGlobals, in);
     else if (cmd == "clear")
-      do_clear(in);
+      do_clear(theGlobals, in);
 
     else if (cmd == "draw")
     {
       in >> cmd;
 
       if (cmd == "shapes")
-        do_draw_shapes(in);
+        do_draw_shapes(theGlobals, in);
       else if (cmd == "imagemap")
-        do_draw_imagemap(in);
+        do_draw_imagemap(theGlobals, in);
       else if (cmd == "contours")
-        do_draw_contours(in);
+        do_draw_contours(theGlobals, in);
       else
         throw runtime_error("draw " + cmd + " not implemented");
     }
@@ -5512,6 +7207,139 @@ static void process_cmd(const string &text)
 // Main program.
 // ----------------------------------------------------------------------
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Process the given script
+ *
+ * The hash of the script and the command line settings is
+ * a part of the fingerprints of the images.
+ *
+ * \param theGlobals The globals the script modifies
+ * \param theName The script filename
+ */
+// ----------------------------------------------------------------------
+
+void process_script(Globals &theGlobals, const string &theName)
+{
+  if (theGlobals.verbose) cout << "Processing file: " << theName << endl;
+
+  string text = read_script(theName);
+  text = preprocess_script(theGlobals, text);
+
+  theGlobals.scriptfingerprint = 0;
+  boost::hash_combine(theGlobals.scriptfingerprint, theGlobals.cmdline_querydata);
+  boost::hash_combine(theGlobals.scriptfingerprint, theGlobals.cmdline_conf);
+  boost::hash_combine(theGlobals.scriptfingerprint, text);
+
+  process_cmd(theGlobals, text);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Run a job
+ *
+ * The job starts from the given state so that the settings of
+ * earlier jobs do not leak into it. Only the caches and the query
+ * streams are shared between jobs.
+ *
+ * \param theGlobals The globals running the job
+ * \param theState The initial state of the job
+ * \param theScripts The scripts to process
+ * \return An empty string on success, otherwise the error message
+ */
+// ----------------------------------------------------------------------
+
+string run_job(Globals &theGlobals, const JobState &theState, const vector<string> &theScripts)
+{
+  string error;
+  try
+  {
+    theGlobals.restore(theState);
+    for (vector<string>::const_iterator it = theScripts.begin(); it != theScripts.end(); ++it)
+      process_script(theGlobals, *it);
+  }
+  catch (const std::exception &e)
+  {
+    error = e.what();
+  }
+  catch (...)
+  {
+    error = "unknown error";
+  }
+
+  // Images still being written belong to this job
+
+  try
+  {
+    theGlobals.imagewriter.wait();
+  }
+  catch (const std::exception &e)
+  {
+    if (error.empty()) error = e.what();
+  }
+
+  return error;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Process the command line scripts whenever the querydata changes
+ *
+ * Each pass starts from the given state, which includes the effects
+ * of the -c option, just like the first pass did.
+ *
+ * Errors are reported but do not stop watching, since the next
+ * update may well fix the problem.
+ *
+ * \param theGlobals The globals running the jobs
+ * \param theState The state before the command line scripts
+ */
+// ----------------------------------------------------------------------
+
+void watch_querydata(Globals &theGlobals, const JobState &theState)
+{
+  const int settletime = 1000;
+
+  const vector<string> scripts(theGlobals.cmdline_files.begin(), theGlobals.cmdline_files.end());
+
+  WatchTools::Watcher watcher;
+
+  for (;;)
+  {
+    if (theGlobals.watchfiles.empty()) throw runtime_error("No querydata files to watch");
+
+    // Files modified before they were watched, for example while the
+    // first pass was running, are handled without waiting.
+
+    vector<string> files;
+    vector<string> changes;
+    for (map<string, time_t>::const_iterator it = theGlobals.watchfiles.begin();
+         it != theGlobals.watchfiles.end();
+         ++it)
+    {
+      files.push_back(it->first);
+      if (NFmiFileSystem::FileModificationTime(it->first) != it->second)
+        changes.push_back(it->first);
+    }
+
+    watcher.watch(files);
+    if (changes.empty()) changes = watcher.wait(settletime);
+
+    if (theGlobals.verbose)
+    {
+      for (vector<string>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+        cout << "Querydata updated: " << *it << endl;
+    }
+
+    const string error = run_job(theGlobals, theState, scripts);
+
+    if (!error.empty())
+    {
+      cerr << "Error: qdcontour failed due to" << endl << "--> " << error << endl;
+    }
+  }
+}
+
 int domain(int argc, const char *argv[])
 {
   // Initialize configuration variables
@@ -5520,32 +7348,46 @@ int domain(int argc, const char *argv[])
 
   // Parse command line
 
-  parse_command_line(argc, argv);
+  parse_command_line(globals, argc, argv);
 
   // Handle command line config text; if any
   //
   if (!globals.cmdline_conf.empty())
   {
-    process_cmd(globals.cmdline_conf);
+    process_cmd(globals, globals.cmdline_conf);
   }
 
+  // The -c option is applied only once, watch mode and server jobs
+  // start from a copy of the state instead.
+
+  JobState state = globals;
+
   // Process all command files
   // ~~~~~~~~~~~~~~~~~~~~~~~~~
 
   list<string>::const_iterator fileiter = globals.cmdline_files.begin();
   for (; fileiter != globals.cmdline_files.end(); ++fileiter)
-  {
-    // Get the script to be executed
+    process_script(globals, *fileiter);
 
-    if (globals.verbose) cout << "Processing file: " << *fileiter << endl;
+  // Serve further jobs if so requested. The jobs inherit the settings
+  // of the command line scripts.
 
-    string text = read_script(*fileiter);
-    text = preprocess_script(text);
+  if (!globals.cmdline_serve.empty())
+  {
+    state = globals;
+    ServerTools::serve(globals.cmdline_serve,
+                       [&state](const vector<string> &theScripts)
+                       { return run_job(globals, state, theScripts); });
+  }
 
-    // Process the commands
+  // Or keep rendering updated data
 
-    process_cmd(text);
+  if (globals.cmdline_watch)
+  {
+    globals.imagewriter.wait();
+    watch_querydata(globals, state);
   }
+
   return 0;
 }
 
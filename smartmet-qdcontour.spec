@@ -30,6 +30,16 @@ Provides: qdcontour
 %description
 qdcontour
 
+%package -n %{RPMNAME}-devel
+Summary: qdcontour contouring library
+Group: Development/Libraries
+Requires: smartmet-library-imagine-devel >= 17.2.10
+Requires: smartmet-library-newbase-devel >= 17.2.13
+Requires: smartmet-library-tron >= 17.2.7
+
+%description -n %{RPMNAME}-devel
+Static library and headers for embedding the qdcontour contouring engine
+
 %prep
 rm -rf $RPM_BUILD_ROOT
 
@@ -49,6 +59,11 @@ rm -rf $RPM_BUILD_ROOT
 %defattr(-,root,root,0775)
 %{_bindir}/qdcontour
 
+%files -n %{RPMNAME}-devel
+%defattr(0664,root,root,0775)
+%{_libdir}/libqdcontour.a
+%{_includedir}/smartmet/qdcontour/*.h
+
 
 %changelog
 * Mon Feb 13 2017 Mika Heiskanen <mika.heiskanen@fmi.fi> - 17.2.13-1.fmi
@@ -0,0 +1,213 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of class ArrowAtlas
+ */
+// ======================================================================
+
+#include "ArrowAtlas.h"
+#include "ColorTools.h"
+
+#include <imagine/NFmiEsriBox.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace Imagine;
+using namespace std;
+
+namespace
+{
+//! Empty margin around the rasterized paths
+const int margin = 2;
+
+//! Maximum number of sprites kept in memory
+const size_t maxsprites = 10000;
+
+}  // namespace anonymous
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Sprite constructor
+ */
+// ----------------------------------------------------------------------
+
+ArrowAtlas::Sprite::Sprite() : itsFits(false), itsLayers() {}
+// ----------------------------------------------------------------------
+/*!
+ * \brief Blend one layer of the sprite onto the image
+ *
+ * \param theImage The image to draw into
+ * \param theLayer The layer to draw
+ * \param theX The X-coordinate of the arrow origin
+ * \param theY The Y-coordinate of the arrow origin
+ * \param theColor The colour
+ * \param theRule The blending rule, which must be blendable
+ */
+// ----------------------------------------------------------------------
+
+void ArrowAtlas::Sprite::draw(NFmiImage &theImage,
+                              size_t theLayer,
+                              int theX,
+                              int theY,
+                              NFmiColorTools::Color theColor,
+                              NFmiColorTools::NFmiBlendRule theRule) const
+{
+  if (theColor == NFmiColorTools::NoColor) return;
+
+  const Runs &runs = itsLayers[theLayer];
+
+  for (Runs::const_iterator it = runs.begin(); it != runs.end(); ++it)
+  {
+    const int j = theY + it->y;
+    if (j < 0 || j >= theImage.Height()) continue;
+
+    const int x1 = max(0, theX + it->x1);
+    const int x2 = min(theImage.Width() - 1, theX + it->x2);
+
+    for (int i = x1; i <= x2; i++)
+    {
+      NFmiColorTools::Color &pixel = theImage(i, j);
+      pixel = ColorTools::blend(theColor, pixel, theRule);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ */
+// ----------------------------------------------------------------------
+
+ArrowAtlas::ArrowAtlas() : itsSprites() {}
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether the atlas is empty
+ */
+// ----------------------------------------------------------------------
+
+bool ArrowAtlas::empty() const { return itsSprites.empty(); }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Discard all sprites
+ */
+// ----------------------------------------------------------------------
+
+void ArrowAtlas::clear() { itsSprites.clear(); }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Find a sprite
+ *
+ * \param theKey The unique key of the arrow shape
+ * \return The sprite, or 0 if there is none
+ */
+// ----------------------------------------------------------------------
+
+const ArrowAtlas::Sprite *ArrowAtlas::find(const string &theKey) const
+{
+  Sprites::const_iterator it = itsSprites.find(theKey);
+  if (it == itsSprites.end()) return 0;
+  return &it->second;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Rasterize a new sprite
+ *
+ * The paths must be positioned relative to the arrow origin. If the
+ * sprite would be larger than the given size, only a marker for an
+ * unusable sprite is stored so that the paths are not measured again.
+ *
+ * \param theKey The unique key of the arrow shape
+ * \param theParts The paths in rendering order
+ * \param theMaxSize The maximum width and height of the sprite
+ * \return The new sprite
+ */
+// ----------------------------------------------------------------------
+
+const ArrowAtlas::Sprite &ArrowAtlas::insert(const string &theKey,
+                                             const Parts &theParts,
+                                             int theMaxSize)
+{
+  if (itsSprites.size() >= maxsprites) itsSprites.clear();
+
+  Sprite &sprite = itsSprites[theKey];
+  sprite.itsFits = false;
+  sprite.itsLayers.clear();
+
+  // The bounding box of all the paths
+
+  NFmiEsriBox box;
+  for (Parts::const_iterator it = theParts.begin(); it != theParts.end(); ++it)
+  {
+    NFmiEsriBox b = it->first.BoundingBox();
+    if (!b.IsValid()) continue;
+    box.Update(b.Xmin(), b.Ymin());
+    box.Update(b.Xmax(), b.Ymax());
+  }
+
+  sprite.itsLayers.resize(theParts.size());
+
+  if (!box.IsValid())
+  {
+    sprite.itsFits = true;
+    return sprite;
+  }
+
+  const int x1 = static_cast<int>(floor(box.Xmin())) - margin;
+  const int y1 = static_cast<int>(floor(box.Ymin())) - margin;
+  const int x2 = static_cast<int>(ceil(box.Xmax())) + margin;
+  const int y2 = static_cast<int>(ceil(box.Ymax())) + margin;
+
+  const int width = x2 - x1 + 1;
+  const int height = y2 - y1 + 1;
+
+  if (width > theMaxSize || height > theMaxSize)
+  {
+    sprite.itsLayers.clear();
+    return sprite;
+  }
+
+  // Render each part with an opaque colour and collect the covered pixels
+
+  for (size_t layer = 0; layer < theParts.size(); layer++)
+  {
+    NFmiImage image(width, height, NFmiColorTools::TransparentColor);
+
+    NFmiPath path = theParts[layer].first;
+    path.Translate(static_cast<float>(-x1), static_cast<float>(-y1));
+
+    if (theParts[layer].second)
+      path.Fill(image, NFmiColorTools::Black, NFmiColorTools::kFmiColorCopy);
+    else
+      path.Stroke(image, NFmiColorTools::Black, NFmiColorTools::kFmiColorCopy);
+
+    Sprite::Runs &runs = sprite.itsLayers[layer];
+
+    for (int j = 0; j < height; j++)
+    {
+      int i = 0;
+      while (i < width)
+      {
+        if (image(i, j) == NFmiColorTools::TransparentColor)
+        {
+          ++i;
+          continue;
+        }
+
+        Sprite::Run run;
+        run.y = j + y1;
+        run.x1 = i + x1;
+        while (i < width && image(i, j) != NFmiColorTools::TransparentColor)
+          ++i;
+        run.x2 = i - 1 + x1;
+        runs.push_back(run);
+      }
+    }
+  }
+
+  sprite.itsFits = true;
+  return sprite;
+}
+
+// ======================================================================
@@ -0,0 +1,379 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of class BandRasterizer
+ */
+// ======================================================================
+
+#include "BandRasterizer.h"
+#include "ColorTools.h"
+#include "ThreadTools.h"
+
+#include <imagine/NFmiColorBlend.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace Imagine;
+using namespace std;
+
+namespace
+{
+//! A scanline crossing of a band edge
+struct Crossing
+{
+  int band;
+  double x;
+
+  bool operator<(const Crossing &theOther) const
+  {
+    if (band != theOther.band) return band < theOther.band;
+    return x < theOther.x;
+  }
+};
+
+//! Sort edges by the first scanline they cross
+struct FirstRowLess
+{
+  template <typename T>
+  bool operator()(const T &theLhs, const T &theRhs) const
+  {
+    return theLhs.firstrow < theRhs.firstrow;
+  }
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Blend a colour onto a horizontal span of pixels
+ */
+// ----------------------------------------------------------------------
+
+template <class T>
+void blend_span(NFmiImage &theImage, int theRow, int theStart, int theEnd, int theColor)
+{
+  for (int i = theStart; i <= theEnd; i++)
+  {
+    NFmiColorTools::Color &pixel = theImage(i, theRow);
+    pixel = T::Blend(theColor, pixel);
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Blend a span with the given rule
+ */
+// ----------------------------------------------------------------------
+
+void blend_span(NFmiImage &theImage,
+                int theRow,
+                int theStart,
+                int theEnd,
+                NFmiColorTools::Color theColor,
+                NFmiColorTools::NFmiBlendRule theRule)
+{
+  switch (theRule)
+  {
+    case NFmiColorTools::kFmiColorCopy:
+      blend_span<NFmiColorBlendCopy>(theImage, theRow, theStart, theEnd, theColor);
+      break;
+    case NFmiColorTools::kFmiColorOver:
+      blend_span<NFmiColorBlendOver>(theImage, theRow, theStart, theEnd, theColor);
+      break;
+    case NFmiColorTools::kFmiColorAtop:
+      blend_span<NFmiColorBlendAtop>(theImage, theRow, theStart, theEnd, theColor);
+      break;
+    case NFmiColorTools::kFmiColorOnOpaque:
+      blend_span<NFmiColorBlendOnOpaque>(theImage, theRow, theStart, theEnd, theColor);
+      break;
+    case NFmiColorTools::kFmiColorOnTransparent:
+      blend_span<NFmiColorBlendOnTransparent>(theImage, theRow, theStart, theEnd, theColor);
+      break;
+    default:
+      throw runtime_error("Internal error: unsupported blending rule in BandRasterizer");
+  }
+}
+
+}  // namespace anonymous
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ *
+ * \param theWidth The width of the image to be filled
+ * \param theHeight The height of the image to be filled
+ */
+// ----------------------------------------------------------------------
+
+BandRasterizer::BandRasterizer(int theWidth, int theHeight)
+    : itsWidth(theWidth), itsHeight(theHeight), itsBands(), itsEdges()
+{
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether the given path and rule can be rasterized
+ *
+ * \param thePath The projected path
+ * \param theRule The blending rule
+ * \return True if the path contains only lines and the rule is supported
+ */
+// ----------------------------------------------------------------------
+
+bool BandRasterizer::supports(const NFmiPath &thePath, NFmiColorTools::NFmiBlendRule theRule)
+{
+  if (!ColorTools::blendable(theRule)) return false;
+
+  for (NFmiPathData::const_iterator it = thePath.Elements().begin(); it != thePath.Elements().end();
+       ++it)
+  {
+    if (it->op == kFmiConicTo || it->op == kFmiCubicTo) return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether there is anything to fill
+ */
+// ----------------------------------------------------------------------
+
+bool BandRasterizer::empty() const { return itsBands.empty(); }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Discard all added bands
+ */
+// ----------------------------------------------------------------------
+
+void BandRasterizer::clear()
+{
+  itsBands.clear();
+  itsEdges.clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Add a new band
+ *
+ * Each subpath is closed implicitly, as in NFmiPath::Fill.
+ *
+ * \param thePath The projected path
+ * \param theColor The fill colour
+ * \param theRule The blending rule
+ */
+// ----------------------------------------------------------------------
+
+void BandRasterizer::add(const NFmiPath &thePath,
+                         NFmiColorTools::Color theColor,
+                         NFmiColorTools::NFmiBlendRule theRule)
+{
+  if (!supports(thePath, theRule))
+    throw runtime_error("Internal error: BandRasterizer cannot fill the given path");
+
+  const int band = static_cast<int>(itsBands.size());
+  Band b;
+  b.color = theColor;
+  b.rule = theRule;
+  itsBands.push_back(b);
+
+  const NFmiPathData &elements = thePath.Elements();
+  if (elements.empty()) return;
+
+  double startx = elements.front().x;
+  double starty = elements.front().y;
+  double lastx = startx;
+  double lasty = starty;
+
+  for (NFmiPathData::const_iterator it = elements.begin(); it != elements.end(); ++it)
+  {
+    if (it->op == kFmiMoveTo)
+    {
+      addEdge(band, lastx, lasty, startx, starty);
+      startx = it->x;
+      starty = it->y;
+    }
+    else
+      addEdge(band, lastx, lasty, it->x, it->y);
+
+    lastx = it->x;
+    lasty = it->y;
+  }
+  addEdge(band, lastx, lasty, startx, starty);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Add a single edge
+ *
+ * Horizontal edges and edges not crossing any scanline centre inside
+ * the image are ignored. The end point of an edge is not included,
+ * so that a vertex shared by two edges is counted only once.
+ */
+// ----------------------------------------------------------------------
+
+void BandRasterizer::addEdge(int theBand, double theX1, double theY1, double theX2, double theY2)
+{
+  if (theY1 == theY2) return;
+  if (theX1 != theX1 || theY1 != theY1 || theX2 != theX2 || theY2 != theY2) return;
+
+  if (theY1 > theY2)
+  {
+    swap(theX1, theX2);
+    swap(theY1, theY2);
+  }
+
+  const double dxdy = (theX2 - theX1) / (theY2 - theY1);
+
+  const double first = max(0.0, ceil(theY1));
+  const double last = min(itsHeight - 1.0, ceil(theY2) - 1);
+
+  if (first > last) return;
+
+  Edge edge;
+  edge.band = theBand;
+  edge.firstrow = static_cast<int>(first);
+  edge.lastrow = static_cast<int>(last);
+  edge.x = theX1 + (first - theY1) * dxdy;
+  edge.dxdy = dxdy;
+  itsEdges.push_back(edge);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Fill all added bands into the image
+ *
+ * The image may be split into horizontal stripes which are filled
+ * in parallel. Each scanline is processed exactly as in the single
+ * threaded case, hence the result does not depend on the number of
+ * threads. The rasterizer is cleared afterwards.
+ *
+ * \param theImage The image to fill
+ * \param theThreads The number of threads to use
+ */
+// ----------------------------------------------------------------------
+
+void BandRasterizer::fill(NFmiImage &theImage, unsigned int theThreads)
+{
+  if (itsEdges.empty())
+  {
+    clear();
+    return;
+  }
+
+  const int width = min(itsWidth, theImage.Width());
+  const int height = min(itsHeight, theImage.Height());
+
+  stable_sort(itsEdges.begin(), itsEdges.end(), FirstRowLess());
+
+  if (theThreads <= 1 || height < 2)
+    fillRows(theImage, 0, height - 1, width);
+  else
+  {
+    // A few stripes per thread balance the uneven work
+
+    const int stripes = min(height, static_cast<int>(4 * theThreads));
+    const int rows = (height + stripes - 1) / stripes;
+
+    ThreadTools::parallel_for(stripes,
+                              theThreads,
+                              [&](size_t theStripe)
+                              {
+                                const int first = static_cast<int>(theStripe) * rows;
+                                const int last = min(height - 1, first + rows - 1);
+                                if (first <= last) fillRows(theImage, first, last, width);
+                              });
+  }
+
+  clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Fill the given scanlines
+ *
+ * Only the given rows of the image are modified, hence separate
+ * stripes can be filled simultaneously. The edges must be sorted.
+ *
+ * \param theImage The image to fill
+ * \param theFirstRow The first scanline to fill
+ * \param theLastRow The last scanline to fill
+ * \param theWidth The width of the area to fill
+ */
+// ----------------------------------------------------------------------
+
+void BandRasterizer::fillRows(NFmiImage &theImage,
+                              int theFirstRow,
+                              int theLastRow,
+                              int theWidth) const
+{
+  vector<Edge>::size_type next = 0;
+  vector<Edge> active;
+  vector<Crossing> crossings;
+
+  // Edges which started above the stripe may still be active
+
+  while (next < itsEdges.size() && itsEdges[next].firstrow <= theFirstRow)
+  {
+    if (itsEdges[next].lastrow >= theFirstRow) active.push_back(itsEdges[next]);
+    ++next;
+  }
+
+  for (int j = theFirstRow; j <= theLastRow; j++)
+  {
+    // Activate the edges starting on this row
+
+    while (next < itsEdges.size() && itsEdges[next].firstrow <= j)
+      active.push_back(itsEdges[next++]);
+
+    if (active.empty())
+    {
+      if (next >= itsEdges.size()) break;
+      continue;
+    }
+
+    // Intersect the scanline with the active edges
+
+    crossings.clear();
+    for (vector<Edge>::const_iterator it = active.begin(); it != active.end(); ++it)
+    {
+      Crossing c;
+      c.band = it->band;
+      c.x = it->x + (j - it->firstrow) * it->dxdy;
+      crossings.push_back(c);
+    }
+
+    // Grouping by band keeps the blending order of separate fills
+
+    sort(crossings.begin(), crossings.end());
+
+    vector<Crossing>::size_type k = 0;
+    while (k + 1 < crossings.size())
+    {
+      // An odd number of crossings means the band path was broken
+      if (crossings[k].band != crossings[k + 1].band)
+      {
+        ++k;
+        continue;
+      }
+
+      const double x1 = max(0.0, ceil(crossings[k].x));
+      const double x2 = min(theWidth - 1.0, floor(crossings[k + 1].x));
+
+      if (x1 <= x2)
+      {
+        const Band &band = itsBands[crossings[k].band];
+        blend_span(theImage, j, static_cast<int>(x1), static_cast<int>(x2), band.color, band.rule);
+      }
+      k += 2;
+    }
+
+    // Retire the edges ending on this row
+
+    vector<Edge>::iterator last = active.begin();
+    for (vector<Edge>::iterator it = active.begin(); it != active.end(); ++it)
+      if (it->lastrow > j) *last++ = *it;
+    active.erase(last, active.end());
+  }
+}
+
+// ======================================================================
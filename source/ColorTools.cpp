@@ -10,6 +10,8 @@
 
 #include "ColorTools.h"
 
+#include <imagine/NFmiColorBlend.h>
+
 using namespace std;
 
 namespace
@@ -241,6 +243,69 @@ Imagine::NFmiColorTools::NFmiBlendRule checkrule(const std::string &theRule)
   throw runtime_error("Unknown blending rule " + theRule);
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether blend() supports the given rule
+ *
+ * Only the rules commonly used for filling are supported.
+ *
+ * \param theRule The blending rule
+ * \return True if the rule is supported
+ */
+// ----------------------------------------------------------------------
+
+bool blendable(Imagine::NFmiColorTools::NFmiBlendRule theRule)
+{
+  using namespace Imagine;
+  switch (theRule)
+  {
+    case NFmiColorTools::kFmiColorCopy:
+    case NFmiColorTools::kFmiColorOver:
+    case NFmiColorTools::kFmiColorAtop:
+    case NFmiColorTools::kFmiColorOnOpaque:
+    case NFmiColorTools::kFmiColorOnTransparent:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Blend a single colour onto a background colour
+ *
+ * The blending is done exactly as when filling with Imagine.
+ * Throws an exception for rules not accepted by blendable().
+ *
+ * \param theColor The colour to blend
+ * \param theBackground The existing colour
+ * \param theRule The blending rule
+ * \return The blended colour
+ */
+// ----------------------------------------------------------------------
+
+Imagine::NFmiColorTools::Color blend(Imagine::NFmiColorTools::Color theColor,
+                                     Imagine::NFmiColorTools::Color theBackground,
+                                     Imagine::NFmiColorTools::NFmiBlendRule theRule)
+{
+  using namespace Imagine;
+  switch (theRule)
+  {
+    case NFmiColorTools::kFmiColorCopy:
+      return NFmiColorBlendCopy::Blend(theColor, theBackground);
+    case NFmiColorTools::kFmiColorOver:
+      return NFmiColorBlendOver::Blend(theColor, theBackground);
+    case NFmiColorTools::kFmiColorAtop:
+      return NFmiColorBlendAtop::Blend(theColor, theBackground);
+    case NFmiColorTools::kFmiColorOnOpaque:
+      return NFmiColorBlendOnOpaque::Blend(theColor, theBackground);
+    case NFmiColorTools::kFmiColorOnTransparent:
+      return NFmiColorBlendOnTransparent::Blend(theColor, theBackground);
+    default:
+      throw runtime_error("Unsupported blending rule in ColorTools::blend");
+  }
+}
+
 }  // namespace ColorTools
 
 // ======================================================================
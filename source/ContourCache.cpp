@@ -24,6 +24,7 @@ namespace
  * \param theHiLimit The upper limit of the contour
  * \param theTime The actual data time which may be interpolated
  * \param theData The query data
+ * \param theVariant Optional extra identification
  * \return The key for the data in the cache
  */
 // ----------------------------------------------------------------------
@@ -31,7 +32,8 @@ namespace
 std::string cache_key(float theLoLimit,
                       float theHiLimit,
                       const NFmiTime &theTime,
-                      const LazyQueryData &theData)
+                      const LazyQueryData &theData,
+                      const std::string &theVariant)
 {
   ostringstream os;
 
@@ -40,6 +42,8 @@ std::string cache_key(float theLoLimit,
      << theData.OriginTime().ToStr(kYYYYMMDDHHMM).CharPtr() << '_' << theData.GetParamName() << '_'
      << theData.GetParamIdent() << '_' << theData.GetLevelNumber();
 
+  if (!theVariant.empty()) os << '_' << theVariant;
+
   return os.str();
 }
 }
@@ -77,15 +81,17 @@ ContourCache::size_type ContourCache::size() const { return itsData.size(); }
  * \param theHiLimit The upper limit of the contour
  * \param theTime The actual data time may be interpolated (<> ValidTime)
  * \param theData The query data
+ * \param theVariant Optional extra identification
  */
 // ----------------------------------------------------------------------
 
 bool ContourCache::contains(float theLoLimit,
                             float theHiLimit,
                             const NFmiTime &theTime,
-                            const LazyQueryData &theData) const
+                            const LazyQueryData &theData,
+                            const std::string &theVariant) const
 {
-  string key = cache_key(theLoLimit, theHiLimit, theTime, theData);
+  string key = cache_key(theLoLimit, theHiLimit, theTime, theData, theVariant);
   storage_type::const_iterator it = itsData.find(key);
   return (it != itsData.end());
 }
@@ -100,6 +106,7 @@ bool ContourCache::contains(float theLoLimit,
  * \param theHiLimit The upper limit of the contour
  * \param theTime The actual data time may be interpolated (<> ValidTime)
  * \param theData The query data
+ * \param theVariant Optional extra identification
  * \return The path
  */
 // ----------------------------------------------------------------------
@@ -107,9 +114,10 @@ bool ContourCache::contains(float theLoLimit,
 const Imagine::NFmiPath &ContourCache::find(float theLoLimit,
                                             float theHiLimit,
                                             const NFmiTime &theTime,
-                                            const LazyQueryData &theData) const
+                                            const LazyQueryData &theData,
+                                            const std::string &theVariant) const
 {
-  string key = cache_key(theLoLimit, theHiLimit, theTime, theData);
+  string key = cache_key(theLoLimit, theHiLimit, theTime, theData, theVariant);
   storage_type::const_iterator it = itsData.find(key);
   if (it != itsData.end()) return it->second;
   throw runtime_error("Contour was not in the cache - use contains first!");
@@ -126,6 +134,7 @@ const Imagine::NFmiPath &ContourCache::find(float theLoLimit,
  * \param theHiLimit The upper limit of the contour
  * \param theTime The actual data time may be interpolated (<> ValidTime)
  * \param theData The query data
+ * \param theVariant Optional extra identification
  */
 // ----------------------------------------------------------------------
 
@@ -133,9 +142,10 @@ void ContourCache::insert(const Imagine::NFmiPath &thePath,
                           float theLoLimit,
                           float theHiLimit,
                           const NFmiTime &theTime,
-                          const LazyQueryData &theData)
+                          const LazyQueryData &theData,
+                          const std::string &theVariant)
 {
-  string key = cache_key(theLoLimit, theHiLimit, theTime, theData);
+  string key = cache_key(theLoLimit, theHiLimit, theTime, theData, theVariant);
 
   typedef pair<storage_type::const_iterator, bool> restype;
 
@@ -20,8 +20,12 @@
 
 #include <boost/make_shared.hpp>
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <tuple>
+#include <utility>
 
 typedef Tron::Traits<double, double, Tron::FmiMissing> MyTraits;
 
@@ -185,6 +189,8 @@ class ContourCalculatorPimple
   ContourCalculatorPimple()
       : itsAreaCache(),
         itsLineCache(),
+        itsAreaMemo(),
+        itsLineMemo(),
         isCacheOn(false),
         itWasCached(false),
         itsData(),
@@ -192,13 +198,21 @@ class ContourCalculatorPimple
   {
   }
 
+  // Contours of the active data, valid until the data changes
+
+  typedef std::tuple<float, float, int> MemoKey;
+  typedef std::map<MemoKey, Imagine::NFmiPath> Memo;
+
   ContourCache itsAreaCache;
   ContourCache itsLineCache;
+  Memo itsAreaMemo;
+  Memo itsLineMemo;
   bool isCacheOn;
   bool itWasCached;
   boost::shared_ptr<DataMatrixAdapter> itsData;  // does not own!
   bool itsHintsOK;
   boost::shared_ptr<MyHints> itsHints;
+  std::recursive_mutex itsMutex;  // serializes concurrent use
 
   void require_hints();
 
@@ -240,8 +254,12 @@ ContourCalculator::ContourCalculator() { itsPimple.reset(new ContourCalculatorPi
 
 void ContourCalculator::clearCache()
 {
+  std::lock_guard<std::recursive_mutex> lock(itsPimple->itsMutex);
+
   itsPimple->itsAreaCache.clear();
   itsPimple->itsLineCache.clear();
+  itsPimple->itsAreaMemo.clear();
+  itsPimple->itsLineMemo.clear();
 }
 
 // ----------------------------------------------------------------------
@@ -265,19 +283,30 @@ bool ContourCalculator::wasCached() const { return itsPimple->itWasCached; }
 // ----------------------------------------------------------------------
 /*!
  * \brief Set new active data on
+ *
+ * The contours calculated from the previous data are forgotten,
+ * excluding those stored in the persistent cache.
  */
 // ----------------------------------------------------------------------
 
 void ContourCalculator::data(const NFmiDataMatrix<float> &theData)
 {
+  std::lock_guard<std::recursive_mutex> lock(itsPimple->itsMutex);
+
   itsPimple->itsData.reset(new DataMatrixAdapter(theData));
   itsPimple->itsHintsOK = false;
+  itsPimple->itsAreaMemo.clear();
+  itsPimple->itsLineMemo.clear();
 }
 
 // ----------------------------------------------------------------------
 /*!
  * \brief Return the desired contour
  *
+ * Contours of the active data are remembered until new data is set
+ * even if the cache is off, since the same contours are often
+ * needed for both fills and patterns.
+ *
  *\return The path object
  */
 // ----------------------------------------------------------------------
@@ -288,6 +317,8 @@ Imagine::NFmiPath ContourCalculator::contour(const LazyQueryData &theData,
                                              const NFmiTime &theTime,
                                              ContourInterpolation theInterpolation)
 {
+  std::lock_guard<std::recursive_mutex> lock(itsPimple->itsMutex);
+
   if (itsPimple->itsData.get() == 0)
     throw std::runtime_error("ContourCalculator:: No data set before calling contour");
 
@@ -298,9 +329,51 @@ Imagine::NFmiPath ContourCalculator::contour(const LazyQueryData &theData,
     return itsPimple->itsAreaCache.find(theLoLimit, theHiLimit, theTime, theData);
   }
 
+  Imagine::NFmiPath path =
+      contour(*theData.Grid(), theData.IsWorldData(), theLoLimit, theHiLimit, theInterpolation);
+
+  if (itsPimple->isCacheOn)
+    itsPimple->itsAreaCache.insert(path, theLoLimit, theHiLimit, theTime, theData);
+
+  return path;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the desired contour of data on the given grid
+ *
+ * The persistent cache is not used, since there is no querydata to
+ * identify the contour with.
+ *
+ * \param theGrid The grid of the active data
+ * \param theWorldData True if the grid covers the whole world
+ * \return The path object in world coordinates
+ */
+// ----------------------------------------------------------------------
+
+Imagine::NFmiPath ContourCalculator::contour(const NFmiGrid &theGrid,
+                                             bool theWorldData,
+                                             float theLoLimit,
+                                             float theHiLimit,
+                                             ContourInterpolation theInterpolation)
+{
+  std::lock_guard<std::recursive_mutex> lock(itsPimple->itsMutex);
+
+  if (itsPimple->itsData.get() == 0)
+    throw std::runtime_error("ContourCalculator:: No data set before calling contour");
+
+  const ContourCalculatorPimple::MemoKey key(theLoLimit, theHiLimit, theInterpolation);
+
+  ContourCalculatorPimple::Memo::const_iterator memo = itsPimple->itsAreaMemo.find(key);
+  if (memo != itsPimple->itsAreaMemo.end())
+  {
+    itsPimple->itWasCached = true;
+    return memo->second;
+  }
+
   itsPimple->require_hints();
 
-  const bool worlddata = theData.IsWorldData();
+  const bool worlddata = theWorldData;
 
   // Build the contours
 
@@ -358,10 +431,9 @@ Imagine::NFmiPath ContourCalculator::contour(const LazyQueryData &theData,
   Imagine::NFmiPath path;
   add_path(path, geom.get());
 
-  path.InvGrid(theData.Grid());
+  path.InvGrid(&theGrid);
 
-  if (itsPimple->isCacheOn)
-    itsPimple->itsAreaCache.insert(path, theLoLimit, theHiLimit, theTime, theData);
+  itsPimple->itsAreaMemo.insert(std::make_pair(key, path));
 
   itsPimple->itWasCached = false;
   return path;
@@ -371,6 +443,10 @@ Imagine::NFmiPath ContourCalculator::contour(const LazyQueryData &theData,
 /*!
  * \brief Return the desired contour line
  *
+ * Contour lines of the active data are remembered until new data is
+ * set even if the cache is off, since the same lines are often needed
+ * for both strokes and labels.
+ *
  *\return The path object
  */
 // ----------------------------------------------------------------------
@@ -380,6 +456,8 @@ Imagine::NFmiPath ContourCalculator::contour(const LazyQueryData &theData,
                                              const NFmiTime &theTime,
                                              ContourInterpolation theInterpolation)
 {
+  std::lock_guard<std::recursive_mutex> lock(itsPimple->itsMutex);
+
   if (itsPimple->itsData.get() == 0)
     throw std::runtime_error("ContourCalculator:: No data set before calling contour");
 
@@ -390,7 +468,48 @@ Imagine::NFmiPath ContourCalculator::contour(const LazyQueryData &theData,
     return itsPimple->itsLineCache.find(theValue, kFloatMissing, theTime, theData);
   }
 
-  const bool worlddata = theData.IsWorldData();
+  Imagine::NFmiPath path =
+      contour(*theData.Grid(), theData.IsWorldData(), theValue, theInterpolation);
+
+  if (itsPimple->isCacheOn)
+    itsPimple->itsLineCache.insert(path, theValue, kFloatMissing, theTime, theData);
+
+  return path;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the desired contour line of data on the given grid
+ *
+ * The persistent cache is not used, since there is no querydata to
+ * identify the contour with.
+ *
+ * \param theGrid The grid of the active data
+ * \param theWorldData True if the grid covers the whole world
+ * \return The path object in world coordinates
+ */
+// ----------------------------------------------------------------------
+
+Imagine::NFmiPath ContourCalculator::contour(const NFmiGrid &theGrid,
+                                             bool theWorldData,
+                                             float theValue,
+                                             ContourInterpolation theInterpolation)
+{
+  std::lock_guard<std::recursive_mutex> lock(itsPimple->itsMutex);
+
+  if (itsPimple->itsData.get() == 0)
+    throw std::runtime_error("ContourCalculator:: No data set before calling contour");
+
+  const ContourCalculatorPimple::MemoKey key(theValue, kFloatMissing, theInterpolation);
+
+  ContourCalculatorPimple::Memo::const_iterator memo = itsPimple->itsLineMemo.find(key);
+  if (memo != itsPimple->itsLineMemo.end())
+  {
+    itsPimple->itWasCached = true;
+    return memo->second;
+  }
+
+  const bool worlddata = theWorldData;
 
   itsPimple->require_hints();
 
@@ -429,10 +548,9 @@ Imagine::NFmiPath ContourCalculator::contour(const LazyQueryData &theData,
   Imagine::NFmiPath path;
   add_path(path, geom.get());
 
-  path.InvGrid(theData.Grid());
+  path.InvGrid(&theGrid);
 
-  if (itsPimple->isCacheOn)
-    itsPimple->itsLineCache.insert(path, theValue, kFloatMissing, theTime, theData);
+  itsPimple->itsLineMemo.insert(std::make_pair(key, path));
 
   itsPimple->itWasCached = false;
   return path;
@@ -0,0 +1,498 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of namespace ContourRenderer
+ */
+// ======================================================================
+
+#include "ContourRenderer.h"
+#include "BandRasterizer.h"
+#include "ColorTools.h"
+#include "ContourCalculator.h"
+#include "ContourInterpolation.h"
+#include "ParamTools.h"
+#include "PathTools.h"
+#include "PixelGridLookup.h"
+#include "StripeStroker.h"
+#include "ThreadTools.h"
+
+#include <newbase/NFmiArea.h>
+#include <newbase/NFmiFastQueryInfo.h>
+#include <newbase/NFmiGlobals.h>
+#include <newbase/NFmiGrid.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+using namespace Imagine;
+using namespace std;
+
+namespace
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether the grid covers the whole world
+ *
+ * The same test as in LazyQueryData::IsWorldData.
+ */
+// ----------------------------------------------------------------------
+
+bool is_world_data(const NFmiGrid &theGrid)
+{
+  const double lon1 = theGrid.Area()->BottomLeftLatLon().X();
+  const double lon2 = theGrid.Area()->TopRightLatLon().X();
+  const int xnumber = theGrid.XNumber();
+
+  // Predicted span if there was one more grid point
+  const double span = (lon2 - lon1) * xnumber / (xnumber - 1);
+
+  return (std::abs(span - 360) < 0.001);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Select the parameter and level of the specification
+ */
+// ----------------------------------------------------------------------
+
+void select(NFmiFastQueryInfo &theInfo, const ContourSpec &theSpec)
+{
+  if (!theInfo.Param(ParamTools::toparam(theSpec.param())))
+    throw runtime_error("ContourRenderer: parameter '" + theSpec.param() + "' is not available");
+
+  if (theSpec.level() < 0)
+  {
+    theInfo.FirstLevel();
+    return;
+  }
+
+  for (theInfo.ResetLevel(); theInfo.NextLevel();)
+    if (theInfo.Level()->LevelValue() == static_cast<unsigned int>(theSpec.level())) return;
+
+  throw runtime_error("ContourRenderer: level " + boost::lexical_cast<string>(theSpec.level()) +
+                      " is not available");
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Flip fill inside out if contour limits are missing
+ *
+ * We assume the path has already been projected to pixel coordinates
+ * so that we can use reasonable values for the external box around
+ * the image.
+ */
+// ----------------------------------------------------------------------
+
+void invert_if_missing(NFmiPath &thePath, float lolimit, float hilimit)
+{
+  const float m = 10000;
+  if (lolimit != kFloatMissing || hilimit != kFloatMissing) return;
+  thePath.MoveTo(-m, -m);
+  thePath.LineTo(m, -m);
+  thePath.LineTo(m, m);
+  thePath.LineTo(-m, m);
+  thePath.LineTo(-m, -m);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether a value belongs to a contour fill interval
+ */
+// ----------------------------------------------------------------------
+
+bool inside_range(float theValue, float theLoLimit, float theHiLimit)
+{
+  if (theValue == kFloatMissing) return false;
+  if (theLoLimit != kFloatMissing && theValue < theLoLimit) return false;
+  if (theHiLimit != kFloatMissing && theValue >= theHiLimit) return false;
+  return true;
+}
+
+}  // namespace anonymous
+
+namespace ContourRenderer
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Default options, same as the qdcontour defaults
+ */
+// ----------------------------------------------------------------------
+
+Options::Options()
+    : fillmode("polygon"),
+      rasterizer("imagine"),
+      simplifytolerance(0),
+      simplifyarea(0),
+      threads(1),
+      units()
+{
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Reject specifications using features not supported here
+ *
+ * \param theSpec The specification to check
+ */
+// ----------------------------------------------------------------------
+
+void check(const ContourSpec &theSpec)
+{
+  const string prefix = "ContourRenderer: parameter '" + theSpec.param() + "' uses ";
+
+  if (!theSpec.contourPatterns().empty())
+    throw runtime_error(prefix + "contour patterns, which are not supported");
+  if (!theSpec.contourSymbols().empty())
+    throw runtime_error(prefix + "contour symbols, which are not supported");
+  if (!theSpec.contourFonts().empty())
+    throw runtime_error(prefix + "contour fonts, which are not supported");
+  if (!theSpec.contourLabels().empty())
+    throw runtime_error(prefix + "contour labels, which are not supported");
+  if (!theSpec.labelPoints().empty() || !theSpec.pixelLabels().empty() ||
+      theSpec.labelDX() > 0 || theSpec.labelDY() > 0 || theSpec.labelXyDX() > 0 ||
+      theSpec.labelXyDY() > 0)
+    throw runtime_error(prefix + "labels, which are not supported");
+  if (!theSpec.overlay().empty())
+    throw runtime_error(prefix + "an overlay, which is not supported");
+  if (theSpec.smoother() != "None")
+    throw runtime_error(prefix + "smoothing, which is not supported");
+  if (theSpec.dataLoLimit() != kFloatMissing || theSpec.dataHiLimit() != kFloatMissing)
+    throw runtime_error(prefix + "data limits, which are not supported");
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Prepare a contour fill for rendering
+ *
+ * The contour is projected, inverted if it is a fill of missing
+ * values, clipped to the image and simplified. The clipping margin
+ * makes sure the artificial edges created by the clipping are never
+ * visible, even when the rasterizer antialiases the edges.
+ *
+ * \param thePath The contour in world coordinates
+ * \param theArea The projection of the image
+ * \param theLoLimit The lower limit of the fill
+ * \param theHiLimit The upper limit of the fill
+ * \param theWidth The width of the image
+ * \param theHeight The height of the image
+ * \param theOptions The simplification settings
+ * \return The path in pixel coordinates
+ */
+// ----------------------------------------------------------------------
+
+NFmiPath fillPath(const NFmiPath &thePath,
+                  const NFmiArea &theArea,
+                  float theLoLimit,
+                  float theHiLimit,
+                  int theWidth,
+                  int theHeight,
+                  const Options &theOptions)
+{
+  // Avoid unnecessary work if the path is empty
+
+  if (thePath.Empty() && theLoLimit != kFloatMissing && theHiLimit != kFloatMissing)
+    return thePath;
+
+  NFmiPath path = thePath;
+  // MeridianTools::Relocate(path,theArea);
+  path.Project(&theArea);
+  invert_if_missing(path, theLoLimit, theHiLimit);
+
+  const double margin = 2;
+  path = PathTools::clipPolygons(path, -margin, -margin, theWidth + margin, theHeight + margin);
+
+  return PathTools::simplifyPolygons(
+      path, theOptions.simplifytolerance, theOptions.simplifyarea);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Prepare a contour line for rendering
+ *
+ * The contour is projected, simplified and clipped to the image. The
+ * margin depends on the line width so that the clipped line ends
+ * remain outside the image.
+ *
+ * \param thePath The contour in world coordinates
+ * \param theArea The projection of the image
+ * \param theLineWidth The width of the line
+ * \param theWidth The width of the image
+ * \param theHeight The height of the image
+ * \return The path in pixel coordinates
+ */
+// ----------------------------------------------------------------------
+
+NFmiPath strokePath(const NFmiPath &thePath,
+                    const NFmiArea &theArea,
+                    float theLineWidth,
+                    int theWidth,
+                    int theHeight)
+{
+  NFmiPath path = thePath;
+  // MeridianTools::Relocate(path,theArea);
+  path.Project(&theArea);
+  path.SimplifyLines(10);
+
+  const double margin = ceil(theLineWidth) + 2;
+  return PathTools::clipLines(path, -margin, -margin, theWidth + margin, theHeight + margin);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw contour fills directly from the grid
+ *
+ * With nearest neighbour and discrete interpolation the contours
+ * follow the grid cell edges, hence the fills can be rendered as a
+ * reprojected raster without building any polygons. Each pixel is
+ * mapped to the nearest grid point with the lookup table, and each
+ * grid point to the fill interval containing its value.
+ *
+ * Returns false if the raster mode cannot be used, in which case
+ * nothing is drawn and the caller should contour normally. This
+ * happens for fills of missing values, for uncommon blending rules
+ * and if the fill intervals overlap.
+ *
+ * \param theImage The image to draw into
+ * \param theSpec The fills to draw
+ * \param theValues The values on the grid of the lookup
+ * \param theLookup The pixel to grid mapping of the image
+ * \param theThreads The number of threads to use
+ * \return True if the fills were drawn
+ */
+// ----------------------------------------------------------------------
+
+bool fillRaster(NFmiImage &theImage,
+                const ContourSpec &theSpec,
+                const NFmiDataMatrix<float> &theValues,
+                PixelGridLookup &theLookup,
+                unsigned int theThreads)
+{
+  const list<ContourRange> &fills = theSpec.contourFills();
+  if (fills.empty()) return false;
+
+  const int nx = static_cast<int>(theValues.NX());
+  const int ny = static_cast<int>(theValues.NY());
+  if (nx != theLookup.gridWidth() || ny != theLookup.gridHeight()) return false;
+
+  vector<float> lolimits;
+  vector<float> hilimits;
+  vector<NFmiColorTools::Color> colors;
+  vector<NFmiColorTools::NFmiBlendRule> rules;
+
+  for (list<ContourRange>::const_iterator it = fills.begin(); it != fills.end(); ++it)
+  {
+    if (it->lolimit() == kFloatMissing && it->hilimit() == kFloatMissing) return false;
+    NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(it->rule());
+    if (!ColorTools::blendable(rule)) return false;
+    lolimits.push_back(it->lolimit());
+    hilimits.push_back(it->hilimit());
+    colors.push_back(it->color());
+    rules.push_back(rule);
+  }
+
+  // The fill interval of each grid point, -1 for none
+
+  vector<int> cellbands(static_cast<size_t>(nx) * ny, -1);
+  for (int j = 0; j < ny; j++)
+    for (int i = 0; i < nx; i++)
+    {
+      const float value = theValues[i][j];
+      int &band = cellbands[i + j * nx];
+      for (unsigned int b = 0; b < lolimits.size(); b++)
+      {
+        if (!inside_range(value, lolimits[b], hilimits[b])) continue;
+        if (band >= 0) return false;
+        band = b;
+      }
+    }
+
+  const vector<int> &indices = theLookup.nearestGridPoints(theThreads);
+  const int width = theImage.Width();
+
+  ThreadTools::parallel_for(
+      theImage.Height(),
+      theThreads,
+      [&](size_t theRow)
+      {
+        const int j = static_cast<int>(theRow);
+        const int *index = &indices[theRow * width];
+        for (int i = 0; i < width; i++)
+        {
+          if (index[i] < 0) continue;
+          const int band = cellbands[index[i]];
+          if (band < 0) continue;
+          theImage(i, j) = ColorTools::blend(colors[band], theImage(i, j), rules[band]);
+        }
+      });
+  return true;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw the contours of one specification
+ *
+ * \param theImage The image to draw into
+ * \param theValues The values on the grid
+ * \param theGrid The grid of the values
+ * \param theSpec The contour fills and lines to draw
+ * \param theArea The projection of the image
+ * \param theOptions The rendering settings
+ */
+// ----------------------------------------------------------------------
+
+void draw(NFmiImage &theImage,
+          const NFmiDataMatrix<float> &theValues,
+          const NFmiGrid &theGrid,
+          const ContourSpec &theSpec,
+          const NFmiArea &theArea,
+          const Options &theOptions)
+{
+  check(theSpec);
+
+  if (theOptions.fillmode != "polygon" && theOptions.fillmode != "raster")
+    throw runtime_error("ContourRenderer: unknown fill mode '" + theOptions.fillmode + "'");
+  if (theOptions.rasterizer != "imagine" && theOptions.rasterizer != "scanline")
+    throw runtime_error("ContourRenderer: unknown rasterizer '" + theOptions.rasterizer + "'");
+
+  const ContourInterpolation interp = ContourInterpolationValue(theSpec.contourInterpolation());
+  if (interp == Missing)
+    throw runtime_error("ContourRenderer: unknown contour interpolation method " +
+                        theSpec.contourInterpolation());
+
+  // Prepare the values as qdcontour does
+
+  NFmiDataMatrix<float> values = theValues;
+  if (theSpec.replace())
+    values.Replace(theSpec.replaceSourceValue(), theSpec.replaceTargetValue());
+  theSpec.despeckle(values);
+
+  const bool worlddata = is_world_data(theGrid);
+
+  ContourCalculator calculator;
+  calculator.data(values);
+
+  const int width = theImage.Width();
+  const int height = theImage.Height();
+
+  // Fill the contours
+
+  bool filled = false;
+  if (theOptions.fillmode == "raster" && (interp == Nearest || interp == Discrete))
+  {
+    PixelGridLookup lookup;
+    lookup.init(theArea, width, height, theGrid);
+    filled = fillRaster(theImage, theSpec, values, lookup, theOptions.threads);
+  }
+
+  if (!filled)
+  {
+    // Collect consecutive fills to be rendered in a single pass
+
+    const bool scanline = (theOptions.rasterizer == "scanline");
+    BandRasterizer rasterizer(width, height);
+
+    for (list<ContourRange>::const_iterator it = theSpec.contourFills().begin();
+         it != theSpec.contourFills().end();
+         ++it)
+    {
+      NFmiPath path = fillPath(
+          calculator.contour(theGrid, worlddata, it->lolimit(), it->hilimit(), interp),
+          theArea,
+          it->lolimit(),
+          it->hilimit(),
+          width,
+          height,
+          theOptions);
+
+      if (path.Empty()) continue;
+
+      NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(it->rule());
+
+      if (scanline)
+      {
+        if (BandRasterizer::supports(path, rule))
+        {
+          rasterizer.add(path, it->color(), rule);
+          continue;
+        }
+        rasterizer.fill(theImage, theOptions.threads);
+      }
+
+      path.Fill(theImage, it->color(), rule);
+    }
+
+    rasterizer.fill(theImage, theOptions.threads);
+  }
+
+  // Stroke the contours
+
+  StripeStroker stroker;
+
+  for (list<ContourValue>::const_iterator it = theSpec.contourValues().begin();
+       it != theSpec.contourValues().end();
+       ++it)
+  {
+    const float linewidth = it->linewidth();
+    NFmiPath path = strokePath(calculator.contour(theGrid, worlddata, it->value(), interp),
+                               theArea,
+                               linewidth,
+                               width,
+                               height);
+
+    stroker.add(path, linewidth, it->color(), ColorTools::checkrule(it->rule()));
+  }
+
+  stroker.stroke(theImage, theOptions.threads);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Render the contours of the active time of the querydata
+ *
+ * The parameter and level of each specification are selected from the
+ * querydata, which must be gridded. The unit conversions of the
+ * options are applied to the values. The size of the image is the
+ * size of the area.
+ *
+ * \param theInfo The querydata, with the desired time selected
+ * \param theSpecs The contours to draw, in order
+ * \param theArea The projection of the image
+ * \param theBackground The initial colour of the image
+ * \param theOptions The rendering settings
+ * \return The rendered image
+ */
+// ----------------------------------------------------------------------
+
+NFmiImage render(NFmiFastQueryInfo &theInfo,
+                 const list<ContourSpec> &theSpecs,
+                 const NFmiArea &theArea,
+                 NFmiColorTools::Color theBackground,
+                 const Options &theOptions)
+{
+  if (theInfo.Grid() == 0) throw runtime_error("ContourRenderer: the querydata is not gridded");
+
+  const int width = static_cast<int>(theArea.Width() + 0.5);
+  const int height = static_cast<int>(theArea.Height() + 0.5);
+
+  NFmiImage image(width, height, theBackground);
+
+  for (list<ContourSpec>::const_iterator it = theSpecs.begin(); it != theSpecs.end(); ++it)
+  {
+    select(theInfo, *it);
+
+    NFmiDataMatrix<float> values;
+    theInfo.Values(values);
+    theOptions.units.convert(FmiParameterName(theInfo.Param().GetParamIdent()), values);
+
+    draw(image, values, *theInfo.Grid(), *it, theArea, theOptions);
+  }
+
+  return image;
+}
+
+}  // namespace ContourRenderer
+
+// ======================================================================
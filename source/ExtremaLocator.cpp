@@ -40,11 +40,18 @@
  *
  * If there is no bounding box, we simply choose the first one
  * available.
+ *
+ * The candidates are stored in a flat array, and the removal of
+ * candidates near the chosen ones as well as the distances to the
+ * previous timestep locations are calculated using uniform grid
+ * spatial indices. Hence fine grids with thousands of candidates
+ * can be processed quickly.
  */
 // ======================================================================
 
 #include "ExtremaLocator.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <cmath>
 
@@ -69,24 +76,22 @@ double distance(double theX1, double theY1, double theX2, double theY2)
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Minimum distance of point from collection of points
+ * \brief Sort candidate indices by their distances
  */
 // ----------------------------------------------------------------------
 
-template <typename T>
-double mindistance(double theX, double theY, const T &theCoords)
+class DistanceLess
 {
-  double best = -1;
-  for (typename T::const_iterator it = theCoords.begin(); it != theCoords.end(); ++it)
+ public:
+  DistanceLess(const vector<double> &theDistances) : itsDistances(theDistances) {}
+  bool operator()(size_t theLhs, size_t theRhs) const
   {
-    double dist = distance(theX, theY, it->first, it->second);
-    if (best < 0)
-      best = dist;
-    else
-      best = min(best, dist);
+    return itsDistances[theLhs] < itsDistances[theRhs];
   }
-  return best;
-}
+
+ private:
+  const vector<double> &itsDistances;
+};
 
 }  // namespace anonymous
 
@@ -107,7 +112,9 @@ ExtremaLocator::ExtremaLocator()
     : itsMinDistanceToSame(500),
       itsMinDistanceToDifferent(500),
       itsPreviousCoordinates(),
-      itsCurrentCoordinates()
+      itsCurrentCoordinates(),
+      itsCandidates(),
+      itsPreviousIndex()
 {
 }
 
@@ -121,7 +128,8 @@ ExtremaLocator::ExtremaLocator()
 
 bool ExtremaLocator::empty() const
 {
-  return (itsPreviousCoordinates.empty() && itsCurrentCoordinates.empty());
+  return (itsPreviousCoordinates.empty() && itsCurrentCoordinates.empty() &&
+          itsCandidates.empty());
 }
 
 // ----------------------------------------------------------------------
@@ -134,6 +142,8 @@ void ExtremaLocator::clear()
 {
   itsPreviousCoordinates.clear();
   itsCurrentCoordinates.clear();
+  itsCandidates.clear();
+  itsPreviousIndex.clear();
 }
 
 // ----------------------------------------------------------------------
@@ -185,15 +195,17 @@ void ExtremaLocator::minDistanceToDifferent(float theDistance)
 
 void ExtremaLocator::nextTime()
 {
+  mergeCandidates();
   itsPreviousCoordinates.clear();
   swap(itsPreviousCoordinates, itsCurrentCoordinates);
+  indexPrevious();
 }
 
 // ----------------------------------------------------------------------
 /*!
  * \brief Add a new coordinate
  *
- * \param theContour The contour value
+ * \param theType The extremum type
  * \param theX The X-coordinate
  * \param theY The Y-coordinate
  */
@@ -201,12 +213,11 @@ void ExtremaLocator::nextTime()
 
 void ExtremaLocator::add(Extremum theType, double theX, double theY)
 {
-  // Default constructed values are a desired side-effect in here
-  // This is much simpler than using find + insert with checking
-
-  Coordinates &c = itsCurrentCoordinates[theType];
-
-  c.push_back(Coordinates::value_type(theX, theY));
+  Candidate candidate;
+  candidate.type = theType;
+  candidate.x = theX;
+  candidate.y = theY;
+  itsCandidates.push_back(candidate);
 }
 
 // ----------------------------------------------------------------------
@@ -217,42 +228,103 @@ void ExtremaLocator::add(Extremum theType, double theX, double theY)
 
 const ExtremaLocator::ExtremaCoordinates &ExtremaLocator::chooseCoordinates()
 {
-  // Make a duplicate for the final choices
+  // Earlier choices are candidates too, and they precede the new ones
+
+  Candidates candidates;
+  for (ExtremaCoordinates::const_iterator eit = itsCurrentCoordinates.begin();
+       eit != itsCurrentCoordinates.end();
+       ++eit)
+    for (Coordinates::const_iterator it = eit->second.begin(); it != eit->second.end(); ++it)
+    {
+      Candidate candidate;
+      candidate.type = eit->first;
+      candidate.x = it->first;
+      candidate.y = it->second;
+      candidates.push_back(candidate);
+    }
+
+  candidates.insert(candidates.end(), itsCandidates.begin(), itsCandidates.end());
+  itsCandidates.clear();
+  itsCurrentCoordinates.clear();
 
-  ExtremaCoordinates candidates;
   ExtremaCoordinates choices;
-  swap(itsCurrentCoordinates, candidates);
 
-  while (!candidates.empty())
+  if (!candidates.empty())
   {
-    for (ExtremaCoordinates::iterator cit = candidates.begin(); cit != candidates.end(); ++cit)
-    {
-      // removeCandidates may have cleared some contour from
-      // possible coordinates
+    // The candidates of each type in order of preference
 
-      if (cit->second.empty()) continue;
+    const Extremum types[2] = {Minimum, Maximum};
+    vector<size_t> order[2];
+    size_t next[2] = {0, 0};
+    size_t alive[2] = {0, 0};
 
-      // find the best label coordinate
+    vector<double> xcoords(candidates.size());
+    vector<double> ycoords(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+      xcoords[i] = candidates[i].x;
+      ycoords[i] = candidates[i].y;
+    }
 
-      const Extremum value = cit->first;
+    for (int t = 0; t < 2; t++)
+    {
+      order[t] = chooseOrder(candidates, types[t]);
+      alive[t] = order[t].size();
+    }
 
-      Coordinates::const_iterator best = chooseOne(cit->second, value);
-      if (best == cit->second.end())
-        throw runtime_error("Internal error in ExtremaLocator::chooseLabels()");
+    // Index the candidates for the removals
 
-      // add the best label coordinate
+    const double radius = max(itsMinDistanceToSame, itsMinDistanceToDifferent);
 
-      Coordinates &coords = choices[value];
-      coords.push_back(*best);
+    SpatialHash hash;
+    hash.build(xcoords, ycoords, radius);
 
-      // and erase all candidates too close to the accepted coordinate
+    vector<char> removed(candidates.size(), 0);
 
-      removeCandidates(candidates, *best, value);
+    while (alive[0] > 0 || alive[1] > 0)
+    {
+      for (int t = 0; t < 2; t++)
+      {
+        // Earlier removals may have eliminated all candidates
+
+        while (next[t] < order[t].size() && removed[order[t][next[t]]])
+          ++next[t];
+        if (next[t] >= order[t].size()) continue;
+
+        const size_t chosen = order[t][next[t]];
+        const Candidate &best = candidates[chosen];
+
+        choices[best.type].push_back(XY(best.x, best.y));
+
+        // Erase the chosen one and all candidates too close to it
+
+        removed[chosen] = 1;
+        --alive[t];
+
+        hash.visit(best.x,
+                   best.y,
+                   radius,
+                   [&](size_t i)
+                   {
+                     if (removed[i]) return;
+
+                     const Candidate &c = candidates[i];
+                     const double dist = distance(best.x, best.y, c.x, c.y);
+
+                     bool erase = false;
+                     if (c.type != best.type)
+                       erase = (dist < itsMinDistanceToDifferent);
+                     else
+                       erase = (dist < itsMinDistanceToSame);
+
+                     if (erase)
+                     {
+                       removed[i] = 1;
+                       --alive[c.type == types[0] ? 0 : 1];
+                     }
+                   });
+      }
     }
-
-    // Now we erase any possible empty containers left behind
-
-    removeEmpties(candidates);
   }
 
   swap(itsCurrentCoordinates, choices);
@@ -262,128 +334,87 @@ const ExtremaLocator::ExtremaCoordinates &ExtremaLocator::chooseCoordinates()
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Choose a label location from given candidates
+ * \brief Order the candidates of the given type by preference
+ *
+ * If there are coordinates for the type from the previous timestep,
+ * the candidates closest to them are preferred. Otherwise the first
+ * candidate is the one closest to the border, that is, the first one
+ * added. Ties are resolved by the order in which candidates were added.
  *
- * \param theCandidates The list of candidates
+ * \param theCandidates The candidates
  * \param theType The extremum type
+ * \return Indices to the candidates of the given type
  */
 // ----------------------------------------------------------------------
 
-ExtremaLocator::Coordinates::const_iterator ExtremaLocator::chooseOne(
-    const Coordinates &theCandidates, Extremum theType)
+vector<size_t> ExtremaLocator::chooseOrder(const Candidates &theCandidates,
+                                           Extremum theType) const
 {
-  ExtremaCoordinates::const_iterator pit = itsPreviousCoordinates.find(theType);
-  if (pit == itsPreviousCoordinates.end()) return chooseClosestToBorder(theCandidates, theType);
+  vector<size_t> order;
+  for (size_t i = 0; i < theCandidates.size(); i++)
+    if (theCandidates[i].type == theType) order.push_back(i);
 
-  return chooseClosestToPrevious(theCandidates, pit->second, theType);
-}
+  PreviousIndex::const_iterator pit = itsPreviousIndex.find(theType);
+  if (pit == itsPreviousIndex.end()) return order;
 
-// ----------------------------------------------------------------------
-/*!
- * \brief Choose a label location from given candidates closest to earlier ones
- *
- * \param theCandidates The list of candidates
- * \param thePreviousChoises The list of choises from previous timestep
- * \param theType The extremum type
- */
-// ----------------------------------------------------------------------
+  // Without any previous coordinates all distances would be equal,
+  // and the last candidate was traditionally chosen first
 
-ExtremaLocator::Coordinates::const_iterator ExtremaLocator::chooseClosestToPrevious(
-    const Coordinates &theCandidates, const Coordinates &thePreviousChoises, Extremum theType)
-{
-  double bestdist = -1;
-  Coordinates::const_iterator best = theCandidates.end();
+  if (pit->second.empty())
+  {
+    reverse(order.begin(), order.end());
+    return order;
+  }
 
-  for (Coordinates::const_iterator it = theCandidates.begin(); it != theCandidates.end(); ++it)
+  vector<double> distances(theCandidates.size(), 0);
+  for (size_t i = 0; i < order.size(); i++)
   {
-    double mindist = mindistance(it->first, it->second, thePreviousChoises);
-    if (bestdist < 0 || mindist < bestdist)
-    {
-      bestdist = mindist;
-      best = it;
-    }
+    const Candidate &c = theCandidates[order[i]];
+    distances[order[i]] = pit->second.nearestDistance(c.x, c.y);
   }
-  return best;
+
+  stable_sort(order.begin(), order.end(), DistanceLess(distances));
+  return order;
 }
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Choose a label location closest to the bounding box
+ * \brief Move unchosen candidates into the current coordinates
  *
- * \param theCandidates The list of candidates
- * \param theType The extremum type
+ * This is needed only if the coordinates were not chosen for the
+ * timestep, in which case all candidates are remembered instead.
  */
 // ----------------------------------------------------------------------
 
-ExtremaLocator::Coordinates::const_iterator ExtremaLocator::chooseClosestToBorder(
-    const Coordinates &theCandidates, Extremum theType)
+void ExtremaLocator::mergeCandidates()
 {
-  if (theCandidates.empty()) return theCandidates.end();
-
-  return theCandidates.begin();
+  for (Candidates::const_iterator it = itsCandidates.begin(); it != itsCandidates.end(); ++it)
+    itsCurrentCoordinates[it->type].push_back(XY(it->x, it->y));
+  itsCandidates.clear();
 }
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Remove candidates too close to the chosen point
- *
- * Note that the code erases only candidate coordinates and may
- * leave empty containers behind. This is necessary so that
- * any top level iterators will not become invalidated.
- *
- * \param theCandidates The candidates to clean up
- * \param thePoint The chosen point
- * \param theParam The chosen parameter
- * \param theContour The chosen contour value
+ * \brief Build the spatial index for the previous coordinates
  */
 // ----------------------------------------------------------------------
 
-void ExtremaLocator::removeCandidates(ExtremaCoordinates &theCandidates,
-                                      const XY &thePoint,
-                                      Extremum theType)
+void ExtremaLocator::indexPrevious()
 {
-  for (ExtremaCoordinates::iterator pit = theCandidates.begin(); pit != theCandidates.end();)
-  {
-    const Extremum etype = pit->first;
+  itsPreviousIndex.clear();
 
-    for (Coordinates::iterator it = pit->second.begin(); it != pit->second.end();)
+  for (ExtremaCoordinates::const_iterator eit = itsPreviousCoordinates.begin();
+       eit != itsPreviousCoordinates.end();
+       ++eit)
+  {
+    vector<double> x;
+    vector<double> y;
+    for (Coordinates::const_iterator it = eit->second.begin(); it != eit->second.end(); ++it)
     {
-      const double dist = distance(thePoint.first, thePoint.second, it->first, it->second);
-
-      bool erase = false;
-
-      if (etype != theType)
-        erase = (dist < itsMinDistanceToDifferent);
-      else
-        erase = (dist < itsMinDistanceToSame);
-
-      if (erase)
-        it = pit->second.erase(it);
-      else
-        ++it;
+      x.push_back(it->first);
+      y.push_back(it->second);
     }
-    ++pit;
-  }
-}
-
-// ----------------------------------------------------------------------
-/*!
- * \brief Remove any empty subcontainers from the candidates
- *
- * The details of the algorithm are important. Note how empty elements
- * are deleted so that the current iterator will not be invalidated.
- *
- */
-// ----------------------------------------------------------------------
-
-void ExtremaLocator::removeEmpties(ExtremaCoordinates &theCandidates)
-{
-  for (ExtremaCoordinates::iterator pit = theCandidates.begin(); pit != theCandidates.end();)
-  {
-    if (pit->second.empty())
-      theCandidates.erase(pit++);
-    else
-      ++pit;
+    itsPreviousIndex[eit->first].build(x, y, itsMinDistanceToSame);
   }
 }
 
@@ -0,0 +1,316 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of namespace ExtremaTools
+ */
+// ======================================================================
+
+#include "ExtremaTools.h"
+#include "ThreadTools.h"
+
+#include <newbase/NFmiGlobals.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+//! Minimum of two values
+struct Min
+{
+  float operator()(float theLhs, float theRhs) const { return min(theLhs, theRhs); }
+};
+
+//! Maximum of two values
+struct Max
+{
+  float operator()(float theLhs, float theRhs) const { return max(theLhs, theRhs); }
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Running minimum or maximum of a strided sequence
+ *
+ * The van Herk / Gil-Werman algorithm: the sequence is split into
+ * blocks of the window width, and the prefix and suffix extrema of
+ * each block are calculated. Each window then spans at most two
+ * blocks, and its extremum is the combination of a suffix and
+ * a prefix value. Only three operations per element are needed
+ * regardless of the window width.
+ *
+ * The result for the window starting at element k is stored at k.
+ *
+ * \param theInput The input sequence
+ * \param theCount The number of elements in the sequence
+ * \param theStride The distance between successive elements
+ * \param theWidth The window width
+ * \param theOutput The output sequence with the same stride
+ * \param thePrefix Work space
+ * \param theSuffix Work space
+ * \param theOp Min or Max
+ */
+// ----------------------------------------------------------------------
+
+template <typename Op>
+void running(const float *theInput,
+             size_t theCount,
+             size_t theStride,
+             size_t theWidth,
+             float *theOutput,
+             vector<float> &thePrefix,
+             vector<float> &theSuffix,
+             Op theOp)
+{
+  if (theWidth == 0 || theCount < theWidth) return;
+
+  thePrefix.resize(theCount);
+  theSuffix.resize(theCount);
+
+  for (size_t k = 0; k < theCount; k++)
+  {
+    const float value = theInput[k * theStride];
+    thePrefix[k] = (k % theWidth == 0 ? value : theOp(thePrefix[k - 1], value));
+  }
+
+  for (size_t k = theCount; k-- > 0;)
+  {
+    const float value = theInput[k * theStride];
+    const bool blockend = (k == theCount - 1 || (k + 1) % theWidth == 0);
+    theSuffix[k] = (blockend ? value : theOp(theSuffix[k + 1], value));
+  }
+
+  for (size_t k = 0; k + theWidth <= theCount; k++)
+    theOutput[k * theStride] = theOp(theSuffix[k], thePrefix[k + theWidth - 1]);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Running minima and maxima of a strided sequence
+ */
+// ----------------------------------------------------------------------
+
+void running_minmax(const float *theMinInput,
+                    const float *theMaxInput,
+                    size_t theCount,
+                    size_t theStride,
+                    size_t theWidth,
+                    float *theMinOutput,
+                    float *theMaxOutput)
+{
+  vector<float> prefix;
+  vector<float> suffix;
+  running(theMinInput, theCount, theStride, theWidth, theMinOutput, prefix, suffix, Min());
+  running(theMaxInput, theCount, theStride, theWidth, theMaxOutput, prefix, suffix, Max());
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Running minima and maxima along the rows of a grid
+ *
+ * The grid is stored row by row. Separate inputs are given for the
+ * minima and the maxima so that the passes can be chained.
+ */
+// ----------------------------------------------------------------------
+
+void horizontal(const vector<float> &theMinInput,
+                const vector<float> &theMaxInput,
+                size_t theWidth,
+                size_t theHeight,
+                size_t theWindow,
+                vector<float> &theMinOutput,
+                vector<float> &theMaxOutput,
+                unsigned int theThreads)
+{
+  theMinOutput.resize(theMinInput.size());
+  theMaxOutput.resize(theMaxInput.size());
+
+  ThreadTools::parallel_for(theHeight,
+                            theThreads,
+                            [&](size_t j)
+                            {
+                              const size_t pos = j * theWidth;
+                              running_minmax(&theMinInput[pos],
+                                             &theMaxInput[pos],
+                                             theWidth,
+                                             1,
+                                             theWindow,
+                                             &theMinOutput[pos],
+                                             &theMaxOutput[pos]);
+                            });
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Running minima and maxima along the columns of a grid
+ */
+// ----------------------------------------------------------------------
+
+void vertical(const vector<float> &theMinInput,
+              const vector<float> &theMaxInput,
+              size_t theWidth,
+              size_t theHeight,
+              size_t theWindow,
+              vector<float> &theMinOutput,
+              vector<float> &theMaxOutput,
+              unsigned int theThreads)
+{
+  theMinOutput.resize(theMinInput.size());
+  theMaxOutput.resize(theMaxInput.size());
+
+  ThreadTools::parallel_for(theWidth,
+                            theThreads,
+                            [&](size_t i)
+                            {
+                              running_minmax(&theMinInput[i],
+                                             &theMaxInput[i],
+                                             theHeight,
+                                             theWidth,
+                                             theWindow,
+                                             &theMinOutput[i],
+                                             &theMaxOutput[i]);
+                            });
+}
+
+}  // namespace anonymous
+
+namespace ExtremaTools
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Find the local extrema of a grid
+ *
+ * A point is a maximum if no value in the surrounding window is
+ * larger and some value is smaller, and vice versa for minima.
+ * Note that only the values off the centre row and column are
+ * compared, as has always been done in qdcontour. In addition
+ * the value must differ from both the smallest and the largest
+ * value on the rim of the window by at least the given gradient.
+ * Points whose window contains missing values or extends outside
+ * the grid are never extrema.
+ *
+ * The window minima and maxima are calculated with separable
+ * running filters, and the rows are processed in parallel.
+ * The result is identical to a direct search of each window.
+ *
+ * \param theValues The values to analyze
+ * \param theDX The window radius in the X-direction
+ * \param theDY The window radius in the Y-direction
+ * \param theMinGradient Minimum required difference to the rim
+ * \param theThreads The number of threads to use
+ * \return 1 for maxima, -1 for minima, 0 for other points
+ */
+// ----------------------------------------------------------------------
+
+NFmiDataMatrix<int> extrema(const NFmiDataMatrix<float> &theValues,
+                            int theDX,
+                            int theDY,
+                            float theMinGradient,
+                            unsigned int theThreads)
+{
+  const size_t nx = theValues.NX();
+  const size_t ny = theValues.NY();
+
+  NFmiDataMatrix<int> result(nx, ny, 0);
+
+  if (theDX < 1 || theDY < 1) return result;
+
+  const size_t dx = theDX;
+  const size_t dy = theDY;
+
+  if (nx < 2 * dx + 1 || ny < 2 * dy + 1) return result;
+
+  // Row by row storage and the number of missing values in each
+  // rectangle starting from the origin
+
+  vector<float> values(nx * ny);
+  vector<size_t> missing((nx + 1) * (ny + 1), 0);
+
+  for (size_t j = 0; j < ny; j++)
+    for (size_t i = 0; i < nx; i++)
+    {
+      const float value = theValues[i][j];
+      values[i + j * nx] = value;
+      missing[(i + 1) + (j + 1) * (nx + 1)] = (value == kFloatMissing ? 1 : 0) +
+                                              missing[i + (j + 1) * (nx + 1)] +
+                                              missing[(i + 1) + j * (nx + 1)] -
+                                              missing[i + j * (nx + 1)];
+    }
+
+  // Extrema of the DX*DY quadrants off the centre row and column
+
+  vector<float> tmpmin, tmpmax;
+  vector<float> quadmin, quadmax;
+  horizontal(values, values, nx, ny, dx, tmpmin, tmpmax, theThreads);
+  vertical(tmpmin, tmpmax, nx, ny, dy, quadmin, quadmax, theThreads);
+
+  // Extrema of the rim rows and columns
+
+  vector<float> rowmin, rowmax;
+  vector<float> colmin, colmax;
+  horizontal(values, values, nx, ny, 2 * dx + 1, rowmin, rowmax, theThreads);
+  vertical(values, values, nx, ny, 2 * dy + 1, colmin, colmax, theThreads);
+
+  ThreadTools::parallel_for(
+      ny - 2 * dy,
+      theThreads,
+      [&](size_t row)
+      {
+        const size_t j = row + dy;
+        for (size_t i = dx; i < nx - dx; i++)
+        {
+          // Discard windows with missing values
+
+          const size_t x1 = i - dx;
+          const size_t y1 = j - dy;
+          const size_t x2 = i + dx + 1;
+          const size_t y2 = j + dy + 1;
+
+          const size_t count = missing[x2 + y2 * (nx + 1)] - missing[x1 + y2 * (nx + 1)] -
+                               missing[x2 + y1 * (nx + 1)] + missing[x1 + y1 * (nx + 1)];
+          if (count > 0) continue;
+
+          // Compare with the quadrants
+
+          const size_t q1 = (i - dx) + (j - dy) * nx;
+          const size_t q2 = (i + 1) + (j - dy) * nx;
+          const size_t q3 = (i - dx) + (j + 1) * nx;
+          const size_t q4 = (i + 1) + (j + 1) * nx;
+
+          const float offmin = min(min(quadmin[q1], quadmin[q2]), min(quadmin[q3], quadmin[q4]));
+          const float offmax = max(max(quadmax[q1], quadmax[q2]), max(quadmax[q3], quadmax[q4]));
+
+          const float value = values[i + j * nx];
+          const bool smaller = (offmin < value);
+          const bool bigger = (offmax > value);
+
+          if (smaller == bigger) continue;
+
+          // Minimum change from center to rim
+
+          const size_t top = (i - dx) + (j - dy) * nx;
+          const size_t bottom = (i - dx) + (j + dy) * nx;
+          const size_t left = (i - dx) + (j - dy) * nx;
+          const size_t right = (i + dx) + (j - dy) * nx;
+
+          const float minimum =
+              min(min(rowmin[top], rowmin[bottom]), min(colmin[left], colmin[right]));
+          const float maximum =
+              max(max(rowmax[top], rowmax[bottom]), max(colmax[left], colmax[right]));
+
+          const float change = min(abs(value - minimum), abs(value - maximum));
+
+          if (change < theMinGradient) continue;
+
+          result[i][j] = (smaller ? 1 : -1);
+        }
+      });
+
+  return result;
+}
+
+}  // namespace ExtremaTools
+
+// ======================================================================
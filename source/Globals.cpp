@@ -8,15 +8,11 @@
 #include "ColorTools.h"
 #include "Globals.h"
 #include "LazyQueryData.h"
-#include "TimeTools.h"
 
 #include <imagine/NFmiEsriBox.h>
 
 #ifdef IMAGINE_WITH_CAIRO
 #include "ImagineXr.h"
-#else
-#include <imagine/NFmiFace.h>
-#include <imagine/NFmiFreeType.h>
 #endif
 
 #include <imagine/NFmiPath.h>
@@ -26,6 +22,7 @@
 #include <newbase/NFmiTime.h>
 
 #include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
 
 #include <string>
 
@@ -33,18 +30,17 @@ using NFmiSettings::Optional;
 // using namespace Imagine;
 using namespace std;
 
+// The single instance declared in Globals.h
+Globals globals;
+
 // ----------------------------------------------------------------------
 /*!
- * \brief Constructor for global variables
+ * \brief Constructor for the job state
  */
 // ----------------------------------------------------------------------
 
-Globals::Globals()
-    : verbose(false),
-      force(false),
-      cmdline_querydata(),
-      cmdline_files(),
-      datapath(Optional<string>("qdcontour::querydata_path", ".")),
+JobState::JobState()
+    : datapath(Optional<string>("qdcontour::querydata_path", ".")),
       mapspath(Optional<string>("qdcontour::maps_path", ".")),
       savepath("."),
       prefix(),
@@ -60,9 +56,12 @@ Globals::Globals()
       pngquality(-1),
       jpegquality(-1),
       savealpha(true),
+      pngthreads(0),
       reducecolors(false),
       wantpalette(false),
       forcepalette(false),
+      exactpalette(false),
+      palettecolors(),
       contourinterpolation("Linear"),
       contourtriangles(1),
       smoother("None"),
@@ -71,6 +70,7 @@ Globals::Globals()
       expanddata(false),
       projection(),
       filter("none"),
+      areas(),
       foregroundrule("Over"),
       background(),
       foreground(),
@@ -84,11 +84,17 @@ Globals::Globals()
       fillrule("Atop"),
       strokerule("Atop"),
       contourlinewidth(1),
+      contourfillsimplifytolerance(0),
+      contourfillsimplifyarea(0),
+      contourrasterizer("imagine"),
+      contourfillmode("polygon"),
+      threads(1),
       directionparam("WindDirection"),
       speedparam("WindSpeedMS"),
       speedxcomponent(),
       speedycomponent(),
       arrowscale(1),
+      arrowspritesize(0),
       arrowfillcolor("white"),
       arrowstrokecolor("black"),
       arrowfillrule("Over"),
@@ -104,9 +110,7 @@ Globals::Globals()
       windarrowsxydx(-1),
       windarrowsxydy(-1),
       arrowpoints(),
-      queryfilelist(),
-      queryfilenames(),
-      queryinfo(),
+      manifestfile(),
       querydatalevel(-1),
       timesteps(24),
       timestep(0),
@@ -133,20 +137,19 @@ Globals::Globals()
       lowpressurerule("Over"),
       lowpressurefactor(1),
       lowpressuremaximum(1020),
+      pressureradius(0),
+      pressureparam("Pressure"),
+      calculator(boost::make_shared<ContourCalculator>()),
       pressurelocator(),
       labellocator(),
       symbollocator(),
       imagelocator(),
-      calculator(),
-      maskcalculator(),
-      maskqueryinfo(),
-      querystreams(),
+      maskbitmap(),
+      contourcache(false),
+      itsImageCacheOn(true),
       shapespecs(),
       specs(),
       unitsconverter(),
-      itsImageCache(),
-      itsImageCacheOn(true),
-      itsArrowCache(),
       graticulecolor(""),
       graticulelon1(),
       graticulelat1(),
@@ -167,220 +170,199 @@ Globals::Globals()
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Destructor
+ * \brief Constructor for global variables
  */
 // ----------------------------------------------------------------------
 
-Globals::~Globals() {}
+Globals::Globals()
+    : JobState(),
+      RenderCaches(),
+      verbose(false),
+      force(false),
+      cmdline_querydata(),
+      cmdline_serve(),
+      cmdline_watch(false),
+      cmdline_files(),
+      queryfilelist(),
+      queryfilenames(),
+      querymtimes(),
+      watchfiles(),
+      querystreams(),
+      maskqueryinfo(),
+      manifest(),
+      scriptfingerprint(0),
+      frameimages(),
+      imagewriter()
+{
+}
+
 // ----------------------------------------------------------------------
 /*!
- * \brief Return the given image
+ * \brief Constructor for the caches
  */
 // ----------------------------------------------------------------------
 
-const ImagineXr_or_NFmiImage &Globals::getImage(const string &theFile) const
+RenderCaches::RenderCaches()
+    : projectedcache(),
+      pixelgridlookups(),
+      imagecolors(),
+      itsImageCache(boost::make_shared<ImageCache>()),
+      itsArrowCache(),
+      arrowatlas(),
+      areacaches(),
+      mutex()
 {
-  return itsImageCache.getImage(theFile);
 }
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Set image modes
+ * \brief Constructor for the caches of an area
+ *
+ * \param theImageCache The image cache shared with the job
  */
 // ----------------------------------------------------------------------
 
-void Globals::setImageModes(Imagine::NFmiImage &theImage) const
+RenderCaches::RenderCaches(const boost::shared_ptr<ImageCache> &theImageCache)
+    : projectedcache(),
+      pixelgridlookups(),
+      imagecolors(),
+      itsImageCache(theImageCache),
+      itsArrowCache(),
+      arrowatlas(),
+      areacaches(),
+      mutex()
 {
-  theImage.SaveAlpha(savealpha);
-  theImage.WantPalette(wantpalette);
-  theImage.ForcePalette(forcepalette);
-  if (gamma > 0) theImage.Gamma(gamma);
-  if (!intent.empty()) theImage.Intent(intent);
-  if (pngquality >= 0) theImage.PngQuality(pngquality);
-  if (jpegquality >= 0) theImage.JpegQuality(jpegquality);
-  if (alphalimit >= 0) theImage.AlphaLimit(alphalimit);
 }
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Return the area object
+ * \brief Destructor
  */
 // ----------------------------------------------------------------------
 
-boost::shared_ptr<NFmiArea> Globals::createArea() const
-{
-  if (projection.empty()) throw runtime_error("A projection specification is required");
-
-  return NFmiAreaFactory::Create(projection);
-}
-
+Globals::~Globals() {}
 // ----------------------------------------------------------------------
 /*!
- * \brief Return the time stamp string to be rendered in the image
+ * \brief Restore the given job state
+ *
+ * The caches and the query streams are kept. The manifest is reloaded
+ * only if the job state refers to a different manifest file.
+ *
+ * \param theState The state to restore
  */
 // ----------------------------------------------------------------------
 
-const std::string Globals::getImageStampText(const NFmiTime &theTime) const
+void Globals::restore(const JobState &theState)
 {
-  NFmiTime tobs = TimeTools::ConvertZone(theTime, timestampzone);
-
-  const int obsyy = tobs.GetYear();
-  const int obsmm = tobs.GetMonth();
-  const int obsdd = tobs.GetDay();
-  const int obshh = tobs.GetHour();
-  const int obsmi = tobs.GetMin();
-
-  // Interpretation: The age of the forecast is the age
-  // of the oldest forecast
-
-  NFmiTime tfor;
-
-  for (unsigned int qi = 0; qi < querystreams.size(); qi++)
-  {
-    NFmiTime futctime = querystreams[qi]->OriginTime();
-    NFmiTime tlocal = TimeTools::ConvertZone(futctime, timestampzone);
-    if (qi == 0 || tlocal.IsLessThan(tfor)) tfor = tlocal;
-  }
+  static_cast<JobState &>(*this) = theState;
 
-  const int foryy = tfor.GetYear();
-  const int formm = tfor.GetMonth();
-  const int fordd = tfor.GetDay();
-  const int forhh = tfor.GetHour();
-  const int formi = tfor.GetMin();
-
-  char buffer[100];
-
-  string stamp;
-  if (timestampimage == "obs")
-  {
-    if (timestampimageformat == "hour")  // hh:mi
-      sprintf(buffer, "%02d:%02d", obshh, obsmi);
-
-    else if (timestampimageformat == "hourdate")  // hh:mi dd.mm.
-      sprintf(buffer, "%02d:%02d %02d.%02d.", obshh, obsmi, obsdd, obsmm);
-
-    else if (timestampimageformat == "datehour")  // d.m h:mi.
-      sprintf(buffer, "%d.%d. %d:%02d", obsdd, obsmm, obshh, obsmi);
-
-    else  // hh:mi dd.mm.yyyy
-      sprintf(buffer, "%02d:%02d %02d.%02d.%04d", obshh, obsmi, obsdd, obsmm, obsyy);
-    stamp = buffer;
-  }
-  else if (timestampimage == "for")
+  if (manifest.file() != manifestfile)
   {
-    if (timestampimageformat == "hour")  // hh:mi
-      sprintf(buffer, "%02d:%02d", forhh, formi);
-    else if (timestampimageformat == "hourdate")  // hh:mi dd.mm.
-      sprintf(buffer, "%02d:%02d %02d.%02d.", forhh, formi, fordd, formm);
-    else if (timestampimageformat == "datehour")  // d.m h:mi
-      sprintf(buffer, "%d.%d. %d:%02d", fordd, formm, forhh, formi);
-    else  // hh:mi dd.mm.yyyy
-      sprintf(buffer, "%02d:%02d %02d.%02d.%04d", forhh, formi, fordd, formm, foryy);
-    stamp = buffer;
-  }
-  else if (timestampimage == "forobs")
-  {
-    if (timestampimageformat == "hour")  // hh:mi +hh
-      sprintf(buffer, "%02d:%02d", forhh, formi);
-    else if (timestampimageformat == "hourdate")  // dd.mm. hh:mi + hh
-      sprintf(buffer, "%02d.%02d. %02d:%02d", fordd, formm, forhh, formi);
-    else if (timestampimageformat == "datehour")  // d.m. h:mi + hh
-      sprintf(buffer, "%d.%d. %d:%02d", fordd, formm, forhh, formi);
-    else  // dd.mm.yy hh:mi +hh
-      sprintf(buffer, "%02d.%02d.%04d %02d:%02d", fordd, formm, foryy, forhh, formi);
-
-    stamp = buffer;
-
-    const long diff = tobs.DifferenceInMinutes(tfor);
-    if (diff % 60 == 0 && timestep % 60 == 0)
-      sprintf(buffer, " %s%ldh", (diff < 0 ? "" : "+"), diff / 60);
+    if (manifestfile.empty())
+      manifest.clear();
     else
-      sprintf(buffer, " %s%ldm", (diff < 0 ? "" : "+"), diff);
-
-    stamp += buffer;
+      manifest.load(manifestfile);
   }
-  return stamp;
 }
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Draw the given text into the time stamp position in the image
+ * \brief Return the given image
  */
 // ----------------------------------------------------------------------
 
-#ifdef IMAGINE_WITH_CAIRO
-void Globals::drawImageStampText(ImagineXr &img, const std::string &text) const
+const ImagineXr_or_NFmiImage &RenderCaches::getImage(const string &theFile) const
 {
-  if (text.empty()) return;
+  return itsImageCache->getImage(theFile);
+}
 
-  int x = timestampimagex;
-  int y = timestampimagey;
+// ----------------------------------------------------------------------
+/*!
+ * \brief Get the pixel/grid mappings for the given image and grid
+ *
+ * Only a few mappings are kept, since a full image lookup table can
+ * be large. Typically there is one image area and one or two grids.
+ * When several areas are rendered each area has its own caches, and
+ * hence its own mappings.
+ */
+// ----------------------------------------------------------------------
 
-  if (x < 0) x += img.Width();
-  if (y < 0) y += img.Height();
+PixelGridLookup &RenderCaches::getPixelGridLookup(const NFmiArea &theArea,
+                                                  int theWidth,
+                                                  int theHeight,
+                                                  const NFmiGrid &theGrid)
+{
+  const std::size_t maxlookups = 4;
 
-  // ImagineXr version (AKa 5-Aug-2008)
-  //
-  img.MakeFace(timestampimagefont, timestampimagebackground);
+  const string key = PixelGridLookup::key(theArea, theWidth, theHeight, theGrid);
+  if (pixelgridlookups.find(key) == pixelgridlookups.end() &&
+      pixelgridlookups.size() >= maxlookups)
+    pixelgridlookups.clear();
 
-  img.DrawFace(x,
-               y,
-               text,                  // should be UTF-8
-               timestampimagecolor);  // font color
+  PixelGridLookup &lookup = pixelgridlookups[key];
+  lookup.init(theArea, theWidth, theHeight, theGrid);
+  return lookup;
 }
-#else
-/*** NFmiImage version (original) ***/
-void Globals::drawImageStampText(Imagine::NFmiImage &theImage, const std::string &theText) const
-{
-  if (theText.empty()) return;
-
-  Imagine::NFmiFace face(timestampimagefont);
 
-  int x = timestampimagex;
-  int y = timestampimagey;
+// ----------------------------------------------------------------------
+/*!
+ * \brief Get the pixel mappings for the given image when there is no grid
+ */
+// ----------------------------------------------------------------------
 
-  if (x < 0) x += theImage.Width();
-  if (y < 0) y += theImage.Height();
+PixelGridLookup &RenderCaches::getPixelGridLookup(const NFmiArea &theArea,
+                                                  int theWidth,
+                                                  int theHeight)
+{
+  const std::size_t maxlookups = 4;
 
-  if (timestampimagebackground != Imagine::NFmiColorTools::NoColor)
-  {
-    face.Background(true);
-    face.BackgroundMargin(timestampimagexmargin, timestampimageymargin);
-    face.BackgroundColor(timestampimagebackground);
-  }
+  const string key = PixelGridLookup::key(theArea, theWidth, theHeight);
+  if (pixelgridlookups.find(key) == pixelgridlookups.end() &&
+      pixelgridlookups.size() >= maxlookups)
+    pixelgridlookups.clear();
 
-  face.Draw(theImage, x, y, theText, Imagine::kFmiAlignNorthWest, timestampimagecolor);
+  PixelGridLookup &lookup = pixelgridlookups[key];
+  lookup.init(theArea, theWidth, theHeight);
+  return lookup;
 }
-#endif
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Draw the "combine" image over the given image
+ * \brief Set image modes
  */
 // ----------------------------------------------------------------------
 
-#ifdef IMAGINE_WITH_CAIRO
-void Globals::drawCombine(ImagineXr &xr) const
+void JobState::setImageModes(Imagine::NFmiImage &theImage) const
 {
-  if (combine.empty()) return;
+  theImage.SaveAlpha(savealpha);
+  theImage.WantPalette(wantpalette);
+  theImage.ForcePalette(forcepalette);
+  if (gamma > 0) theImage.Gamma(gamma);
+  if (!intent.empty()) theImage.Intent(intent);
+  if (pngquality >= 0) theImage.PngQuality(pngquality);
+  if (jpegquality >= 0) theImage.JpegQuality(jpegquality);
+  if (alphalimit >= 0) theImage.AlphaLimit(alphalimit);
+}
 
-  Imagine::NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(combinerule);
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the area object
+ */
+// ----------------------------------------------------------------------
 
-  xr.Composite(
-      getImage(combine), rule, Imagine::kFmiAlignNorthWest, combinex, combiney, combinefactor);
-}
-#else
-/*** NFmiImage code (original) ***/
-void Globals::drawCombine(Imagine::NFmiImage &theImage) const
-{
-  if (combine.empty()) return;
+boost::shared_ptr<NFmiArea> JobState::createArea() const { return createArea(projection); }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the area object for the given projection
+ */
+// ----------------------------------------------------------------------
 
-  Imagine::NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(combinerule);
+boost::shared_ptr<NFmiArea> JobState::createArea(const std::string &theProjection)
+{
+  if (theProjection.empty()) throw runtime_error("A projection specification is required");
 
-  theImage.Composite(
-      getImage(combine), rule, Imagine::kFmiAlignNorthWest, combinex, combiney, combinefactor);
+  return NFmiAreaFactory::Create(theProjection);
 }
-#endif
 
 // ----------------------------------------------------------------------
 // Get specs for round arrows
@@ -394,7 +376,7 @@ bool rangefits(float speed, float lolimit, float hilimit)
   return true;
 }
 
-ArrowStyle Globals::getArrowFill(float speed) const
+ArrowStyle JobState::getArrowFill(float speed) const
 {
   BOOST_FOREACH (const ArrowStyle &c, arrowfillstyles)
   {
@@ -403,7 +385,7 @@ ArrowStyle Globals::getArrowFill(float speed) const
   return ArrowStyle(ColorTools::parsecolor(arrowfillcolor), ColorTools::checkrule(arrowfillrule));
 }
 
-ArrowStyle Globals::getArrowStroke(float speed) const
+ArrowStyle JobState::getArrowStroke(float speed) const
 {
   BOOST_FOREACH (const ArrowStyle &c, arrowstrokestyles)
   {
@@ -413,7 +395,7 @@ ArrowStyle Globals::getArrowStroke(float speed) const
                     ColorTools::checkrule(arrowstrokerule));
 }
 
-RoundArrowColor Globals::getRoundArrowFillColor(float speed) const
+RoundArrowColor JobState::getRoundArrowFillColor(float speed) const
 {
   BOOST_FOREACH (const RoundArrowColor &c, roundarrowfillcolors)
   {
@@ -422,7 +404,7 @@ RoundArrowColor Globals::getRoundArrowFillColor(float speed) const
   return RoundArrowColor(Imagine::NFmiColorTools::MakeColor(255, 255, 255));
 }
 
-RoundArrowColor Globals::getRoundArrowStrokeColor(float speed) const
+RoundArrowColor JobState::getRoundArrowStrokeColor(float speed) const
 {
   BOOST_FOREACH (const RoundArrowColor &c, roundarrowstrokecolors)
   {
@@ -431,7 +413,7 @@ RoundArrowColor Globals::getRoundArrowStrokeColor(float speed) const
   return RoundArrowColor(Imagine::NFmiColorTools::Black);
 }
 
-RoundArrowSize Globals::getRoundArrowSize(float speed) const
+RoundArrowSize JobState::getRoundArrowSize(float speed) const
 {
   BOOST_FOREACH (const RoundArrowSize &sz, roundarrowsizes)
   {
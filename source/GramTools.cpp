@@ -28,6 +28,15 @@ const float barb_angle = 45.f / 180.f * 3.14159265358979323846f;
 // Flag side length
 const float flag_length = 7;
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the wind speed in whole knots as used by the arrows
+ *
+ * The meteorological arrow shape depends only on this value.
+ */
+// ----------------------------------------------------------------------
+
+int knots(float theSpeed) { return static_cast<int>(round(theSpeed / 0.5144444444f)); }
 // ----------------------------------------------------------------------
 /*!
  * \brief Return meteorological arrow flags for the given wind speed
@@ -52,7 +61,7 @@ Imagine::NFmiPath metarrowflags(float theSpeed)
   path.LineTo(spot_size, spot_size);
 
   // The actual speed in knots
-  const int speed = static_cast<int>(round(theSpeed / 0.5144444444f));
+  const int speed = knots(theSpeed);
 
   // Handle bad cases
   if (speed < 50) return path;
@@ -98,7 +107,7 @@ Imagine::NFmiPath metarrowlines(float theSpeed)
   if (theSpeed == kFloatMissing) return path;
 
   // The actual speed in knots
-  const int speed = static_cast<int>(round(theSpeed / 0.5144444444f));
+  const int speed = knots(theSpeed);
 
   // Handle bad cases
   if (speed < 5) return path;
@@ -11,28 +11,124 @@
 using namespace Imagine;
 using namespace std;
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ */
+// ----------------------------------------------------------------------
+
+ImageCache::ImageCache() : itsMutex(), itsCache(), itsOrder(), itsBytes(0), itsLimit(0) {}
 // ----------------------------------------------------------------------
 /*!
  * \brief Clear the cache
  */
 // ----------------------------------------------------------------------
 
-void ImageCache::clear() const { itsCache.clear(); }
+void ImageCache::clear() const
+{
+  lock_guard<mutex> lock(itsMutex);
+  itsCache.clear();
+  itsOrder.clear();
+  itsBytes = 0;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Discard least recently used images until the limit is met
+ *
+ * Images referenced outside the cache are never discarded.
+ */
+// ----------------------------------------------------------------------
+
+void ImageCache::trim() const
+{
+  lock_guard<mutex> lock(itsMutex);
+
+  if (itsLimit == 0) return;
+
+  order_type::iterator it = itsOrder.end();
+  while (itsBytes > itsLimit && it != itsOrder.begin())
+  {
+    --it;
+    storage_type::iterator pos = itsCache.find(*it);
+    if (!pos->second.image.unique()) continue;
+
+    itsBytes -= pos->second.bytes;
+    itsCache.erase(pos);
+    it = itsOrder.erase(it);
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Set the memory limit
+ *
+ * \param theBytes The limit in bytes, or 0 for no limit
+ */
+// ----------------------------------------------------------------------
+
+void ImageCache::limit(size_t theBytes)
+{
+  {
+    lock_guard<mutex> lock(itsMutex);
+    itsLimit = theBytes;
+  }
+  trim();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the approximate size of the cached images in bytes
+ */
+// ----------------------------------------------------------------------
+
+size_t ImageCache::bytes() const
+{
+  lock_guard<mutex> lock(itsMutex);
+  return itsBytes;
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Find image from cache (or read it if necessary)
  */
 // ----------------------------------------------------------------------
 
-const ImagineXr_or_NFmiImage &ImageCache::getImage(const string &theFile) const
+ImageCache::ImagePtr ImageCache::image(const string &theFile) const
 {
-  storage_type::const_iterator it = itsCache.find(theFile);
-  if (it != itsCache.end()) return it->second;
+  lock_guard<mutex> lock(itsMutex);
+
+  storage_type::iterator it = itsCache.find(theFile);
+  if (it != itsCache.end())
+  {
+    itsOrder.splice(itsOrder.begin(), itsOrder, it->second.position);
+    return it->second.image;
+  }
 
-  pair<storage_type::const_iterator, bool> ret =
-      itsCache.insert(storage_type::value_type(theFile, ImagineXr_or_NFmiImage(theFile)));
+  Entry entry;
+  entry.image.reset(new ImagineXr_or_NFmiImage(theFile));
+  entry.bytes = 4 * static_cast<size_t>(entry.image->Width()) * entry.image->Height();
 
-  if (ret.second) return ret.first->second;
+  pair<storage_type::iterator, bool> ret = itsCache.insert(storage_type::value_type(theFile, entry));
 
-  throw runtime_error("ImageCache failed to store '" + theFile + "'");
+  if (!ret.second) throw runtime_error("ImageCache failed to store '" + theFile + "'");
+
+  itsOrder.push_front(theFile);
+  ret.first->second.position = itsOrder.begin();
+  itsBytes += entry.bytes;
+
+  return entry.image;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Find image from cache (or read it if necessary)
+ *
+ * The reference is valid until the cache is next trimmed or cleared.
+ */
+// ----------------------------------------------------------------------
+
+const ImagineXr_or_NFmiImage &ImageCache::getImage(const string &theFile) const
+{
+  return *image(theFile);
 }
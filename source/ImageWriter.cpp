@@ -0,0 +1,221 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of class ImageWriter
+ */
+// ======================================================================
+
+#include "ImageWriter.h"
+
+#include <utility>
+
+using namespace std;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Destructor
+ *
+ * Pending jobs are completed, but their errors are ignored.
+ */
+// ----------------------------------------------------------------------
+
+ImageWriter::~ImageWriter() { stop(); }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ */
+// ----------------------------------------------------------------------
+
+ImageWriter::ImageWriter()
+    : itsMutex(),
+      itsJobReady(),
+      itsJobDone(),
+      itsJobs(),
+      itsThreads(),
+      itsActiveJobs(0),
+      itsQuitting(false),
+      itsError()
+{
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Set the number of writer threads
+ *
+ * Pending jobs are completed first, and their errors are rethrown.
+ *
+ * \param theThreads The number of threads, 0 for writing synchronously
+ */
+// ----------------------------------------------------------------------
+
+void ImageWriter::threads(unsigned int theThreads)
+{
+  wait();
+  stop();
+
+  itsQuitting = false;
+  for (unsigned int i = 0; i < theThreads; i++)
+    itsThreads.push_back(thread(&ImageWriter::work, this));
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Submit a new job
+ *
+ * Blocks until there is room in the queue.
+ *
+ * \param theJob The job to run
+ */
+// ----------------------------------------------------------------------
+
+void ImageWriter::submit(const Job &theJob)
+{
+  if (itsThreads.empty())
+  {
+    theJob();
+    return;
+  }
+
+  unique_lock<mutex> lock(itsMutex);
+  while (itsJobs.size() >= itsThreads.size())
+    itsJobDone.wait(lock);
+
+  itsJobs.push_back(theJob);
+  itsJobReady.notify_one();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Wait for all submitted jobs to complete
+ *
+ * The first error thrown by the jobs since the previous wait is
+ * rethrown.
+ */
+// ----------------------------------------------------------------------
+
+void ImageWriter::wait()
+{
+  unique_lock<mutex> lock(itsMutex);
+  while (!itsJobs.empty() || itsActiveJobs > 0)
+    itsJobDone.wait(lock);
+
+  if (itsError)
+  {
+    exception_ptr error = itsError;
+    itsError = exception_ptr();
+    rethrow_exception(error);
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Wait for all submitted jobs to complete, ignoring errors
+ */
+// ----------------------------------------------------------------------
+
+void ImageWriter::discard()
+{
+  unique_lock<mutex> lock(itsMutex);
+  while (!itsJobs.empty() || itsActiveJobs > 0)
+    itsJobDone.wait(lock);
+
+  itsError = exception_ptr();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Complete pending jobs and stop the threads
+ */
+// ----------------------------------------------------------------------
+
+void ImageWriter::stop()
+{
+  {
+    lock_guard<mutex> lock(itsMutex);
+    itsQuitting = true;
+  }
+  itsJobReady.notify_all();
+
+  for (size_t i = 0; i < itsThreads.size(); i++)
+    itsThreads[i].join();
+  itsThreads.clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Run jobs until told to quit
+ */
+// ----------------------------------------------------------------------
+
+void ImageWriter::work()
+{
+  unique_lock<mutex> lock(itsMutex);
+  while (true)
+  {
+    while (itsJobs.empty() && !itsQuitting)
+      itsJobReady.wait(lock);
+
+    if (itsJobs.empty()) return;
+
+    Job job = move(itsJobs.front());
+    itsJobs.pop_front();
+    ++itsActiveJobs;
+
+    lock.unlock();
+
+    exception_ptr error;
+    try
+    {
+      job();
+    }
+    catch (...)
+    {
+      error = current_exception();
+    }
+
+    // Release the image before anyone is told the job is done
+    job = Job();
+
+    lock.lock();
+    --itsActiveJobs;
+    if (error && !itsError) itsError = error;
+    itsJobDone.notify_all();
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Destructor
+ *
+ * Discards the jobs unless wait() was called. Errors are not thrown,
+ * since the scope is normally being left due to another exception.
+ */
+// ----------------------------------------------------------------------
+
+ImageWriter::Guard::~Guard()
+{
+  if (!itsWaited) itsWriter.discard();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ *
+ * \param theWriter The writer to guard
+ */
+// ----------------------------------------------------------------------
+
+ImageWriter::Guard::Guard(ImageWriter &theWriter) : itsWriter(theWriter), itsWaited(false) {}
+// ----------------------------------------------------------------------
+/*!
+ * \brief Wait for the jobs to complete, rethrowing errors
+ */
+// ----------------------------------------------------------------------
+
+void ImageWriter::Guard::wait()
+{
+  itsWaited = true;
+  itsWriter.wait();
+}
+
+// ======================================================================
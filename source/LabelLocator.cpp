@@ -46,11 +46,18 @@
  *
  * If there is no bounding box, we simply choose the first one
  * available.
+ *
+ * Since there may be hundreds of thousands of candidates, they are
+ * stored in a flat array and the removals are done with the help
+ * of a uniform grid spatial index. Likewise the previous timestep
+ * locations are indexed for the distance calculations. The choices
+ * are identical to those of a plain implementation of the algorithm.
  */
 // ======================================================================
 
 #include "LabelLocator.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <cmath>
 #include <iostream>
@@ -76,24 +83,23 @@ double distance(double theX1, double theY1, double theX2, double theY2)
 
 // ----------------------------------------------------------------------
 /*!
- * \brief Minimum distance of point from collection of points
+ * \brief Sort candidate indices by the sorting distance
  */
 // ----------------------------------------------------------------------
 
 template <typename T>
-double mindistance(double theX, double theY, const T &theCoords)
+class DistanceLess
 {
-  double best = -1;
-  for (typename T::const_iterator it = theCoords.begin(); it != theCoords.end(); ++it)
+ public:
+  DistanceLess(const T &theCandidates) : itsCandidates(theCandidates) {}
+  bool operator()(std::size_t theLhs, std::size_t theRhs) const
   {
-    double dist = distance(theX, theY, it->second.first, it->second.second);
-    if (best < 0)
-      best = dist;
-    else
-      best = min(best, dist);
+    return itsCandidates[theLhs].dist < itsCandidates[theRhs].dist;
   }
-  return best;
-}
+
+ private:
+  const T &itsCandidates;
+};
 
 }  // namespace anonymous
 
@@ -121,7 +127,9 @@ LabelLocator::LabelLocator()
       itsMinDistanceToDifferentParameter(30),
       itsActiveParameter(0),
       itsPreviousCoordinates(),
-      itsCurrentCoordinates()
+      itsCurrentCoordinates(),
+      itsCandidates(),
+      itsPreviousIndex()
 {
 }
 
@@ -135,7 +143,8 @@ LabelLocator::LabelLocator()
 
 bool LabelLocator::empty() const
 {
-  return (itsPreviousCoordinates.empty() && itsCurrentCoordinates.empty());
+  return (itsPreviousCoordinates.empty() && itsCurrentCoordinates.empty() &&
+          itsCandidates.empty());
 }
 
 // ----------------------------------------------------------------------
@@ -149,6 +158,8 @@ void LabelLocator::clear()
   itsActiveParameter = badparameter;
   itsPreviousCoordinates.clear();
   itsCurrentCoordinates.clear();
+  itsCandidates.clear();
+  itsPreviousIndex.clear();
 }
 
 // ----------------------------------------------------------------------
@@ -276,8 +287,56 @@ void LabelLocator::parameter(int theParameter)
 
 void LabelLocator::nextTime()
 {
+  mergeCandidates();
   itsPreviousCoordinates.clear();
   swap(itsPreviousCoordinates, itsCurrentCoordinates);
+  indexPrevious();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Move unchosen candidates into the current coordinates
+ *
+ * This is needed only if labels were not chosen for the timestep,
+ * in which case all candidates are remembered for the next one.
+ */
+// ----------------------------------------------------------------------
+
+void LabelLocator::mergeCandidates()
+{
+  for (Candidates::const_iterator it = itsCandidates.begin(); it != itsCandidates.end(); ++it)
+    itsCurrentCoordinates[it->param][it->contour].insert(
+        Coordinates::value_type(it->dist, XY(it->x, it->y)));
+  itsCandidates.clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Build the spatial index for the previous coordinates
+ */
+// ----------------------------------------------------------------------
+
+void LabelLocator::indexPrevious()
+{
+  itsPreviousIndex.clear();
+
+  for (ParamCoordinates::const_iterator pit = itsPreviousCoordinates.begin();
+       pit != itsPreviousCoordinates.end();
+       ++pit)
+  {
+    for (ContourCoordinates::const_iterator cit = pit->second.begin(); cit != pit->second.end();
+         ++cit)
+    {
+      vector<double> x;
+      vector<double> y;
+      for (Coordinates::const_iterator it = cit->second.begin(); it != cit->second.end(); ++it)
+      {
+        x.push_back(it->second.first);
+        y.push_back(it->second.second);
+      }
+      itsPreviousIndex[pit->first][cit->first].build(x, y, itsMinDistanceToSameValue);
+    }
+  }
 }
 
 // ----------------------------------------------------------------------
@@ -321,29 +380,29 @@ void LabelLocator::add(float theContour, int theX, int theY)
   if (itsActiveParameter == badparameter)
     throw runtime_error("LabelLocator: Cannot add label location before setting the parameter");
 
-  // Default constructed values are a desired side-effect in here
-  // This is much simpler than using find + insert with checking
-
-  ContourCoordinates &cc = itsCurrentCoordinates[itsActiveParameter];
-  Coordinates &c = cc[theContour];
-
   // Now calculate the distance value used for sorting
 
-  ParamCoordinates::const_iterator it = itsPreviousCoordinates.find(itsActiveParameter);
+  PreviousIndex::const_iterator it = itsPreviousIndex.find(itsActiveParameter);
 
   float dist;
-  if (it == itsPreviousCoordinates.end())
+  if (it == itsPreviousIndex.end())
     dist = distanceToBorder(static_cast<float>(theX), static_cast<float>(theY));
   else
   {
-    ContourCoordinates::const_iterator jt = it->second.find(theContour);
+    map<float, SpatialHash>::const_iterator jt = it->second.find(theContour);
     if (jt == it->second.end())
       dist = distanceToBorder(static_cast<float>(theX), static_cast<float>(theY));
     else
-      dist = static_cast<float>(mindistance(static_cast<float>(theX), theY, jt->second));
+      dist = static_cast<float>(jt->second.nearestDistance(static_cast<float>(theX), theY));
   }
 
-  c.insert(Coordinates::value_type(dist, XY(theX, theY)));
+  Candidate candidate;
+  candidate.param = itsActiveParameter;
+  candidate.contour = theContour;
+  candidate.dist = dist;
+  candidate.x = theX;
+  candidate.y = theY;
+  itsCandidates.push_back(candidate);
 }
 
 // ----------------------------------------------------------------------
@@ -370,143 +429,163 @@ float LabelLocator::distanceToBorder(float theX, float theY) const
 // ----------------------------------------------------------------------
 /*!
  * \brief Choose the final label locations
+ *
+ * The candidates are grouped by parameter and contour, and each
+ * group is sorted by the sorting distance. Ties are resolved by
+ * the order in which the candidates were added.
  */
 // ----------------------------------------------------------------------
 
 const LabelLocator::ParamCoordinates &LabelLocator::chooseLabels()
 {
-  // Make a duplicate for the final choices
+  // Earlier choices are candidates too, and they precede the new ones
+
+  Candidates candidates;
+  for (ParamCoordinates::const_iterator pit = itsCurrentCoordinates.begin();
+       pit != itsCurrentCoordinates.end();
+       ++pit)
+    for (ContourCoordinates::const_iterator cit = pit->second.begin(); cit != pit->second.end();
+         ++cit)
+      for (Coordinates::const_iterator it = cit->second.begin(); it != cit->second.end(); ++it)
+      {
+        Candidate candidate;
+        candidate.param = pit->first;
+        candidate.contour = cit->first;
+        candidate.dist = it->first;
+        candidate.x = it->second.first;
+        candidate.y = it->second.second;
+        candidates.push_back(candidate);
+      }
+
+  candidates.insert(candidates.end(), itsCandidates.begin(), itsCandidates.end());
+  itsCandidates.clear();
+  itsCurrentCoordinates.clear();
 
-  ParamCoordinates candidates;
   ParamCoordinates choices;
-  swap(itsCurrentCoordinates, candidates);
 
-  while (!candidates.empty())
+  if (candidates.empty())
   {
-    const int param = candidates.begin()->first;
-    ContourCoordinates &contours = candidates.begin()->second;
+    swap(itsCurrentCoordinates, choices);
+    return itsCurrentCoordinates;
+  }
 
-    for (ContourCoordinates::iterator cit = contours.begin(); cit != contours.end(); ++cit)
-    {
-      // removeCandidates may have cleared some contour from
-      // possible coordinates
+  // Number the groups in parameter and contour order
 
-      if (cit->second.empty()) continue;
+  typedef map<int, map<float, size_t> > GroupNumbers;
+  GroupNumbers numbers;
+  for (Candidates::const_iterator it = candidates.begin(); it != candidates.end(); ++it)
+    numbers[it->param][it->contour] = 0;
 
-      // the candidate is the first label coordinate, since we've
-      // sorted them so
+  vector<size_t> groupparam;  // parameter number of each group
+  vector<size_t> paramstart;  // first group of each parameter
+  vector<float> groupcontour;
 
-      if (cit->second.empty())
-        throw runtime_error("Internal error in LabelLocator::chooseLabels()");
-      const float value = cit->first;
-      const Coordinates::value_type best = *(cit->second.begin());
+  for (GroupNumbers::iterator pit = numbers.begin(); pit != numbers.end(); ++pit)
+  {
+    paramstart.push_back(groupcontour.size());
+    for (map<float, size_t>::iterator cit = pit->second.begin(); cit != pit->second.end(); ++cit)
+    {
+      cit->second = groupcontour.size();
+      groupparam.push_back(paramstart.size() - 1);
+      groupcontour.push_back(cit->first);
+    }
+  }
+  paramstart.push_back(groupcontour.size());
 
-#if 0
-		  cout << "Chose: " << best.first << " at "
-			   << best.second.first
-			   << ' '
-			   << best.second.second
-			   << endl;
-#endif
+  // Sort the candidates of each group
 
-      // add the best label coordinate
+  vector<size_t> group(candidates.size());
+  vector<vector<size_t> > order(groupcontour.size());
+  vector<size_t> alive(paramstart.size() - 1, 0);
 
-      ContourCoordinates &contours = choices[param];
-      Coordinates &coords = contours[value];
-      coords.insert(best);
+  vector<double> xcoords(candidates.size());
+  vector<double> ycoords(candidates.size());
 
-      // and erase all candidates too close to the accepted coordinate
+  for (size_t i = 0; i < candidates.size(); i++)
+  {
+    group[i] = numbers[candidates[i].param][candidates[i].contour];
+    order[group[i]].push_back(i);
+    ++alive[groupparam[group[i]]];
+    xcoords[i] = candidates[i].x;
+    ycoords[i] = candidates[i].y;
+  }
 
-      removeCandidates(candidates, best.second, param, value);
-    }
+  for (size_t g = 0; g < order.size(); g++)
+    stable_sort(order[g].begin(), order[g].end(), DistanceLess<Candidates>(candidates));
 
-    // Now we erase any possible empty containers left behind
+  // Index the candidates for the removals
 
-    removeEmpties(candidates);
-  }
+  const double radius =
+      max(itsMinDistanceToSameValue,
+          max(itsMinDistanceToDifferentValue, itsMinDistanceToDifferentParameter));
 
-  swap(itsCurrentCoordinates, choices);
+  SpatialHash hash;
+  hash.build(xcoords,
+             ycoords,
+             max(itsMinDistanceToDifferentValue, itsMinDistanceToDifferentParameter));
 
-  return itsCurrentCoordinates;
-}
+  vector<char> removed(candidates.size(), 0);
+  vector<size_t> next(order.size(), 0);
 
-// ----------------------------------------------------------------------
-/*!
- * \brief Remove candidates too close to the chosen point
- *
- * Note that the code erases only candidate coordinates and may
- * leave empty containers behind. This is necessary so that
- * any top level iterators will not become invalidated.
- *
- * \param theCandidates The candidates to clean up
- * \param thePoint The chosen point
- * \param theParam The chosen parameter
- * \param theContour The chosen contour value
- */
-// ----------------------------------------------------------------------
+  // Always process the first parameter which still has candidates
 
-void LabelLocator::removeCandidates(ParamCoordinates &theCandidates,
-                                    const XY &thePoint,
-                                    int theParam,
-                                    float theContour)
-{
-  for (ParamCoordinates::iterator pit = theCandidates.begin(); pit != theCandidates.end();)
+  for (size_t p = 0; p < alive.size();)
   {
-    const int param = pit->first;
-    for (ContourCoordinates::iterator cit = pit->second.begin(); cit != pit->second.end();)
+    if (alive[p] == 0)
     {
-      const float contour = cit->first;
-      for (Coordinates::iterator it = cit->second.begin(); it != cit->second.end();)
-      {
-        const double dist =
-            distance(thePoint.first, thePoint.second, it->second.first, it->second.second);
-
-        bool erase = false;
-
-        if (param != theParam)
-          erase = (dist < itsMinDistanceToDifferentParameter);
-        else if (contour != theContour)
-          erase = (dist < itsMinDistanceToDifferentValue);
-        else
-          erase = (dist < itsMinDistanceToSameValue);
-
-        if (erase)
-          cit->second.erase(it++);
-        else
-          ++it;
-      }
-      ++cit;
+      ++p;
+      continue;
     }
-    ++pit;
-  }
-}
-
-// ----------------------------------------------------------------------
-/*!
- * \brief Remove any empty subcontainers from the candidates
- *
- * The details of the algorithm are important. Note how empty elements
- * are deleted so that the current iterator will not be invalidated.
- *
- */
-// ----------------------------------------------------------------------
 
-void LabelLocator::removeEmpties(ParamCoordinates &theCandidates)
-{
-  for (ParamCoordinates::iterator pit = theCandidates.begin(); pit != theCandidates.end();)
-  {
-    for (ContourCoordinates::iterator cit = pit->second.begin(); cit != pit->second.end();)
+    for (size_t g = paramstart[p]; g < paramstart[p + 1]; g++)
     {
-      if (cit->second.empty())
-        pit->second.erase(cit++);
-      else
-        ++cit;
+      // Earlier removals may have eliminated all candidates
+
+      while (next[g] < order[g].size() && removed[order[g][next[g]]])
+        ++next[g];
+      if (next[g] >= order[g].size()) continue;
+
+      const size_t chosen = order[g][next[g]];
+      const Candidate &best = candidates[chosen];
+
+      choices[best.param][best.contour].insert(
+          Coordinates::value_type(best.dist, XY(best.x, best.y)));
+
+      // Erase the chosen one and all candidates too close to it
+
+      removed[chosen] = 1;
+      --alive[p];
+
+      hash.visit(best.x,
+                 best.y,
+                 radius,
+                 [&](size_t i)
+                 {
+                   if (removed[i]) return;
+
+                   const Candidate &c = candidates[i];
+                   const double dist = distance(best.x, best.y, c.x, c.y);
+
+                   bool erase = false;
+                   if (c.param != best.param)
+                     erase = (dist < itsMinDistanceToDifferentParameter);
+                   else if (c.contour != best.contour)
+                     erase = (dist < itsMinDistanceToDifferentValue);
+                   else
+                     erase = (dist < itsMinDistanceToSameValue);
+
+                   if (erase)
+                   {
+                     removed[i] = 1;
+                     --alive[groupparam[group[i]]];
+                   }
+                 });
     }
-    if (pit->second.empty())
-      theCandidates.erase(pit++);
-    else
-      ++pit;
   }
+
+  swap(itsCurrentCoordinates, choices);
+
+  return itsCurrentCoordinates;
 }
 
 // ======================================================================
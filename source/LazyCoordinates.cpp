@@ -9,11 +9,14 @@
 // ----------------------------------------------------------------------
 /*!
  * \brief Constructor
+ *
+ * \param theArea The area whose world coordinates are needed
+ * \param theData The querydata whose grid is to be projected
  */
 // ----------------------------------------------------------------------
 
-LazyCoordinates::LazyCoordinates(const NFmiArea &theArea)
-    : itsArea(theArea), itsInitialized(false), itsData()
+LazyCoordinates::LazyCoordinates(const NFmiArea &theArea, const LazyQueryData &theData)
+    : itsArea(theArea), itsQueryData(theData), itsInitialized(false), itsData()
 {
 }
 
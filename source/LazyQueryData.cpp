@@ -11,9 +11,11 @@
 #include <newbase/NFmiInterpolation.h>
 #include <newbase/NFmiGrid.h>
 #include <newbase/NFmiQueryData.h>
+#include <boost/functional/hash.hpp>
 #include <fstream>
 #include <stdexcept>
 #include <sstream>
+#include <vector>
 
 using namespace std;
 
@@ -79,6 +81,37 @@ void LazyQueryData::Read(const std::string &theDataFile)
 
   itsData.reset(new NFmiQueryData(theDataFile));
   itsInfo.reset(new NFmiFastQueryInfo(itsData.get()));
+
+  std::lock_guard<std::mutex> lock(itsFingerprintMutex);
+  itsFingerprints.clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return an independent iterator to the same data
+ *
+ * The clone shares the data itself but has its own position in it,
+ * which makes it possible to read the same data from several threads.
+ *
+ * \return The new object positioned like this one
+ */
+// ----------------------------------------------------------------------
+
+boost::shared_ptr<LazyQueryData> LazyQueryData::Clone() const
+{
+  boost::shared_ptr<LazyQueryData> data(new LazyQueryData);
+  data->itsInputName = itsInputName;
+  data->itsDataFile = itsDataFile;
+  data->itsData = itsData;
+  data->itsInfo.reset(new NFmiFastQueryInfo(*itsInfo));
+  data->itsLocations = itsLocations;
+  data->itsLocationsWorldXY = itsLocationsWorldXY;
+  data->itsLocationsXY = itsLocationsXY;
+  data->itsLocationsArea = itsLocationsArea;
+
+  std::lock_guard<std::mutex> lock(itsFingerprintMutex);
+  data->itsFingerprints = itsFingerprints;
+  return data;
 }
 
 // ----------------------------------------------------------------------
@@ -145,6 +178,20 @@ bool LazyQueryData::NextTime() { return itsInfo->NextTime(); }
 
 bool LazyQueryData::PreviousTime() { return itsInfo->PreviousTime(); }
 // ----------------------------------------------------------------------
+/*!
+ * \brief Return the index of the current time
+ */
+// ----------------------------------------------------------------------
+
+unsigned long LazyQueryData::TimeIndex() const { return itsInfo->TimeIndex(); }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Set the current time by its index
+ */
+// ----------------------------------------------------------------------
+
+bool LazyQueryData::TimeIndex(unsigned long theIndex) { return itsInfo->TimeIndex(theIndex); }
+// ----------------------------------------------------------------------
 /*!
  *
  */
@@ -322,4 +369,113 @@ bool LazyQueryData::IsWorldData() const
   return (std::abs(span - 360) < 0.001);
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Fingerprint of a parameter at the active time of the iterator
+ *
+ * The hash covers the locations of the given level, or of all levels
+ * if the level is negative. Each combination is hashed only once,
+ * since the data does not change until it is read again. The memo
+ * is guarded by a mutex, so fingerprints may be calculated from
+ * several threads at once.
+ *
+ * \param theInfo The iterator positioned at the desired time
+ * \param theParam The parameter
+ * \param theLevel The level value, or a negative value for all levels
+ * \return The fingerprint, zero if the parameter is not available
+ */
+// ----------------------------------------------------------------------
+
+std::size_t LazyQueryData::TimeFingerprint(NFmiFastQueryInfo &theInfo,
+                                           FmiParameterName theParam,
+                                           int theLevel) const
+{
+  const FingerprintKey key(theInfo.TimeIndex(), theParam, theLevel);
+
+  {
+    std::lock_guard<std::mutex> lock(itsFingerprintMutex);
+    std::map<FingerprintKey, std::size_t>::const_iterator it = itsFingerprints.find(key);
+    if (it != itsFingerprints.end()) return it->second;
+  }
+
+  // The hash is calculated without the lock, at worst twice
+
+  std::size_t hash = 0;
+  if (theInfo.Param(theParam))
+  {
+    for (theInfo.ResetLevel(); theInfo.NextLevel();)
+    {
+      if (theLevel >= 0 && theInfo.Level()->LevelValue() != static_cast<unsigned int>(theLevel))
+        continue;
+      for (theInfo.ResetLocation(); theInfo.NextLocation();)
+        boost::hash_combine(hash, theInfo.FloatValue());
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(itsFingerprintMutex);
+  itsFingerprints[key] = hash;
+  return hash;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Fingerprint of the data needed for the given time interval
+ *
+ * The data times inside the interval are included, as are the
+ * nearest times outside it if the interval does not start or end
+ * at a data time, since those are needed for interpolation. Only
+ * the given parameters and levels are included, so that updates
+ * to other parameters do not affect the result. This is used to
+ * find out which images are affected when the data is updated.
+ * A separate iterator is used so that the active parameter, level
+ * and time are not changed.
+ *
+ * \param theTime1 The start of the interval
+ * \param theTime2 The end of the interval
+ * \param theParams The parameters and levels to include
+ * \return The fingerprint
+ */
+// ----------------------------------------------------------------------
+
+std::size_t LazyQueryData::Fingerprint(const NFmiTime &theTime1,
+                                       const NFmiTime &theTime2,
+                                       const ParamLevels &theParams) const
+{
+  NFmiFastQueryInfo info(itsData.get());
+
+  std::vector<unsigned long> indexes;
+  bool hasprevious = false;
+  unsigned long previous = 0;
+
+  for (info.ResetTime(); info.NextTime();)
+  {
+    const NFmiMetTime &t = info.ValidTime();
+    if (t.IsLessThan(theTime1))
+    {
+      hasprevious = true;
+      previous = info.TimeIndex();
+      continue;
+    }
+
+    if (indexes.empty() && hasprevious && !t.IsEqual(theTime1)) indexes.push_back(previous);
+    indexes.push_back(info.TimeIndex());
+
+    if (!t.IsLessThan(theTime2)) break;
+  }
+
+  std::size_t hash = 0;
+  for (std::vector<unsigned long>::const_iterator it = indexes.begin(); it != indexes.end(); ++it)
+  {
+    info.TimeIndex(*it);
+    boost::hash_combine(hash, *it);
+    for (ParamLevels::const_iterator pit = theParams.begin(); pit != theParams.end(); ++pit)
+    {
+      boost::hash_combine(hash, static_cast<int>(pit->first));
+      boost::hash_combine(hash, pit->second);
+      boost::hash_combine(hash, TimeFingerprint(info, pit->first, pit->second));
+    }
+  }
+  return hash;
+}
+
 // ======================================================================
@@ -0,0 +1,140 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of class Manifest
+ */
+// ======================================================================
+
+#include "Manifest.h"
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ */
+// ----------------------------------------------------------------------
+
+Manifest::Manifest() : itsFile(), itsFingerprints(), itsModified(false) {}
+// ----------------------------------------------------------------------
+/*!
+ * \brief Start using the given manifest file
+ *
+ * Pending changes to the previous file are saved first. A missing
+ * file is not an error, it merely means nothing has been rendered.
+ *
+ * \param theFile The manifest file
+ */
+// ----------------------------------------------------------------------
+
+void Manifest::load(const string &theFile)
+{
+  save();
+  itsFingerprints.clear();
+  itsFile = theFile;
+
+  ifstream input(theFile.c_str());
+  if (!input) return;
+
+  string line;
+  while (getline(input, line))
+  {
+    const string::size_type pos = line.find(' ');
+    if (pos == string::npos || pos == 0 || pos + 1 >= line.size())
+      throw runtime_error("Invalid line in manifest file '" + theFile + "'");
+
+    size_t pos2 = 0;
+    const unsigned long long fingerprint = stoull(line.substr(0, pos), &pos2, 16);
+    if (pos2 != pos) throw runtime_error("Invalid fingerprint in manifest file '" + theFile + "'");
+
+    itsFingerprints[line.substr(pos + 1)] = static_cast<size_t>(fingerprint);
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Save the manifest if it has been modified
+ *
+ * Nothing is saved if no file has been loaded.
+ */
+// ----------------------------------------------------------------------
+
+void Manifest::save()
+{
+  if (!itsModified || itsFile.empty()) return;
+
+  const string tmpfile = itsFile + ".tmp";
+  {
+    ofstream output(tmpfile.c_str());
+    if (!output) throw runtime_error("Failed to open '" + tmpfile + "' for writing");
+
+    output << hex;
+    for (map<string, size_t>::const_iterator it = itsFingerprints.begin();
+         it != itsFingerprints.end();
+         ++it)
+      output << it->second << ' ' << it->first << '\n';
+
+    output.close();
+    if (output.fail()) throw runtime_error("Failed to write '" + tmpfile + "'");
+  }
+
+  if (rename(tmpfile.c_str(), itsFile.c_str()) != 0)
+    throw runtime_error("Failed to rename '" + tmpfile + "' to '" + itsFile + "'");
+
+  itsModified = false;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Save the manifest and forget all fingerprints
+ */
+// ----------------------------------------------------------------------
+
+void Manifest::clear()
+{
+  save();
+  itsFile.clear();
+  itsFingerprints.clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Find the fingerprint of an image
+ *
+ * \param theImage The image filename
+ * \param theFingerprint The fingerprint, if found
+ * \return True if the image has been rendered before
+ */
+// ----------------------------------------------------------------------
+
+bool Manifest::find(const string &theImage, size_t &theFingerprint) const
+{
+  map<string, size_t>::const_iterator it = itsFingerprints.find(theImage);
+  if (it == itsFingerprints.end()) return false;
+  theFingerprint = it->second;
+  return true;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Record the fingerprint of a rendered image
+ *
+ * \param theImage The image filename
+ * \param theFingerprint The fingerprint of its inputs
+ */
+// ----------------------------------------------------------------------
+
+void Manifest::update(const string &theImage, size_t theFingerprint)
+{
+  map<string, size_t>::iterator it = itsFingerprints.find(theImage);
+  if (it != itsFingerprints.end() && it->second == theFingerprint) return;
+
+  itsFingerprints[theImage] = theFingerprint;
+  itsModified = true;
+}
+
+// ======================================================================
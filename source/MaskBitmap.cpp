@@ -0,0 +1,31 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of class MaskBitmap
+ */
+// ======================================================================
+
+#include "MaskBitmap.h"
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ */
+// ----------------------------------------------------------------------
+
+MaskBitmap::MaskBitmap() : itsWidth(0), itsHeight(0), itsWordsPerRow(0), itsBits() {}
+// ----------------------------------------------------------------------
+/*!
+ * \brief Discard the bitmap
+ */
+// ----------------------------------------------------------------------
+
+void MaskBitmap::clear()
+{
+  itsWidth = 0;
+  itsHeight = 0;
+  itsWordsPerRow = 0;
+  itsBits.clear();
+}
+
+// ======================================================================
@@ -6,6 +6,7 @@
 
 #include "MeridianTools.h"
 
+#include <cmath>
 #include <set>
 
 // Imagine headers
@@ -107,6 +108,29 @@ void Relocate(NFmiPath &thePath, const NFmiArea &theArea)
   thePath.Add(path);
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Calculate direction of north on paper coordinates
+ */
+// ----------------------------------------------------------------------
+
+double PaperNorth(const NFmiArea &theArea, const NFmiPoint &theLatLon)
+{
+  // Safety against polar regions just in case
+
+  if (theLatLon.Y() <= -89.9 || theLatLon.Y() >= 89.9) return 0;
+
+  const NFmiPoint origo = theArea.ToXY(theLatLon);
+
+  const float pi = 3.141592658979323f;
+  const double latstep = 0.01;  // degrees to north
+
+  const double lat = theLatLon.Y() + latstep;
+  const NFmiPoint north = theArea.ToXY(NFmiPoint(theLatLon.X(), lat));
+  const float alpha = static_cast<float>(atan2(origo.X() - north.X(), origo.Y() - north.Y()));
+  return alpha * 180 / pi;
+}
+
 }  // MeridianTools
 
 // ======================================================================
@@ -566,6 +566,69 @@ NFmiDataMatrix<float> values(const std::string &theFunction, LazyQueryData &theQ
   throw runtime_error("Unrecognized meta function " + theFunction);
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the parameters the given meta function is calculated from
+ *
+ * An exception is thrown if the name is not recognized. One should
+ * always test with isMeta first.
+ *
+ * \param theFunction The function name
+ * \return The parameters, possibly none
+ */
+// ----------------------------------------------------------------------
+
+std::vector<FmiParameterName> parameters(const std::string &theFunction)
+{
+  std::vector<FmiParameterName> params;
+
+  if (theFunction == "MetaElevationAngle")
+    return params;
+
+  if (theFunction == "MetaWindChill")
+  {
+    params.push_back(kFmiTemperature);
+    params.push_back(kFmiWindSpeedMS);
+  }
+  else if (theFunction == "MetaDewDifference")
+  {
+    params.push_back(kFmiRoadTemperature);
+    params.push_back(kFmiDewPoint);
+  }
+  else if (theFunction == "MetaN")
+    params.push_back(kFmiTotalCloudCover);
+  else if (theFunction == "MetaNN")
+    params.push_back(kFmiMiddleAndLowCloudCover);
+  else if (theFunction == "MetaT2mAdvection")
+  {
+    params.push_back(kFmiTemperature);
+    params.push_back(kFmiWindSpeedMS);
+    params.push_back(kFmiWindDirection);
+  }
+  else if (theFunction == "MetaThermalFront")
+    params.push_back(kFmiTemperature);
+  else if (theFunction == "MetaDewDifferenceAir")
+  {
+    params.push_back(kFmiTemperature);
+    params.push_back(kFmiDewPoint);
+  }
+  else if (theFunction == "MetaSnowProb")
+  {
+    params.push_back(kFmiTemperature);
+    params.push_back(kFmiHumidity);
+  }
+  else if (theFunction == "MetaThetaE")
+  {
+    params.push_back(kFmiTemperature);
+    params.push_back(kFmiHumidity);
+    params.push_back(kFmiPressure);
+  }
+  else
+    throw runtime_error("Unrecognized meta function " + theFunction);
+
+  return params;
+}
+
 }  // namespace MetaFunctions
 
 // ======================================================================
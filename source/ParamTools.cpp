@@ -0,0 +1,41 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of namespace ParamTools
+ */
+// ======================================================================
+
+#include "ParamTools.h"
+
+#include <newbase/NFmiEnumConverter.h>
+
+#include <boost/lexical_cast.hpp>
+
+namespace ParamTools
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Convert a parameter name or number into an enum
+ *
+ * \param theName The parameter name or number
+ * \return The parameter, kFmiBadParameter if the name is not known
+ */
+// ----------------------------------------------------------------------
+
+FmiParameterName toparam(const std::string &theName)
+{
+  static NFmiEnumConverter converter;
+
+  try
+  {
+    return FmiParameterName(boost::lexical_cast<int>(theName));
+  }
+  catch (...)
+  {
+    return FmiParameterName(converter.ToEnum(theName));
+  }
+}
+
+}  // namespace ParamTools
+
+// ======================================================================
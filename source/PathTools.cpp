@@ -0,0 +1,548 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of namespace PathTools
+ */
+// ======================================================================
+
+#include "PathTools.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Imagine;
+using namespace std;
+
+namespace
+{
+//! A single vertex of a polygon ring
+struct Vertex
+{
+  Vertex(double theX, double theY) : x(theX), y(theY) {}
+  double x;
+  double y;
+};
+
+typedef vector<Vertex> Ring;
+
+//! The four boundaries of the clipping rectangle
+enum Boundary
+{
+  Left,
+  Right,
+  Top,
+  Bottom
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether the path contains curves we cannot clip
+ */
+// ----------------------------------------------------------------------
+
+bool has_curves(const NFmiPath &thePath)
+{
+  for (NFmiPathData::const_iterator it = thePath.Elements().begin(); it != thePath.Elements().end();
+       ++it)
+  {
+    if (it->op == kFmiConicTo || it->op == kFmiCubicTo) return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether a vertex is on the inner side of a boundary
+ */
+// ----------------------------------------------------------------------
+
+bool inside(const Vertex &theVertex, Boundary theBoundary, double theLimit)
+{
+  switch (theBoundary)
+  {
+    case Left:
+      return theVertex.x >= theLimit;
+    case Right:
+      return theVertex.x <= theLimit;
+    case Top:
+      return theVertex.y >= theLimit;
+    case Bottom:
+      return theVertex.y <= theLimit;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Intersect an edge with a boundary
+ *
+ * The edge is known to cross the boundary, hence the division is safe.
+ */
+// ----------------------------------------------------------------------
+
+Vertex intersect(const Vertex &theStart, const Vertex &theEnd, Boundary theBoundary, double theLimit)
+{
+  if (theBoundary == Left || theBoundary == Right)
+  {
+    const double t = (theLimit - theStart.x) / (theEnd.x - theStart.x);
+    return Vertex(theLimit, theStart.y + t * (theEnd.y - theStart.y));
+  }
+  const double t = (theLimit - theStart.y) / (theEnd.y - theStart.y);
+  return Vertex(theStart.x + t * (theEnd.x - theStart.x), theLimit);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Clip a closed ring against a single boundary (Sutherland-Hodgman)
+ */
+// ----------------------------------------------------------------------
+
+void clip_ring(const Ring &theInput, Ring &theOutput, Boundary theBoundary, double theLimit)
+{
+  theOutput.clear();
+  if (theInput.empty()) return;
+
+  Vertex previous = theInput.back();
+  bool previnside = inside(previous, theBoundary, theLimit);
+
+  for (Ring::const_iterator it = theInput.begin(); it != theInput.end(); ++it)
+  {
+    const bool curinside = inside(*it, theBoundary, theLimit);
+    if (curinside)
+    {
+      if (!previnside) theOutput.push_back(intersect(previous, *it, theBoundary, theLimit));
+      theOutput.push_back(*it);
+    }
+    else if (previnside)
+      theOutput.push_back(intersect(previous, *it, theBoundary, theLimit));
+
+    previous = *it;
+    previnside = curinside;
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Clip a single ring and append the result to the output path
+ *
+ * Rings completely inside the rectangle are copied as is so that
+ * the original path operations are preserved. Rings completely
+ * outside on any one side are discarded.
+ */
+// ----------------------------------------------------------------------
+
+void add_clipped_ring(NFmiPath &theOutput,
+                      NFmiPathData::const_iterator theBegin,
+                      NFmiPathData::const_iterator theEnd,
+                      double theX1,
+                      double theY1,
+                      double theX2,
+                      double theY2)
+{
+  if (theBegin == theEnd) return;
+
+  double minx = theBegin->x;
+  double maxx = theBegin->x;
+  double miny = theBegin->y;
+  double maxy = theBegin->y;
+
+  for (NFmiPathData::const_iterator it = theBegin; it != theEnd; ++it)
+  {
+    minx = min(minx, it->x);
+    maxx = max(maxx, it->x);
+    miny = min(miny, it->y);
+    maxy = max(maxy, it->y);
+  }
+
+  if (maxx < theX1 || minx > theX2 || maxy < theY1 || miny > theY2) return;
+
+  if (minx >= theX1 && maxx <= theX2 && miny >= theY1 && maxy <= theY2)
+  {
+    for (NFmiPathData::const_iterator it = theBegin; it != theEnd; ++it)
+    {
+      if (it == theBegin)
+        theOutput.MoveTo(it->x, it->y);
+      else if (it->op == kFmiGhostLineTo)
+        theOutput.GhostLineTo(it->x, it->y);
+      else
+        theOutput.LineTo(it->x, it->y);
+    }
+    return;
+  }
+
+  Ring ring;
+  for (NFmiPathData::const_iterator it = theBegin; it != theEnd; ++it)
+    ring.push_back(Vertex(it->x, it->y));
+
+  Ring tmp;
+  clip_ring(ring, tmp, Left, theX1);
+  clip_ring(tmp, ring, Right, theX2);
+  clip_ring(ring, tmp, Top, theY1);
+  clip_ring(tmp, ring, Bottom, theY2);
+
+  if (ring.size() < 3) return;
+
+  theOutput.MoveTo(ring[0].x, ring[0].y);
+  for (Ring::size_type i = 1; i < ring.size(); i++)
+    theOutput.LineTo(ring[i].x, ring[i].y);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Clip a line segment to the rectangle (Liang-Barsky)
+ *
+ * \return True if some part of the segment is visible
+ */
+// ----------------------------------------------------------------------
+
+bool clip_segment(double &theX0,
+                  double &theY0,
+                  double &theX1,
+                  double &theY1,
+                  double theXmin,
+                  double theYmin,
+                  double theXmax,
+                  double theYmax)
+{
+  const double dx = theX1 - theX0;
+  const double dy = theY1 - theY0;
+
+  const double p[4] = {-dx, dx, -dy, dy};
+  const double q[4] = {theX0 - theXmin, theXmax - theX0, theY0 - theYmin, theYmax - theY0};
+
+  double t0 = 0;
+  double t1 = 1;
+
+  for (int i = 0; i < 4; i++)
+  {
+    if (p[i] == 0)
+    {
+      if (q[i] < 0) return false;
+    }
+    else
+    {
+      const double t = q[i] / p[i];
+      if (p[i] < 0)
+      {
+        if (t > t1) return false;
+        t0 = max(t0, t);
+      }
+      else
+      {
+        if (t < t0) return false;
+        t1 = min(t1, t);
+      }
+    }
+  }
+
+  const double x0 = theX0;
+  const double y0 = theY0;
+
+  if (t1 < 1)
+  {
+    theX1 = x0 + t1 * dx;
+    theY1 = y0 + t1 * dy;
+  }
+  if (t0 > 0)
+  {
+    theX0 = x0 + t0 * dx;
+    theY0 = y0 + t0 * dy;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Squared distance of a vertex from a line segment
+ */
+// ----------------------------------------------------------------------
+
+double segment_distance2(const Vertex &thePoint, const Vertex &theStart, const Vertex &theEnd)
+{
+  const double dx = theEnd.x - theStart.x;
+  const double dy = theEnd.y - theStart.y;
+  const double len2 = dx * dx + dy * dy;
+
+  double t = 0;
+  if (len2 > 0)
+    t = max(0.0, min(1.0, ((thePoint.x - theStart.x) * dx + (thePoint.y - theStart.y) * dy) / len2));
+
+  const double ex = theStart.x + t * dx - thePoint.x;
+  const double ey = theStart.y + t * dy - thePoint.y;
+  return ex * ex + ey * ey;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Mark the vertices to keep in the range [theFirst,theLast]
+ *
+ * Iterative Douglas-Peucker to avoid deep recursion on long rings.
+ */
+// ----------------------------------------------------------------------
+
+void douglas_peucker(const Ring &theRing,
+                     vector<char> &theKeep,
+                     Ring::size_type theFirst,
+                     Ring::size_type theLast,
+                     double theTolerance2)
+{
+  vector<pair<Ring::size_type, Ring::size_type> > stack;
+  stack.push_back(make_pair(theFirst, theLast));
+
+  while (!stack.empty())
+  {
+    const Ring::size_type first = stack.back().first;
+    const Ring::size_type last = stack.back().second;
+    stack.pop_back();
+
+    double best = -1;
+    Ring::size_type besti = first;
+    for (Ring::size_type i = first + 1; i < last; i++)
+    {
+      const double d = segment_distance2(theRing[i], theRing[first], theRing[last]);
+      if (d > best)
+      {
+        best = d;
+        besti = i;
+      }
+    }
+
+    if (best > theTolerance2)
+    {
+      theKeep[besti] = 1;
+      stack.push_back(make_pair(first, besti));
+      stack.push_back(make_pair(besti, last));
+    }
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Absolute area of a ring
+ */
+// ----------------------------------------------------------------------
+
+double ring_area(const Ring &theRing)
+{
+  double sum = 0;
+  for (Ring::size_type i = 0, j = theRing.size() - 1; i < theRing.size(); j = i++)
+    sum += (theRing[j].x - theRing[i].x) * (theRing[j].y + theRing[i].y);
+  return 0.5 * abs(sum);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Simplify a single ring and append the result to the output path
+ */
+// ----------------------------------------------------------------------
+
+void add_simplified_ring(NFmiPath &theOutput,
+                         NFmiPathData::const_iterator theBegin,
+                         NFmiPathData::const_iterator theEnd,
+                         double theTolerance,
+                         double theMinArea)
+{
+  Ring ring;
+  for (NFmiPathData::const_iterator it = theBegin; it != theEnd; ++it)
+    ring.push_back(Vertex(it->x, it->y));
+
+  // Rings stored with an explicit closing vertex are handled as open ones
+
+  if (ring.size() > 1 && ring.front().x == ring.back().x && ring.front().y == ring.back().y)
+    ring.pop_back();
+
+  if (ring.size() < 3) return;
+
+  if (theMinArea > 0 && ring_area(ring) < theMinArea) return;
+
+  if (theTolerance > 0 && ring.size() > 4)
+  {
+    // Split the ring at the vertex furthest from the first one
+
+    Ring::size_type split = 0;
+    double best = -1;
+    for (Ring::size_type i = 1; i < ring.size(); i++)
+    {
+      const double dx = ring[i].x - ring[0].x;
+      const double dy = ring[i].y - ring[0].y;
+      if (dx * dx + dy * dy > best)
+      {
+        best = dx * dx + dy * dy;
+        split = i;
+      }
+    }
+
+    vector<char> keep(ring.size() + 1, 0);
+    keep[0] = keep[split] = keep[ring.size()] = 1;
+
+    ring.push_back(ring.front());
+    const double tolerance2 = theTolerance * theTolerance;
+    douglas_peucker(ring, keep, 0, split, tolerance2);
+    douglas_peucker(ring, keep, split, ring.size() - 1, tolerance2);
+    ring.pop_back();
+
+    Ring simplified;
+    for (Ring::size_type i = 0; i < ring.size(); i++)
+      if (keep[i]) simplified.push_back(ring[i]);
+
+    if (simplified.size() < 3) return;
+    swap(ring, simplified);
+  }
+
+  theOutput.MoveTo(ring[0].x, ring[0].y);
+  for (Ring::size_type i = 1; i < ring.size(); i++)
+    theOutput.LineTo(ring[i].x, ring[i].y);
+}
+
+}  // namespace anonymous
+
+namespace PathTools
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Clip a path to be filled into the given rectangle
+ *
+ * Each subpath is considered to be a closed ring, which is clipped
+ * independently of the others. This preserves the even-odd filling
+ * result inside the rectangle, and hence the rectangle should be
+ * slightly larger than the image to be filled. Paths containing
+ * curves are returned unclipped.
+ *
+ * \param thePath The projected path
+ * \param theX1 The minimum X-coordinate
+ * \param theY1 The minimum Y-coordinate
+ * \param theX2 The maximum X-coordinate
+ * \param theY2 The maximum Y-coordinate
+ * \return The clipped path
+ */
+// ----------------------------------------------------------------------
+
+NFmiPath clipPolygons(const NFmiPath &thePath, double theX1, double theY1, double theX2, double theY2)
+{
+  if (has_curves(thePath)) return thePath;
+
+  NFmiPath path;
+
+  const NFmiPathData &elements = thePath.Elements();
+
+  NFmiPathData::const_iterator begin = elements.begin();
+  for (NFmiPathData::const_iterator it = elements.begin(); it != elements.end(); ++it)
+  {
+    if (it->op == kFmiMoveTo && it != begin)
+    {
+      add_clipped_ring(path, begin, it, theX1, theY1, theX2, theY2);
+      begin = it;
+    }
+  }
+  add_clipped_ring(path, begin, elements.end(), theX1, theY1, theX2, theY2);
+
+  return path;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Clip a path to be stroked into the given rectangle
+ *
+ * The rectangle should be larger than the image by at least the
+ * line width so that the clipped line ends are not visible.
+ *
+ * \param thePath The projected path
+ * \param theX1 The minimum X-coordinate
+ * \param theY1 The minimum Y-coordinate
+ * \param theX2 The maximum X-coordinate
+ * \param theY2 The maximum Y-coordinate
+ * \return The clipped path
+ */
+// ----------------------------------------------------------------------
+
+NFmiPath clipLines(const NFmiPath &thePath, double theX1, double theY1, double theX2, double theY2)
+{
+  if (has_curves(thePath)) return thePath;
+
+  NFmiPath path;
+
+  double penx = 0;
+  double peny = 0;
+  bool connected = false;
+
+  for (NFmiPathData::const_iterator it = thePath.Elements().begin();
+       it != thePath.Elements().end();
+       ++it)
+  {
+    if (it->op == kFmiMoveTo)
+    {
+      connected = false;
+    }
+    else
+    {
+      double x0 = penx;
+      double y0 = peny;
+      double x1 = it->x;
+      double y1 = it->y;
+
+      if (!clip_segment(x0, y0, x1, y1, theX1, theY1, theX2, theY2))
+        connected = false;
+      else
+      {
+        if (!connected || x0 != penx || y0 != peny) path.MoveTo(x0, y0);
+
+        if (it->op == kFmiGhostLineTo)
+          path.GhostLineTo(x1, y1);
+        else
+          path.LineTo(x1, y1);
+
+        connected = (x1 == it->x && y1 == it->y);
+      }
+    }
+    penx = it->x;
+    peny = it->y;
+  }
+
+  return path;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Simplify a path to be filled
+ *
+ * Rings whose area is below the given limit are discarded, the
+ * remaining ones are simplified with the Douglas-Peucker algorithm.
+ * Both the tolerance and the area are in pixel units, hence the
+ * path must already be projected. Paths containing curves are
+ * returned as is.
+ *
+ * \param thePath The projected path
+ * \param theTolerance The maximum allowed deviation in pixels
+ * \param theMinArea The minimum ring area in square pixels
+ * \return The simplified path
+ */
+// ----------------------------------------------------------------------
+
+NFmiPath simplifyPolygons(const NFmiPath &thePath, double theTolerance, double theMinArea)
+{
+  if (has_curves(thePath)) return thePath;
+  if (theTolerance <= 0 && theMinArea <= 0) return thePath;
+
+  NFmiPath path;
+
+  const NFmiPathData &elements = thePath.Elements();
+
+  NFmiPathData::const_iterator begin = elements.begin();
+  for (NFmiPathData::const_iterator it = elements.begin(); it != elements.end(); ++it)
+  {
+    if (it->op == kFmiMoveTo && it != begin)
+    {
+      add_simplified_ring(path, begin, it, theTolerance, theMinArea);
+      begin = it;
+    }
+  }
+  if (begin != elements.end())
+    add_simplified_ring(path, begin, elements.end(), theTolerance, theMinArea);
+
+  return path;
+}
+
+}  // namespace PathTools
+
+// ======================================================================
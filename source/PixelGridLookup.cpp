@@ -0,0 +1,361 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of class PixelGridLookup
+ */
+// ======================================================================
+
+#include "PixelGridLookup.h"
+#include "MeridianTools.h"
+#include "ThreadTools.h"
+
+#include <newbase/NFmiGrid.h>
+
+#include <boost/functional/hash.hpp>
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ */
+// ----------------------------------------------------------------------
+
+PixelGridLookup::PixelGridLookup()
+    : itsKey(),
+      itsArea(0),
+      itsGrid(0),
+      itsWidth(0),
+      itsHeight(0),
+      itsGridWidth(0),
+      itsGridHeight(0),
+      itsNearestGridPoints(),
+      itsGridPixels(),
+      itsGridNorth(),
+      itsPixelPoints()
+{
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return a key identifying the mappings
+ *
+ * \param theArea The image area
+ * \param theWidth The image width
+ * \param theHeight The image height
+ * \param theGrid The data grid
+ * \return The key
+ */
+// ----------------------------------------------------------------------
+
+string PixelGridLookup::key(const NFmiArea &theArea,
+                            int theWidth,
+                            int theHeight,
+                            const NFmiGrid &theGrid)
+{
+  if (theGrid.Area() == 0) throw runtime_error("PixelGridLookup: The data grid has no area");
+
+  ostringstream os;
+  os << theArea << '_' << theWidth << 'x' << theHeight << '_' << *theGrid.Area() << '_'
+     << theGrid.XNumber() << 'x' << theGrid.YNumber();
+  return os.str();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return a key identifying the mappings without a grid
+ *
+ * \param theArea The image area
+ * \param theWidth The image width
+ * \param theHeight The image height
+ * \return The key
+ */
+// ----------------------------------------------------------------------
+
+string PixelGridLookup::key(const NFmiArea &theArea, int theWidth, int theHeight)
+{
+  ostringstream os;
+  os << theArea << '_' << theWidth << 'x' << theHeight;
+  return os.str();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Discard all mappings
+ */
+// ----------------------------------------------------------------------
+
+void PixelGridLookup::clear()
+{
+  itsKey.clear();
+  itsArea = 0;
+  itsGrid = 0;
+  itsWidth = itsHeight = itsGridWidth = itsGridHeight = 0;
+  itsNearestGridPoints.clear();
+  itsGridPixels.clear();
+  itsGridNorth.clear();
+  itsPixelPoints.clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Establish the image and the grid to be mapped
+ *
+ * The cached mappings are discarded only if the area, the image
+ * size or the grid differs from the previous ones.
+ *
+ * \param theArea The image area
+ * \param theWidth The image width
+ * \param theHeight The image height
+ * \param theGrid The data grid
+ */
+// ----------------------------------------------------------------------
+
+void PixelGridLookup::init(const NFmiArea &theArea,
+                           int theWidth,
+                           int theHeight,
+                           const NFmiGrid &theGrid)
+{
+  itsArea = &theArea;
+  itsGrid = &theGrid;
+
+  const string newkey = key(theArea, theWidth, theHeight, theGrid);
+  if (newkey == itsKey) return;
+
+  reset(newkey, theWidth, theHeight);
+  itsGridWidth = static_cast<int>(theGrid.XNumber());
+  itsGridHeight = static_cast<int>(theGrid.YNumber());
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Establish the image to be mapped when there is no grid
+ *
+ * Only the mappings which do not need a grid are available.
+ *
+ * \param theArea The image area
+ * \param theWidth The image width
+ * \param theHeight The image height
+ */
+// ----------------------------------------------------------------------
+
+void PixelGridLookup::init(const NFmiArea &theArea, int theWidth, int theHeight)
+{
+  itsArea = &theArea;
+  itsGrid = 0;
+
+  const string newkey = key(theArea, theWidth, theHeight);
+  if (newkey == itsKey) return;
+
+  reset(newkey, theWidth, theHeight);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Discard the cached mappings of the previous image
+ */
+// ----------------------------------------------------------------------
+
+void PixelGridLookup::reset(const string &theKey, int theWidth, int theHeight)
+{
+  itsKey = theKey;
+  itsWidth = theWidth;
+  itsHeight = theHeight;
+  itsGridWidth = itsGridHeight = 0;
+
+  itsNearestGridPoints.clear();
+  itsGridPixels.clear();
+  itsGridNorth.clear();
+  itsPixelPoints.clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Establish all coordinates of a point
+ *
+ * The grid coordinates are missing if there is no grid.
+ */
+// ----------------------------------------------------------------------
+
+PixelGridLookup::PixelPoint PixelGridLookup::makePoint(const NFmiPoint &theXY,
+                                                       const NFmiPoint &theLatLon) const
+{
+  PixelPoint point;
+  point.xy = theXY;
+  point.latlon = theLatLon;
+  point.grid = (itsGrid != 0 ? itsGrid->LatLonToGrid(theLatLon)
+                             : NFmiPoint(kFloatMissing, kFloatMissing));
+  point.north = static_cast<float>(MeridianTools::PaperNorth(*itsArea, theLatLon));
+  return point;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The nearest grid point of each pixel
+ *
+ * The pixels are stored row by row, the grid points are given as
+ * i + j*gridWidth(), or -1 for pixels outside the grid.
+ *
+ * \param theThreads The number of threads to use for the calculation
+ * \return The grid point indices
+ */
+// ----------------------------------------------------------------------
+
+const std::vector<int> &PixelGridLookup::nearestGridPoints(unsigned int theThreads)
+{
+  if (!itsNearestGridPoints.empty() || itsArea == 0 || itsGrid == 0)
+    return itsNearestGridPoints;
+
+  itsNearestGridPoints.assign(static_cast<size_t>(itsWidth) * itsHeight, -1);
+
+  const double xmax = itsGridWidth - 1;
+  const double ymax = itsGridHeight - 1;
+
+  ThreadTools::parallel_for(itsHeight,
+                            theThreads,
+                            [&](size_t theRow)
+                            {
+                              const int j = static_cast<int>(theRow);
+                              int *out = &itsNearestGridPoints[theRow * itsWidth];
+                              for (int i = 0; i < itsWidth; i++)
+                              {
+                                NFmiPoint latlon = itsArea->ToLatLon(NFmiPoint(i, j));
+                                NFmiPoint ij = itsGrid->LatLonToGrid(latlon);
+                                const double x = ij.X();
+                                const double y = ij.Y();
+                                if (x >= 0 && x <= xmax && y >= 0 && y <= ymax)
+                                {
+                                  const int gi = static_cast<int>(floor(x + 0.5));
+                                  const int gj = static_cast<int>(floor(y + 0.5));
+                                  out[i] = gi + gj * itsGridWidth;
+                                }
+                              }
+                            });
+
+  return itsNearestGridPoints;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The direction of north on paper at each grid point
+ *
+ * The angles are stored as i + j*gridWidth(). The coordinates of
+ * the grid points are needed only when the field is first calculated.
+ *
+ * \param theLatLons The geographic coordinates of the grid points
+ * \param theThreads The number of threads to use for the calculation
+ * \return The angles in degrees
+ */
+// ----------------------------------------------------------------------
+
+const vector<float> &PixelGridLookup::gridNorth(const NFmiDataMatrix<NFmiPoint> &theLatLons,
+                                                unsigned int theThreads)
+{
+  if (!itsGridNorth.empty() || itsArea == 0) return itsGridNorth;
+
+  const size_t nx = theLatLons.NX();
+  const size_t ny = theLatLons.NY();
+
+  itsGridNorth.resize(nx * ny);
+
+  ThreadTools::parallel_for(ny,
+                            theThreads,
+                            [&](size_t j)
+                            {
+                              for (size_t i = 0; i < nx; i++)
+                                itsGridNorth[i + j * nx] = static_cast<float>(
+                                    MeridianTools::PaperNorth(*itsArea, theLatLons[i][j]));
+                            });
+
+  return itsGridNorth;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The coordinates of a regular grid of pixels
+ *
+ * The pixels are generated row by row starting from the given
+ * pixel and continuing up to and including the image edges.
+ *
+ * \param theX0 The first x-coordinate
+ * \param theY0 The first y-coordinate
+ * \param theDX The x-spacing, must be positive
+ * \param theDY The y-spacing, must be positive
+ * \return The coordinates
+ */
+// ----------------------------------------------------------------------
+
+const PixelGridLookup::PixelPoints &PixelGridLookup::pixelPoints(float theX0,
+                                                                 float theY0,
+                                                                 float theDX,
+                                                                 float theDY)
+{
+  if (theDX <= 0 || theDY <= 0)
+    throw runtime_error("PixelGridLookup: The pixel grid spacing must be positive");
+
+  ostringstream os;
+  os << theX0 << '_' << theY0 << '_' << theDX << '_' << theDY;
+
+  map<string, PixelPoints>::iterator it = itsPixelPoints.find(os.str());
+  if (it != itsPixelPoints.end()) return it->second;
+
+  PixelPoints &points = itsPixelPoints[os.str()];
+  if (itsArea == 0) return points;
+
+  for (float y = theY0; y <= itsHeight; y += theDY)
+    for (float x = theX0; x <= itsWidth; x += theDX)
+    {
+      const NFmiPoint xy(x, y);
+      points.push_back(makePoint(xy, itsArea->ToLatLon(xy)));
+    }
+
+  return points;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The coordinates of a list of geographic points
+ *
+ * The list is identified by a hash of its coordinates, so that the
+ * same list given again for a later timestep is found in the cache.
+ *
+ * \param theLatLons The geographic coordinates
+ * \return The coordinates, in the same order
+ */
+// ----------------------------------------------------------------------
+
+const PixelGridLookup::PixelPoints &PixelGridLookup::latlonPoints(
+    const std::list<NFmiPoint> &theLatLons)
+{
+  std::size_t hash = theLatLons.size();
+  for (std::list<NFmiPoint>::const_iterator iter = theLatLons.begin(); iter != theLatLons.end();
+       ++iter)
+  {
+    boost::hash_combine(hash, iter->X());
+    boost::hash_combine(hash, iter->Y());
+  }
+
+  ostringstream os;
+  os << "points_" << hash;
+
+  map<string, PixelPoints>::iterator it = itsPixelPoints.find(os.str());
+  if (it != itsPixelPoints.end()) return it->second;
+
+  PixelPoints &points = itsPixelPoints[os.str()];
+  if (itsArea == 0) return points;
+
+  for (std::list<NFmiPoint>::const_iterator iter = theLatLons.begin(); iter != theLatLons.end();
+       ++iter)
+  {
+    // NFmiPoint latlon = MeridianTools::Relocate(*iter,theArea);
+    points.push_back(makePoint(itsArea->ToXY(*iter), *iter));
+  }
+
+  return points;
+}
+
+// ======================================================================
@@ -0,0 +1,670 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of namespace PngTools
+ */
+// ======================================================================
+
+#include "PngTools.h"
+#include "ThreadTools.h"
+
+#include <imagine/NFmiColorTools.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+using namespace Imagine;
+using namespace std;
+
+namespace
+{
+//! The deflate window size, which is also the dictionary size
+const size_t dictsize = 32768;
+
+//! Desired amount of uncompressed data per chunk
+const size_t chunksize = 256 * 1024;
+
+//! A compressed chunk of rows
+struct Chunk
+{
+  vector<unsigned char> data;
+  uLong adler;
+  size_t length;
+};
+
+//! Extracts the samples of the given row
+typedef function<void(int theRow, unsigned char *theOutput)> RowFunction;
+
+//! The layout of the samples
+struct Layout
+{
+  int width;
+  int height;
+  size_t bpp;     // bytes per pixel
+  bool adaptive;  // choose the filter row by row, or use none
+  int colortype;  // PNG colour type
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Convert an image row into PNG samples
+ */
+// ----------------------------------------------------------------------
+
+void extract_row(const NFmiImage &theImage, int theRow, bool theAlpha, unsigned char *theOutput)
+{
+  for (int i = 0; i < theImage.Width(); i++)
+  {
+    const NFmiColorTools::Color c = theImage(i, theRow);
+    *theOutput++ = static_cast<unsigned char>(NFmiColorTools::GetRed(c));
+    *theOutput++ = static_cast<unsigned char>(NFmiColorTools::GetGreen(c));
+    *theOutput++ = static_cast<unsigned char>(NFmiColorTools::GetBlue(c));
+    if (theAlpha)
+    {
+      // Imagine alpha is transparency in range 0-127
+      const int opacity = NFmiColorTools::MaxAlpha - NFmiColorTools::GetAlpha(c);
+      *theOutput++ = static_cast<unsigned char>((opacity * 255 + 63) / NFmiColorTools::MaxAlpha);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The Paeth predictor
+ */
+// ----------------------------------------------------------------------
+
+int paeth(int a, int b, int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a);
+  const int pb = abs(p - b);
+  const int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Filter a row of samples
+ *
+ * All five filters are tried, and the one with the smallest sum of
+ * absolute values is chosen, as libpng does by default for
+ * truecolor images. Palette images are not filtered.
+ *
+ * \param theRow The samples of the row
+ * \param thePrevious The samples of the previous row, zeros for the first row
+ * \param theSize The number of bytes in a row
+ * \param theBpp The number of bytes per pixel
+ * \param theAdaptive True if the filter is to be chosen
+ * \param theWork Work space
+ * \param theOutput The filter type followed by the filtered row
+ */
+// ----------------------------------------------------------------------
+
+void filter_row(const unsigned char *theRow,
+                const unsigned char *thePrevious,
+                size_t theSize,
+                size_t theBpp,
+                bool theAdaptive,
+                vector<unsigned char> &theWork,
+                unsigned char *theOutput)
+{
+  if (!theAdaptive)
+  {
+    theOutput[0] = 0;
+    copy(theRow, theRow + theSize, theOutput + 1);
+    return;
+  }
+
+  theWork.resize(5 * theSize);
+
+  unsigned long best_sum = 0;
+  int best = -1;
+
+  for (int type = 0; type < 5; type++)
+  {
+    unsigned char *out = &theWork[type * theSize];
+    unsigned long sum = 0;
+
+    for (size_t k = 0; k < theSize; k++)
+    {
+      const int x = theRow[k];
+      const int a = (k >= theBpp ? theRow[k - theBpp] : 0);
+      const int b = thePrevious[k];
+      const int c = (k >= theBpp ? thePrevious[k - theBpp] : 0);
+
+      int value = x;
+      switch (type)
+      {
+        case 1:
+          value = x - a;
+          break;
+        case 2:
+          value = x - b;
+          break;
+        case 3:
+          value = x - (a + b) / 2;
+          break;
+        case 4:
+          value = x - paeth(a, b, c);
+          break;
+      }
+
+      out[k] = static_cast<unsigned char>(value);
+      const int s = static_cast<signed char>(out[k]);
+      sum += abs(s);
+    }
+
+    if (best < 0 || sum < best_sum)
+    {
+      best = type;
+      best_sum = sum;
+    }
+  }
+
+  theOutput[0] = static_cast<unsigned char>(best);
+  copy(theWork.begin() + best * theSize, theWork.begin() + (best + 1) * theSize, theOutput + 1);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Filter and compress a range of rows
+ *
+ * The rows preceding the range are filtered too so that the
+ * compressor can be primed with the same data the previous chunk
+ * ended with.
+ */
+// ----------------------------------------------------------------------
+
+void compress_rows(const RowFunction &theRows,
+                   const Layout &theLayout,
+                   int theFirstRow,
+                   int theLastRow,
+                   int theLevel,
+                   Chunk &theChunk)
+{
+  const size_t bpp = theLayout.bpp;
+  const size_t rowsize = bpp * theLayout.width;
+  const size_t linesize = rowsize + 1;
+
+  const int dictrows = min(theFirstRow, static_cast<int>((dictsize + linesize - 1) / linesize));
+  const int firstrow = theFirstRow - dictrows;
+
+  vector<unsigned char> filtered(linesize * (theLastRow - firstrow));
+  vector<unsigned char> previous(rowsize, 0);
+  vector<unsigned char> current(rowsize);
+  vector<unsigned char> work;
+
+  if (firstrow > 0) theRows(firstrow - 1, &previous[0]);
+
+  for (int j = firstrow; j < theLastRow; j++)
+  {
+    theRows(j, &current[0]);
+    filter_row(&current[0],
+               &previous[0],
+               rowsize,
+               bpp,
+               theLayout.adaptive,
+               work,
+               &filtered[(j - firstrow) * linesize]);
+    swap(previous, current);
+  }
+
+  const size_t dictlength = min(dictsize, dictrows * linesize);
+  const unsigned char *data = &filtered[dictrows * linesize];
+  const size_t length = filtered.size() - dictrows * linesize;
+
+  z_stream zs;
+  zs.zalloc = Z_NULL;
+  zs.zfree = Z_NULL;
+  zs.opaque = Z_NULL;
+
+  if (deflateInit2(&zs, theLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw runtime_error("PngTools: failed to initialize zlib");
+
+  if (dictlength > 0)
+    deflateSetDictionary(&zs, data - dictlength, static_cast<uInt>(dictlength));
+
+  const bool last = (theLastRow == theLayout.height);
+
+  theChunk.data.resize(deflateBound(&zs, length) + 64);
+  zs.next_in = const_cast<unsigned char *>(data);
+  zs.avail_in = static_cast<uInt>(length);
+  zs.next_out = &theChunk.data[0];
+  zs.avail_out = static_cast<uInt>(theChunk.data.size());
+
+  const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+  const bool ok = (last ? ret == Z_STREAM_END : ret == Z_OK && zs.avail_in == 0);
+
+  theChunk.data.resize(zs.total_out);
+  deflateEnd(&zs);
+
+  if (!ok) throw runtime_error("PngTools: zlib compression failed");
+
+  theChunk.adler = adler32(adler32(0L, Z_NULL, 0), data, static_cast<uInt>(length));
+  theChunk.length = length;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Append a big endian 32-bit integer
+ */
+// ----------------------------------------------------------------------
+
+void append_uint32(vector<unsigned char> &theBuffer, unsigned long theValue)
+{
+  theBuffer.push_back(static_cast<unsigned char>((theValue >> 24) & 0xff));
+  theBuffer.push_back(static_cast<unsigned char>((theValue >> 16) & 0xff));
+  theBuffer.push_back(static_cast<unsigned char>((theValue >> 8) & 0xff));
+  theBuffer.push_back(static_cast<unsigned char>(theValue & 0xff));
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Write a PNG chunk
+ */
+// ----------------------------------------------------------------------
+
+void write_chunk(ostream &theOutput,
+                 const char *theType,
+                 const unsigned char *theData,
+                 size_t theLength)
+{
+  vector<unsigned char> header;
+  append_uint32(header, theLength);
+  header.insert(header.end(), theType, theType + 4);
+
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, reinterpret_cast<const Bytef *>(theType), 4);
+  if (theLength > 0) crc = crc32(crc, theData, static_cast<uInt>(theLength));
+
+  vector<unsigned char> trailer;
+  append_uint32(trailer, crc);
+
+  theOutput.write(reinterpret_cast<const char *>(&header[0]), header.size());
+  if (theLength > 0) theOutput.write(reinterpret_cast<const char *>(theData), theLength);
+  theOutput.write(reinterpret_cast<const char *>(&trailer[0]), trailer.size());
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Compress the rows in parallel and write the PNG stream
+ *
+ * \param theOutput The output stream
+ * \param theRows The function extracting the samples of a row
+ * \param theLayout The layout of the samples
+ * \param thePalette The PLTE chunk data, or empty
+ * \param theTransparency The tRNS chunk data, or empty
+ * \param theOptions The encoding options
+ */
+// ----------------------------------------------------------------------
+
+void write_png(ostream &theOutput,
+               const RowFunction &theRows,
+               const Layout &theLayout,
+               const vector<unsigned char> &thePalette,
+               const vector<unsigned char> &theTransparency,
+               const PngTools::Options &theOptions)
+{
+  const int width = theLayout.width;
+  const int height = theLayout.height;
+
+  const int level = (theOptions.level < 0 ? Z_DEFAULT_COMPRESSION : min(theOptions.level, 9));
+  const size_t linesize = theLayout.bpp * static_cast<size_t>(width) + 1;
+
+  // Compress the chunks in parallel
+
+  const int rows = max(1, static_cast<int>(chunksize / linesize));
+  const size_t nchunks = (height + rows - 1) / rows;
+
+  vector<Chunk> chunks(nchunks);
+
+  ThreadTools::parallel_for(nchunks,
+                            theOptions.threads,
+                            [&](size_t k)
+                            {
+                              const int first = static_cast<int>(k) * rows;
+                              const int last = min(height, first + rows);
+                              compress_rows(theRows, theLayout, first, last, level, chunks[k]);
+                            });
+
+  // The zlib stream header with a level hint and the combined checksum
+
+  int flevel = 3;
+  if (level == Z_DEFAULT_COMPRESSION || level == 6)
+    flevel = 2;
+  else if (level < 2)
+    flevel = 0;
+  else if (level < 6)
+    flevel = 1;
+
+  const int cmf = 0x78;
+  int flg = flevel << 6;
+  flg += (31 - (cmf * 256 + flg) % 31) % 31;
+
+  uLong adler = adler32(0L, Z_NULL, 0);
+  for (size_t k = 0; k < nchunks; k++)
+    adler = adler32_combine(adler, chunks[k].adler, static_cast<z_off_t>(chunks[k].length));
+
+  // Write the stream
+
+  ostream &out = theOutput;
+
+  const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  out.write(reinterpret_cast<const char *>(signature), sizeof(signature));
+
+  vector<unsigned char> ihdr;
+  append_uint32(ihdr, width);
+  append_uint32(ihdr, height);
+  ihdr.push_back(8);              // bit depth
+  ihdr.push_back(theLayout.colortype);
+  ihdr.push_back(0);              // deflate
+  ihdr.push_back(0);              // adaptive filtering
+  ihdr.push_back(0);              // no interlace
+  write_chunk(out, "IHDR", &ihdr[0], ihdr.size());
+
+  if (!thePalette.empty()) write_chunk(out, "PLTE", &thePalette[0], thePalette.size());
+  if (!theTransparency.empty())
+    write_chunk(out, "tRNS", &theTransparency[0], theTransparency.size());
+
+  const unsigned char zheader[2] = {static_cast<unsigned char>(cmf),
+                                    static_cast<unsigned char>(flg)};
+  write_chunk(out, "IDAT", zheader, sizeof(zheader));
+
+  for (size_t k = 0; k < nchunks; k++)
+    write_chunk(out, "IDAT", &chunks[k].data[0], chunks[k].data.size());
+
+  vector<unsigned char> ztrailer;
+  append_uint32(ztrailer, adler);
+  write_chunk(out, "IDAT", &ztrailer[0], ztrailer.size());
+
+  write_chunk(out, "IEND", 0, 0);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Write the PNG stream into a file
+ */
+// ----------------------------------------------------------------------
+
+void write_file(const string &theFilename,
+                const RowFunction &theRows,
+                const Layout &theLayout,
+                const vector<unsigned char> &thePalette,
+                const vector<unsigned char> &theTransparency,
+                const PngTools::Options &theOptions)
+{
+  ofstream out(theFilename.c_str(), ios::out | ios::binary);
+  if (!out) throw runtime_error("PngTools: failed to open '" + theFilename + "' for writing");
+
+  write_png(out, theRows, theLayout, thePalette, theTransparency, theOptions);
+
+  out.close();
+  if (!out) throw runtime_error("PngTools: failed to write '" + theFilename + "'");
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The layout of a truecolor image
+ */
+// ----------------------------------------------------------------------
+
+Layout truecolor_layout(const NFmiImage &theImage, bool theAlpha)
+{
+  Layout layout;
+  layout.width = theImage.Width();
+  layout.height = theImage.Height();
+  layout.bpp = (theAlpha ? 4 : 3);
+  layout.adaptive = true;
+  layout.colortype = (theAlpha ? 6 : 2);
+  return layout;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Find the palette entry nearest to the given colour
+ *
+ * The distance is the squared Euclidean distance of the RGBA
+ * components.
+ */
+// ----------------------------------------------------------------------
+
+unsigned char nearest_color(const PngTools::Colors &thePalette, NFmiColorTools::Color theColor)
+{
+  const int r = NFmiColorTools::GetRed(theColor);
+  const int g = NFmiColorTools::GetGreen(theColor);
+  const int b = NFmiColorTools::GetBlue(theColor);
+  const int a = NFmiColorTools::GetAlpha(theColor);
+
+  size_t best = 0;
+  int bestdistance = -1;
+
+  for (size_t k = 0; k < thePalette.size(); k++)
+  {
+    const int dr = NFmiColorTools::GetRed(thePalette[k]) - r;
+    const int dg = NFmiColorTools::GetGreen(thePalette[k]) - g;
+    const int db = NFmiColorTools::GetBlue(thePalette[k]) - b;
+    const int da = NFmiColorTools::GetAlpha(thePalette[k]) - a;
+    const int distance = dr * dr + dg * dg + db * db + da * da;
+    if (bestdistance < 0 || distance < bestdistance)
+    {
+      best = k;
+      bestdistance = distance;
+    }
+  }
+
+  return static_cast<unsigned char>(best);
+}
+
+}  // namespace anonymous
+
+namespace PngTools
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Write the image as a PNG file
+ *
+ * \param theImage The image to write
+ * \param theFilename The name of the file
+ * \param theOptions The encoding options
+ */
+// ----------------------------------------------------------------------
+
+void write(const NFmiImage &theImage, const string &theFilename, const Options &theOptions)
+{
+  if (theImage.Width() <= 0 || theImage.Height() <= 0)
+    throw runtime_error("PngTools: cannot write an empty image to '" + theFilename + "'");
+
+  const bool alpha = theOptions.savealpha;
+
+  write_file(theFilename,
+             [&](int theRow, unsigned char *theOutput)
+             { extract_row(theImage, theRow, alpha, theOutput); },
+             truecolor_layout(theImage, alpha),
+             vector<unsigned char>(),
+             vector<unsigned char>(),
+             theOptions);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Encode the image as PNG into memory
+ *
+ * \param theImage The image to encode
+ * \param theOptions The encoding options
+ * \return The PNG file contents
+ */
+// ----------------------------------------------------------------------
+
+vector<unsigned char> encode(const NFmiImage &theImage, const Options &theOptions)
+{
+  if (theImage.Width() <= 0 || theImage.Height() <= 0)
+    throw runtime_error("PngTools: cannot encode an empty image");
+
+  const bool alpha = theOptions.savealpha;
+
+  ostringstream out;
+  write_png(out,
+            [&](int theRow, unsigned char *theOutput)
+            { extract_row(theImage, theRow, alpha, theOutput); },
+            truecolor_layout(theImage, alpha),
+            vector<unsigned char>(),
+            vector<unsigned char>(),
+            theOptions);
+
+  const string buffer = out.str();
+  return vector<unsigned char>(buffer.begin(), buffer.end());
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the pixels as RGBA samples row by row
+ *
+ * \param theImage The image
+ * \return The samples, four bytes per pixel
+ */
+// ----------------------------------------------------------------------
+
+vector<unsigned char> rgba(const NFmiImage &theImage)
+{
+  vector<unsigned char> samples(4 * static_cast<size_t>(theImage.Width()) * theImage.Height());
+  const size_t rowsize = 4 * static_cast<size_t>(theImage.Width());
+
+  for (int j = 0; j < theImage.Height(); j++)
+    extract_row(theImage, j, true, &samples[j * rowsize]);
+
+  return samples;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Write the image as an 8-bit palette PNG file
+ *
+ * The palette starts with the given known colours in the given
+ * order, followed by any other colours in the order they appear
+ * in the image. Known colours therefore keep their indices in
+ * successive images. Once all 256 slots are taken any further
+ * colours are mapped to the nearest palette entry, which affects
+ * only the few pixels with those colours instead of quantizing
+ * the whole image.
+ *
+ * Without savealpha all colours are considered opaque.
+ *
+ * \param theImage The image to write
+ * \param theFilename The name of the file
+ * \param theOptions The encoding options
+ * \param theKnownColors Colours expected to appear in the image
+ */
+// ----------------------------------------------------------------------
+
+void writeIndexed(const NFmiImage &theImage,
+                  const string &theFilename,
+                  const Options &theOptions,
+                  const Colors &theKnownColors)
+{
+  const int width = theImage.Width();
+  const int height = theImage.Height();
+
+  if (width <= 0 || height <= 0)
+    throw runtime_error("PngTools: cannot write an empty image to '" + theFilename + "'");
+
+  const NFmiColorTools::Color mask = (theOptions.savealpha ? 0xFFFFFFFF : 0x00FFFFFF);
+
+  // Build the palette and the indices
+
+  Colors colors;
+  unordered_map<NFmiColorTools::Color, unsigned char> indices;
+
+  for (Colors::const_iterator it = theKnownColors.begin();
+       it != theKnownColors.end() && colors.size() < 256;
+       ++it)
+  {
+    const NFmiColorTools::Color color = (*it & mask);
+    if (indices.insert(make_pair(color, static_cast<unsigned char>(colors.size()))).second)
+      colors.push_back(color);
+  }
+
+  vector<unsigned char> pixels(static_cast<size_t>(width) * height);
+
+  bool first = true;
+  NFmiColorTools::Color previous = 0;
+  unsigned char index = 0;
+
+  for (int j = 0; j < height; j++)
+    for (int i = 0; i < width; i++)
+    {
+      const NFmiColorTools::Color color = (theImage(i, j) & mask);
+      if (first || color != previous)
+      {
+        unordered_map<NFmiColorTools::Color, unsigned char>::const_iterator it =
+            indices.find(color);
+        if (it != indices.end())
+          index = it->second;
+        else
+        {
+          if (colors.size() < 256)
+          {
+            index = static_cast<unsigned char>(colors.size());
+            colors.push_back(color);
+          }
+          else
+            index = nearest_color(colors, color);
+          indices.insert(make_pair(color, index));
+        }
+        previous = color;
+        first = false;
+      }
+      pixels[i + static_cast<size_t>(j) * width] = index;
+    }
+
+  // The PLTE and tRNS chunks, omitting opaque entries at the end of tRNS
+
+  vector<unsigned char> palette;
+  vector<unsigned char> transparency;
+  size_t ntransparent = 0;
+
+  for (size_t k = 0; k < colors.size(); k++)
+  {
+    palette.push_back(static_cast<unsigned char>(NFmiColorTools::GetRed(colors[k])));
+    palette.push_back(static_cast<unsigned char>(NFmiColorTools::GetGreen(colors[k])));
+    palette.push_back(static_cast<unsigned char>(NFmiColorTools::GetBlue(colors[k])));
+
+    const int opacity = NFmiColorTools::MaxAlpha - NFmiColorTools::GetAlpha(colors[k]);
+    transparency.push_back(
+        static_cast<unsigned char>((opacity * 255 + 63) / NFmiColorTools::MaxAlpha));
+    if (transparency.back() != 255) ntransparent = k + 1;
+  }
+  transparency.resize(ntransparent);
+
+  Layout layout;
+  layout.width = width;
+  layout.height = height;
+  layout.bpp = 1;
+  layout.adaptive = false;
+  layout.colortype = 3;
+
+  write_file(theFilename,
+             [&](int theRow, unsigned char *theOutput)
+             {
+               const unsigned char *row = &pixels[static_cast<size_t>(theRow) * width];
+               copy(row, row + width, theOutput);
+             },
+             layout,
+             palette,
+             transparency,
+             theOptions);
+}
+
+}  // namespace PngTools
+
+// ======================================================================
@@ -0,0 +1,236 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of struct RenderContext
+ */
+// ======================================================================
+
+#include "RenderContext.h"
+#include "ColorTools.h"
+#include "LazyQueryData.h"
+#include "TimeTools.h"
+
+#ifdef IMAGINE_WITH_CAIRO
+#include "ImagineXr.h"
+#else
+#include <imagine/NFmiFace.h>
+#include <imagine/NFmiFreeType.h>
+#endif
+
+#include <newbase/NFmiTime.h>
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ *
+ * The context uses the caches exclusively until it is destroyed.
+ * Using caches which are already in use by another context is
+ * an error, since the caches are not synchronized.
+ *
+ * \param theState The state of the job
+ * \param theCaches The caches to use
+ * \param theQueryStreams The available data
+ * \param theVerbose True if progress information is to be printed
+ */
+// ----------------------------------------------------------------------
+
+RenderContext::RenderContext(JobState &theState,
+                             RenderCaches &theCaches,
+                             const QueryStreams &theQueryStreams,
+                             bool theVerbose)
+    : state(theState),
+      caches(theCaches),
+      querystreams(theQueryStreams),
+      queryinfo(),
+      calculator(theState.calculator.get()),
+      verbose(theVerbose),
+      itsCachesLock(theCaches.mutex, std::try_to_lock)
+{
+  if (!itsCachesLock.owns_lock())
+    throw runtime_error("The render caches are already in use by another context");
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the time stamp string to be rendered in the image
+ */
+// ----------------------------------------------------------------------
+
+const std::string RenderContext::getImageStampText(const NFmiTime &theTime) const
+{
+  NFmiTime tobs = TimeTools::ConvertZone(theTime, state.timestampzone);
+
+  const int obsyy = tobs.GetYear();
+  const int obsmm = tobs.GetMonth();
+  const int obsdd = tobs.GetDay();
+  const int obshh = tobs.GetHour();
+  const int obsmi = tobs.GetMin();
+
+  // Interpretation: The age of the forecast is the age
+  // of the oldest forecast
+
+  NFmiTime tfor;
+
+  for (unsigned int qi = 0; qi < querystreams.size(); qi++)
+  {
+    NFmiTime futctime = querystreams[qi]->OriginTime();
+    NFmiTime tlocal = TimeTools::ConvertZone(futctime, state.timestampzone);
+    if (qi == 0 || tlocal.IsLessThan(tfor)) tfor = tlocal;
+  }
+
+  const int foryy = tfor.GetYear();
+  const int formm = tfor.GetMonth();
+  const int fordd = tfor.GetDay();
+  const int forhh = tfor.GetHour();
+  const int formi = tfor.GetMin();
+
+  char buffer[100];
+
+  string stamp;
+  if (state.timestampimage == "obs")
+  {
+    if (state.timestampimageformat == "hour")  // hh:mi
+      sprintf(buffer, "%02d:%02d", obshh, obsmi);
+
+    else if (state.timestampimageformat == "hourdate")  // hh:mi dd.mm.
+      sprintf(buffer, "%02d:%02d %02d.%02d.", obshh, obsmi, obsdd, obsmm);
+
+    else if (state.timestampimageformat == "datehour")  // d.m h:mi.
+      sprintf(buffer, "%d.%d. %d:%02d", obsdd, obsmm, obshh, obsmi);
+
+    else  // hh:mi dd.mm.yyyy
+      sprintf(buffer, "%02d:%02d %02d.%02d.%04d", obshh, obsmi, obsdd, obsmm, obsyy);
+    stamp = buffer;
+  }
+  else if (state.timestampimage == "for")
+  {
+    if (state.timestampimageformat == "hour")  // hh:mi
+      sprintf(buffer, "%02d:%02d", forhh, formi);
+    else if (state.timestampimageformat == "hourdate")  // hh:mi dd.mm.
+      sprintf(buffer, "%02d:%02d %02d.%02d.", forhh, formi, fordd, formm);
+    else if (state.timestampimageformat == "datehour")  // d.m h:mi
+      sprintf(buffer, "%d.%d. %d:%02d", fordd, formm, forhh, formi);
+    else  // hh:mi dd.mm.yyyy
+      sprintf(buffer, "%02d:%02d %02d.%02d.%04d", forhh, formi, fordd, formm, foryy);
+    stamp = buffer;
+  }
+  else if (state.timestampimage == "forobs")
+  {
+    if (state.timestampimageformat == "hour")  // hh:mi +hh
+      sprintf(buffer, "%02d:%02d", forhh, formi);
+    else if (state.timestampimageformat == "hourdate")  // dd.mm. hh:mi + hh
+      sprintf(buffer, "%02d.%02d. %02d:%02d", fordd, formm, forhh, formi);
+    else if (state.timestampimageformat == "datehour")  // d.m. h:mi + hh
+      sprintf(buffer, "%d.%d. %d:%02d", fordd, formm, forhh, formi);
+    else  // dd.mm.yy hh:mi +hh
+      sprintf(buffer, "%02d.%02d.%04d %02d:%02d", fordd, formm, foryy, forhh, formi);
+
+    stamp = buffer;
+
+    const long diff = tobs.DifferenceInMinutes(tfor);
+    if (diff % 60 == 0 && state.timestep % 60 == 0)
+      sprintf(buffer, " %s%ldh", (diff < 0 ? "" : "+"), diff / 60);
+    else
+      sprintf(buffer, " %s%ldm", (diff < 0 ? "" : "+"), diff);
+
+    stamp += buffer;
+  }
+  return stamp;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw the given text into the time stamp position in the image
+ */
+// ----------------------------------------------------------------------
+
+#ifdef IMAGINE_WITH_CAIRO
+void RenderContext::drawImageStampText(ImagineXr &img, const std::string &text) const
+{
+  if (text.empty()) return;
+
+  int x = state.timestampimagex;
+  int y = state.timestampimagey;
+
+  if (x < 0) x += img.Width();
+  if (y < 0) y += img.Height();
+
+  // ImagineXr version (AKa 5-Aug-2008)
+  //
+  img.MakeFace(state.timestampimagefont, state.timestampimagebackground);
+
+  img.DrawFace(x,
+               y,
+               text,                        // should be UTF-8
+               state.timestampimagecolor);  // font color
+}
+#else
+/*** NFmiImage version (original) ***/
+void RenderContext::drawImageStampText(Imagine::NFmiImage &theImage,
+                                       const std::string &theText) const
+{
+  if (theText.empty()) return;
+
+  Imagine::NFmiFace face(state.timestampimagefont);
+
+  int x = state.timestampimagex;
+  int y = state.timestampimagey;
+
+  if (x < 0) x += theImage.Width();
+  if (y < 0) y += theImage.Height();
+
+  if (state.timestampimagebackground != Imagine::NFmiColorTools::NoColor)
+  {
+    face.Background(true);
+    face.BackgroundMargin(state.timestampimagexmargin, state.timestampimageymargin);
+    face.BackgroundColor(state.timestampimagebackground);
+  }
+
+  face.Draw(theImage, x, y, theText, Imagine::kFmiAlignNorthWest, state.timestampimagecolor);
+}
+#endif
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Draw the "combine" image over the given image
+ */
+// ----------------------------------------------------------------------
+
+#ifdef IMAGINE_WITH_CAIRO
+void RenderContext::drawCombine(ImagineXr &xr) const
+{
+  if (state.combine.empty()) return;
+
+  Imagine::NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(state.combinerule);
+
+  xr.Composite(caches.getImage(state.combine),
+               rule,
+               Imagine::kFmiAlignNorthWest,
+               state.combinex,
+               state.combiney,
+               state.combinefactor);
+}
+#else
+/*** NFmiImage code (original) ***/
+void RenderContext::drawCombine(Imagine::NFmiImage &theImage) const
+{
+  if (state.combine.empty()) return;
+
+  Imagine::NFmiColorTools::NFmiBlendRule rule = ColorTools::checkrule(state.combinerule);
+
+  theImage.Composite(caches.getImage(state.combine),
+                     rule,
+                     Imagine::kFmiAlignNorthWest,
+                     state.combinex,
+                     state.combiney,
+                     state.combinefactor);
+}
+#endif
+
+// ======================================================================
@@ -0,0 +1,245 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of namespace ServerTools
+ */
+// ======================================================================
+
+#include "ServerTools.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Run a job and return the status line
+ *
+ * \param theLine The job
+ * \param theJob The function running the scripts
+ * \param theQuit Set to true if the job was "quit"
+ */
+// ----------------------------------------------------------------------
+
+string run(const string &theLine, const ServerTools::JobFunction &theJob, bool &theQuit)
+{
+  istringstream input(theLine);
+  vector<string> scripts;
+  string name;
+  while (input >> name)
+    scripts.push_back(name);
+
+  if (scripts.size() == 1 && scripts[0] == "quit")
+  {
+    theQuit = true;
+    return "OK\n";
+  }
+
+  if (scripts.empty()) return "ERROR: no scripts given\n";
+
+  const string error = theJob(scripts);
+  if (error.empty()) return "OK\n";
+
+  // Keep the status on one line
+  string message = error;
+  for (string::iterator it = message.begin(); it != message.end(); ++it)
+    if (*it == '\n') *it = ' ';
+
+  return "ERROR: " + message + "\n";
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Redirect std::cout to std::cerr for the lifetime of the object
+ *
+ * The original buffer remains available for the job status lines.
+ */
+// ----------------------------------------------------------------------
+
+class StdoutRedirect
+{
+ public:
+  StdoutRedirect() : itsBuffer(cout.rdbuf(cerr.rdbuf())) {}
+  ~StdoutRedirect() { cout.rdbuf(itsBuffer); }
+  streambuf *buffer() const { return itsBuffer; }
+
+ private:
+  StdoutRedirect(const StdoutRedirect &);
+  StdoutRedirect &operator=(const StdoutRedirect &);
+
+  streambuf *itsBuffer;
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Serve jobs from the standard input
+ *
+ * The standard output is reserved for the job status lines, any
+ * progress output of the jobs is sent to the standard error instead.
+ */
+// ----------------------------------------------------------------------
+
+void serve_stdin(const ServerTools::JobFunction &theJob)
+{
+  StdoutRedirect redirect;
+  ostream status(redirect.buffer());
+
+  bool quit = false;
+  string line;
+  while (!quit && getline(cin, line))
+  {
+    if (line.find_first_not_of(" \t\r") == string::npos) continue;
+    status << run(line, theJob, quit) << flush;
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Remove a stale socket left behind by an earlier server
+ *
+ * Anything else at the path is an error, since the path is most
+ * likely mistyped.
+ */
+// ----------------------------------------------------------------------
+
+void remove_socket(const string &theSocket)
+{
+  struct stat info;
+  if (lstat(theSocket.c_str(), &info) < 0) return;
+
+  if (!S_ISSOCK(info.st_mode))
+    throw runtime_error("'" + theSocket + "' exists and is not a socket");
+
+  unlink(theSocket.c_str());
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Serve jobs from a Unix domain socket
+ *
+ * The clients are served one at a time. A client which does not
+ * send its job or read the status within the timeout is dropped,
+ * so that a stalled client cannot hang the server.
+ */
+// ----------------------------------------------------------------------
+
+void serve_socket(const string &theSocket, const ServerTools::JobFunction &theJob)
+{
+  const int clienttimeout = 10;  // seconds
+
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+
+  if (theSocket.size() >= sizeof(address.sun_path))
+    throw runtime_error("Socket name '" + theSocket + "' is too long");
+
+  strncpy(address.sun_path, theSocket.c_str(), sizeof(address.sun_path) - 1);
+
+  const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0) throw runtime_error(string("Failed to create a socket: ") + strerror(errno));
+
+  try
+  {
+    remove_socket(theSocket);
+  }
+  catch (...)
+  {
+    close(server);
+    throw;
+  }
+
+  if (bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+      listen(server, 16) < 0)
+  {
+    const string error = strerror(errno);
+    close(server);
+    throw runtime_error("Failed to listen to socket '" + theSocket + "': " + error);
+  }
+
+  bool quit = false;
+  while (!quit)
+  {
+    const int client = accept(server, 0, 0);
+    if (client < 0)
+    {
+      if (errno == EINTR) continue;
+      const string error = strerror(errno);
+      close(server);
+      throw runtime_error("Failed to accept a connection: " + error);
+    }
+
+    timeval timeout;
+    timeout.tv_sec = clienttimeout;
+    timeout.tv_usec = 0;
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Read until the client closes its end or a newline arrives
+
+    string line;
+    bool timedout = false;
+    char buffer[4096];
+    while (line.find('\n') == string::npos)
+    {
+      const ssize_t n = read(client, buffer, sizeof(buffer));
+      if (n > 0)
+        line.append(buffer, n);
+      else if (n < 0 && errno == EINTR)
+        continue;
+      else
+      {
+        timedout = (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        break;
+      }
+    }
+    line = line.substr(0, line.find('\n'));
+
+    const string status =
+        (timedout ? string("ERROR: timed out waiting for the job\n") : run(line, theJob, quit));
+    if (send(client, status.c_str(), status.size(), MSG_NOSIGNAL) < 0)
+      cerr << "Warning: failed to send job status: " << strerror(errno) << endl;
+
+    close(client);
+  }
+
+  close(server);
+  remove_socket(theSocket);
+}
+
+}  // namespace anonymous
+
+namespace ServerTools
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Serve jobs until told to quit
+ *
+ * \param theSocket The Unix domain socket path, or "-" for standard input
+ * \param theJob The function running the scripts of a job
+ */
+// ----------------------------------------------------------------------
+
+void serve(const string &theSocket, const JobFunction &theJob)
+{
+  if (theSocket == "-")
+    serve_stdin(theJob);
+  else
+    serve_socket(theSocket, theJob);
+}
+
+}  // namespace ServerTools
+
+// ======================================================================
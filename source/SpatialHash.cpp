@@ -0,0 +1,202 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of class SpatialHash
+ */
+// ======================================================================
+
+#include "SpatialHash.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ */
+// ----------------------------------------------------------------------
+
+SpatialHash::SpatialHash()
+    : itsCellSize(1),
+      itsMinX(0),
+      itsMinY(0),
+      itsColumns(0),
+      itsRows(0),
+      itsX(),
+      itsY(),
+      itsCellStart(),
+      itsItems()
+{
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Discard all points
+ */
+// ----------------------------------------------------------------------
+
+void SpatialHash::clear()
+{
+  itsColumns = itsRows = 0;
+  itsX.clear();
+  itsY.clear();
+  itsCellStart.clear();
+  itsItems.clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Build the index
+ *
+ * The number of cells is limited to be proportional to the number of
+ * points, the cells are enlarged if necessary.
+ *
+ * \param theX The x-coordinates of the points
+ * \param theY The y-coordinates of the points
+ * \param theCellSize The desired cell size
+ */
+// ----------------------------------------------------------------------
+
+void SpatialHash::build(const vector<double> &theX, const vector<double> &theY, double theCellSize)
+{
+  if (theX.size() != theY.size())
+    throw runtime_error("SpatialHash: coordinate vectors must be of equal size");
+
+  clear();
+  if (theX.empty()) return;
+
+  itsX = theX;
+  itsY = theY;
+
+  double maxx = itsX[0];
+  double maxy = itsY[0];
+  itsMinX = itsX[0];
+  itsMinY = itsY[0];
+  for (size_t i = 1; i < itsX.size(); i++)
+  {
+    itsMinX = min(itsMinX, itsX[i]);
+    itsMinY = min(itsMinY, itsY[i]);
+    maxx = max(maxx, itsX[i]);
+    maxy = max(maxy, itsY[i]);
+  }
+
+  // Avoid excessive memory use for tiny cells or sparse points
+
+  itsCellSize = max(theCellSize, 1.0);
+  const double maxcells = 4.0 * itsX.size() + 16;
+  while (((maxx - itsMinX) / itsCellSize + 1) * ((maxy - itsMinY) / itsCellSize + 1) > maxcells)
+    itsCellSize *= 2;
+
+  itsColumns = static_cast<int>((maxx - itsMinX) / itsCellSize) + 1;
+  itsRows = static_cast<int>((maxy - itsMinY) / itsCellSize) + 1;
+
+  // Counting sort of the points into the cells
+
+  const size_t ncells = static_cast<size_t>(itsColumns) * itsRows;
+  itsCellStart.assign(ncells + 1, 0);
+
+  vector<size_t> cells(itsX.size());
+  for (size_t i = 0; i < itsX.size(); i++)
+  {
+    cells[i] =
+        static_cast<size_t>(column(itsX[i])) + static_cast<size_t>(row(itsY[i])) * itsColumns;
+    ++itsCellStart[cells[i] + 1];
+  }
+
+  for (size_t c = 0; c < ncells; c++)
+    itsCellStart[c + 1] += itsCellStart[c];
+
+  vector<size_t> pos(itsCellStart.begin(), itsCellStart.end() - 1);
+  itsItems.resize(itsX.size());
+  for (size_t i = 0; i < itsX.size(); i++)
+    itsItems[pos[cells[i]]++] = i;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The cell column of the given x-coordinate, clamped to the grid
+ */
+// ----------------------------------------------------------------------
+
+int SpatialHash::column(double theX) const
+{
+  const double i = floor((theX - itsMinX) / itsCellSize);
+  if (!(i > 0)) return 0;
+  if (i >= itsColumns) return itsColumns - 1;
+  return static_cast<int>(i);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The cell row of the given y-coordinate, clamped to the grid
+ */
+// ----------------------------------------------------------------------
+
+int SpatialHash::row(double theY) const
+{
+  const double j = floor((theY - itsMinY) / itsCellSize);
+  if (!(j > 0)) return 0;
+  if (j >= itsRows) return itsRows - 1;
+  return static_cast<int>(j);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The distance to the nearest point
+ *
+ * The cells are searched in rings of increasing size around the
+ * point until no closer point can be found.
+ *
+ * \param theX The x-coordinate
+ * \param theY The y-coordinate
+ * \return The distance, or -1 if there are no points
+ */
+// ----------------------------------------------------------------------
+
+double SpatialHash::nearestDistance(double theX, double theY) const
+{
+  if (itsX.empty()) return -1;
+
+  const int ci = column(theX);
+  const int cj = row(theY);
+  const int maxring = max(itsColumns, itsRows);
+
+  double best = -1;
+
+  for (int k = 0; k <= maxring; k++)
+  {
+    for (int j = cj - k; j <= cj + k; j++)
+    {
+      if (j < 0 || j >= itsRows) continue;
+
+      // Full rows at the top and bottom of the ring, only the ends otherwise
+
+      const bool edge = (j == cj - k || j == cj + k);
+      const int step = (edge ? 1 : max(1, 2 * k));
+
+      for (int i = ci - k; i <= ci + k; i += step)
+      {
+        if (i < 0 || i >= itsColumns) continue;
+
+        const size_t cell = static_cast<size_t>(i) + static_cast<size_t>(j) * itsColumns;
+        for (size_t n = itsCellStart[cell]; n < itsCellStart[cell + 1]; n++)
+        {
+          const size_t p = itsItems[n];
+          const double dx = itsX[p] - theX;
+          const double dy = itsY[p] - theY;
+          const double dist = sqrt(dx * dx + dy * dy);
+          if (best < 0 || dist < best) best = dist;
+        }
+      }
+    }
+
+    // Points in the next ring are at least k cells away
+
+    if (best >= 0 && best <= k * itsCellSize) break;
+  }
+
+  return best;
+}
+
+// ======================================================================
@@ -0,0 +1,193 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of class StripeStroker
+ */
+// ======================================================================
+
+#include "StripeStroker.h"
+#include "PathTools.h"
+#include "ThreadTools.h"
+
+#include <imagine/NFmiEsriBox.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace Imagine;
+using namespace std;
+
+namespace
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Stroke a path with the given style
+ */
+// ----------------------------------------------------------------------
+
+void stroke_path(NFmiImage &theImage,
+                 const NFmiPath &thePath,
+                 float theWidth,
+                 NFmiColorTools::Color theColor,
+                 NFmiColorTools::NFmiBlendRule theRule)
+{
+  if (theWidth == 1)
+    thePath.Stroke(theImage, theColor, theRule);
+  else
+    thePath.Stroke(theImage, theWidth, theColor, theRule);
+}
+
+}  // namespace anonymous
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ */
+// ----------------------------------------------------------------------
+
+StripeStroker::StripeStroker() : itsStrokes() {}
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether there is anything to stroke
+ */
+// ----------------------------------------------------------------------
+
+bool StripeStroker::empty() const { return itsStrokes.empty(); }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Discard all added strokes
+ */
+// ----------------------------------------------------------------------
+
+void StripeStroker::clear() { itsStrokes.clear(); }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Add a new stroke
+ *
+ * \param thePath The projected path
+ * \param theWidth The line width
+ * \param theColor The line colour
+ * \param theRule The blending rule
+ */
+// ----------------------------------------------------------------------
+
+void StripeStroker::add(const NFmiPath &thePath,
+                        float theWidth,
+                        NFmiColorTools::Color theColor,
+                        NFmiColorTools::NFmiBlendRule theRule)
+{
+  if (thePath.Empty()) return;
+
+  const NFmiEsriBox box = thePath.BoundingBox();
+  if (!box.IsValid()) return;
+
+  Stroke s;
+  s.path = thePath;
+  s.width = theWidth;
+  s.color = theColor;
+  s.rule = theRule;
+  s.margin = ceil(theWidth) + 2;
+  s.ymin = box.Ymin() - s.margin;
+  s.ymax = box.Ymax() + s.margin;
+  itsStrokes.push_back(s);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Stroke all added paths into the image
+ *
+ * With a single thread the paths are stroked directly into the
+ * image. The stroker is cleared afterwards.
+ *
+ * \param theImage The image to stroke into
+ * \param theThreads The number of threads to use
+ */
+// ----------------------------------------------------------------------
+
+void StripeStroker::stroke(NFmiImage &theImage, unsigned int theThreads)
+{
+  const int height = theImage.Height();
+
+  if (theThreads <= 1 || height < 2 || itsStrokes.empty())
+  {
+    for (vector<Stroke>::const_iterator it = itsStrokes.begin(); it != itsStrokes.end(); ++it)
+      stroke_path(theImage, it->path, it->width, it->color, it->rule);
+  }
+  else
+  {
+    // Each stripe processes only the paths crossing it, hence a few
+    // stripes per thread balance the uneven work
+
+    const int stripes = min(height, static_cast<int>(4 * theThreads));
+    const int rows = (height + stripes - 1) / stripes;
+
+    ThreadTools::parallel_for(stripes,
+                              theThreads,
+                              [&](size_t theStripe)
+                              {
+                                const int first = static_cast<int>(theStripe) * rows;
+                                const int last = min(height - 1, first + rows - 1);
+                                if (first <= last) strokeRows(theImage, first, last);
+                              });
+  }
+
+  clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Stroke the paths into the given rows
+ *
+ * Only the given rows of the image are modified, hence separate
+ * stripes can be stroked simultaneously. The paths are clipped to
+ * the rows expanded by the margin of the stroke, so that each stripe
+ * rasterizes only the parts of the paths near it.
+ *
+ * \param theImage The image to stroke into
+ * \param theFirstRow The first row to stroke
+ * \param theLastRow The last row to stroke
+ */
+// ----------------------------------------------------------------------
+
+void StripeStroker::strokeRows(NFmiImage &theImage, int theFirstRow, int theLastRow) const
+{
+  const int width = theImage.Width();
+  const int rows = theLastRow - theFirstRow + 1;
+
+  // The image is copied only if some stroke reaches the stripe
+
+  NFmiImage stripe;
+  bool copied = false;
+
+  for (vector<Stroke>::const_iterator it = itsStrokes.begin(); it != itsStrokes.end(); ++it)
+  {
+    if (it->ymax < theFirstRow || it->ymin > theLastRow + 1) continue;
+
+    NFmiPath path = PathTools::clipLines(it->path,
+                                        -it->margin,
+                                        theFirstRow - it->margin,
+                                        width + it->margin,
+                                        theLastRow + 1 + it->margin);
+    if (path.Empty()) continue;
+
+    if (!copied)
+    {
+      stripe = NFmiImage(width, rows);
+      for (int j = 0; j < rows; j++)
+        for (int i = 0; i < width; i++)
+          stripe(i, j) = theImage(i, theFirstRow + j);
+      copied = true;
+    }
+
+    path.Translate(0, static_cast<float>(-theFirstRow));
+    stroke_path(stripe, path, it->width, it->color, it->rule);
+  }
+
+  if (!copied) return;
+
+  for (int j = 0; j < rows; j++)
+    for (int i = 0; i < width; i++)
+      theImage(i, theFirstRow + j) = stripe(i, j);
+}
+
+// ======================================================================
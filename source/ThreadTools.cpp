@@ -0,0 +1,120 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of namespace ThreadTools
+ */
+// ======================================================================
+
+#include "ThreadTools.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ThreadTools
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Resolve the number of threads to use
+ *
+ * Zero means the number of hardware threads available, any other
+ * value is used as is. At least one thread is always used.
+ *
+ * \param theThreads The requested number of threads
+ * \return The number of threads to use
+ */
+// ----------------------------------------------------------------------
+
+unsigned int concurrency(int theThreads)
+{
+  if (theThreads > 0) return static_cast<unsigned int>(theThreads);
+  const unsigned int n = std::thread::hardware_concurrency();
+  return (n > 0 ? n : 1);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Call the given function for indices 0...theCount-1 in parallel
+ *
+ * The indices are handed out dynamically so that uneven work is
+ * balanced between the threads. The calling thread participates
+ * in the work. If any call throws, the remaining indices are
+ * skipped and the first exception is rethrown once all threads
+ * have finished. Likewise, if a thread cannot be started, the
+ * threads already started are stopped and joined first.
+ *
+ * \param theCount The number of work items
+ * \param theThreads The maximum number of threads to use
+ * \param theFunction The work to be done for each index
+ */
+// ----------------------------------------------------------------------
+
+void parallel_for(std::size_t theCount,
+                  unsigned int theThreads,
+                  const std::function<void(std::size_t)> &theFunction)
+{
+  if (theThreads <= 1 || theCount <= 1)
+  {
+    for (std::size_t i = 0; i < theCount; i++)
+      theFunction(i);
+    return;
+  }
+
+  std::atomic<std::size_t> next(0);
+  std::atomic<bool> failed(false);
+  std::exception_ptr error;
+  std::mutex errormutex;
+
+  auto worker = [&]()
+  {
+    while (!failed)
+    {
+      const std::size_t i = next++;
+      if (i >= theCount) break;
+      try
+      {
+        theFunction(i);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(errormutex);
+        if (!error) error = std::current_exception();
+        failed = true;
+      }
+    }
+  };
+
+  const std::size_t nthreads = std::min<std::size_t>(theThreads, theCount);
+
+  // If starting a thread fails, the started threads must be joined
+  // before the exception is passed on
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  try
+  {
+    for (std::size_t i = 1; i < nthreads; i++)
+      threads.emplace_back(worker);
+  }
+  catch (...)
+  {
+    failed = true;
+    for (std::size_t i = 0; i < threads.size(); i++)
+      threads[i].join();
+    throw;
+  }
+
+  worker();
+
+  for (std::size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  if (error) std::rethrow_exception(error);
+}
+
+}  // namespace ThreadTools
+
+// ======================================================================
@@ -0,0 +1,195 @@
+// ======================================================================
+/*!
+ * \file
+ * \brief Implementation of class WatchTools::Watcher
+ */
+// ======================================================================
+
+#include "WatchTools.h"
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+//! The events which indicate a completed file
+const uint32_t watchmask = IN_CLOSE_WRITE | IN_MOVED_TO;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether the path is a directory
+ */
+// ----------------------------------------------------------------------
+
+bool is_directory(const string &thePath)
+{
+  struct stat st;
+  return (stat(thePath.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Split a path into the directory and the file name
+ */
+// ----------------------------------------------------------------------
+
+void split_path(const string &thePath, string &theDir, string &theFile)
+{
+  const string::size_type pos = thePath.rfind('/');
+  if (pos == string::npos)
+  {
+    theDir = ".";
+    theFile = thePath;
+  }
+  else
+  {
+    theDir = (pos == 0 ? "/" : thePath.substr(0, pos));
+    theFile = thePath.substr(pos + 1);
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Wait for events for at most the given time
+ *
+ * \param theFd The inotify descriptor
+ * \param theTimeout The timeout in milliseconds, or -1 for no limit
+ * \return True if there are events to be read
+ */
+// ----------------------------------------------------------------------
+
+bool poll_events(int theFd, int theTimeout)
+{
+  struct pollfd pfd;
+  pfd.fd = theFd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  for (;;)
+  {
+    const int ret = poll(&pfd, 1, theTimeout);
+    if (ret > 0) return true;
+    if (ret == 0) return false;
+    if (errno != EINTR) throw runtime_error(string("poll failed: ") + strerror(errno));
+  }
+}
+
+}  // namespace anonymous
+
+namespace WatchTools
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Destructor
+ */
+// ----------------------------------------------------------------------
+
+Watcher::~Watcher() { close(itsFd); }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Constructor
+ */
+// ----------------------------------------------------------------------
+
+Watcher::Watcher() : itsFd(inotify_init()), itsWatches(), itsFiles()
+{
+  if (itsFd < 0) throw runtime_error(string("inotify_init failed: ") + strerror(errno));
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Start watching the given files
+ *
+ * Files which are already being watched are ignored.
+ *
+ * \param theFiles The files or directories to watch
+ */
+// ----------------------------------------------------------------------
+
+void Watcher::watch(const vector<string> &theFiles)
+{
+  for (vector<string>::const_iterator it = theFiles.begin(); it != theFiles.end(); ++it)
+  {
+    if (find(itsFiles.begin(), itsFiles.end(), *it) != itsFiles.end()) continue;
+
+    string dir, file;
+    if (is_directory(*it))
+      dir = *it;
+    else
+      split_path(*it, dir, file);
+
+    const int wd = inotify_add_watch(itsFd, dir.c_str(), watchmask);
+    if (wd < 0)
+      throw runtime_error("Failed to watch '" + dir + "': " + strerror(errno));
+
+    itsWatches[wd][file] = *it;
+    itsFiles.push_back(*it);
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Wait until some of the watched files change
+ *
+ * Changes made since the previous call are returned immediately.
+ *
+ * \param theSettleTime Milliseconds to wait for further changes
+ * \return The changed files or directories, in the order they were added
+ */
+// ----------------------------------------------------------------------
+
+vector<string> Watcher::wait(int theSettleTime)
+{
+  if (itsFiles.empty()) throw runtime_error("No files to watch");
+
+  // Collect the changes until they settle
+
+  set<string> changes;
+  char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (poll_events(itsFd, changes.empty() ? -1 : theSettleTime))
+  {
+    const ssize_t n = read(itsFd, buffer, sizeof(buffer));
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+      throw runtime_error(string("Failed to read inotify events: ") + strerror(errno));
+    }
+
+    for (char *ptr = buffer; ptr < buffer + n;)
+    {
+      const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+      ptr += sizeof(struct inotify_event) + event->len;
+
+      map<int, map<string, string> >::const_iterator dir = itsWatches.find(event->wd);
+      if (dir == itsWatches.end() || event->len == 0) continue;
+
+      map<string, string>::const_iterator file = dir->second.find(event->name);
+      if (file != dir->second.end()) changes.insert(file->second);
+
+      file = dir->second.find("");
+      if (file != dir->second.end()) changes.insert(file->second);
+    }
+  }
+
+  vector<string> result;
+  for (vector<string>::const_iterator it = itsFiles.begin(); it != itsFiles.end(); ++it)
+    if (changes.count(*it) > 0) result.push_back(*it);
+
+  return result;
+}
+
+}  // namespace WatchTools
+
+// ======================================================================